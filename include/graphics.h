@@ -32,6 +32,16 @@ typedef struct {
     double m[4][4];
 } Matrix;
 
+// Matrix4f Structure, a float copy of a Matrix for the vertex stream transforms
+typedef struct {
+    float m[4][4];
+} Matrix4f;
+
+// Affine Structure, a float 3x4 transform with an implied last row of 0 0 0 1, rows 16-byte aligned for SSE
+typedef struct {
+    float m[3][4] __attribute__((aligned(16)));
+} Affine;
+
 // Point and Vector Structures
 typedef struct {
     float val[4]; // Four-element vector of doubles
@@ -39,6 +49,16 @@ typedef struct {
 
 typedef Point Vector;
 
+// VertexStream Structure, a structure-of-arrays buffer of homogeneous points
+typedef struct {
+    int n; // number of points in the stream
+    int capacity; // number of points the arrays can hold
+    float *x; // x coordinates
+    float *y; // y coordinates
+    float *z; // z coordinates
+    float *w; // homogeneous coordinates
+} VertexStream;
+
 // Line Structure
 typedef struct {
     int zBuffer; // Whether to use z-buffer, default to true (1)
@@ -77,9 +97,112 @@ typedef struct {
     int zBuffer;
 } Polygon;
 
+// Mesh Structure, an indexed face set whose faces share their vertices
+typedef struct {
+    int oneSided;
+    int nVertex; // Number of shared vertices
+    Point *vertex; // Vertex positions
+    Vector *normal; // Normal of each vertex, NULL if the mesh has none
+    Color *color; // Body color of each vertex, NULL to use the DrawState body color
+    int nFace; // Number of faces
+    int *faceStart; // nFace + 1 offsets into index, face f uses index[faceStart[f]] up to index[faceStart[f + 1]]
+    int *index; // Vertex indices of all the faces, faceStart[nFace] of them
+    int zBuffer;
+} Mesh;
+
+// SharedMesh Structure, an immutable mesh referenced by any number of modules, freed with its last reference
+typedef struct {
+    Mesh mesh; // Geometry, never changed once shared
+    int refCount; // References held by modules and by whoever created it
+} SharedMesh;
+
+// MeshLOD Structure, one model at decreasing levels of detail, shared by the modules drawing it
+#define LOD_MAX_LEVELS 8
+typedef struct {
+    int nLevel; // Number of levels, level 0 is the model as given
+    Mesh level[LOD_MAX_LEVELS]; // Meshes of decreasing detail, each with about half the triangles of the one before
+    Point min; // Minimum corner of the bounding box of the model
+    Point max; // Maximum corner of the bounding box of the model
+    float facePixels; // Screen area in pixels a face should cover, used to pick the level to draw
+    int refCount; // References held by modules and by whoever created it
+} MeshLOD;
+
+// VertexCache Structure, post-transform cache of mesh vertices keyed by vertex index
+typedef struct {
+    int size; // Number of entries, replaced first in first out
+    int next; // Entry replaced by the next miss
+    int nVertex; // Number of vertex indices covered by slot
+    int *slot; // Entry holding each vertex index, -1 if it is not cached
+    int *tag; // Vertex index held by each entry, -1 if the entry is empty
+    Point *clip; // Position of each entry after the view transform, before the divide
+    Point *screen; // Normalized screen position of each entry
+    Color *color; // Shaded color of each entry
+    unsigned char *shaded; // Whether the color of each entry has been computed
+    int *face; // Face that last looked up each entry, entries of the current face are never replaced
+    int current; // Number of the face being put together
+    long lookups; // Lookups since the last reset
+    long hits; // Lookups that found the vertex already cached
+} VertexCache;
+
+// CacheEntry Structure, the head of every entry of an LruCache, followed by the entry's key and payload
+typedef struct CacheEntry {
+    unsigned int hash; // hash of the entry's key
+    size_t bytes; // memory held by the entry and its payload
+    struct CacheEntry *chain; // next entry in the same hash bucket
+    struct CacheEntry *newer; // next more recently used entry, NULL for the newest
+    struct CacheEntry *older; // next less recently used entry, NULL for the oldest
+} CacheEntry;
+
+// LruCache Structure, a hash table of entries evicted least recently used first beyond a budget
+typedef struct {
+    size_t budget; // most bytes to hold, least recently used entries are evicted beyond it
+    size_t bytes; // bytes held by all the entries
+    int nEntry; // number of entries held
+    int nBucket; // size of the hash table, a power of two
+    CacheEntry **bucket; // hash table of entries chained through chain
+    CacheEntry *newest; // most recently used entry
+    CacheEntry *oldest; // least recently used entry, the next to be evicted
+    long lookups; // lookups since the cache was created or reset
+    long hits; // lookups that found the entry already made
+    long evictions; // entries evicted to stay within the budget
+    void (*release)(CacheEntry *e); // frees what an entry holds besides its own block, NULL for nothing
+} LruCache;
+
+#define LRU_HASH_SEED 2166136261u // starting value of lruCache_hash
+
+// TessEntry Structure, one tessellated Bezier patch held by a TessCache
+typedef struct {
+    CacheEntry entry; // hash table and LRU list links, first so the entry can be cast
+    Point key[4][4]; // control points the mesh was tessellated from
+    int nu, nv; // grid of the tessellation, the LOD bucket it was made for
+    Mesh mesh; // object space triangles with the patch normals
+} TessEntry;
+
+// TessCache, object space tessellations of Bezier patches kept across frames
+typedef LruCache TessCache;
+
+// WorldEntry Structure, world space geometry of one module's polygons and meshes drawn under one GTM
+typedef struct {
+    CacheEntry entry; // hash table and LRU list links, first so the entry can be cast
+    void *module; // module the geometry was transformed from
+    unsigned long version; // version of the module when it was transformed
+    Matrix GTM; // transform the module was drawn under
+    int nElement; // number of elements of the module
+    int *first; // index in vertex of the first vertex of each element, -1 for none
+    int nVertex; // number of vertices and normals
+    Point *vertex; // world space vertices
+    Vector *normal; // unit world space normals
+} WorldEntry;
+
+// WorldCache, world space geometry of lit modules kept across frames
+typedef LruCache WorldCache;
+
+#define BEZIER_MAX_DEPTH 10 // deepest subdivision of a curve, at most 2^BEZIER_MAX_DEPTH segments
+
 // Bezier Curve Structure
 typedef struct {
     Point vertex[4]; // 4 control points
+    int divisions; // draw 2^divisions segments by forward differencing, at most BEZIER_MAX_DEPTH, 0 to subdivide until flat
     int zBuffer;
 } BezierCurve;
 
@@ -107,15 +230,30 @@ typedef enum {
     ObjSurfaceColor,
     ObjSurfaceCoeff,
     ObjLight,
-    ObjModule
+    ObjModule,
+    ObjMesh,
+    ObjSharedMesh,
+    ObjMeshLOD,
+    ObjInstances
 } ObjectType;
 
+// Instances Structure, copies of one module, each drawn under its own transform
+typedef struct {
+    void *module; // Module every instance draws, only referenced
+    int count; // Number of instances
+    Matrix *matrix; // Transform of each instance, applied to the module before the LTM in effect
+    Color *body; // Body color of each instance, NULL to keep the DrawState's
+} Instances;
+
 // union that can hold one instance of any of the constituent types.
 typedef union {
     Point point;
     Line line;
     Polyline polyline;
     Polygon polygon;
+    Mesh mesh;
+    SharedMesh *sharedMesh;
+    MeshLOD *meshLOD;
     Matrix matrix;
     Color color;
     Matrix identity;
@@ -123,19 +261,125 @@ typedef union {
     BezierSurface bezierSurface;
     float coeff;
     void *module;
+    Instances instances;
 } Object;
 
+// ArenaBlock Structure, a chunk of memory handed out by an Arena, its bytes follow the header
+typedef struct ArenaBlock {
+    struct ArenaBlock *next; // next block to fill
+    size_t size; // bytes after the header
+} ArenaBlock;
+
+// Arena Structure, a bump allocator whose memory is all given back at once
+typedef struct {
+    ArenaBlock *first; // every block, in the order they are filled
+    ArenaBlock *current; // block being filled, the ones after it are empty
+    char *next; // first free byte of the current block
+    char *end; // end of the current block
+    size_t blockSize; // size of the next block to allocate, doubled with each new block up to a limit
+    size_t used; // bytes handed out since the last reset, with alignment
+    size_t held; // bytes of all the blocks
+    long allocations; // blocks taken from the heap since the arena was initialized
+} Arena;
+
 // Element Structure for Linked List
 typedef struct {
-    ObjectType type; // Type of object stored in the obj pointer
-    Object obj; // Pointer to the object
+    ObjectType type; // Type of object stored in obj
     void *next; // Next pointer
+    Object obj[]; // The object, allocated only as large as its type needs
 } Element;
 
+// Bounds Structure, bounding volume of a module cached in its own coordinates
+typedef struct {
+    Point min; // minimum corner of the axis-aligned bounding box
+    Point max; // maximum corner of the axis-aligned bounding box
+    Point center; // center of the bounding sphere, the center of the box
+    double radius; // radius of the bounding sphere, as far as the geometry reaches from center
+    int empty; // whether the module contains no geometry
+    unsigned long version; // module version the bounds were computed for, 0 if never
+    unsigned long epoch; // edit epoch when the bounds were last validated
+} Bounds;
+
+// CommandOp Enumeration, the operations of a compiled module
+typedef enum {
+    CmdReturn, // end of a routine
+    CmdCall, // draw the routine starting at arg, count indexes its bounds in point (min, max, sphere center with the radius as w), -1 if it draws nothing
+    CmdColor, // set the foreground color to color[arg]
+    CmdBodyColor, // set the body color to color[arg]
+    CmdSurfaceColor, // set the surface color to color[arg]
+    CmdSurfaceCoeff, // set the surface coefficient to real[arg]
+    CmdLoad, // set the local transform to matrix[arg]
+    CmdPoint, // draw point[arg]
+    CmdLine, // draw the line record at integer[arg]: point, zBuffer
+    CmdPolyline, // draw the polyline record at integer[arg]: numVertex, point, zBuffer
+    CmdPolygon, // draw the polygon record at integer[arg]: nVertex, point, normal, color, oneSided, zBuffer
+    CmdMesh, // draw the mesh record at integer[arg]: nVertex, nFace, point, normal, color, faceStart, index, oneSided, zBuffer
+    CmdMeshLOD, // draw the LOD record at integer[arg]: nLevel, facePixels in real, bounds in point, a mesh record per level
+    CmdBezierCurve, // draw the curve record at integer[arg]: point, divisions, zBuffer
+    CmdBezierSurface, // draw the surface record at integer[arg]: point, divisions, solid, zBuffer
+    CmdInstances, // draw the instances record at integer[arg]: routine, count, matrix, color; count indexes the bounds as for CmdCall
+} CommandOp;
+
+// Command Structure, one operation of a compiled module
+typedef struct {
+    int op; // a CommandOp
+    int arg; // index of the operand in one of the buffer's arrays, see CommandOp
+    int count; // second operand of CmdCall
+} Command;
+
+// CommandBuffer Structure, a module graph flattened into arrays that refer to each other only by index
+typedef struct {
+    Command *command; // routines, the first is the compiled module and each sub-module has one
+    int nCommand, commandCap;
+    Point *point; // vertices, normals, control points and bounds, packed
+    int nPoint, pointCap;
+    Color *color; // state colors and vertex colors
+    int nColor, colorCap;
+    Matrix *matrix; // transform operands
+    int nMatrix, matrixCap;
+    float *real; // surface coefficients and LOD face areas
+    int nReal, realCap;
+    int *integer; // geometry records and mesh indices, -1 for a missing array
+    int nInteger, integerCap;
+    unsigned long version; // version of the module graph compiled, 0 if none
+    void *mapping; // snapshot file the arrays are mapped from, NULL if they are on the heap
+    size_t mappingBytes; // length of the mapping
+} CommandBuffer;
+
+#define SNAPSHOT_MAGIC 0x504e5347 // "GSNP" as written by a little-endian machine
+#define SNAPSHOT_VERSION 2 // layout of the snapshot files this library writes and reads
+#define SNAPSHOT_ALIGN 64 // every array of a snapshot file starts at a multiple of this
+
+// the arrays of a snapshot file, in the order they follow the header
+typedef enum {
+    SnapshotCommands,
+    SnapshotPoints,
+    SnapshotColors,
+    SnapshotMatrices,
+    SnapshotReals,
+    SnapshotIntegers,
+    SnapshotLights,
+    SnapshotArrays, // number of arrays
+} SnapshotArray;
+
+// SnapshotHeader Structure, the start of a scene snapshot file
+typedef struct {
+    unsigned int magic; // SNAPSHOT_MAGIC, read back differently on a machine of the other byte order
+    int version; // SNAPSHOT_VERSION of the writer, files of other versions are refused
+    int size[SnapshotArrays]; // bytes of an item of each array, which must match the reader's
+    int count[SnapshotArrays]; // items in each array
+    long offset[SnapshotArrays]; // where each array starts in the file
+    long bytes; // length of the file
+} SnapshotHeader;
+
 // Module Structure
 typedef struct {
     Element *head; // Pointer to the head of the linked list
     Element *tail; // Pointer to the last object
+    unsigned long version; // Edit stamp, bumped whenever the list of Elements changes
+    Bounds bounds; // Lazily computed bounds of the module, see module_bounds
+    Arena arena; // storage of the Elements added by the module_* functions and their arrays
+    void *release; // list of the Elements holding references or heap memory, undone by module_clear
 } Module;
 
 // View2D Structure
@@ -171,8 +415,99 @@ typedef enum {
     ShadeFlat, // Draw objects using shading calculations, but each polygon is a constant value
     ShadeGouraud, // Draw objects using Gouraud shading
     ShadePhong, // Draw objects using Phong shading
+    ShadeDepthOnly, // Write only the depth of polygons, with no color work (depth prepasses, occlusion)
 } ShadeMethod;
 
+// DepthPyramid Structure, a hierarchical min/max z-buffer over tiles of an image's depth plane
+#define HIZ_MAX_LEVELS 16
+typedef struct {
+    Image *src; // image whose depth plane is summarized
+    int tile; // width and height of a level 0 tile in pixels
+    int levels; // number of levels, the last one is a single tile
+    int cols[HIZ_MAX_LEVELS]; // tiles per row at each level
+    int rows[HIZ_MAX_LEVELS]; // tiles per column at each level
+    float *zmin[HIZ_MAX_LEVELS]; // farthest (smallest) 1/z in each tile
+    float *zmax[HIZ_MAX_LEVELS]; // nearest (largest) 1/z in each tile
+    unsigned char *dirty[HIZ_MAX_LEVELS]; // tiles whose zmin and zmax are out of date
+} DepthPyramid;
+
+// OcclusionQuery Structure, counts the pixels of depth-only geometry that pass the depth test
+typedef struct {
+    long samples; // visible samples counted since the query began
+    int active; // whether the query is between begin and end
+} OcclusionQuery;
+
+// DrawStats Structure, counters of the work done by module_draw
+typedef struct {
+    long hizTests; // occlusion tests run against a depth pyramid
+    long hizHits; // tests that found the work occluded, so it was skipped
+    long hizMisses; // tests that found the work potentially visible
+    long hizPolygonsCulled; // polygons skipped as occluded
+    long hizModulesCulled; // sub-modules skipped as occluded
+    long frustumTests; // sub-modules tested against the view volume
+    long frustumSphereCulls; // sub-modules found outside the view volume by their bounding sphere
+    long frustumModulesCulled; // sub-modules skipped as outside the view volume, by sphere or box
+    long instancesDrawn; // instances of an instancing element drawn
+    long instancesCulled; // instances skipped as outside the view volume or occluded
+    long matrixMultiplies; // matrix products formed while traversing modules
+    long vertexTransforms; // points and vertices taken through a matrix
+    long normalMatrices; // normal matrices computed for shading
+    long meshVertices; // mesh vertices transformed, one per miss of the vertex cache
+    long meshFaces; // mesh faces assembled from the index buffer
+    long meshCacheLookups; // face vertices looked up in the vertex cache
+    long meshCacheHits; // lookups that found the vertex already transformed
+    long meshVerticesShaded; // mesh vertices lit, at most once per cache entry
+    float meshCacheHitRate; // hit rate of the vertex cache over the last mesh drawn
+    long patchTessellations; // solid Bezier patches tessellated
+    long patchCacheHits; // solid Bezier patches drawn from the tessellation cache
+    long lodSelected[LOD_MAX_LEVELS]; // LOD elements drawn at each level of detail
+    long heapAllocations; // heap allocations made while drawing: scratch blocks and tessellated patches
+} DrawStats;
+
+// DrawItemType Enumeration, the kinds of record in a draw list
+typedef enum {
+    DrawItemPolygon, // filled or framed polygon, drawn with polygon_drawShade
+    DrawItemDepth, // depth-only polygon, drawn or counted into the occlusion query
+    DrawItemPoint,
+    DrawItemLine,
+    DrawItemPolyline,
+    DrawItemBezierCurve,
+    DrawItemBezierSurface, // wire frame Bezier surface
+    DrawItemTask, // the items of a sub-module traversed as its own task, drawn in its place
+} DrawItemType;
+
+// the screen space primitive of a draw list item, its arrays and larger types in the list's arena
+typedef union {
+    Polygon polygon;
+    Polyline polyline;
+    Point point;
+    Line *line;
+    BezierCurve *bezierCurve;
+    BezierSurface *bezierSurface;
+    struct DrawTask *task;
+} DrawPrimitive;
+
+// DrawItem Structure, one transformed and shaded primitive with the DrawState fields its rasterization reads
+typedef struct {
+    DrawItemType type;
+    ShadeMethod shade; // shading method the polygon is filled with
+    Color color; // foreground color of the DrawState
+    Color flatColor; // flat fill color of the DrawState
+    DrawPrimitive prim;
+} DrawItem;
+
+// DrawList Structure, primitives recorded by module_draw in the order it would have drawn them
+typedef struct {
+    DrawItem *item; // items in drawing order
+    int nItem;
+    int maxItem; // room in item
+    Arena arena; // copies of the items' vertices and colors, and the tasks of a pool
+    Arena scratch; // scratch memory for the traversal recording into the list and for drawing it
+    struct DrawPool *pool; // pool whose thread records into the list, NULL if it is not one
+    int thread; // index of that thread in the pool
+    int depth; // nesting of the sub-module being recorded, counted from the module drawn
+} DrawList;
+
 // DrawState Structure
 typedef struct {
     Color color; // Foreground color, used in the default drawing mode
@@ -183,8 +518,27 @@ typedef struct {
     ShadeMethod shade; // An enumerated type
     int zBufferFlag; // Whether to use z-buffer hidden surface removal
     Point viewer; // A Point representing the view location in 3D (identical to the VRP in View3D)
+    DepthPyramid *hiz; // Depth pyramid of the target image used to skip occluded work, NULL to disable
+    OcclusionQuery *query; // Active occlusion query, depth-only polygons are counted instead of drawn, NULL for none
+    int vertexCacheSize; // Entries in the post-transform cache used to draw meshes, 0 for one per vertex
+    TessCache *tessCache; // Tessellations of solid Bezier patches kept across draws, NULL to tessellate every draw
+    WorldCache *worldCache; // World space geometry of lit modules kept across draws, NULL to transform every draw
+    Arena *scratch; // Memory for geometry being drawn, reset by module_draw after each element, NULL to use the library's own
+    int frustumCull; // Whether to skip sub-modules whose bounds are outside the view volume, on by default
+    DrawList *drawList; // List the primitives are recorded into instead of being drawn, NULL to draw them
 } DrawState;
 
+// DrawTask Structure, a sub-module a DrawPool traverses on whichever thread takes it
+typedef struct DrawTask {
+    void *module; // module to traverse
+    Matrix GTM; // transform it is drawn under
+    DrawState ds; // DrawState it is drawn with
+    int depth; // nesting of the module below the one the pool draws
+    DrawList *list; // list of the thread that traversed it
+    int first; // its first item in list
+    int count; // its items in list, those of its own sub-modules are in their tasks
+} DrawTask;
+
 typedef enum {
     LightNone,
     LightAmbient,
@@ -193,6 +547,23 @@ typedef enum {
     LightSpot,
 } LightType;
 
+// ShadowMap Structure, a depth-only render of the scene from a light's viewpoint
+typedef struct {
+    int faces; // 1 for spot and directional lights, 6 (a cube map) for point lights
+    int size; // width and height of each face in pixels
+    float bias; // relative depth bias used by the shadow test
+    Image *depth[6]; // depth-only images holding 1/z, one per face
+    Matrix vtm[6]; // world to shadow map screen transformation, one per face
+    int valid; // whether depth holds a render matching the fields below
+    LightType type; // light parameters the map was rendered with
+    Point position;
+    Vector direction;
+    float cutoff;
+    Module *module; // module graph the map was rendered from
+    Matrix gtm; // global transform the module graph was rendered with
+    unsigned long version; // module graph version the map was rendered from
+} ShadowMap;
+
 typedef struct {
     LightType type;
     Color color;
@@ -200,6 +571,7 @@ typedef struct {
     Point position;
     float cutoff; // stores the cosine of the cutoff angle of a spotlight
     float sharpness; // coefficient of the falloff function (power for cosine)
+    ShadowMap *shadow; // shadow map if the light casts shadows, NULL otherwise
 } Light;
 
 typedef struct {
@@ -207,6 +579,66 @@ typedef struct {
     Light light[MAX_LIGHTS];
 } Lighting;
 
+// SnapshotLight Structure, a light as stored in a scene snapshot, without its shadow map
+typedef struct {
+    int type; // a LightType
+    float cutoff;
+    float sharpness;
+    Color color;
+    Vector direction;
+    Point position;
+} SnapshotLight;
+
+// DrawPool Structure, threads traversing a module graph in parallel into draw lists
+typedef struct DrawPool {
+    int threads; // number of threads, including the one calling drawPool_draw
+    int depth; // sub-modules nested at most this deep become tasks of their own
+    DrawList *list; // one draw list per thread
+    DrawStats *stats; // counters of each thread's traversal
+    void *queue; // task queues of the threads and what guards them
+    Matrix *VTM; // view transformation of the draw in progress
+    Lighting *lighting; // lighting of the draw in progress
+    Image *src; // image of the draw in progress
+} DrawPool;
+
+#define BVH_BINS 16 // candidate SAH splits per axis when building a BVH node
+#define BVH_LEAF_SIZE 4 // most triangles a BVH leaf holds unless no split is found
+
+// BVHTriangle Structure, a world-space triangle of the geometry a BVH is built over
+typedef struct {
+    Point vertex[3]; // corners in world coordinates
+    Element *element; // polygon, mesh, LOD or Bezier surface element the triangle came from
+    int face; // face of the mesh or patch, or fan triangle of the polygon, it came from
+} BVHTriangle;
+
+// BVHNode Structure, a node of a BVH, stored depth first
+typedef struct {
+    float min[3]; // box around the triangles below the node
+    float max[3];
+    int index; // leaf: first triangle; inner node: right child, the left child is the next node
+    int count; // triangles in a leaf, 0 for an inner node
+} BVHNode;
+
+// BVH Structure, a bounding volume hierarchy over the triangles of a module graph
+typedef struct {
+    BVHNode *node; // nodes, the root first
+    int nNode;
+    BVHTriangle *triangle; // triangles in leaf order
+    int nTriangle;
+    int *slot; // place in triangle of each triangle in the order the module graph yields them, used to refit
+} BVH;
+
+// BVHHit Structure, where a ray meets the geometry of a BVH
+typedef struct {
+    double t; // distance along the ray in lengths of its direction
+    double u, v; // barycentric coordinates of the hit on the triangle, of its second and third corners
+    Point point; // hit point in world coordinates
+    Vector normal; // unit normal of the triangle, facing the ray origin
+    int triangle; // index of the triangle in the BVH
+    Element *element; // element the triangle came from
+    int face; // face the triangle came from, see BVHTriangle
+} BVHHit;
+
 // Function prototypes
 Stack *stack_create(void);
 void stack_push(Stack *stack, void *element, size_t element_size);
@@ -240,6 +672,7 @@ void matrix_set(Matrix *m, int r, int c, double v);
 void matrix_copy(Matrix *dest, Matrix *src);
 void matrix_transpose(Matrix *m);
 void matrix_multiply(Matrix *left, Matrix *right, Matrix *m);
+void matrix_normal(Matrix *m, Matrix *n);
 void matrix_xformPoint(Matrix *m, Point *p, Point *q);
 void matrix_xformVector(Matrix *m, Vector *p, Vector *q);
 void matrix_xformPolygon(Matrix *m, Polygon *p);
@@ -269,6 +702,30 @@ void view2D_set( View2D *view, Point *vrp, int dx, Vector *xaxis, int screenx, i
 /* 3D VIew */
 void matrix_setView3D(Matrix *vtm, View3D *view);
 
+/* Vertex Stream Functions */
+void matrix4f_set(Matrix4f *f, Matrix *m);
+VertexStream *vertexStream_create(int capacity);
+void vertexStream_free(VertexStream *vs);
+int vertexStream_reserve(VertexStream *vs, int capacity);
+void vertexStream_setPoints(VertexStream *vs, Point *p, int n);
+void vertexStream_getPoints(VertexStream *vs, Point *p);
+void vertexStream_xform(Matrix4f *m, VertexStream *in, VertexStream *out, int normalize);
+
+/* Affine Functions */
+void affine_identity(Affine *a);
+void affine_set(Affine *a, Matrix *m);
+void affine_toMatrix(Affine *a, Matrix *m);
+void affine_multiply(Affine *left, Affine *right, Affine *out);
+void affine_translate(Affine *a, float tx, float ty, float tz);
+void affine_scale(Affine *a, float sx, float sy, float sz);
+void affine_rotateX(Affine *a, float cth, float sth);
+void affine_rotateY(Affine *a, float cth, float sth);
+void affine_rotateZ(Affine *a, float cth, float sth);
+void affine_shear2D(Affine *a, float shx, float shy);
+void affine_xformPoint(Affine *a, Point *p, Point *q);
+void affine_xformVector(Affine *a, Vector *v, Vector *q);
+void affine_xformPoints(Affine *a, Point *in, Point *out, int n);
+
 /* Point functions */
 void point_set2D(Point *p, double x, double y);
 void point_set3D(Point *p, double x, double y, double z);
@@ -330,8 +787,44 @@ void polygon_drawShade(Polygon *p, Image *src, DrawState *ds, Lighting *light);
 void polygon_drawFill(Polygon *p, Image *src, Color c, Lighting *ls);
 void polygon_drawFillB(Polygon *p, Image *src, Color c);
 void polygon_drawFillAA(Polygon *p, Image *src, Color c);
+void polygon_drawDepth(Polygon *p, Image *src, Arena *scratch);
+long polygon_countDepth(Polygon *p, Image *src, Arena *scratch);
 void polygon_shade(Polygon *p, DrawState *ds, Lighting *ls);
 
+/* Mesh functions */
+Mesh *mesh_create(void);
+void mesh_free(Mesh *m);
+void mesh_init(Mesh *m);
+void mesh_clear(Mesh *m);
+void mesh_set(Mesh *m, int nVertex, Point *vlist, Vector *nlist, Color *clist, int nFace, int *faceStart, int *index);
+void mesh_setNormals(Mesh *m);
+void mesh_setSided(Mesh *m, int oneSided);
+void mesh_zBuffer(Mesh *m, int flag);
+void mesh_copy(Mesh *to, Mesh *from);
+void mesh_optimize(Mesh *m, int cacheSize);
+int readPLY(char filename[], int *nPolygons, Polygon **plist, Color **clist, int estNormals);
+int readPLYMesh(char filename[], Mesh *m, int estNormals);
+
+/* Shared Mesh Functions */
+SharedMesh *sharedMesh_create(Mesh *m);
+SharedMesh *sharedMesh_retain(SharedMesh *s);
+void sharedMesh_release(SharedMesh *s);
+
+/* Level of Detail Functions */
+int mesh_simplify(Mesh *m, int targetFaces, Mesh *out);
+MeshLOD *meshLOD_create(Mesh *m, int nLevel);
+MeshLOD *meshLOD_retain(MeshLOD *lod);
+void meshLOD_release(MeshLOD *lod);
+int meshLOD_select(MeshLOD *lod, float pixels);
+
+/* Vertex Cache Functions */
+int vertexCache_init(VertexCache *vc, int size, int nVertex);
+void vertexCache_clear(VertexCache *vc);
+void vertexCache_reset(VertexCache *vc);
+void vertexCache_nextFace(VertexCache *vc);
+int vertexCache_lookup(VertexCache *vc, int v, int *hit);
+float vertexCache_hitRate(VertexCache *vc);
+
 
 /* Bezier Curve and Surface Functions*/
 void bezierCurve_init(BezierCurve *b);
@@ -344,24 +837,66 @@ void bezierCurve_normalize(BezierCurve *b);
 void bezierSurface_normalize(BezierSurface *b);
 void bezierCurve_zBuffer(BezierCurve *p, int flag);
 void bezierSurface_zBuffer(BezierSurface *p, int flag);
+void bezierCurve_setDivisions(BezierCurve *b, int d);
 void bezierSurface_setDivisions(BezierSurface *b, int d);
 void bezierSurface_setSolid(BezierSurface *b, int s);
+void bezierSurface_getPoint(BezierSurface *b, Point *p, int row, int col);
+void bezierSurface_setPoint(BezierSurface *b, Point *p, int row, int col);
+int bezierSurface_tessellate(BezierSurface *b, int nu, int nv, Mesh *m);
+int bezierCurve_tessellate(BezierCurve *b, float tolerance, Point *out, int max);
 void bezierCurve_draw(BezierCurve *b, Image *src, Color c);
+void bezierCurve_drawRecursive(BezierCurve *b, Image *src, Color c);
 void bezierSurface_drawLines(BezierSurface *b, Image *src, Color c);
 
+/* LRU Cache Functions */
+LruCache *lruCache_create(size_t budget, void (*release)(CacheEntry *e));
+void lruCache_free(LruCache *c);
+void lruCache_reset(LruCache *c);
+unsigned int lruCache_hash(unsigned int h, const void *key, size_t bytes);
+CacheEntry *lruCache_find(LruCache *c, unsigned int hash, int (*match)(CacheEntry *e, void *key), void *key);
+void lruCache_insert(LruCache *c, CacheEntry *e);
+float lruCache_hitRate(LruCache *c);
+
+/* Tessellation Cache Functions */
+TessCache *tessCache_create(size_t budget);
+void tessCache_free(TessCache *tc);
+void tessCache_reset(TessCache *tc);
+Mesh *tessCache_lookup(TessCache *tc, BezierSurface *b, int nu, int nv, int *hit);
+float tessCache_hitRate(TessCache *tc);
+
+/* World Cache Functions */
+WorldCache *worldCache_create(size_t budget);
+void worldCache_free(WorldCache *wc);
+void worldCache_reset(WorldCache *wc);
+WorldEntry *worldCache_lookup(WorldCache *wc, void *module, unsigned long version, Matrix *GTM);
+WorldEntry *worldCache_insert(WorldCache *wc, void *module, unsigned long version, Matrix *GTM, int nElement, int nVertex);
+float worldCache_hitRate(WorldCache *wc);
+
+/* Arena Functions */
+void arena_init(Arena *a);
+void *arena_alloc(Arena *a, size_t bytes);
+void arena_reset(Arena *a);
+void arena_free(Arena *a);
+
 /* 2D and Generic Module Functions */
 Element *element_create(void);
 Element *element_init(ObjectType type, void *obj);
 void element_delete(Element *e);
+size_t element_bytes(ObjectType type);
 Module *module_create(void);
 void module_clear(Module *md);
 void module_delete(Module *md);
+size_t module_memory(Module *md);
 void module_insert(Module *md, Element *e);
 void module_module(Module *md, Module *sub);
+void module_instances(Module *md, Module *sub, Matrix *matrix, Color *body, int count);
 void module_point(Module *md, Point *p);
 void module_line(Module *md, Line *p);
 void module_polyline(Module *md, Polyline *p);
 void module_polygon(Module *md, Polygon *p);
+void module_mesh(Module *md, Mesh *m);
+void module_sharedMesh(Module *md, SharedMesh *s);
+void module_meshLOD(Module *md, MeshLOD *lod);
 void module_bezierCurve(Module *m, BezierCurve *b, int divisions);
 void module_bezierSurface(Module *m, BezierSurface *b, int divisions, int solid);
 void module_identity(Module *md);
@@ -370,6 +905,10 @@ void module_scale2D(Module *md, double sx, double sy);
 void module_rotateZ(Module *md, double cth, double sth);
 void module_shear2D(Module *md, double shx, double shy);
 void module_draw(Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *lighting, Image *src);
+unsigned long module_version(Module *md);
+void module_invalidate(Module *md);
+int module_bounds(Module *md, Point *min, Point *max);
+int module_sphere(Module *md, Point *center, double *radius);
 
 /* 3D Module Functions */
 void module_translate(Module *md, double tx, double ty, double tz);
@@ -381,6 +920,20 @@ void module_cube(Module *md, int solid);
 void module_pyramid( Module *md );
 void module_cylinder( Module *mod, int sides );
 void module_tetrahedron( Module *md );
+void module_teapot(Module *md, int divisions, int solid);
+void module_freePrimitives(void);
+
+/* Command Buffer Functions */
+CommandBuffer *commandBuffer_create(void);
+void commandBuffer_free(CommandBuffer *cb);
+void commandBuffer_clear(CommandBuffer *cb);
+int module_compile(Module *md, CommandBuffer *cb);
+void commandBuffer_draw(CommandBuffer *cb, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *lighting, Image *src);
+int commandBuffer_valid(CommandBuffer *cb);
+
+/* Snapshot Functions */
+int snapshot_write(char *filename, CommandBuffer *cb, Lighting *lighting);
+CommandBuffer *snapshot_read(char *filename, Lighting *lighting);
 
 /* Shading/Color Module Functions */
 void module_color(Module *md, Color *c);
@@ -390,14 +943,41 @@ void module_surfaceCoeff(Module *md, float coeff);
 
 /* DrawState Functions */
 DrawState *drawstate_create( void );
+void drawstate_init( DrawState *s );
 void drawstate_setColor( DrawState *s, Color c );
 void drawstate_setBody( DrawState *s, Color c );
 void drawstate_setSurface( DrawState *s, Color c );
 void drawstate_setSurfaceCoeff( DrawState *s, float f );
 void drawstate_setShade( DrawState *ds, ShadeMethod s );
+void drawstate_setShading( DrawState *ds, ShadeMethod s );
 void drawstate_setViewer( DrawState *s, Point *v);
 void drawstate_copy( DrawState *to, DrawState *from );
 
+/* DrawStats Functions */
+DrawStats *drawstats_get( void );
+void drawstats_reset( void );
+void drawstats_add( DrawStats *s );
+
+/* Draw List Functions */
+DrawList *drawList_create(void);
+void drawList_init(DrawList *dl);
+void drawList_clear(DrawList *dl);
+void drawList_free(DrawList *dl);
+void drawList_polygon(DrawList *dl, Polygon *p, DrawState *ds);
+void drawList_depth(DrawList *dl, Polygon *p);
+void drawList_point(DrawList *dl, Point *p, Color c);
+void drawList_line(DrawList *dl, Line *l, Color c);
+void drawList_polyline(DrawList *dl, Polyline *p, Color c);
+void drawList_bezierCurve(DrawList *dl, BezierCurve *b, Color c);
+void drawList_bezierSurface(DrawList *dl, BezierSurface *b, Color c);
+int drawList_task(DrawList *dl, Module *md, Matrix *GTM, DrawState *ds);
+void drawList_draw(DrawList *dl, DrawState *ds, Image *src);
+
+/* Draw Pool Functions */
+DrawPool *drawPool_create(int threads, int depth);
+void drawPool_free(DrawPool *pool);
+void drawPool_draw(DrawPool *pool, Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *lighting, Image *src);
+
 /* Light Functions */
 void light_init(Light *l);
 void light_copy(Light *to, Light *from);
@@ -409,6 +989,38 @@ void lighting_init(Lighting *l);
 void lighting_clear(Lighting *l);
 void lighting_add(Lighting *l, LightType type, Color *c, Vector *d, Point *pos, float cutoff, float sharpness);
 void lighting_shading(Lighting *l, Vector *N, Vector *V, Point *p, Color *Cb, Color *Cs, float s, int oneSided, Color *c);
+void lighting_shadingUnit(Lighting *l, Vector *N, Vector *V, Point *p, Color *Cb, Color *Cs, float s, int oneSided, Color *c);
+void lighting_setShadow(Lighting *l, int index, int size);
+int lighting_updateShadows(Lighting *l, Module *md, Matrix *GTM);
+
+/* Shadow Map Functions */
+ShadowMap *shadowMap_create(int faces, int size);
+void shadowMap_free(ShadowMap *sm);
+int shadowMap_current(ShadowMap *sm, Light *light, Module *md, Matrix *GTM);
+void shadowMap_render(ShadowMap *sm, Light *light, Module *md, Matrix *GTM);
+float shadowMap_lookup(ShadowMap *sm, Point *p);
+
+/* Depth Pyramid Functions */
+DepthPyramid *depthPyramid_create(Image *src, int tile);
+void depthPyramid_free(DepthPyramid *hiz);
+void depthPyramid_reset(DepthPyramid *hiz);
+void depthPyramid_markDirty(DepthPyramid *hiz, float x0, float y0, float x1, float y1);
+int depthPyramid_occluded(DepthPyramid *hiz, float x0, float y0, float x1, float y1, float zNear);
+
+/* Occlusion Query Functions */
+void occlusionQuery_begin(OcclusionQuery *q, DrawState *ds);
+long occlusionQuery_end(OcclusionQuery *q, DrawState *ds);
+long module_queryBounds(Module *md, Matrix *VTM, Matrix *GTM, Image *src, DepthPyramid *hiz);
+int module_queryBatch(Module **md, Matrix *GTM, int n, Matrix *VTM, Image *src, DepthPyramid *hiz, long *samples);
+
+/* BVH Functions */
+BVH *bvh_create(Module *md, Matrix *GTM, int threads);
+int bvh_refit(BVH *bvh, Module *md, Matrix *GTM);
+void bvh_free(BVH *bvh);
+int bvh_closestHit(BVH *bvh, Point *origin, Vector *direction, double tMax, BVHHit *hit);
+int bvh_anyHit(BVH *bvh, Point *origin, Vector *direction, double tMax);
+void view3D_ray(View3D *view, double row, double col, Point *origin, Vector *direction);
+int bvh_pick(BVH *bvh, View3D *view, int row, int col, BVHHit *hit);
 
 /* Others */
 void fill(Image *src, Color f, double pixelx, double pixely);
@@ -20,6 +20,7 @@ typedef struct
 
 /* Constructors and destructors */
 Image *image_create(int rows, int cols);
+Image *image_createDepth(int rows, int cols);
 void image_free(Image *src);
 void image_init(Image *src);
 int image_alloc(Image *src, int rows, int cols);
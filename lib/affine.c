@@ -0,0 +1,175 @@
+/***
+ * written by - Jiafeng
+ *
+ * affine transform apis, a float 3x4 matrix whose implied last row is 0 0 0 1.
+ * The builders premultiply in place like the matrix_ ones, touching only the rows
+ * they change, and compose / apply use SSE on whole rows where available.
+ */
+
+#include "graphics.h"
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+/* Affine Functions */
+
+/* set a to the identity transform. */
+void affine_identity(Affine *a) {
+    int i, j;
+    for (i = 0; i < 3; i++)
+        for (j = 0; j < 4; j++)
+            a->m[i][j] = i == j ? 1.0f : 0.0f;
+}
+
+/* set a from the top three rows of m, whose last row is assumed to be 0 0 0 1. */
+void affine_set(Affine *a, Matrix *m) {
+    int i, j;
+    for (i = 0; i < 3; i++)
+        for (j = 0; j < 4; j++)
+            a->m[i][j] = (float)m->m[i][j];
+}
+
+/* copy a into the general matrix m. */
+void affine_toMatrix(Affine *a, Matrix *m) {
+    int i, j;
+    for (i = 0; i < 3; i++)
+        for (j = 0; j < 4; j++)
+            m->m[i][j] = a->m[i][j];
+    m->m[3][0] = m->m[3][1] = m->m[3][2] = 0.0;
+    m->m[3][3] = 1.0;
+}
+
+/**
+ * compose left and right into out (out = left * right), which may be either operand.
+ * Each output row is a combination of the three rows of right plus the translation,
+ * 36 multiplies instead of the 64 of matrix_multiply.
+ */
+void affine_multiply(Affine *left, Affine *right, Affine *out) {
+#if defined(__SSE__)
+    __m128 r0 = _mm_load_ps(right->m[0]), r1 = _mm_load_ps(right->m[1]), r2 = _mm_load_ps(right->m[2]);
+    __m128 t = _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f);
+    __m128 o[3];
+    int i;
+    for (i = 0; i < 3; i++) {
+        o[i] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(left->m[i][0]), r0), _mm_mul_ps(_mm_set1_ps(left->m[i][1]), r1)),
+                          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(left->m[i][2]), r2), _mm_mul_ps(_mm_set1_ps(left->m[i][3]), t)));
+    }
+    for (i = 0; i < 3; i++) _mm_store_ps(out->m[i], o[i]);
+#else
+    Affine tmp;
+    int i, j;
+    for (i = 0; i < 3; i++) {
+        for (j = 0; j < 4; j++) {
+            tmp.m[i][j] = left->m[i][0] * right->m[0][j] + left->m[i][1] * right->m[1][j] + left->m[i][2] * right->m[2][j];
+        }
+        tmp.m[i][3] += left->m[i][3];
+    }
+    *out = tmp;
+#endif
+}
+
+/* premultiply a by a translation of tx, ty and tz, three adds. */
+void affine_translate(Affine *a, float tx, float ty, float tz) {
+    a->m[0][3] += tx;
+    a->m[1][3] += ty;
+    a->m[2][3] += tz;
+}
+
+/* premultiply a by a scale of sx, sy and sz, scaling each row. */
+void affine_scale(Affine *a, float sx, float sy, float sz) {
+    int j;
+    for (j = 0; j < 4; j++) {
+        a->m[0][j] *= sx;
+        a->m[1][j] *= sy;
+        a->m[2][j] *= sz;
+    }
+}
+
+/*
+    Replace rows p and q of a with c * p - s * q and s * p + c * q, the row update
+    shared by the three axis rotations.
+ */
+static void rotateRows(Affine *a, int p, int q, float cth, float sth) {
+#if defined(__SSE__)
+    __m128 rp = _mm_load_ps(a->m[p]), rq = _mm_load_ps(a->m[q]);
+    __m128 c = _mm_set1_ps(cth), s = _mm_set1_ps(sth);
+    _mm_store_ps(a->m[p], _mm_sub_ps(_mm_mul_ps(c, rp), _mm_mul_ps(s, rq)));
+    _mm_store_ps(a->m[q], _mm_add_ps(_mm_mul_ps(s, rp), _mm_mul_ps(c, rq)));
+#else
+    int j;
+    for (j = 0; j < 4; j++) {
+        float rp = a->m[p][j], rq = a->m[q][j];
+        a->m[p][j] = cth * rp - sth * rq;
+        a->m[q][j] = sth * rp + cth * rq;
+    }
+#endif
+}
+
+/* premultiply a by a rotation about the X-axis given by cos(th) and sin(th). */
+void affine_rotateX(Affine *a, float cth, float sth) {
+    rotateRows(a, 1, 2, cth, sth);
+}
+
+/* premultiply a by a rotation about the Y-axis given by cos(th) and sin(th). */
+void affine_rotateY(Affine *a, float cth, float sth) {
+    rotateRows(a, 2, 0, cth, sth);
+}
+
+/* premultiply a by a rotation about the Z-axis given by cos(th) and sin(th). */
+void affine_rotateZ(Affine *a, float cth, float sth) {
+    rotateRows(a, 0, 1, cth, sth);
+}
+
+/* premultiply a by a 2D shear of shx and shy. */
+void affine_shear2D(Affine *a, float shx, float shy) {
+    int j;
+    for (j = 0; j < 4; j++) {
+        float r0 = a->m[0][j], r1 = a->m[1][j];
+        a->m[0][j] = r0 + shx * r1;
+        a->m[1][j] = shy * r0 + r1;
+    }
+}
+
+/* transform the point p by a into q, p and q may be the same point. */
+void affine_xformPoint(Affine *a, Point *p, Point *q) {
+    float x = p->val[0], y = p->val[1], z = p->val[2], w = p->val[3];
+    q->val[0] = a->m[0][0] * x + a->m[0][1] * y + a->m[0][2] * z + a->m[0][3] * w;
+    q->val[1] = a->m[1][0] * x + a->m[1][1] * y + a->m[1][2] * z + a->m[1][3] * w;
+    q->val[2] = a->m[2][0] * x + a->m[2][1] * y + a->m[2][2] * z + a->m[2][3] * w;
+    q->val[3] = w;
+}
+
+/* transform the vector v by a into q, ignoring the translation. */
+void affine_xformVector(Affine *a, Vector *v, Vector *q) {
+    float x = v->val[0], y = v->val[1], z = v->val[2];
+    q->val[0] = a->m[0][0] * x + a->m[0][1] * y + a->m[0][2] * z;
+    q->val[1] = a->m[1][0] * x + a->m[1][1] * y + a->m[1][2] * z;
+    q->val[2] = a->m[2][0] * x + a->m[2][1] * y + a->m[2][2] * z;
+    q->val[3] = 0.0f;
+}
+
+/**
+ * transform n points from in to out, which may be the same array. The columns of a
+ * are loaded once and each point is a sum of four scaled columns.
+ */
+void affine_xformPoints(Affine *a, Point *in, Point *out, int n) {
+#if defined(__SSE__)
+    __m128 c0 = _mm_set_ps(0.0f, a->m[2][0], a->m[1][0], a->m[0][0]);
+    __m128 c1 = _mm_set_ps(0.0f, a->m[2][1], a->m[1][1], a->m[0][1]);
+    __m128 c2 = _mm_set_ps(0.0f, a->m[2][2], a->m[1][2], a->m[0][2]);
+    __m128 c3 = _mm_set_ps(1.0f, a->m[2][3], a->m[1][3], a->m[0][3]);
+    int i;
+    for (i = 0; i < n; i++) {
+        __m128 p = _mm_loadu_ps(in[i].val);
+        __m128 q = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(p, p, 0x00), c0), _mm_mul_ps(_mm_shuffle_ps(p, p, 0x55), c1)),
+                              _mm_add_ps(_mm_mul_ps(_mm_shuffle_ps(p, p, 0xaa), c2), _mm_mul_ps(_mm_shuffle_ps(p, p, 0xff), c3)));
+        _mm_storeu_ps(out[i].val, q);
+    }
+#else
+    int i;
+    for (i = 0; i < n; i++) {
+        affine_xformPoint(a, &in[i], &out[i]);
+    }
+#endif
+}
@@ -0,0 +1,93 @@
+/***
+ * written by - Jiafeng
+ *
+ * arena apis, a bump allocator for memory with one owner and one lifetime. Allocations
+ * are carved in order out of blocks and are never freed one at a time; a reset makes
+ * every block reusable at once and keeps them for the next round of allocations.
+ */
+
+#include "graphics.h"
+
+// alignment of every allocation, enough for any type as from malloc
+#define ARENA_ALIGN 16
+// size of the first block, small so arenas that hold little cost little
+#define ARENA_MIN_BLOCK 1024
+// largest regular block, larger requests get a block of their own
+#define ARENA_MAX_BLOCK (64 * 1024)
+
+// bytes of a block header, rounded so the first allocation is aligned
+#define ARENA_HEADER ((sizeof(ArenaBlock) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1))
+
+/* make b the block being filled. */
+static void arenaUse(Arena *a, ArenaBlock *b) {
+    a->current = b;
+    a->next = (char *)b + ARENA_HEADER;
+    a->end = a->next + b->size;
+}
+
+/* Arena Functions */
+
+/* initialize an empty arena, no memory is allocated until the first arena_alloc. A zeroed Arena is empty too. */
+void arena_init(Arena *a) {
+    if (!a) return;
+    a->first = a->current = NULL;
+    a->next = a->end = NULL;
+    a->blockSize = ARENA_MIN_BLOCK;
+    a->used = 0;
+    a->held = 0;
+    a->allocations = 0;
+}
+
+/**
+ * return bytes of memory from the arena, aligned for any type. The memory lives until
+ * the arena is reset or freed. Returns NULL if a block cannot be allocated.
+ */
+void *arena_alloc(Arena *a, size_t bytes) {
+    ArenaBlock *b;
+    void *p;
+
+    if (!a) return NULL;
+    if (a->blockSize < ARENA_MIN_BLOCK) a->blockSize = ARENA_MIN_BLOCK;
+    bytes = (bytes + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    if ((size_t)(a->end - a->next) < bytes) {
+        // move on to the next empty block that is large enough, or put a new one after the current
+        b = a->current ? a->current->next : a->first;
+        if (!b || b->size < bytes) {
+            size_t size = bytes > a->blockSize ? bytes : a->blockSize;
+            ArenaBlock *made = (ArenaBlock *)malloc(ARENA_HEADER + size);
+            if (!made) return NULL;
+            made->size = size;
+            made->next = b;
+            if (a->current) a->current->next = made;
+            else a->first = made;
+            a->held += ARENA_HEADER + size;
+            a->allocations++;
+            if (a->blockSize < ARENA_MAX_BLOCK) a->blockSize *= 2;
+            b = made;
+        }
+        arenaUse(a, b);
+    }
+    p = a->next;
+    a->next += bytes;
+    a->used += bytes;
+    return p;
+}
+
+/* give back everything allocated from the arena at once, keeping its blocks for reuse. */
+void arena_reset(Arena *a) {
+    if (!a) return;
+    if (a->first) arenaUse(a, a->first);
+    a->used = 0;
+}
+
+/* free every block of the arena, leaving it empty and ready for reuse. */
+void arena_free(Arena *a) {
+    ArenaBlock *b, *next;
+
+    if (!a) return;
+    for (b = a->first; b; b = next) {
+        next = b->next;
+        free(b);
+    }
+    arena_init(a);
+}
@@ -0,0 +1,658 @@
+/***
+ * written by - Jiafeng
+ *
+ * bounding volume hierarchy apis, for ray casting and picking against a module graph
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include "graphics.h"
+
+// nodes with at least this many triangles build their left subtree on another thread
+#define BVH_PARALLEL_MIN 4096
+// deepest a node may be, which bounds the traversal stack
+#define BVH_MAX_DEPTH 64
+// hits nearer the ray origin than this are ignored, so rays may start on a surface
+#define BVH_EPSILON 1e-6
+
+/* Triangle Gathering */
+
+// the triangles of a module graph in the order the graph yields them
+typedef struct {
+    BVHTriangle *triangle;
+    int n, cap;
+    int failed; // whether an allocation failed
+    BVH *refit; // when set, the corners are written to the triangles of this BVH instead
+} Gather;
+
+/* add the triangle a b c, taken through world, made from face of e. */
+static void gatherTriangle(Gather *g, Point *a, Point *b, Point *c, Matrix *world, Element *e, int face) {
+    BVHTriangle *t;
+
+    if (g->refit) {
+        // only the corners move, the triangles keep their places in the tree
+        if (g->n >= g->refit->nTriangle) {
+            g->n++;
+            return;
+        }
+        t = &g->refit->triangle[g->refit->slot[g->n]];
+    }
+    else {
+        if (g->n == g->cap) {
+            int cap = g->cap ? 2 * g->cap : 256;
+            BVHTriangle *grown = realloc(g->triangle, sizeof(BVHTriangle) * cap);
+            if (!grown) {
+                g->failed = 1;
+                return;
+            }
+            g->triangle = grown;
+            g->cap = cap;
+        }
+        t = &g->triangle[g->n];
+        t->element = e;
+        t->face = face;
+    }
+    matrix_xformPoint(world, a, &t->vertex[0]);
+    matrix_xformPoint(world, b, &t->vertex[1]);
+    matrix_xformPoint(world, c, &t->vertex[2]);
+    g->n++;
+}
+
+/* add the faces of a mesh as triangle fans. */
+static void gatherMesh(Gather *g, Mesh *m, Matrix *world, Element *e) {
+    int f, k, s, n;
+
+    if (!m->vertex || !m->faceStart || !m->index) return;
+    for (f = 0; f < m->nFace; f++) {
+        s = m->faceStart[f];
+        n = m->faceStart[f + 1] - s;
+        for (k = 1; k < n - 1; k++) {
+            gatherTriangle(g, &m->vertex[m->index[s]], &m->vertex[m->index[s + k]], &m->vertex[m->index[s + k + 1]], world, e, f);
+        }
+    }
+}
+
+/*
+    Add the surfaces of md under GTM and the LTMs in effect in it: polygons, meshes, the
+    finest level of LOD meshes and solid Bezier patches tessellated at their most cells.
+    Points, lines, curves and wireframe patches have no area and are left out.
+ */
+static void gatherModule(Gather *g, Module *md, Matrix *GTM) {
+    Matrix LTM, world;
+    Mesh patch;
+    Element *e;
+    int i;
+
+    matrix_identity(&LTM);
+    world = *GTM;
+    mesh_init(&patch);
+    for (e = md->head; e != NULL && !g->failed; e = e->next) {
+        switch (e->type) {
+            case ObjPolygon: {
+                Polygon *p = &e->obj->polygon;
+                if (!p->vertex) break;
+                for (i = 1; i < p->nVertex - 1; i++) {
+                    gatherTriangle(g, &p->vertex[0], &p->vertex[i], &p->vertex[i + 1], &world, e, i - 1);
+                }
+                break;
+            }
+            case ObjMesh:
+                gatherMesh(g, &e->obj->mesh, &world, e);
+                break;
+            case ObjSharedMesh:
+                gatherMesh(g, &e->obj->sharedMesh->mesh, &world, e);
+                break;
+            case ObjMeshLOD:
+                gatherMesh(g, &e->obj->meshLOD->level[0], &world, e);
+                break;
+            case ObjBezierSurface: {
+                BezierSurface *b = &e->obj->bezierSurface;
+                int cells = 1 << (b->divisions < 0 ? 0 : b->divisions > 8 ? 8 : b->divisions);
+                if (!b->solid) break;
+                if (!bezierSurface_tessellate(b, cells, cells, &patch)) {
+                    g->failed = 1;
+                    break;
+                }
+                gatherMesh(g, &patch, &world, e);
+                break;
+            }
+            case ObjMatrix:
+                matrix_multiply(&e->obj->matrix, &LTM, &LTM);
+                matrix_multiply(GTM, &LTM, &world);
+                break;
+            case ObjIdentity:
+                matrix_identity(&LTM);
+                world = *GTM;
+                break;
+            case ObjModule:
+                gatherModule(g, e->obj->module, &world);
+                break;
+            case ObjInstances: {
+                Matrix place;
+                for (i = 0; i < e->obj->instances.count; i++) {
+                    matrix_multiply(&world, &e->obj->instances.matrix[i], &place);
+                    gatherModule(g, e->obj->instances.module, &place);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    mesh_clear(&patch);
+}
+
+/* Building */
+
+// the state shared by the threads building one BVH
+typedef struct {
+    BVHNode *node; // 2n - 1 nodes, a node of count triangles owns the 2 count - 1 from it
+    int *ref; // triangle of each place, partitioned in place as the nodes split
+    float (*center)[3]; // centroid of each triangle
+    float (*min)[3]; // box of each triangle
+    float (*max)[3];
+} Builder;
+
+// a subtree handed to another thread
+typedef struct {
+    Builder *b;
+    int at, first, count, depth, threads;
+} BuildTask;
+
+static void buildNode(Builder *b, int at, int first, int count, int depth, int threads);
+
+static void *buildThread(void *arg) {
+    BuildTask *t = (BuildTask *)arg;
+    buildNode(t->b, t->at, t->first, t->count, t->depth, t->threads);
+    return NULL;
+}
+
+/* half the surface area of the box min max. */
+static double boxArea(float *min, float *max) {
+    double dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+    return dx * dy + dy * dz + dz * dx;
+}
+
+/* grow the box min max to hold the box lo hi. */
+static void boxGrow(float *min, float *max, float *lo, float *hi) {
+    int j;
+    for (j = 0; j < 3; j++) {
+        if (lo[j] < min[j]) min[j] = lo[j];
+        if (hi[j] > max[j]) max[j] = hi[j];
+    }
+}
+
+/* the bin of a centroid coordinate c on an axis starting at lo, scale bins per unit. */
+static int binOf(float c, float lo, double scale) {
+    int k = (int)((c - lo) * scale);
+    return k < 0 ? 0 : k >= BVH_BINS ? BVH_BINS - 1 : k;
+}
+
+/*
+    Build the node at of the count triangles from first in b->ref. The split is the
+    cheapest of BVH_BINS - 1 planes per axis by the surface area heuristic, binning the
+    triangles by centroid. A node stays a leaf when splitting costs more than testing
+    its triangles and it holds at most BVH_LEAF_SIZE, or when no plane separates them.
+    With threads to spare, large nodes build their left subtree on a new thread.
+ */
+static void buildNode(Builder *b, int at, int first, int count, int depth, int threads) {
+    BVHNode *n = &b->node[at];
+    float cmin[3], cmax[3];
+    float binMin[BVH_BINS][3], binMax[BVH_BINS][3];
+    float rightMin[BVH_BINS][3], rightMax[BVH_BINS][3];
+    int binCount[BVH_BINS], rightCount[BVH_BINS];
+    double bestCost = HUGE_VAL, scale = 0;
+    int bestAxis = -1, bestBin = 0, mid, i, j, k, axis;
+
+    for (j = 0; j < 3; j++) {
+        n->min[j] = cmin[j] = HUGE_VALF;
+        n->max[j] = cmax[j] = -HUGE_VALF;
+    }
+    for (i = first; i < first + count; i++) {
+        int r = b->ref[i];
+        boxGrow(n->min, n->max, b->min[r], b->max[r]);
+        boxGrow(cmin, cmax, b->center[r], b->center[r]);
+    }
+    n->index = first;
+    n->count = count;
+    if (count <= 1 || depth >= BVH_MAX_DEPTH - 1) return;
+
+    for (axis = 0; axis < 3; axis++) {
+        float lo[3], hi[3];
+        double extent = cmax[axis] - cmin[axis], s, cost;
+        int left;
+
+        if (extent <= 0) continue;
+        s = BVH_BINS / extent;
+        for (k = 0; k < BVH_BINS; k++) {
+            binCount[k] = 0;
+            for (j = 0; j < 3; j++) {
+                binMin[k][j] = HUGE_VALF;
+                binMax[k][j] = -HUGE_VALF;
+            }
+        }
+        for (i = first; i < first + count; i++) {
+            int r = b->ref[i];
+            k = binOf(b->center[r][axis], cmin[axis], s);
+            binCount[k]++;
+            boxGrow(binMin[k], binMax[k], b->min[r], b->max[r]);
+        }
+        // sweep from the right to know the box of everything above each plane
+        for (j = 0; j < 3; j++) {
+            lo[j] = HUGE_VALF;
+            hi[j] = -HUGE_VALF;
+        }
+        for (k = BVH_BINS - 1, left = 0; k > 0; k--) {
+            boxGrow(lo, hi, binMin[k], binMax[k]);
+            left += binCount[k];
+            memcpy(rightMin[k], lo, sizeof(lo));
+            memcpy(rightMax[k], hi, sizeof(hi));
+            rightCount[k] = left;
+        }
+        // and from the left to price the plane after each bin
+        for (j = 0; j < 3; j++) {
+            lo[j] = HUGE_VALF;
+            hi[j] = -HUGE_VALF;
+        }
+        for (k = 0, left = 0; k < BVH_BINS - 1; k++) {
+            boxGrow(lo, hi, binMin[k], binMax[k]);
+            left += binCount[k];
+            if (left == 0 || rightCount[k + 1] == 0) continue;
+            cost = left * boxArea(lo, hi) + rightCount[k + 1] * boxArea(rightMin[k + 1], rightMax[k + 1]);
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestBin = k;
+                scale = s;
+            }
+        }
+    }
+
+    if (bestAxis < 0) {
+        // every centroid is in the same place, halve the list if it is too long for a leaf
+        if (count <= BVH_LEAF_SIZE) return;
+        mid = count / 2;
+    }
+    else {
+        // a traversal step costs about as much as a triangle test
+        double area = boxArea(n->min, n->max);
+        if (count <= BVH_LEAF_SIZE && (area <= 0 || 1 + bestCost / area >= count)) return;
+        for (i = first, j = first + count - 1; i <= j; ) {
+            if (binOf(b->center[b->ref[i]][bestAxis], cmin[bestAxis], scale) <= bestBin) i++;
+            else {
+                int t = b->ref[i];
+                b->ref[i] = b->ref[j];
+                b->ref[j--] = t;
+            }
+        }
+        mid = i - first;
+    }
+
+    n->count = 0;
+    n->index = at + 2 * mid;
+    if (threads > 1 && count >= BVH_PARALLEL_MIN) {
+        BuildTask task = {b, at + 1, first, mid, depth + 1, threads / 2};
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, buildThread, &task) == 0) {
+            buildNode(b, n->index, first + mid, count - mid, depth + 1, threads - threads / 2);
+            pthread_join(thread, NULL);
+            return;
+        }
+    }
+    buildNode(b, at + 1, first, mid, depth + 1, 1);
+    buildNode(b, n->index, first + mid, count - mid, depth + 1, 1);
+}
+
+/* copy the subtree at in from to the end of to, closing the gaps, and return its new place. */
+static int compactNode(BVHNode *from, int at, BVHNode *to, int *n) {
+    int place = (*n)++;
+    to[place] = from[at];
+    if (from[at].count == 0) {
+        compactNode(from, at + 1, to, n);
+        to[place].index = compactNode(from, from[at].index, to, n);
+    }
+    return place;
+}
+
+/* set the box of every node from its triangles or children, leaves up. */
+static void refitNodes(BVH *bvh) {
+    BVHNode *n;
+    int i, j, k;
+
+    for (i = bvh->nNode - 1; i >= 0; i--) {
+        n = &bvh->node[i];
+        for (j = 0; j < 3; j++) {
+            n->min[j] = HUGE_VALF;
+            n->max[j] = -HUGE_VALF;
+        }
+        if (n->count == 0) {
+            boxGrow(n->min, n->max, bvh->node[i + 1].min, bvh->node[i + 1].max);
+            boxGrow(n->min, n->max, bvh->node[n->index].min, bvh->node[n->index].max);
+            continue;
+        }
+        for (k = n->index; k < n->index + n->count; k++) {
+            for (j = 0; j < 3; j++) {
+                float lo[3] = {bvh->triangle[k].vertex[j].val[0], bvh->triangle[k].vertex[j].val[1], bvh->triangle[k].vertex[j].val[2]};
+                boxGrow(n->min, n->max, lo, lo);
+            }
+        }
+    }
+}
+
+/* BVH Functions */
+
+/**
+ * Build a BVH over the world-space triangles of the module graph md drawn under GTM
+ * (the identity if NULL): its polygons and meshes as triangle fans, the finest level of
+ * its LOD meshes and its solid Bezier patches at their most cells. Nodes are split by
+ * the binned surface area heuristic, and the top of the tree is built on up to threads
+ * threads. Returns NULL if memory runs out.
+ */
+BVH *bvh_create(Module *md, Matrix *GTM, int threads) {
+    Gather g = {NULL, 0, 0, 0, NULL};
+    Builder b = {NULL, NULL, NULL, NULL, NULL};
+    BVHNode *node;
+    BVH *bvh;
+    Matrix I;
+    int i, j, k, n;
+
+    if (!md) return NULL;
+    if (!GTM) {
+        matrix_identity(&I);
+        GTM = &I;
+    }
+    gatherModule(&g, md, GTM);
+    bvh = (BVH *)calloc(1, sizeof(BVH));
+    if (g.failed || !bvh) {
+        free(g.triangle);
+        free(bvh);
+        return NULL;
+    }
+    n = g.n;
+    if (n == 0) {
+        free(g.triangle);
+        return bvh;
+    }
+
+    b.node = malloc(sizeof(BVHNode) * (2 * n - 1));
+    b.ref = malloc(sizeof(int) * n);
+    b.center = malloc(sizeof(float) * 3 * n);
+    b.min = malloc(sizeof(float) * 3 * n);
+    b.max = malloc(sizeof(float) * 3 * n);
+    bvh->triangle = malloc(sizeof(BVHTriangle) * n);
+    bvh->slot = malloc(sizeof(int) * n);
+    if (b.node && b.ref && b.center && b.min && b.max && bvh->triangle && bvh->slot) {
+        for (i = 0; i < n; i++) {
+            b.ref[i] = i;
+            for (j = 0; j < 3; j++) {
+                b.min[i][j] = b.max[i][j] = g.triangle[i].vertex[0].val[j];
+                for (k = 1; k < 3; k++) {
+                    if (g.triangle[i].vertex[k].val[j] < b.min[i][j]) b.min[i][j] = g.triangle[i].vertex[k].val[j];
+                    if (g.triangle[i].vertex[k].val[j] > b.max[i][j]) b.max[i][j] = g.triangle[i].vertex[k].val[j];
+                }
+                b.center[i][j] = (b.min[i][j] + b.max[i][j]) / 2;
+            }
+        }
+        buildNode(&b, 0, 0, n, 0, threads < 1 ? 1 : threads);
+
+        // the nodes were placed with room for the worst case, pack them depth first
+        node = malloc(sizeof(BVHNode) * (2 * n - 1));
+        if (node) {
+            compactNode(b.node, 0, node, &bvh->nNode);
+            bvh->node = realloc(node, sizeof(BVHNode) * bvh->nNode);
+            if (!bvh->node) bvh->node = node;
+            for (i = 0; i < n; i++) {
+                bvh->triangle[i] = g.triangle[b.ref[i]];
+                bvh->slot[b.ref[i]] = i;
+            }
+            bvh->nTriangle = n;
+        }
+    }
+    free(b.node);
+    free(b.ref);
+    free(b.center);
+    free(b.min);
+    free(b.max);
+    free(g.triangle);
+    if (!bvh->node) {
+        bvh_free(bvh);
+        return NULL;
+    }
+    return bvh;
+}
+
+/**
+ * Move the triangles of bvh to where the module graph md under GTM now puts them and
+ * grow or shrink the boxes of the nodes to match, keeping the tree as it was built.
+ * This is for graphs whose transforms changed but which yield the same triangles in
+ * the same order; the tree gets slower as the triangles move away from where it was
+ * built, and bvh_create makes a new one. Returns 0 if md yields a different number of
+ * triangles, in which case bvh is left as it was and must be rebuilt, 1 otherwise.
+ */
+int bvh_refit(BVH *bvh, Module *md, Matrix *GTM) {
+    Gather g = {NULL, 0, 0, 0, NULL};
+    BVHTriangle *saved;
+    Matrix I;
+
+    if (!bvh || !md) return 0;
+    if (!GTM) {
+        matrix_identity(&I);
+        GTM = &I;
+    }
+    if (bvh->nTriangle == 0) {
+        gatherModule(&g, md, GTM);
+        free(g.triangle);
+        return g.n == 0;
+    }
+    // keep the old corners until the count is known to match
+    saved = malloc(sizeof(BVHTriangle) * bvh->nTriangle);
+    if (!saved) return 0;
+    memcpy(saved, bvh->triangle, sizeof(BVHTriangle) * bvh->nTriangle);
+    g.refit = bvh;
+    gatherModule(&g, md, GTM);
+    if (g.failed || g.n != bvh->nTriangle) {
+        memcpy(bvh->triangle, saved, sizeof(BVHTriangle) * bvh->nTriangle);
+        free(saved);
+        return 0;
+    }
+    free(saved);
+    refitNodes(bvh);
+    return 1;
+}
+
+/* free the BVH and everything it holds. */
+void bvh_free(BVH *bvh) {
+    if (!bvh) return;
+    free(bvh->node);
+    free(bvh->triangle);
+    free(bvh->slot);
+    free(bvh);
+}
+
+/* Ray Queries */
+
+/* distance along the ray to the box of n, or -1 if the ray misses it within tMax. */
+static double rayBox(BVHNode *n, double *o, double *inv, double tMax) {
+    double tNear = 0, tFar = tMax, t0, t1;
+    int j;
+    for (j = 0; j < 3; j++) {
+        t0 = (n->min[j] - o[j]) * inv[j];
+        t1 = (n->max[j] - o[j]) * inv[j];
+        // a NaN, from a ray in the plane of a face, leaves the interval alone
+        tNear = fmax(tNear, fmin(t0, t1));
+        tFar = fmin(tFar, fmax(t0, t1));
+    }
+    return tNear <= tFar ? tNear : -1;
+}
+
+/*
+    Intersect the ray with both sides of the triangle, Moller-Trumbore. Returns 1 with
+    t, u and v set if it meets the triangle between BVH_EPSILON and tMax.
+ */
+static int rayTriangle(BVHTriangle *tri, double *o, double *d, double tMax, double *t, double *u, double *v) {
+    double e1[3], e2[3], p[3], q[3], s[3], det, inv, a, b, c;
+    int j;
+
+    for (j = 0; j < 3; j++) {
+        e1[j] = tri->vertex[1].val[j] - tri->vertex[0].val[j];
+        e2[j] = tri->vertex[2].val[j] - tri->vertex[0].val[j];
+        s[j] = o[j] - tri->vertex[0].val[j];
+    }
+    p[0] = d[1] * e2[2] - d[2] * e2[1];
+    p[1] = d[2] * e2[0] - d[0] * e2[2];
+    p[2] = d[0] * e2[1] - d[1] * e2[0];
+    det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+    if (det == 0) return 0;
+    inv = 1 / det;
+    a = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv;
+    if (a < 0 || a > 1) return 0;
+    q[0] = s[1] * e1[2] - s[2] * e1[1];
+    q[1] = s[2] * e1[0] - s[0] * e1[2];
+    q[2] = s[0] * e1[1] - s[1] * e1[0];
+    b = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv;
+    if (b < 0 || a + b > 1) return 0;
+    c = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv;
+    if (c <= BVH_EPSILON || c > tMax) return 0;
+    *t = c;
+    *u = a;
+    *v = b;
+    return 1;
+}
+
+/*
+    Walk the tree nearer child first and return the index of the nearest triangle the
+    ray meets within tMax, or with any set the first one found, or -1 for none.
+ */
+static int rayTrace(BVH *bvh, Point *origin, Vector *direction, double tMax, int any, double *t, double *u, double *v) {
+    int stack[BVH_MAX_DEPTH + 1], top = 0, best = -1, at, k;
+    double entry[BVH_MAX_DEPTH + 1], o[3], d[3], inv[3], tl, tr, tt, uu, vv;
+    BVHNode *n;
+
+    if (!bvh || bvh->nNode == 0 || !origin || !direction) return -1;
+    for (k = 0; k < 3; k++) {
+        o[k] = origin->val[k];
+        d[k] = direction->val[k];
+        inv[k] = 1 / d[k];
+    }
+    if ((entry[0] = rayBox(&bvh->node[0], o, inv, tMax)) < 0) return -1;
+    stack[top++] = 0;
+    while (top > 0) {
+        top--;
+        // a nearer hit may have been found since the node was pushed
+        if (entry[top] > tMax) continue;
+        at = stack[top];
+        n = &bvh->node[at];
+        if (n->count > 0) {
+            for (k = n->index; k < n->index + n->count; k++) {
+                if (rayTriangle(&bvh->triangle[k], o, d, tMax, &tt, &uu, &vv)) {
+                    best = k;
+                    tMax = *t = tt;
+                    *u = uu;
+                    *v = vv;
+                    if (any) return best;
+                }
+            }
+            continue;
+        }
+        tl = rayBox(&bvh->node[at + 1], o, inv, tMax);
+        tr = rayBox(&bvh->node[n->index], o, inv, tMax);
+        // the far child goes on the stack first so the near one is taken next
+        if (tl >= 0 && tr >= 0) {
+            int nearLeft = tl <= tr;
+            stack[top] = nearLeft ? n->index : at + 1;
+            entry[top++] = nearLeft ? tr : tl;
+            stack[top] = nearLeft ? at + 1 : n->index;
+            entry[top++] = nearLeft ? tl : tr;
+        }
+        else if (tl >= 0) {
+            stack[top] = at + 1;
+            entry[top++] = tl;
+        }
+        else if (tr >= 0) {
+            stack[top] = n->index;
+            entry[top++] = tr;
+        }
+    }
+    return best;
+}
+
+/**
+ * Cast the ray from origin along direction and fill in hit with the nearest triangle
+ * it meets, both sides counting, at a distance between a small epsilon and tMax in
+ * lengths of direction (HUGE_VAL for no limit). Returns 1 if there is a hit, 0 if not.
+ */
+int bvh_closestHit(BVH *bvh, Point *origin, Vector *direction, double tMax, BVHHit *hit) {
+    BVHTriangle *tri;
+    double t, u, v, e1[3], e2[3], dot;
+    int k = rayTrace(bvh, origin, direction, tMax, 0, &t, &u, &v), j;
+
+    if (k < 0) return 0;
+    if (!hit) return 1;
+    tri = &bvh->triangle[k];
+    hit->t = t;
+    hit->u = u;
+    hit->v = v;
+    for (j = 0; j < 3; j++) {
+        hit->point.val[j] = origin->val[j] + t * direction->val[j];
+        e1[j] = tri->vertex[1].val[j] - tri->vertex[0].val[j];
+        e2[j] = tri->vertex[2].val[j] - tri->vertex[0].val[j];
+    }
+    hit->point.val[3] = 1;
+    vector_set(&hit->normal, e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]);
+    vector_normalize(&hit->normal);
+    dot = vector_dot(&hit->normal, direction);
+    if (dot > 0) vector_set(&hit->normal, -hit->normal.val[0], -hit->normal.val[1], -hit->normal.val[2]);
+    hit->triangle = k;
+    hit->element = tri->element;
+    hit->face = tri->face;
+    return 1;
+}
+
+/**
+ * Whether the ray from origin along direction meets any triangle between a small
+ * epsilon and tMax, stopping at the first one found. Made for shadow and visibility
+ * rays, where which triangle is hit does not matter.
+ */
+int bvh_anyHit(BVH *bvh, Point *origin, Vector *direction, double tMax) {
+    double t, u, v;
+    return rayTrace(bvh, origin, direction, tMax, 1, &t, &u, &v) >= 0;
+}
+
+/**
+ * Put the world-space ray through the point at row and col of the image made with
+ * view into origin and direction, so pixel centers are at half-integers. The ray
+ * starts at the center of projection and reaches the view plane at t = 1.
+ */
+void view3D_ray(View3D *view, double row, double col, Point *origin, Vector *direction) {
+    Vector vpn = view->vpn, vup = view->vup, u;
+    double x, y;
+    int j;
+
+    vector_normalize(&vpn);
+    vector_cross(&vup, &vpn, &u);
+    vector_normalize(&u);
+    vector_cross(&vpn, &u, &vup);
+    // screen x and y run against u and vup, see matrix_setView3D
+    x = (view->screenx / 2.0 - col) * view->du / view->screenx;
+    y = (view->screeny / 2.0 - row) * view->dv / view->screeny;
+    for (j = 0; j < 3; j++) {
+        origin->val[j] = view->vrp.val[j] - view->d * vpn.val[j];
+        direction->val[j] = view->d * vpn.val[j] + x * u.val[j] + y * vup.val[j];
+    }
+    origin->val[3] = 1;
+    direction->val[3] = 0;
+}
+
+/**
+ * Find what is under the center of the pixel at row and col of the image made with
+ * view: the nearest triangle of bvh on the ray through it. Returns 1 and fills in hit
+ * if there is one, 0 if the pixel shows only background.
+ */
+int bvh_pick(BVH *bvh, View3D *view, int row, int col, BVHHit *hit) {
+    Point origin;
+    Vector direction;
+
+    if (!view) return 0;
+    view3D_ray(view, row + 0.5, col + 0.5, &origin, &direction);
+    return bvh_closestHit(bvh, &origin, &direction, HUGE_VAL, hit);
+}
@@ -0,0 +1,579 @@
+/***
+ * written by - Jiafeng
+ *
+ * draw list apis, traversal of a module graph split from its rasterization. module_draw
+ * with a draw list in its DrawState records the primitives it reaches, transformed to
+ * the screen and shaded, with the DrawState fields their rasterization reads, and
+ * drawList_draw rasterizes them later in the same order.
+ *
+ * A draw pool runs the traversal on several threads. Sub-modules near the top of the
+ * graph become tasks, pushed on the queue of the thread that reached them and taken
+ * newest first by that thread or oldest first by idle threads stealing work. Each
+ * thread records into its own list, a task's items one run of it, and the item the
+ * task left in its parent's place says where. Drawing from the root task and following
+ * those items gives back the order module_draw would have drawn in, whichever thread
+ * took which task, so the image is the same as drawing the module directly.
+ */
+
+#include <string.h>
+#include <pthread.h>
+#include "graphics.h"
+
+// items a draw list first makes room for, doubled whenever it is full
+#define DRAW_LIST_ITEMS 256
+
+// depth of the sub-modules made into tasks when the pool is created with none
+#define DRAW_POOL_DEPTH 2
+
+// tasks waiting on one thread, pushed and popped at tail, stolen at head
+typedef struct {
+    DrawTask **task;
+    int head;
+    int tail;
+    int max;
+} TaskDeque;
+
+// what a pool thread is started with
+typedef struct {
+    DrawPool *pool;
+    int thread;
+} PoolThread;
+
+// the task queues of a pool's threads, all guarded by one lock
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t wake; // signalled when a task is pushed, the last one finishes, a draw starts or ends
+    TaskDeque *deque; // one per thread
+    int pending; // tasks pushed and not yet finished
+    int draws; // draws started, the threads wait between draws for it to change
+    int busy; // threads still working on the draw in progress
+    int started; // threads after the caller's that are running
+    int quit; // set when the pool is freed, the threads then return
+    pthread_t *thread; // the threads after the caller's, started with the pool
+    PoolThread *arg; // what each of them is started with, no pool if it could not be
+} TaskQueue;
+
+/* a new item of the given type at the end of the list, or NULL if there is no room for one. */
+static DrawItem *itemAdd(DrawList *dl, DrawItemType type) {
+    DrawItem *item;
+
+    if (dl->nItem == dl->maxItem) {
+        int max = dl->maxItem ? dl->maxItem * 2 : DRAW_LIST_ITEMS;
+        item = (DrawItem *)realloc(dl->item, sizeof(DrawItem) * max);
+        if (!item) return NULL;
+        dl->item = item;
+        dl->maxItem = max;
+    }
+    item = &dl->item[dl->nItem++];
+    item->type = type;
+    return item;
+}
+
+/* copy of bytes of src in the list's arena, NULL if src is NULL or there is no room. */
+static void *listCopy(DrawList *dl, void *src, size_t bytes) {
+    void *p;
+
+    if (!src) return NULL;
+    p = arena_alloc(&dl->arena, bytes);
+    if (p) memcpy(p, src, bytes);
+    return p;
+}
+
+/* record the vertices of p, and its colors if color is set, as an item of the given type. */
+static DrawItem *itemPolygon(DrawList *dl, DrawItemType type, Polygon *p, int color) {
+    DrawItem *item;
+    Polygon *q;
+
+    if (!dl || !p || p->nVertex < 1) return NULL;
+    item = itemAdd(dl, type);
+    if (!item) return NULL;
+    q = &item->prim.polygon;
+    *q = *p;
+    q->normal = NULL;
+    q->vertex = listCopy(dl, p->vertex, sizeof(Point) * p->nVertex);
+    q->color = color ? listCopy(dl, p->color, sizeof(Color) * p->nVertex) : NULL;
+    if (!q->vertex || (color && p->color && !q->color)) {
+        dl->nItem--;
+        return NULL;
+    }
+    return item;
+}
+
+/* mark the screen box of n points, grown by a pixel as module_draw does, dirty in hiz. */
+static void markDirty(DepthPyramid *hiz, Point *v, int n) {
+    float x0, y0, x1, y1;
+    int i;
+
+    if (!hiz || n < 1) return;
+    x0 = x1 = v[0].val[0];
+    y0 = y1 = v[0].val[1];
+    for (i = 1; i < n; i++) {
+        if (v[i].val[0] < x0) x0 = v[i].val[0];
+        if (v[i].val[0] > x1) x1 = v[i].val[0];
+        if (v[i].val[1] < y0) y0 = v[i].val[1];
+        if (v[i].val[1] > y1) y1 = v[i].val[1];
+    }
+    depthPyramid_markDirty(hiz, x0 - 1, y0 - 1, x1 + 1, y1 + 1);
+}
+
+/*
+    Rasterize n items into src with the depth pyramid, occlusion query and z-buffer flag
+    of ds, and the shading fields each item recorded. The items of a task are drawn in
+    its place. Large polygons are filled through scratch, reset after each item.
+ */
+static void drawItems(DrawItem *item, int n, DrawState *ds, Image *src, Arena *scratch) {
+    DrawState rs;
+    int i;
+
+    drawstate_copy(&rs, ds);
+    rs.drawList = NULL;
+    rs.scratch = scratch;
+    for (i = 0; i < n; i++, item++) {
+        switch (item->type) {
+            case DrawItemPolygon:
+                rs.shade = item->shade;
+                rs.color = item->color;
+                rs.flatColor = item->flatColor;
+                polygon_drawShade(&item->prim.polygon, src, &rs, NULL);
+                markDirty(ds->hiz, item->prim.polygon.vertex, item->prim.polygon.nVertex);
+                break;
+            case DrawItemDepth:
+                if (ds->query) {
+                    ds->query->samples += polygon_countDepth(&item->prim.polygon, src, scratch);
+                } else {
+                    polygon_drawDepth(&item->prim.polygon, src, scratch);
+                    markDirty(ds->hiz, item->prim.polygon.vertex, item->prim.polygon.nVertex);
+                }
+                break;
+            case DrawItemPoint:
+                point_draw(&item->prim.point, src, item->color);
+                markDirty(ds->hiz, &item->prim.point, 1);
+                break;
+            case DrawItemLine:
+                line_draw(item->prim.line, src, item->color);
+                markDirty(ds->hiz, &item->prim.line->a, 1);
+                markDirty(ds->hiz, &item->prim.line->b, 1);
+                break;
+            case DrawItemPolyline:
+                polyline_draw(&item->prim.polyline, src, item->color);
+                markDirty(ds->hiz, item->prim.polyline.vertex, item->prim.polyline.numVertex);
+                break;
+            case DrawItemBezierCurve:
+                bezierCurve_draw(item->prim.bezierCurve, src, item->color);
+                markDirty(ds->hiz, item->prim.bezierCurve->vertex, 4);
+                break;
+            case DrawItemBezierSurface:
+                bezierSurface_drawLines(item->prim.bezierSurface, src, item->color);
+                markDirty(ds->hiz, &item->prim.bezierSurface->vertex[0][0], 16);
+                break;
+            case DrawItemTask: {
+                DrawTask *t = item->prim.task;
+                if (t->list) drawItems(&t->list->item[t->first], t->count, ds, src, scratch);
+                break;
+            }
+            default:
+                break;
+        }
+        if (scratch->used) arena_reset(scratch);
+    }
+}
+
+/* Draw List Functions */
+
+/* allocate an empty draw list. Returns NULL if the allocation fails. */
+DrawList *drawList_create(void) {
+    DrawList *dl = (DrawList *)malloc(sizeof(DrawList));
+    drawList_init(dl);
+    return dl;
+}
+
+/* initialize an empty draw list that belongs to no pool. */
+void drawList_init(DrawList *dl) {
+    if (!dl) return;
+    dl->item = NULL;
+    dl->nItem = dl->maxItem = 0;
+    arena_init(&dl->arena);
+    arena_init(&dl->scratch);
+    dl->pool = NULL;
+    dl->thread = 0;
+    dl->depth = 0;
+}
+
+/* empty the list for the next recording, keeping its memory. */
+void drawList_clear(DrawList *dl) {
+    if (!dl) return;
+    dl->nItem = 0;
+    dl->depth = 0;
+    arena_reset(&dl->arena);
+    arena_reset(&dl->scratch);
+}
+
+/* free the list and everything it holds. */
+void drawList_free(DrawList *dl) {
+    if (!dl) return;
+    free(dl->item);
+    arena_free(&dl->arena);
+    arena_free(&dl->scratch);
+    free(dl);
+}
+
+/* record a filled or framed polygon in screen coordinates with the shading fields of ds. */
+void drawList_polygon(DrawList *dl, Polygon *p, DrawState *ds) {
+    DrawItem *item = itemPolygon(dl, DrawItemPolygon, p, 1);
+
+    if (!item) return;
+    item->shade = ds->shade;
+    item->color = ds->color;
+    item->flatColor = ds->flatColor;
+}
+
+/* record a depth-only polygon in screen coordinates. */
+void drawList_depth(DrawList *dl, Polygon *p) {
+    itemPolygon(dl, DrawItemDepth, p, 0);
+}
+
+/* record a point in screen coordinates drawn in color c. */
+void drawList_point(DrawList *dl, Point *p, Color c) {
+    DrawItem *item;
+
+    if (!dl || !p || !(item = itemAdd(dl, DrawItemPoint))) return;
+    item->color = c;
+    item->prim.point = *p;
+}
+
+/* record a line in screen coordinates drawn in color c. */
+void drawList_line(DrawList *dl, Line *l, Color c) {
+    DrawItem *item;
+
+    if (!dl || !l || !(item = itemAdd(dl, DrawItemLine))) return;
+    item->color = c;
+    if (!(item->prim.line = listCopy(dl, l, sizeof(Line)))) dl->nItem--;
+}
+
+/* record a polyline in screen coordinates drawn in color c. */
+void drawList_polyline(DrawList *dl, Polyline *p, Color c) {
+    DrawItem *item;
+
+    if (!dl || !p || p->numVertex < 1 || !(item = itemAdd(dl, DrawItemPolyline))) return;
+    item->color = c;
+    item->prim.polyline = *p;
+    if (!(item->prim.polyline.vertex = listCopy(dl, p->vertex, sizeof(Point) * p->numVertex))) dl->nItem--;
+}
+
+/* record a Bezier curve with its control points in screen coordinates drawn in color c. */
+void drawList_bezierCurve(DrawList *dl, BezierCurve *b, Color c) {
+    DrawItem *item;
+
+    if (!dl || !b || !(item = itemAdd(dl, DrawItemBezierCurve))) return;
+    item->color = c;
+    if (!(item->prim.bezierCurve = listCopy(dl, b, sizeof(BezierCurve)))) dl->nItem--;
+}
+
+/* record the wire frame of a Bezier surface with its control points in screen coordinates drawn in color c. */
+void drawList_bezierSurface(DrawList *dl, BezierSurface *b, Color c) {
+    DrawItem *item;
+
+    if (!dl || !b || !(item = itemAdd(dl, DrawItemBezierSurface))) return;
+    item->color = c;
+    if (!(item->prim.bezierSurface = listCopy(dl, b, sizeof(BezierSurface)))) dl->nItem--;
+}
+
+/**
+ * hand md, drawn under GTM with a copy of ds, to the pool the list belongs to as a task
+ * of its own and record where its items go. Returns 0, leaving md for the caller to
+ * draw, if the list belongs to no pool, md is nested too deep to be worth a task or
+ * there is no memory for one.
+ */
+int drawList_task(DrawList *dl, Module *md, Matrix *GTM, DrawState *ds) {
+    DrawPool *pool;
+    TaskQueue *q;
+    TaskDeque *d;
+    DrawTask *t;
+    DrawItem *item;
+
+    if (!dl || !(pool = dl->pool) || dl->depth >= pool->depth) return 0;
+    if (!(item = itemAdd(dl, DrawItemTask))) return 0;
+    if (!(t = (DrawTask *)arena_alloc(&dl->arena, sizeof(DrawTask)))) {
+        dl->nItem--;
+        return 0;
+    }
+    t->module = md;
+    t->GTM = *GTM;
+    drawstate_copy(&t->ds, ds);
+    t->depth = dl->depth + 1;
+    t->list = NULL;
+    t->first = t->count = 0;
+    item->prim.task = t;
+
+    q = (TaskQueue *)pool->queue;
+    d = &q->deque[dl->thread];
+    pthread_mutex_lock(&q->lock);
+    if (d->tail == d->max) {
+        // close the gap the thieves left, or make more room
+        if (d->head > 0) {
+            memmove(d->task, d->task + d->head, sizeof(DrawTask *) * (d->tail - d->head));
+            d->tail -= d->head;
+            d->head = 0;
+        } else {
+            int max = d->max ? d->max * 2 : DRAW_LIST_ITEMS;
+            DrawTask **task = (DrawTask **)realloc(d->task, sizeof(DrawTask *) * max);
+            if (!task) {
+                pthread_mutex_unlock(&q->lock);
+                dl->nItem--;
+                return 0;
+            }
+            d->task = task;
+            d->max = max;
+        }
+    }
+    d->task[d->tail++] = t;
+    q->pending++;
+    pthread_cond_signal(&q->wake);
+    pthread_mutex_unlock(&q->lock);
+    return 1;
+}
+
+/**
+ * rasterize the items of a list recorded by module_draw into src, in the order they
+ * were recorded. The z-buffer flag, depth pyramid and occlusion query of ds are used,
+ * so the DrawState the list was recorded with should have neither of the latter two.
+ * The shading of each item is the one it was recorded with.
+ */
+void drawList_draw(DrawList *dl, DrawState *ds, Image *src) {
+    if (!dl || !ds || !src) return;
+    drawItems(dl->item, dl->nItem, ds, src, &dl->scratch);
+}
+
+/* the next task for thread to run, its own newest or another's oldest, NULL once all are done. */
+static DrawTask *poolTake(DrawPool *pool, int thread) {
+    TaskQueue *q = (TaskQueue *)pool->queue;
+    DrawTask *t = NULL;
+    int i;
+
+    pthread_mutex_lock(&q->lock);
+    while (q->pending > 0) {
+        TaskDeque *d = &q->deque[thread];
+        if (d->tail > d->head) {
+            t = d->task[--d->tail];
+            break;
+        }
+        for (i = 1; i < pool->threads && !t; i++) {
+            d = &q->deque[(thread + i) % pool->threads];
+            if (d->tail > d->head) t = d->task[d->head++];
+        }
+        if (t) break;
+        pthread_cond_wait(&q->wake, &q->lock);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return t;
+}
+
+/* run tasks on thread until there are none left anywhere. */
+static void poolWork(DrawPool *pool, int thread) {
+    TaskQueue *q = (TaskQueue *)pool->queue;
+    DrawList *dl = &pool->list[thread];
+    DrawTask *t;
+
+    while ((t = poolTake(pool, thread))) {
+        t->list = dl;
+        t->first = dl->nItem;
+        t->ds.drawList = dl;
+        t->ds.scratch = &dl->scratch;
+        dl->depth = t->depth;
+        module_draw((Module *)t->module, pool->VTM, &t->GTM, &t->ds, pool->lighting, pool->src);
+        t->count = dl->nItem - t->first;
+
+        pthread_mutex_lock(&q->lock);
+        if (--q->pending == 0) pthread_cond_broadcast(&q->wake);
+        pthread_mutex_unlock(&q->lock);
+    }
+}
+
+/*
+    a pool thread. It sleeps until a draw starts, takes part in its traversal, hands
+    back the counters of that traversal and sleeps again, until the pool is freed.
+ */
+static void *poolThread(void *arg) {
+    PoolThread *pt = (PoolThread *)arg;
+    TaskQueue *q = (TaskQueue *)pt->pool->queue;
+    int draws = 0, quit;
+
+    for (;;) {
+        pthread_mutex_lock(&q->lock);
+        while (q->draws == draws && !q->quit) pthread_cond_wait(&q->wake, &q->lock);
+        draws = q->draws;
+        quit = q->quit;
+        pthread_mutex_unlock(&q->lock);
+        if (quit) return NULL;
+
+        drawstats_reset();
+        poolWork(pt->pool, pt->thread);
+        pt->pool->stats[pt->thread] = *drawstats_get();
+
+        pthread_mutex_lock(&q->lock);
+        if (--q->busy == 0) pthread_cond_broadcast(&q->wake);
+        pthread_mutex_unlock(&q->lock);
+    }
+}
+
+/* validate the cached bounds of every module below md, so the threads only read them. */
+static void boundsPrime(Module *md) {
+    Element *e;
+
+    module_bounds(md, NULL, NULL);
+    for (e = md->head; e != NULL; e = e->next) {
+        if (e->type == ObjModule) boundsPrime((Module *)e->obj->module);
+        else if (e->type == ObjInstances) boundsPrime((Module *)e->obj->instances.module);
+    }
+}
+
+/* Draw Pool Functions */
+
+/**
+ * allocate a pool of threads, counting the caller, that traverse module graphs in
+ * parallel. Sub-modules nested up to depth deep, or DRAW_POOL_DEPTH if depth is not
+ * positive, are traversed as tasks of their own. The threads after the caller's are
+ * started here and wait for drawPool_draw between draws; one that cannot be started
+ * leaves its share to the others. Returns NULL if the allocation fails.
+ */
+DrawPool *drawPool_create(int threads, int depth) {
+    DrawPool *pool = (DrawPool *)malloc(sizeof(DrawPool));
+    TaskQueue *q;
+    int i;
+
+    if (!pool) return NULL;
+    pool->threads = threads < 1 ? 1 : threads;
+    pool->depth = depth < 1 ? DRAW_POOL_DEPTH : depth;
+    pool->list = (DrawList *)malloc(sizeof(DrawList) * pool->threads);
+    pool->stats = (DrawStats *)calloc(pool->threads, sizeof(DrawStats));
+    pool->queue = q = (TaskQueue *)malloc(sizeof(TaskQueue));
+    if (q) {
+        q->deque = (TaskDeque *)calloc(pool->threads, sizeof(TaskDeque));
+        q->thread = (pthread_t *)malloc(sizeof(pthread_t) * pool->threads);
+        q->arg = (PoolThread *)malloc(sizeof(PoolThread) * pool->threads);
+    }
+    if (!pool->list || !pool->stats || !q || !q->deque || !q->thread || !q->arg) {
+        if (q) {
+            free(q->deque);
+            free(q->thread);
+            free(q->arg);
+        }
+        free(q);
+        free(pool->stats);
+        free(pool->list);
+        free(pool);
+        return NULL;
+    }
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->wake, NULL);
+    q->pending = 0;
+    q->draws = q->busy = q->started = q->quit = 0;
+    for (i = 0; i < pool->threads; i++) {
+        drawList_init(&pool->list[i]);
+        pool->list[i].pool = pool;
+        pool->list[i].thread = i;
+    }
+    pool->VTM = NULL;
+    pool->lighting = NULL;
+    pool->src = NULL;
+
+    for (i = 1; i < pool->threads; i++) {
+        q->arg[i].pool = pool;
+        q->arg[i].thread = i;
+        if (pthread_create(&q->thread[i], NULL, poolThread, &q->arg[i])) q->arg[i].pool = NULL;
+        else q->started++;
+    }
+    return pool;
+}
+
+/* stop the pool's threads and free the pool, its draw lists and its queues. */
+void drawPool_free(DrawPool *pool) {
+    TaskQueue *q;
+    int i;
+
+    if (!pool) return;
+    q = (TaskQueue *)pool->queue;
+    pthread_mutex_lock(&q->lock);
+    q->quit = 1;
+    pthread_cond_broadcast(&q->wake);
+    pthread_mutex_unlock(&q->lock);
+    for (i = 1; i < pool->threads; i++) {
+        if (q->arg[i].pool) pthread_join(q->thread[i], NULL);
+    }
+    for (i = 0; i < pool->threads; i++) {
+        free(pool->list[i].item);
+        arena_free(&pool->list[i].arena);
+        arena_free(&pool->list[i].scratch);
+        free(q->deque[i].task);
+    }
+    pthread_mutex_destroy(&q->lock);
+    pthread_cond_destroy(&q->wake);
+    free(q->deque);
+    free(q->thread);
+    free(q->arg);
+    free(q);
+    free(pool->stats);
+    free(pool->list);
+    free(pool);
+}
+
+/**
+ * Draw md into src as module_draw would, traversing it on the pool's threads into
+ * their draw lists and then rasterizing those on the calling thread in the order
+ * module_draw would have drawn in, so the image is the same. The traversal leaves out
+ * the depth pyramid, the occlusion query, the tessellation cache and the world cache
+ * of ds, which are not shared between threads; the rasterization keeps the pyramid up
+ * to date and counts into the query. The counters of every thread's traversal are
+ * added to those of the caller.
+ */
+void drawPool_draw(DrawPool *pool, Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *lighting, Image *src) {
+    TaskQueue *q;
+    DrawList *dl;
+    DrawTask *root;
+    int i;
+
+    if (!pool || !md || !VTM || !GTM || !ds || !src) return;
+    for (i = 0; i < pool->threads; i++) drawList_clear(&pool->list[i]);
+    // the threads test bounds, which must not be made lazily by several at once
+    if (ds->frustumCull) boundsPrime(md);
+    pool->VTM = VTM;
+    pool->lighting = lighting;
+    pool->src = src;
+
+    // the root task, queued on the caller's thread like any sub-module
+    dl = &pool->list[0];
+    dl->depth = -1;
+    if (!drawList_task(dl, md, GTM, ds)) {
+        module_draw(md, VTM, GTM, ds, lighting, src);
+        return;
+    }
+    root = dl->item[0].prim.task;
+    dl->nItem = 0;
+    root->ds.hiz = NULL;
+    root->ds.query = NULL;
+    root->ds.tessCache = NULL;
+    root->ds.worldCache = NULL;
+
+    // wake the waiting threads, work alongside them and wait for the last to finish
+    q = (TaskQueue *)pool->queue;
+    pthread_mutex_lock(&q->lock);
+    q->busy = q->started;
+    q->draws++;
+    pthread_cond_broadcast(&q->wake);
+    pthread_mutex_unlock(&q->lock);
+    poolWork(pool, 0);
+    pthread_mutex_lock(&q->lock);
+    while (q->busy > 0) pthread_cond_wait(&q->wake, &q->lock);
+    pthread_mutex_unlock(&q->lock);
+    for (i = 1; i < pool->threads; i++) {
+        if (q->arg[i].pool) drawstats_add(&pool->stats[i]);
+    }
+
+    drawItems(&root->list->item[root->first], root->count, ds, src, &pool->list[0].scratch);
+    // module_draw leaves the top level's colors in ds
+    ds->color = root->ds.color;
+    ds->body = root->ds.body;
+    ds->surface = root->ds.surface;
+    ds->surfaceCoeff = root->ds.surfaceCoeff;
+    ds->flatColor = root->ds.flatColor;
+}
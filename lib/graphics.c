@@ -399,20 +399,50 @@ void matrix_transpose(Matrix *m)
 }
 
 /***
- * Multiply left and right and put the result in m.
+ * Multiply left and right and put the result in m, which may be left or right.
  */
 void matrix_multiply(Matrix *left, Matrix *right, Matrix *m)
 {
-	Matrix tmpL, tmpR;
-	matrix_copy(&tmpL, left);
-	matrix_copy(&tmpR, right);
+	Matrix tmp;
 	for (int i = 0; i < 4; i++)
 	{
 		for (int j = 0; j < 4; j++)
 		{
-			m->m[i][j] = tmpL.m[i][0] * tmpR.m[0][j] + tmpL.m[i][1] * tmpR.m[1][j] + tmpL.m[i][2] * tmpR.m[2][j] + tmpL.m[i][3] * tmpR.m[3][j];
+			tmp.m[i][j] = left->m[i][0] * right->m[0][j] + left->m[i][1] * right->m[1][j] + left->m[i][2] * right->m[2][j] + left->m[i][3] * right->m[3][j];
 		}
 	}
+	*m = tmp;
+}
+
+/***
+ * Put in n the matrix that carries surface normals through m: the transpose of the
+ * inverse of m's upper 3x3, computed as its cofactor matrix with the sign of the
+ * determinant. Unlike m itself it keeps normals perpendicular to their surfaces
+ * under non-uniform scales and shears. Its scale is arbitrary, so the normals it
+ * produces still need normalizing.
+ */
+void matrix_normal(Matrix *m, Matrix *n)
+{
+	double a[3][3], det;
+	for (int i = 0; i < 3; i++)
+		for (int j = 0; j < 3; j++)
+			a[i][j] = m->m[i][j];
+	matrix_identity(n);
+	for (int i = 0; i < 3; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			int r0 = (i + 1) % 3, r1 = (i + 2) % 3, c0 = (j + 1) % 3, c1 = (j + 2) % 3;
+			n->m[i][j] = a[r0][c0] * a[r1][c1] - a[r0][c1] * a[r1][c0];
+		}
+	}
+	det = a[0][0] * n->m[0][0] + a[0][1] * n->m[0][1] + a[0][2] * n->m[0][2];
+	if (det < 0)
+	{
+		for (int i = 0; i < 3; i++)
+			for (int j = 0; j < 3; j++)
+				n->m[i][j] = -n->m[i][j];
+	}
 }
 
 /***
@@ -527,18 +557,22 @@ void matrix_xformCircle(Matrix *m, Circle *c, double scale) {
 	c->r *= scale;
 }
 
+/*
+	The builders below premultiply in place. Each one only touches the rows its
+	matrix changes, and gives the same result as building the full 4x4 matrix
+	and calling matrix_multiply.
+ */
+
 /***
  * Premultiply the matrix by a scale matrix parameterized by sx and sy .
  */
 void matrix_scale2D(Matrix *m, double sx, double sy)
 {
-	Matrix S;
- 
-  matrix_identity(&S);
-  S.m[0][0] = sx;
-  S.m[1][1] = sy;
- 
-  matrix_multiply(&S, m, m);
+	for (int j = 0; j < 4; j++)
+	{
+		m->m[0][j] = sx * m->m[0][j];
+		m->m[1][j] = sy * m->m[1][j];
+	}
 }
 
 /***
@@ -547,16 +581,12 @@ void matrix_scale2D(Matrix *m, double sx, double sy)
  */
 void matrix_rotateZ(Matrix *m, double cth, double sth)
 {
-	Matrix r, tmp;
-	matrix_clear(&r);
-	matrix_copy(&tmp, m);
-	matrix_set(&r, 0, 0, cth);
-	matrix_set(&r, 0, 1, -sth);
-	matrix_set(&r, 1, 0, sth);
-	matrix_set(&r, 1, 1, cth);
-	matrix_set(&r, 2, 2, 1);
-	matrix_set(&r, 3, 3, 1);
-	matrix_multiply(&r, &tmp, m);
+	for (int j = 0; j < 4; j++)
+	{
+		double r0 = m->m[0][j], r1 = m->m[1][j];
+		m->m[0][j] = cth * r0 - sth * r1;
+		m->m[1][j] = sth * r0 + cth * r1;
+	}
 }
 
 /***
@@ -564,12 +594,11 @@ void matrix_rotateZ(Matrix *m, double cth, double sth)
  */
 void matrix_translate2D(Matrix *m, double tx, double ty)
 {
-	Matrix t, tmp;
-	matrix_identity(&t);
-	matrix_copy(&tmp, m);
-	matrix_set(&t, 0, 3, tx);
-	matrix_set(&t, 1, 3, ty);
-	matrix_multiply(&t, &tmp, m);
+	for (int j = 0; j < 4; j++)
+	{
+		m->m[0][j] = m->m[0][j] + tx * m->m[3][j];
+		m->m[1][j] = m->m[1][j] + ty * m->m[3][j];
+	}
 }
 
 /***
@@ -577,12 +606,12 @@ void matrix_translate2D(Matrix *m, double tx, double ty)
  */
 void matrix_shear2D(Matrix *m, double shx, double shy)
 {
-	Matrix sh, tmp;
-	matrix_identity(&sh);
-	matrix_copy(&tmp, m);
-	matrix_set(&sh, 0, 1, shx);
-	matrix_set(&sh, 1, 0, shy);
-	matrix_multiply(&sh, &tmp, m);
+	for (int j = 0; j < 4; j++)
+	{
+		double r0 = m->m[0][j], r1 = m->m[1][j];
+		m->m[0][j] = r0 + shx * r1;
+		m->m[1][j] = shy * r0 + r1;
+	}
 }
 
 /* 3D Matrix functions */
@@ -592,13 +621,12 @@ void matrix_shear2D(Matrix *m, double shx, double shy)
  */
 void matrix_translate(Matrix *m, double tx, double ty, double tz)
 {
-	Matrix t, tmp;
-	matrix_identity(&t);
-	matrix_copy(&tmp, m);
-	matrix_set(&t, 0, 3, tx);
-	matrix_set(&t, 1, 3, ty);
-	matrix_set(&t, 2, 3, tz);
-	matrix_multiply(&t, &tmp, m);
+	for (int j = 0; j < 4; j++)
+	{
+		m->m[0][j] = m->m[0][j] + tx * m->m[3][j];
+		m->m[1][j] = m->m[1][j] + ty * m->m[3][j];
+		m->m[2][j] = m->m[2][j] + tz * m->m[3][j];
+	}
 }
 
 /***
@@ -606,14 +634,12 @@ void matrix_translate(Matrix *m, double tx, double ty, double tz)
  */
 void matrix_scale(Matrix *m, double sx, double sy, double sz)
 {
-	Matrix s, tmp;
-	matrix_clear(&s);
-	matrix_copy(&tmp, m);
-	matrix_set(&s, 0, 0, sx);
-	matrix_set(&s, 1, 1, sy);
-	matrix_set(&s, 2, 2, sz);
-	matrix_set(&s, 3, 3, 1);
-	matrix_multiply(&s, &tmp, m);
+	for (int j = 0; j < 4; j++)
+	{
+		m->m[0][j] = sx * m->m[0][j];
+		m->m[1][j] = sy * m->m[1][j];
+		m->m[2][j] = sz * m->m[2][j];
+	}
 }
 
 /***
@@ -622,16 +648,12 @@ void matrix_scale(Matrix *m, double sx, double sy, double sz)
  */
 void matrix_rotateX(Matrix *m, double cth, double sth)
 {
-	Matrix r, tmp;
-	matrix_clear(&r);
-	matrix_copy(&tmp, m);
-	matrix_set(&r, 0, 0, 1);
-	matrix_set(&r, 1, 1, cth);
-	matrix_set(&r, 1, 2, -sth);
-	matrix_set(&r, 2, 1, sth);
-	matrix_set(&r, 2, 2, cth);
-	matrix_set(&r, 3, 3, 1);
-	matrix_multiply(&r, &tmp, m);
+	for (int j = 0; j < 4; j++)
+	{
+		double r1 = m->m[1][j], r2 = m->m[2][j];
+		m->m[1][j] = cth * r1 - sth * r2;
+		m->m[2][j] = sth * r1 + cth * r2;
+	}
 }
 
 /***
@@ -640,16 +662,12 @@ void matrix_rotateX(Matrix *m, double cth, double sth)
  */
 void matrix_rotateY(Matrix *m, double cth, double sth)
 {
-	Matrix r, tmp;
-	matrix_clear(&r);
-	matrix_copy(&tmp, m);
-	matrix_set(&r, 0, 0, cth);
-	matrix_set(&r, 0, 2, sth);
-	matrix_set(&r, 1, 1, 1);
-	matrix_set(&r, 2, 0, -sth);
-	matrix_set(&r, 2, 2, cth);
-	matrix_set(&r, 3, 3, 1);
-	matrix_multiply(&r, &tmp, m);
+	for (int j = 0; j < 4; j++)
+	{
+		double r0 = m->m[0][j], r2 = m->m[2][j];
+		m->m[0][j] = cth * r0 + sth * r2;
+		m->m[2][j] = -sth * r0 + cth * r2;
+	}
 }
 
 /***
@@ -658,20 +676,13 @@ void matrix_rotateY(Matrix *m, double cth, double sth)
  */
 void matrix_rotateXYZ(Matrix *m, Vector *u, Vector *v, Vector *w)
 {
-	Matrix r, tmp;
-	matrix_clear(&r);
-	matrix_copy(&tmp, m);
-	matrix_set(&r, 0, 0, u->val[0]);
-	matrix_set(&r, 0, 1, u->val[1]);
-	matrix_set(&r, 0, 2, u->val[2]);
-	matrix_set(&r, 1, 0, v->val[0]);
-	matrix_set(&r, 1, 1, v->val[1]);
-	matrix_set(&r, 1, 2, v->val[2]);
-	matrix_set(&r, 2, 0, w->val[0]);
-	matrix_set(&r, 2, 1, w->val[1]);
-	matrix_set(&r, 2, 2, w->val[2]);
-	matrix_set(&r, 3, 3, 1);
-	matrix_multiply(&r, &tmp, m);
+	for (int j = 0; j < 4; j++)
+	{
+		double r0 = m->m[0][j], r1 = m->m[1][j], r2 = m->m[2][j];
+		m->m[0][j] = u->val[0] * r0 + u->val[1] * r1 + u->val[2] * r2;
+		m->m[1][j] = v->val[0] * r0 + v->val[1] * r1 + v->val[2] * r2;
+		m->m[2][j] = w->val[0] * r0 + w->val[1] * r1 + w->val[2] * r2;
+	}
 }
 
 /***
@@ -679,12 +690,11 @@ void matrix_rotateXYZ(Matrix *m, Vector *u, Vector *v, Vector *w)
  */
 void matrix_shearZ(Matrix *m, double shx, double shy)
 {
-	Matrix sh, tmp;
-	matrix_identity(&sh);
-	matrix_copy(&tmp, m);
-	matrix_set(&sh, 0, 2, shx);
-	matrix_set(&sh, 1, 2, shy);
-	matrix_multiply(&sh, &tmp, m);
+	for (int j = 0; j < 4; j++)
+	{
+		m->m[0][j] = m->m[0][j] + shx * m->m[2][j];
+		m->m[1][j] = m->m[1][j] + shy * m->m[2][j];
+	}
 }
 
 /***
@@ -692,11 +702,10 @@ void matrix_shearZ(Matrix *m, double shx, double shy)
  */
 void matrix_perspective(Matrix *m, double d)
 {
-	Matrix pers;
-	matrix_identity(&pers);
-	pers.m[3][2] = 1/d;
-	pers.m[3][3] = 0.0;
-	matrix_multiply(&pers, m, m);
+	for (int j = 0; j < 4; j++)
+	{
+		m->m[3][j] = (1 / d) * m->m[2][j];
+	}
 }
 
 /* 2D Viewing */
@@ -735,30 +744,16 @@ void matrix_setView3D(Matrix *vtm, View3D *view)
 	vector_cross(&view->vup, &view->vpn, &u); // calculate u vector
 	vector_cross(&view->vpn, &u, &view->vup); // recalcula vup vector
 	matrix_translate(vtm, -view->vrp.val[0], -view->vrp.val[1], -view->vrp.val[2]); // translate vrp to origin
-	printf("After VRP translation\n");
-	matrix_print(vtm, stdout);
 	vector_normalize(&u);
 	vector_normalize(&view->vpn);
 	vector_normalize(&view->vup);
 	matrix_rotateXYZ(vtm, &u, &view->vup, &view->vpn); // orient view coordinate
-	printf("After Rxyz\n");
-	matrix_print(vtm, stdout);
 	matrix_translate(vtm, 0, 0, view->d); // move center of projection to origin
-	printf("After translating center of projection to origin\n");
-	matrix_print(vtm, stdout);
 	matrix_scale(vtm, (2 * view->d) / ((view->d + view->b) * view->du), (2 * view->d) / ((view->d + view->b) * view->dv), 1 / (view->d + view->b)); // scale to canonical view volume
-	printf("After scaling to canonical view volume\n");
-	matrix_print(vtm, stdout);
 	matrix_perspective(vtm, view->d / (view->d + view->b));
-	printf("After perspective\n");
-	matrix_print(vtm, stdout);
 	dprime = view->d / (view->d + view->b);
-	matrix_scale(vtm, -view->screenx/(2*dprime), -view->screeny/(2*dprime), 1.0);
-	printf("After scaling to screen\n");
-	matrix_print(vtm, stdout);
-	matrix_translate2D(vtm, view->screenx/2, view->screeny/2);
-	printf("After translating to screen\n");
-	matrix_print(vtm, stdout);
+	matrix_scale(vtm, -view->screenx/(2*dprime), -view->screeny/(2*dprime), 1.0); // scale to screen
+	matrix_translate2D(vtm, view->screenx/2, view->screeny/2); // translate to screen
 }
 
 /* DrawState Functions */
@@ -766,6 +761,12 @@ void matrix_setView3D(Matrix *vtm, View3D *view)
 /* create a new DrawState structure and initialize the fields. */
 DrawState *drawstate_create( void ) {
 	DrawState *ds = (DrawState *)malloc(sizeof(DrawState));
+    drawstate_init(ds);
+    return ds;
+}
+
+/* initialize the fields of an existing DrawState to the defaults. */
+void drawstate_init( DrawState *ds ) {
     if (ds) {
         // Initialize with default values
         ds->color = (Color){{1.0, 1.0, 1.0}}; 
@@ -776,8 +777,15 @@ DrawState *drawstate_create( void ) {
         ds->shade = ShadeFrame;  // Default to frame shading
         ds->zBufferFlag = 1;  // Enable z-buffer by default
         ds->viewer = (Point){{0.0, 0.0, 0.0, 1.0}};  // Viewer at origin
+        ds->hiz = NULL;  // No occlusion culling by default
+        ds->query = NULL;  // No occlusion query by default
+        ds->vertexCacheSize = 0;  // Cache every mesh vertex by default
+        ds->tessCache = NULL;  // Tessellate Bezier patches every draw by default
+        ds->worldCache = NULL;  // Transform lit geometry to world space every draw by default
+        ds->scratch = NULL;  // Draw through the library's scratch memory by default
+        ds->frustumCull = 1;  // Skip sub-modules outside the view volume by default
+        ds->drawList = NULL;  // Draw primitives as they are reached by default
     }
-    return ds;
 }
 
 /* set the color field to c. */
@@ -815,6 +823,11 @@ void drawstate_setShade( DrawState *ds, ShadeMethod s ) {
 	}
 }
 
+/* set the shade field to s, the same as drawstate_setShade. */
+void drawstate_setShading( DrawState *ds, ShadeMethod s ) {
+	drawstate_setShade(ds, s);
+}
+
 /* set the viewer field to v. */
 void drawstate_setViewer( DrawState *ds, Point *v ) {
 	if (ds) {
@@ -0,0 +1,195 @@
+/***
+ * written by - Jiafeng
+ *
+ * hierarchical z-buffer (depth pyramid) apis
+ */
+
+#include <string.h>
+#include "graphics.h"
+
+// relative slack on the occlusion test so a surface is never hidden by its own depth
+#define HIZ_EPSILON (1e-5)
+
+/* Depth Pyramid Functions */
+
+/**
+ * allocate a depth pyramid over the depth plane of src with level 0 tiles of
+ * tile x tile pixels. Each level halves the number of tiles in both directions
+ * until a single tile covers the image. Every tile starts out dirty.
+ * Returns NULL if the allocation fails.
+ */
+DepthPyramid *depthPyramid_create(Image *src, int tile) {
+    DepthPyramid *hiz;
+    int level, n;
+
+    if (!src || !src->depth || tile <= 0) return NULL;
+    hiz = (DepthPyramid *)malloc(sizeof(DepthPyramid));
+    if (!hiz) return NULL;
+    hiz->src = src;
+    hiz->tile = tile;
+    hiz->cols[0] = (src->cols + tile - 1) / tile;
+    hiz->rows[0] = (src->rows + tile - 1) / tile;
+    for (level = 0; level < HIZ_MAX_LEVELS; level++) {
+        hiz->zmin[level] = hiz->zmax[level] = NULL;
+        hiz->dirty[level] = NULL;
+    }
+    for (level = 0; level < HIZ_MAX_LEVELS; level++) {
+        if (level > 0) {
+            hiz->cols[level] = (hiz->cols[level - 1] + 1) / 2;
+            hiz->rows[level] = (hiz->rows[level - 1] + 1) / 2;
+        }
+        n = hiz->cols[level] * hiz->rows[level];
+        hiz->zmin[level] = (float *)malloc(sizeof(float) * n);
+        hiz->zmax[level] = (float *)malloc(sizeof(float) * n);
+        hiz->dirty[level] = (unsigned char *)malloc(n);
+        if (!hiz->zmin[level] || !hiz->zmax[level] || !hiz->dirty[level]) {
+            hiz->levels = level + 1;
+            depthPyramid_free(hiz);
+            return NULL;
+        }
+        memset(hiz->dirty[level], 1, n);
+        hiz->levels = level + 1;
+        if (n == 1) break;
+    }
+    return hiz;
+}
+
+/* free the depth pyramid, but not the image it summarizes. */
+void depthPyramid_free(DepthPyramid *hiz) {
+    int level;
+    if (!hiz) return;
+    for (level = 0; level < hiz->levels; level++) {
+        free(hiz->zmin[level]);
+        free(hiz->zmax[level]);
+        free(hiz->dirty[level]);
+    }
+    free(hiz);
+}
+
+/* mark every tile dirty, call after clearing or rewriting the whole depth plane. */
+void depthPyramid_reset(DepthPyramid *hiz) {
+    int level;
+    if (!hiz) return;
+    for (level = 0; level < hiz->levels; level++) {
+        memset(hiz->dirty[level], 1, hiz->cols[level] * hiz->rows[level]);
+    }
+}
+
+/**
+ * mark the tiles touching the screen rectangle [x0, x1] x [y0, y1] dirty at every level,
+ * call after drawing into that part of the depth plane.
+ */
+void depthPyramid_markDirty(DepthPyramid *hiz, float x0, float y0, float x1, float y1) {
+    int level, c0, c1, r0, r1, r, span = hiz->tile;
+
+    if (x1 < 0 || y1 < 0 || x0 >= hiz->src->cols || y0 >= hiz->src->rows) return;
+    if (x0 < 0) x0 = 0;
+    if (y0 < 0) y0 = 0;
+    for (level = 0; level < hiz->levels; level++, span *= 2) {
+        c0 = (int)x0 / span;
+        r0 = (int)y0 / span;
+        c1 = (int)x1 / span;
+        r1 = (int)y1 / span;
+        if (c1 >= hiz->cols[level]) c1 = hiz->cols[level] - 1;
+        if (r1 >= hiz->rows[level]) r1 = hiz->rows[level] - 1;
+        for (r = r0; r <= r1; r++) {
+            memset(&hiz->dirty[level][r * hiz->cols[level] + c0], 1, c1 - c0 + 1);
+        }
+    }
+}
+
+/*
+    Bring tile (r, c) of the given level up to date, from the depth plane at
+    level 0 and from the four child tiles above that.
+ */
+static void refreshTile(DepthPyramid *hiz, int level, int r, int c) {
+    int i = r * hiz->cols[level] + c;
+    float lo = HUGE_VALF, hi = -HUGE_VALF;
+
+    if (!hiz->dirty[level][i]) return;
+    if (level == 0) {
+        int row, col;
+        int r0 = r * hiz->tile, r1 = r0 + hiz->tile, c0 = c * hiz->tile, c1 = c0 + hiz->tile;
+        if (r1 > hiz->src->rows) r1 = hiz->src->rows;
+        if (c1 > hiz->src->cols) c1 = hiz->src->cols;
+        for (row = r0; row < r1; row++) {
+            float *z = hiz->src->depth[row];
+            for (col = c0; col < c1; col++) {
+                lo = z[col] < lo ? z[col] : lo;
+                hi = z[col] > hi ? z[col] : hi;
+            }
+        }
+    } else {
+        int dr, dc;
+        for (dr = 0; dr < 2; dr++) {
+            for (dc = 0; dc < 2; dc++) {
+                int cr = 2 * r + dr, cc = 2 * c + dc, j;
+                if (cr >= hiz->rows[level - 1] || cc >= hiz->cols[level - 1]) continue;
+                refreshTile(hiz, level - 1, cr, cc);
+                j = cr * hiz->cols[level - 1] + cc;
+                if (hiz->zmin[level - 1][j] < lo) lo = hiz->zmin[level - 1][j];
+                if (hiz->zmax[level - 1][j] > hi) hi = hiz->zmax[level - 1][j];
+            }
+        }
+    }
+    hiz->zmin[level][i] = lo;
+    hiz->zmax[level][i] = hi;
+    hiz->dirty[level][i] = 0;
+}
+
+/*
+    Recursive part of depthPyramid_occluded, tests tile (r, c) of the level and
+    descends into the children overlapping the rectangle when the tile alone
+    cannot prove the occlusion.
+ */
+static int tileOccluded(DepthPyramid *hiz, int level, int r, int c, int x0, int y0, int x1, int y1, float zNear) {
+    int dr, dc, span;
+
+    refreshTile(hiz, level, r, c);
+    if (zNear < hiz->zmin[level][r * hiz->cols[level] + c] * (1 - HIZ_EPSILON)) return 1;
+    if (level == 0) return 0;
+
+    span = hiz->tile << (level - 1);
+    for (dr = 0; dr < 2; dr++) {
+        for (dc = 0; dc < 2; dc++) {
+            int cr = 2 * r + dr, cc = 2 * c + dc;
+            if (cr >= hiz->rows[level - 1] || cc >= hiz->cols[level - 1]) continue;
+            if ((cc + 1) * span <= x0 || cc * span > x1 || (cr + 1) * span <= y0 || cr * span > y1) continue;
+            if (!tileOccluded(hiz, level - 1, cr, cc, x0, y0, x1, y1, zNear)) return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * conservative occlusion test of a screen rectangle [x0, x1] x [y0, y1] whose nearest
+ * point has depth zNear (1/z). Returns 1 only if every pixel of the rectangle already
+ * holds something nearer, so anything inside the rectangle can be skipped.
+ * Starts at the coarsest level whose tiles cover the rectangle with at most 2x2 tiles
+ * and descends only where a coarse tile cannot decide.
+ */
+int depthPyramid_occluded(DepthPyramid *hiz, float x0, float y0, float x1, float y1, float zNear) {
+    int level, span, r, c, r0, r1, c0, c1;
+    int ix0, iy0, ix1, iy1;
+
+    if (!hiz || zNear <= 0) return 0;
+    if (x1 < 0 || y1 < 0 || x0 >= hiz->src->cols || y0 >= hiz->src->rows) return 0;
+    ix0 = x0 < 0 ? 0 : (int)x0;
+    iy0 = y0 < 0 ? 0 : (int)y0;
+    ix1 = x1 >= hiz->src->cols ? hiz->src->cols - 1 : (int)x1;
+    iy1 = y1 >= hiz->src->rows ? hiz->src->rows - 1 : (int)y1;
+
+    for (level = 0, span = hiz->tile; level < hiz->levels - 1; level++, span *= 2) {
+        if (ix1 / span - ix0 / span <= 1 && iy1 / span - iy0 / span <= 1) break;
+    }
+    r0 = iy0 / span;
+    r1 = iy1 / span;
+    c0 = ix0 / span;
+    c1 = ix1 / span;
+    for (r = r0; r <= r1; r++) {
+        for (c = c0; c <= c1; c++) {
+            if (!tileOccluded(hiz, level, r, c, ix0, iy0, ix1, iy1, zNear)) return 0;
+        }
+    }
+    return 1;
+}
@@ -108,6 +108,43 @@ Image *image_create(int rows, int cols)
     return image;
 }
 
+/***
+ * Allocates an Image structure that only has a depth plane, for depth-only rendering.
+ * The data and alpha fields are NULL and every depth value starts at 0.0 (infinitely far).
+ * Returns a NULL pointer if the operation fails.
+ */
+Image *image_createDepth(int rows, int cols)
+{
+    int r;
+
+    Image *image = (Image *)malloc(sizeof(Image));
+    if (image == NULL) return NULL;
+    image->rows = rows;
+    image->cols = cols;
+    image->data = NULL;
+    image->alpha = NULL;
+    image->depth = (float **)malloc(sizeof(float *) * rows);
+    if (image->depth == NULL)
+    {
+        free(image);
+        return NULL;
+    }
+    image->depth[0] = (float *)calloc(rows * cols, sizeof(float));
+    if (image->depth[0] == NULL)
+    {
+        free(image->depth);
+        free(image);
+        return NULL;
+    }
+    for (r = 0; r < rows; r++)
+    {
+        image->depth[r] = &(image->depth[0][r * cols]);
+    }
+    image->maxval.rgb[0] = image->maxval.rgb[1] = image->maxval.rgb[2] = 0.0;
+    image->filename = NULL;
+    return image;
+}
+
 /***
  * de-allocates image data and frees the Image structure.
  */
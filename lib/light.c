@@ -22,9 +22,10 @@ void light_init(Light *l) {
     l->position = p;
     l->cutoff = 0.0;
     l->sharpness = 0.0;
+    l->shadow = NULL;
 }
 
-/* Copy the contents of one light to another light */
+/* Copy the contents of one light to another light, the shadow map stays with its own light */
 void light_copy(Light *to, Light *from) {
     to->type = from->type;
     color_copy(&to->color, &from->color);
@@ -32,6 +33,7 @@ void light_copy(Light *to, Light *from) {
     point_copy(&to->position, &from->position);
     to->cutoff = from->cutoff;
     to->sharpness = from->sharpness;
+    if (to->shadow) to->shadow->valid = 0;
 }
 
 /* Lighting Functions */
@@ -46,8 +48,10 @@ Lighting *lighting_create( void ) {
     return l;
 }
 
-/* delete the lighting structure. */
+/* delete the lighting structure and its shadow maps. */
 void lighting_delete(Lighting *lights) {
+    if (!lights) return;
+    lighting_clear(lights);
     free(lights);
 }
 
@@ -57,8 +61,13 @@ void lighting_init(Lighting *l) {
     light_init(&l->light[0]);
 }
 
-/*  reset the Lighting struct to 0 lights */
+/*  reset the Lighting struct to 0 lights, freeing their shadow maps */
 void lighting_clear(Lighting *l) {
+    int i;
+    for (i = 0; i < l->nLights; i++) {
+        shadowMap_free(l->light[i].shadow);
+        l->light[i].shadow = NULL;
+    }
     l->nLights = 0;
     light_init(&l->light[0]);
 }
@@ -76,10 +85,43 @@ void lighting_add(Lighting *l, LightType type, Color *c, Vector *d, Point *pos,
         point_copy(&l->light[l->nLights].position, pos);
         l->light[l->nLights].cutoff = cutoff;
         l->light[l->nLights].sharpness = sharpness;
+        l->light[l->nLights].shadow = NULL;
         l->nLights++;
     }
 }
 
+/**
+ * make light index cast shadows using a shadow map of size x size pixels per face.
+ * Point lights get a six face cube map, spot and directional lights a single face.
+ * A size of 0 turns shadows off for the light.
+ */
+void lighting_setShadow(Lighting *l, int index, int size) {
+    Light *light;
+    if (!l || index < 0 || index >= l->nLights) return;
+    light = &l->light[index];
+    shadowMap_free(light->shadow);
+    light->shadow = NULL;
+    if (size <= 0 || light->type == LightNone || light->type == LightAmbient) return;
+    light->shadow = shadowMap_create(light->type == LightPoint ? 6 : 1, size);
+}
+
+/**
+ * bring the shadow maps of all shadow-casting lights up to date with the module graph md
+ * drawn with global transform GTM. A map is only re-rendered when its light or the
+ * geometry changed since it was last rendered. Returns the number of maps rendered.
+ */
+int lighting_updateShadows(Lighting *l, Module *md, Matrix *GTM) {
+    int i, rendered = 0;
+    if (!l || !md || !GTM) return 0;
+    for (i = 0; i < l->nLights; i++) {
+        Light *light = &l->light[i];
+        if (!light->shadow || shadowMap_current(light->shadow, light, md, GTM)) continue;
+        shadowMap_render(light->shadow, light, md, GTM);
+        rendered++;
+    }
+    return rendered;
+}
+
 /**
  * calculate the proper color given the normal N, view vector V, 3D point P, 
  * body color Cb, surface color Cs, 
@@ -88,6 +130,20 @@ void lighting_add(Lighting *l, LightType type, Color *c, Vector *d, Point *pos,
  * Put the result in the Color c
  */
 void lighting_shading(Lighting *l, Vector *N, Vector *V, Point *p, Color *Cb, Color *Cs, float s, int oneSided, Color *c) {
+    if (l->nLights == 0) {
+        color_copy(c, Cb);
+    } else {
+        vector_normalize(V);
+        vector_normalize(N);
+        lighting_shadingUnit(l, N, V, p, Cb, Cs, s, oneSided, c);
+    }
+}
+
+/**
+ * same as lighting_shading, for a normal N and view vector V that are already unit
+ * length, so neither is normalized again.
+ */
+void lighting_shadingUnit(Lighting *l, Vector *N, Vector *V, Point *p, Color *Cb, Color *Cs, float s, int oneSided, Color *c) {
     if (l->nLights == 0) {
         color_copy(c, Cb);
     } else {
@@ -95,8 +151,6 @@ void lighting_shading(Lighting *l, Vector *N, Vector *V, Point *p, Color *Cb, Co
         int i;
         Color C;
         Vector L;
-        vector_normalize(V);
-        vector_normalize(N);
         color_set(&C, 0.0, 0.0, 0.0);
         for (i = 0; i < l->nLights; i++) {
             switch (l->light[i].type) {
@@ -132,6 +186,12 @@ void lighting_shading(Lighting *l, Vector *N, Vector *V, Point *p, Color *Cb, Co
             double sigma = vector_dot(V, N);
             // if it is two-sided, and light source is facing away from the viewer, skip
             if ((theta<0 && sigma>0) || (theta>0 && sigma<0)) continue;
+            // fraction of the light reaching p, from the shadow map
+            double visible = 1.0;
+            if (l->light[i].shadow) {
+                visible = shadowMap_lookup(l->light[i].shadow, p);
+                if (visible <= 0.0) continue;
+            }
             Vector H;
             vector_set(&H, (L.val[0]+V->val[0])/2, (L.val[1]+V->val[1])/2, (L.val[2]+V->val[2])/2);
             vector_normalize(&H);
@@ -140,21 +200,11 @@ void lighting_shading(Lighting *l, Vector *N, Vector *V, Point *p, Color *Cb, Co
                 beta = -beta;
                 theta = -theta;
             }
-            fprintf(stdout, "H: ");
-            vector_print(&H, stdout);
-            fprintf(stdout, "L * N: %f   beta: %f \n", theta, beta);
-            vector_print(&L, stdout);
-            vector_print(N, stdout);
-            fprintf(stdout, "Gouraud Shade: %f, %f, %f\n", 
-                l->light[i].color.c[0] * (Cb->c[0] * theta + Cs->c[0] * pow(beta, s)),
-                l->light[i].color.c[1] * (Cb->c[1] * theta + Cs->c[1] * pow(beta, s)),
-                l->light[i].color.c[2] * (Cb->c[2] * theta + Cs->c[2] * pow(beta, s))
-            );
             color_set(
                 &C,
-                C.c[0] + l->light[i].color.c[0] * (Cb->c[0] * theta + Cs->c[0] * pow(beta, s)), 
-                C.c[1] + l->light[i].color.c[1] * (Cb->c[1] * theta + Cs->c[1] * pow(beta, s)), 
-                C.c[2] + l->light[i].color.c[2] * (Cb->c[2] * theta + Cs->c[2] * pow(beta, s))
+                C.c[0] + visible * l->light[i].color.c[0] * (Cb->c[0] * theta + Cs->c[0] * pow(beta, s)), 
+                C.c[1] + visible * l->light[i].color.c[1] * (Cb->c[1] * theta + Cs->c[1] * pow(beta, s)), 
+                C.c[2] + visible * l->light[i].color.c[2] * (Cb->c[2] * theta + Cs->c[2] * pow(beta, s))
             );
         }
         color_copy(c, &C);
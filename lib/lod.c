@@ -0,0 +1,549 @@
+/***
+ * written by - Jiafeng
+ *
+ * level of detail apis, quadric error metric simplification (Garland and Heckbert)
+ * and chains of reduced meshes picked by their size on the screen
+ */
+
+#include <string.h>
+#include "graphics.h"
+
+// weight of the planes that hold boundary edges in place, relative to the face planes
+#define QEM_BOUNDARY_WEIGHT 1000.0
+// faces whose normal turns by more than this (cosine) in a collapse veto it
+#define QEM_FLIP_COS 0.2
+// default screen area in pixels a face of the chosen level should cover
+#define LOD_FACE_PIXELS 16.0f
+
+// symmetric 4x4 quadric, stored as its upper triangle a2 ab ac ad b2 bc bd c2 cd d2
+typedef struct {
+    double q[10];
+} Quadric;
+
+// candidate collapse of the edge a b to p, valid while both vertices keep their versions
+typedef struct {
+    double cost;
+    int a, b;
+    int versionA, versionB;
+    float p[3];
+} QemPair;
+
+// position of a vertex with its index, sorted to weld vertices that coincide
+typedef struct {
+    float x, y, z;
+    int i;
+} QemWeld;
+
+// working state of a simplification
+typedef struct {
+    int nVertex; // welded vertices
+    Point *pos; // position of each welded vertex
+    Color *color; // color of each welded vertex, NULL if the model has none
+    Quadric *quadric; // error quadric of each welded vertex
+    int *version; // bumped whenever a vertex moves, 0 once it is collapsed away
+    int **vf; // triangles using each vertex, including dead ones
+    int *vfCount; // length of each list in vf
+    int *vfCap; // capacity of each list in vf
+    int nTri; // triangles
+    int liveTri; // triangles not yet collapsed away
+    int *tri; // three welded vertices per triangle
+    unsigned char *dead; // whether each triangle has been collapsed away
+    QemPair *heap; // min-heap of candidate collapses on cost
+    int nHeap, heapCap;
+    int normals; // whether the model has normals, so the reduced meshes get them
+} Qem;
+
+/* add the plane n . x + d = 0 with weight w to q. */
+static void quadricAddPlane(Quadric *q, double *n, double d, double w) {
+    q->q[0] += w * n[0] * n[0];
+    q->q[1] += w * n[0] * n[1];
+    q->q[2] += w * n[0] * n[2];
+    q->q[3] += w * n[0] * d;
+    q->q[4] += w * n[1] * n[1];
+    q->q[5] += w * n[1] * n[2];
+    q->q[6] += w * n[1] * d;
+    q->q[7] += w * n[2] * n[2];
+    q->q[8] += w * n[2] * d;
+    q->q[9] += w * d * d;
+}
+
+/* squared distance error of the point x y z under q. */
+static double quadricError(Quadric *q, double x, double y, double z) {
+    double *a = q->q;
+    return a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x
+         + a[4] * y * y + 2 * a[5] * y * z + 2 * a[6] * y
+         + a[7] * z * z + 2 * a[8] * z + a[9];
+}
+
+/* unnormalized normal (b - a) x (c - a) of a triangle. */
+static void triNormal(float *a, float *b, float *c, double *n) {
+    double ux = b[0] - a[0], uy = b[1] - a[1], uz = b[2] - a[2];
+    double vx = c[0] - a[0], vy = c[1] - a[1], vz = c[2] - a[2];
+    n[0] = uy * vz - uz * vy;
+    n[1] = uz * vx - ux * vz;
+    n[2] = ux * vy - uy * vx;
+}
+
+static int weldCompare(const void *a, const void *b) {
+    const QemWeld *p = a, *q = b;
+    if (p->x != q->x) return p->x < q->x ? -1 : 1;
+    if (p->y != q->y) return p->y < q->y ? -1 : 1;
+    if (p->z != q->z) return p->z < q->z ? -1 : 1;
+    return p->i - q->i;
+}
+
+static int edgeCompare(const void *a, const void *b) {
+    const int *p = a, *q = b;
+    if (p[0] != q[0]) return p[0] - q[0];
+    return p[1] - q[1];
+}
+
+/* add triangle t to the list of vertex v. Returns 0 if the list cannot grow. */
+static int qemAddFace(Qem *s, int v, int t) {
+    if (s->vfCount[v] == s->vfCap[v]) {
+        int cap = s->vfCap[v] ? 2 * s->vfCap[v] : 8;
+        int *grown = realloc(s->vf[v], sizeof(int) * cap);
+        if (!grown) return 0;
+        s->vf[v] = grown;
+        s->vfCap[v] = cap;
+    }
+    s->vf[v][s->vfCount[v]++] = t;
+    return 1;
+}
+
+/* free the working state. */
+static void qemFree(Qem *s) {
+    int i;
+    if (s->vf) {
+        for (i = 0; i < s->nVertex; i++) free(s->vf[i]);
+    }
+    free(s->pos);
+    free(s->color);
+    free(s->quadric);
+    free(s->version);
+    free(s->vf);
+    free(s->vfCount);
+    free(s->vfCap);
+    free(s->tri);
+    free(s->dead);
+    free(s->heap);
+}
+
+/* push a candidate collapse onto the heap. */
+static void heapPush(Qem *s, QemPair *p) {
+    int i, parent;
+    if (s->nHeap == s->heapCap) {
+        int cap = s->heapCap ? 2 * s->heapCap : 256;
+        QemPair *grown = realloc(s->heap, sizeof(QemPair) * cap);
+        if (!grown) return;
+        s->heap = grown;
+        s->heapCap = cap;
+    }
+    for (i = s->nHeap++; i > 0; i = parent) {
+        parent = (i - 1) / 2;
+        if (s->heap[parent].cost <= p->cost) break;
+        s->heap[i] = s->heap[parent];
+    }
+    s->heap[i] = *p;
+}
+
+/* pop the cheapest candidate collapse into p. Returns 0 if the heap is empty. */
+static int heapPop(Qem *s, QemPair *p) {
+    QemPair last;
+    int i, child;
+    if (s->nHeap == 0) return 0;
+    *p = s->heap[0];
+    last = s->heap[--s->nHeap];
+    for (i = 0; (child = 2 * i + 1) < s->nHeap; i = child) {
+        if (child + 1 < s->nHeap && s->heap[child + 1].cost < s->heap[child].cost) child++;
+        if (last.cost <= s->heap[child].cost) break;
+        s->heap[i] = s->heap[child];
+    }
+    if (s->nHeap > 0) s->heap[i] = last;
+    return 1;
+}
+
+/*
+    Queue the collapse of the edge a b to the point minimizing the sum of their
+    quadrics, or to the better of a, b and their midpoint when that is ill-conditioned.
+ */
+static void qemPushPair(Qem *s, int a, int b) {
+    Quadric q;
+    QemPair pair;
+    double *m = q.q, det, x, y, z, cost;
+    int i;
+
+    for (i = 0; i < 10; i++) m[i] = s->quadric[a].q[i] + s->quadric[b].q[i];
+    det = m[0] * (m[4] * m[7] - m[5] * m[5]) - m[1] * (m[1] * m[7] - m[5] * m[2]) + m[2] * (m[1] * m[5] - m[4] * m[2]);
+    if (fabs(det) > 1e-9 * pow((fabs(m[0]) + fabs(m[4]) + fabs(m[7])) / 3.0, 3.0) && det != 0) {
+        // Cramer's rule on the upper 3x3 against the negated last column
+        double r0 = -m[3], r1 = -m[6], r2 = -m[8];
+        x = (r0 * (m[4] * m[7] - m[5] * m[5]) - m[1] * (r1 * m[7] - m[5] * r2) + m[2] * (r1 * m[5] - m[4] * r2)) / det;
+        y = (m[0] * (r1 * m[7] - r2 * m[5]) - r0 * (m[1] * m[7] - m[5] * m[2]) + m[2] * (m[1] * r2 - r1 * m[2])) / det;
+        z = (m[0] * (m[4] * r2 - m[5] * r1) - m[1] * (m[1] * r2 - r1 * m[2]) + r0 * (m[1] * m[5] - m[4] * m[2])) / det;
+        cost = quadricError(&q, x, y, z);
+    } else {
+        float *pa = s->pos[a].val, *pb = s->pos[b].val;
+        double c[3][3] = {{pa[0], pa[1], pa[2]}, {pb[0], pb[1], pb[2]},
+                          {(pa[0] + pb[0]) / 2, (pa[1] + pb[1]) / 2, (pa[2] + pb[2]) / 2}};
+        int best = 0;
+        double e;
+        cost = quadricError(&q, c[0][0], c[0][1], c[0][2]);
+        for (i = 1; i < 3; i++) {
+            e = quadricError(&q, c[i][0], c[i][1], c[i][2]);
+            if (e < cost) {
+                cost = e;
+                best = i;
+            }
+        }
+        x = c[best][0];
+        y = c[best][1];
+        z = c[best][2];
+    }
+    pair.cost = cost < 0 ? 0 : cost;
+    pair.a = a;
+    pair.b = b;
+    pair.versionA = s->version[a];
+    pair.versionB = s->version[b];
+    pair.p[0] = x;
+    pair.p[1] = y;
+    pair.p[2] = z;
+    heapPush(s, &pair);
+}
+
+/*
+    Weld the vertices of m that share a position, split its faces into triangle fans
+    and set up the quadrics, with the planes through boundary edges added heavily so
+    open borders keep their shape, and the first candidate collapses.
+    Returns 0 if the allocation fails.
+ */
+static int qemInit(Qem *s, Mesh *m) {
+    QemWeld *weld;
+    int *map, *edge = NULL;
+    int i, j, f, n, nEdge;
+
+    memset(s, 0, sizeof(Qem));
+    s->normals = m->normal != NULL;
+    weld = malloc(sizeof(QemWeld) * m->nVertex);
+    map = malloc(sizeof(int) * m->nVertex);
+    if (!weld || !map) {
+        free(weld);
+        free(map);
+        return 0;
+    }
+    for (i = 0; i < m->nVertex; i++) {
+        weld[i].x = m->vertex[i].val[0];
+        weld[i].y = m->vertex[i].val[1];
+        weld[i].z = m->vertex[i].val[2];
+        weld[i].i = i;
+    }
+    qsort(weld, m->nVertex, sizeof(QemWeld), weldCompare);
+    for (i = 0, n = 0; i < m->nVertex; i++) {
+        if (i > 0 && (weld[i - 1].x != weld[i].x || weld[i - 1].y != weld[i].y || weld[i - 1].z != weld[i].z)) n++;
+        map[weld[i].i] = n;
+    }
+    s->nVertex = m->nVertex > 0 ? n + 1 : 0;
+
+    for (f = 0, n = 0; f < m->nFace; f++) n += m->faceStart[f + 1] - m->faceStart[f] - 2 > 0 ? m->faceStart[f + 1] - m->faceStart[f] - 2 : 0;
+    s->pos = malloc(sizeof(Point) * (s->nVertex + 1));
+    s->color = m->color ? malloc(sizeof(Color) * (s->nVertex + 1)) : NULL;
+    s->quadric = calloc(s->nVertex + 1, sizeof(Quadric));
+    s->version = malloc(sizeof(int) * (s->nVertex + 1));
+    s->vf = calloc(s->nVertex + 1, sizeof(int *));
+    s->vfCount = calloc(s->nVertex + 1, sizeof(int));
+    s->vfCap = calloc(s->nVertex + 1, sizeof(int));
+    s->tri = malloc(sizeof(int) * 3 * (n + 1));
+    s->dead = calloc(n + 1, 1);
+    edge = malloc(sizeof(int) * 9 * (n + 1));
+    if (!s->pos || (m->color && !s->color) || !s->quadric || !s->version || !s->vf || !s->vfCount || !s->vfCap ||
+        !s->tri || !s->dead || !edge) {
+        free(weld);
+        free(map);
+        free(edge);
+        qemFree(s);
+        return 0;
+    }
+    // the first vertex at each welded position gives it its color
+    for (i = m->nVertex - 1; i >= 0; i--) {
+        s->pos[map[i]] = m->vertex[i];
+        if (s->color) s->color[map[i]] = m->color[i];
+    }
+    for (i = 0; i < s->nVertex; i++) s->version[i] = 1;
+    free(weld);
+
+    // fans of triangles, dropping the ones welding made degenerate
+    for (f = 0; f < m->nFace; f++) {
+        int *v = &m->index[m->faceStart[f]];
+        for (i = 1; i + 1 < m->faceStart[f + 1] - m->faceStart[f]; i++) {
+            int a = map[v[0]], b = map[v[i]], c = map[v[i + 1]];
+            if (a == b || b == c || a == c) continue;
+            s->tri[3 * s->nTri] = a;
+            s->tri[3 * s->nTri + 1] = b;
+            s->tri[3 * s->nTri + 2] = c;
+            if (!qemAddFace(s, a, s->nTri) || !qemAddFace(s, b, s->nTri) || !qemAddFace(s, c, s->nTri)) {
+                free(map);
+                free(edge);
+                qemFree(s);
+                return 0;
+            }
+            s->nTri++;
+        }
+    }
+    s->liveTri = s->nTri;
+    free(map);
+
+    // face planes, weighted by area
+    for (f = 0, nEdge = 0; f < s->nTri; f++) {
+        int *t = &s->tri[3 * f];
+        float *p = s->pos[t[0]].val;
+        double nrm[3], len, d;
+        triNormal(p, s->pos[t[1]].val, s->pos[t[2]].val, nrm);
+        len = sqrt(nrm[0] * nrm[0] + nrm[1] * nrm[1] + nrm[2] * nrm[2]);
+        if (len > 0) {
+            nrm[0] /= len;
+            nrm[1] /= len;
+            nrm[2] /= len;
+            d = -(nrm[0] * p[0] + nrm[1] * p[1] + nrm[2] * p[2]);
+            for (i = 0; i < 3; i++) quadricAddPlane(&s->quadric[t[i]], nrm, d, len / 2);
+        }
+        for (i = 0; i < 3; i++) {
+            int a = t[i], b = t[(i + 1) % 3];
+            edge[3 * nEdge] = a < b ? a : b;
+            edge[3 * nEdge + 1] = a < b ? b : a;
+            edge[3 * nEdge + 2] = f;
+            nEdge++;
+        }
+    }
+
+    // every edge is a candidate, and an edge with one triangle is on a boundary
+    qsort(edge, nEdge, sizeof(int) * 3, edgeCompare);
+    for (i = 0; i < nEdge; i = j) {
+        for (j = i + 1; j < nEdge && edge[3 * j] == edge[3 * i] && edge[3 * j + 1] == edge[3 * i + 1]; j++);
+        if (j == i + 1) {
+            int *t = &s->tri[3 * edge[3 * i + 2]];
+            float *a = s->pos[edge[3 * i]].val, *b = s->pos[edge[3 * i + 1]].val;
+            double fn[3], e[3], bn[3], len;
+            triNormal(s->pos[t[0]].val, s->pos[t[1]].val, s->pos[t[2]].val, fn);
+            e[0] = b[0] - a[0];
+            e[1] = b[1] - a[1];
+            e[2] = b[2] - a[2];
+            bn[0] = e[1] * fn[2] - e[2] * fn[1];
+            bn[1] = e[2] * fn[0] - e[0] * fn[2];
+            bn[2] = e[0] * fn[1] - e[1] * fn[0];
+            len = sqrt(bn[0] * bn[0] + bn[1] * bn[1] + bn[2] * bn[2]);
+            if (len > 0) {
+                double w = QEM_BOUNDARY_WEIGHT * (e[0] * e[0] + e[1] * e[1] + e[2] * e[2]);
+                bn[0] /= len;
+                bn[1] /= len;
+                bn[2] /= len;
+                quadricAddPlane(&s->quadric[edge[3 * i]], bn, -(bn[0] * a[0] + bn[1] * a[1] + bn[2] * a[2]), w);
+                quadricAddPlane(&s->quadric[edge[3 * i + 1]], bn, -(bn[0] * a[0] + bn[1] * a[1] + bn[2] * a[2]), w);
+            }
+        }
+        qemPushPair(s, edge[3 * i], edge[3 * i + 1]);
+    }
+    free(edge);
+    return 1;
+}
+
+/*
+    Whether moving vertex v to p, with the triangles it shares with other dropped,
+    turns any of its remaining triangles over or makes it degenerate.
+ */
+static int qemFlips(Qem *s, int v, int other, float *p) {
+    int i, j;
+    for (i = 0; i < s->vfCount[v]; i++) {
+        int f = s->vf[v][i], *t = &s->tri[3 * f];
+        float *c[3];
+        double before[3], after[3], lb, la;
+        if (s->dead[f] || t[0] == other || t[1] == other || t[2] == other) continue;
+        for (j = 0; j < 3; j++) c[j] = s->pos[t[j]].val;
+        triNormal(c[0], c[1], c[2], before);
+        for (j = 0; j < 3; j++) if (t[j] == v) c[j] = p;
+        triNormal(c[0], c[1], c[2], after);
+        lb = sqrt(before[0] * before[0] + before[1] * before[1] + before[2] * before[2]);
+        la = sqrt(after[0] * after[0] + after[1] * after[1] + after[2] * after[2]);
+        if (la == 0) return 1;
+        if (lb > 0 && (before[0] * after[0] + before[1] * after[1] + before[2] * after[2]) < QEM_FLIP_COS * lb * la) return 1;
+    }
+    return 0;
+}
+
+/*
+    Collapse the cheapest edges until at most target triangles are left or no edge
+    can be collapsed without folding the surface over.
+ */
+static void qemRun(Qem *s, int target) {
+    QemPair pair;
+    int i, j, a, b;
+
+    while (s->liveTri > target && heapPop(s, &pair)) {
+        a = pair.a;
+        b = pair.b;
+        if (s->version[a] != pair.versionA || s->version[b] != pair.versionB || !s->version[a] || !s->version[b]) continue;
+        if (qemFlips(s, a, b, pair.p) || qemFlips(s, b, a, pair.p)) continue;
+
+        point_set3D(&s->pos[a], pair.p[0], pair.p[1], pair.p[2]);
+        for (i = 0; i < 10; i++) s->quadric[a].q[i] += s->quadric[b].q[i];
+        s->version[a]++;
+        s->version[b] = 0;
+        for (i = 0; i < s->vfCount[b]; i++) {
+            int f = s->vf[b][i], *t = &s->tri[3 * f];
+            if (s->dead[f]) continue;
+            if (t[0] == a || t[1] == a || t[2] == a) {
+                s->dead[f] = 1;
+                s->liveTri--;
+                continue;
+            }
+            for (j = 0; j < 3; j++) if (t[j] == b) t[j] = a;
+            qemAddFace(s, a, f);
+        }
+        free(s->vf[b]);
+        s->vf[b] = NULL;
+        s->vfCount[b] = s->vfCap[b] = 0;
+
+        // every edge of a has a new cost, drop the dead triangles from its list on the way
+        for (i = 0, j = 0; i < s->vfCount[a]; i++) {
+            int f = s->vf[a][i], *t = &s->tri[3 * f], k;
+            if (s->dead[f]) continue;
+            s->vf[a][j++] = f;
+            for (k = 0; k < 3; k++) if (t[k] != a) qemPushPair(s, a, t[k]);
+        }
+        s->vfCount[a] = j;
+    }
+}
+
+/*
+    Store the triangles still alive in out, keeping only the vertices they use.
+    Normals are estimated from the reduced triangles if the model had normals.
+ */
+static void qemExtract(Qem *s, Mesh *out) {
+    int *remap = malloc(sizeof(int) * (s->nVertex + 1));
+    Point *vertex = malloc(sizeof(Point) * (s->nVertex + 1));
+    Color *color = s->color ? malloc(sizeof(Color) * (s->nVertex + 1)) : NULL;
+    int *faceStart = malloc(sizeof(int) * (s->liveTri + 1));
+    int *index = malloc(sizeof(int) * 3 * (s->liveTri + 1));
+    int i, f, n = 0, nFace = 0;
+
+    if (remap && vertex && faceStart && index && (color || !s->color)) {
+        for (i = 0; i < s->nVertex; i++) remap[i] = -1;
+        for (f = 0; f < s->nTri; f++) {
+            if (s->dead[f]) continue;
+            faceStart[nFace] = 3 * nFace;
+            for (i = 0; i < 3; i++) {
+                int v = s->tri[3 * f + i];
+                if (remap[v] < 0) {
+                    remap[v] = n;
+                    vertex[n] = s->pos[v];
+                    if (color) color[n] = s->color[v];
+                    n++;
+                }
+                index[3 * nFace + i] = remap[v];
+            }
+            nFace++;
+        }
+        faceStart[nFace] = 3 * nFace;
+        mesh_set(out, n, vertex, NULL, color, nFace, faceStart, index);
+        if (s->normals) mesh_setNormals(out);
+    }
+    free(remap);
+    free(vertex);
+    free(color);
+    free(faceStart);
+    free(index);
+}
+
+/**
+ * simplify m to at most targetFaces triangles with the quadric error metric and store
+ * the result in out, which must be initialized. Vertices at the same position are
+ * welded first and polygons are split into fans, so out is always triangles. Edges
+ * are collapsed cheapest first to the point that best keeps the planes of the faces
+ * around them; collapses that would fold the surface are skipped, so out may keep
+ * more faces than asked when the model cannot go lower. Returns the faces in out.
+ */
+int mesh_simplify(Mesh *m, int targetFaces, Mesh *out) {
+    Qem s;
+
+    if (!m || !out || m == out) return 0;
+    if (!qemInit(&s, m)) return 0;
+    qemRun(&s, targetFaces);
+    qemExtract(&s, out);
+    out->oneSided = m->oneSided;
+    out->zBuffer = m->zBuffer;
+    qemFree(&s);
+    return out->nFace;
+}
+
+/**
+ * make a chain of up to nLevel levels of detail of m holding one reference, owned by
+ * the caller. Level 0 is a copy of m, and level i is m simplified to about half the
+ * triangles of level i - 1, taken from one run of the simplifier. The chain stops
+ * early when the model cannot be simplified further. Returns NULL if the allocation fails.
+ */
+MeshLOD *meshLOD_create(Mesh *m, int nLevel) {
+    MeshLOD *lod;
+    Qem s;
+    int i, j, target;
+
+    if (!m) return NULL;
+    if (nLevel < 1) nLevel = 1;
+    if (nLevel > LOD_MAX_LEVELS) nLevel = LOD_MAX_LEVELS;
+    lod = (MeshLOD *)malloc(sizeof(MeshLOD));
+    if (!lod) return NULL;
+    for (i = 0; i < LOD_MAX_LEVELS; i++) mesh_init(&lod->level[i]);
+    mesh_copy(&lod->level[0], m);
+    lod->nLevel = 1;
+    lod->facePixels = LOD_FACE_PIXELS;
+    lod->refCount = 1;
+
+    point_set3D(&lod->min, 0, 0, 0);
+    point_set3D(&lod->max, 0, 0, 0);
+    for (i = 0; i < m->nVertex; i++) {
+        for (j = 0; j < 3; j++) {
+            if (i == 0 || m->vertex[i].val[j] < lod->min.val[j]) lod->min.val[j] = m->vertex[i].val[j];
+            if (i == 0 || m->vertex[i].val[j] > lod->max.val[j]) lod->max.val[j] = m->vertex[i].val[j];
+        }
+    }
+
+    if (nLevel > 1 && qemInit(&s, m)) {
+        for (target = s.liveTri / 2; lod->nLevel < nLevel && target > 0; target /= 2) {
+            int before = s.liveTri;
+            qemRun(&s, target);
+            if (s.liveTri == before) break;
+            qemExtract(&s, &lod->level[lod->nLevel]);
+            lod->level[lod->nLevel].oneSided = m->oneSided;
+            lod->level[lod->nLevel].zBuffer = m->zBuffer;
+            lod->nLevel++;
+        }
+        qemFree(&s);
+    }
+    return lod;
+}
+
+/* add a reference to lod and return it. */
+MeshLOD *meshLOD_retain(MeshLOD *lod) {
+    if (lod) lod->refCount++;
+    return lod;
+}
+
+/* drop a reference to lod, freeing it and its meshes with the last one. */
+void meshLOD_release(MeshLOD *lod) {
+    int i;
+    if (!lod || --lod->refCount > 0) return;
+    for (i = 0; i < lod->nLevel; i++) mesh_clear(&lod->level[i]);
+    free(lod);
+}
+
+/**
+ * return the level of lod to draw when its bounding box covers the given number of
+ * pixels on the screen: the coarsest level with at least one face per facePixels of
+ * that area, or level 0 if even it has fewer.
+ */
+int meshLOD_select(MeshLOD *lod, float pixels) {
+    int i;
+    if (!lod) return 0;
+    for (i = lod->nLevel - 1; i > 0; i--) {
+        if (lod->level[i].nFace * lod->facePixels >= pixels) return i;
+    }
+    return 0;
+}
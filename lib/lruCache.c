@@ -0,0 +1,162 @@
+/***
+ * written by - Jiafeng
+ *
+ * lru cache apis, the hash table and least recently used list shared by the caches
+ * that keep geometry across frames. Every entry starts with a CacheEntry; what
+ * follows it, the key and the payload, belongs to the cache built on top, which
+ * hashes the key, compares it on lookup and says how to release the payload.
+ */
+
+#include <string.h>
+#include "graphics.h"
+
+// starting size of the hash table, doubled whenever there are more entries than buckets
+#define LRU_CACHE_BUCKETS 64
+
+/* take e out of the LRU list. */
+static void lruUnlink(LruCache *c, CacheEntry *e) {
+    if (e->newer) e->newer->older = e->older;
+    else c->newest = e->older;
+    if (e->older) e->older->newer = e->newer;
+    else c->oldest = e->newer;
+    e->newer = e->older = NULL;
+}
+
+/* put e at the newest end of the LRU list. */
+static void lruPushNewest(LruCache *c, CacheEntry *e) {
+    e->older = c->newest;
+    e->newer = NULL;
+    if (c->newest) c->newest->newer = e;
+    else c->oldest = e;
+    c->newest = e;
+}
+
+/* remove e from its hash chain and the LRU list, release its payload and free it. */
+static void lruRemove(LruCache *c, CacheEntry *e) {
+    CacheEntry **link = &c->bucket[e->hash & (c->nBucket - 1)];
+
+    while (*link != e) link = &(*link)->chain;
+    *link = e->chain;
+    lruUnlink(c, e);
+    c->bytes -= e->bytes;
+    c->nEntry--;
+    if (c->release) c->release(e);
+    free(e);
+}
+
+/* double the hash table, rehashing every entry. Leaves the table as it is if the allocation fails. */
+static void lruGrow(LruCache *c) {
+    int n = c->nBucket * 2, i;
+    CacheEntry **bucket = (CacheEntry **)calloc(n, sizeof(CacheEntry *));
+    CacheEntry *e, *next;
+
+    if (!bucket) return;
+    for (i = 0; i < c->nBucket; i++) {
+        for (e = c->bucket[i]; e; e = next) {
+            next = e->chain;
+            e->chain = bucket[e->hash & (n - 1)];
+            bucket[e->hash & (n - 1)] = e;
+        }
+    }
+    free(c->bucket);
+    c->bucket = bucket;
+    c->nBucket = n;
+}
+
+/* LRU Cache Functions */
+
+/**
+ * allocate an empty cache that holds at most budget bytes of entries. release, if not
+ * NULL, frees what an entry holds besides its own block before the cache frees it.
+ * Returns NULL if the allocation fails.
+ */
+LruCache *lruCache_create(size_t budget, void (*release)(CacheEntry *e)) {
+    LruCache *c = (LruCache *)malloc(sizeof(LruCache));
+
+    if (!c) return NULL;
+    c->bucket = (CacheEntry **)calloc(LRU_CACHE_BUCKETS, sizeof(CacheEntry *));
+    if (!c->bucket) {
+        free(c);
+        return NULL;
+    }
+    c->nBucket = LRU_CACHE_BUCKETS;
+    c->budget = budget;
+    c->bytes = 0;
+    c->nEntry = 0;
+    c->newest = c->oldest = NULL;
+    c->lookups = c->hits = c->evictions = 0;
+    c->release = release;
+    return c;
+}
+
+/* free the cache and every entry it holds. */
+void lruCache_free(LruCache *c) {
+    if (!c) return;
+    lruCache_reset(c);
+    free(c->bucket);
+    free(c);
+}
+
+/* drop every entry and zero the counters. */
+void lruCache_reset(LruCache *c) {
+    if (!c) return;
+    while (c->oldest) lruRemove(c, c->oldest);
+    c->lookups = c->hits = c->evictions = 0;
+}
+
+/* FNV-1a hash of bytes bytes of key continuing from h, LRU_HASH_SEED for a new hash. */
+unsigned int lruCache_hash(unsigned int h, const void *key, size_t bytes) {
+    const unsigned char *p = (const unsigned char *)key;
+    size_t i;
+
+    for (i = 0; i < bytes; i++) {
+        h = (h ^ p[i]) * 16777619u;
+    }
+    return h;
+}
+
+/**
+ * return the entry with the given hash for which match(entry, key) is nonzero, made
+ * the most recently used, or NULL if there is none. Every call counts as a lookup.
+ */
+CacheEntry *lruCache_find(LruCache *c, unsigned int hash, int (*match)(CacheEntry *e, void *key), void *key) {
+    CacheEntry *e;
+
+    if (!c || !match) return NULL;
+    c->lookups++;
+    for (e = c->bucket[hash & (c->nBucket - 1)]; e; e = e->chain) {
+        if (e->hash == hash && match(e, key)) {
+            c->hits++;
+            lruUnlink(c, e);
+            lruPushNewest(c, e);
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * add the entry e, allocated with malloc and with its hash and bytes set, as the most
+ * recently used. Evicts the least recently used entries while the cache is over its
+ * budget, never e itself, so e stays valid until the next insert or reset.
+ */
+void lruCache_insert(LruCache *c, CacheEntry *e) {
+    if (!c || !e) return;
+    if (c->nEntry >= c->nBucket) lruGrow(c);
+    e->chain = c->bucket[e->hash & (c->nBucket - 1)];
+    c->bucket[e->hash & (c->nBucket - 1)] = e;
+    lruPushNewest(c, e);
+    c->bytes += e->bytes;
+    c->nEntry++;
+
+    while (c->bytes > c->budget && c->oldest != e) {
+        lruRemove(c, c->oldest);
+        c->evictions++;
+    }
+}
+
+/* fraction of the lookups since the cache was created or reset that were hits. */
+float lruCache_hitRate(LruCache *c) {
+    if (!c || c->lookups == 0) return 0.0f;
+    return (float)c->hits / c->lookups;
+}
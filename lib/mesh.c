@@ -0,0 +1,464 @@
+/***
+ * written by - Jiafeng
+ *
+ * indexed mesh apis, faces index into one shared vertex buffer so a vertex used by
+ * several faces is stored, transformed and lit only once
+ */
+
+#include <string.h>
+#include "graphics.h"
+
+/* Mesh Functions */
+
+/* returns an allocated Mesh pointer initialized so that it holds no vertices or faces. */
+Mesh *mesh_create(void) {
+    Mesh *m = (Mesh *)malloc(sizeof(Mesh));
+    if (m) mesh_init(m);
+    return m;
+}
+
+/* frees the internal data and the Mesh pointer. */
+void mesh_free(Mesh *m) {
+    if (!m) return;
+    mesh_clear(m);
+    free(m);
+}
+
+/* initializes the existing Mesh to an empty mesh, without freeing anything. */
+void mesh_init(Mesh *m) {
+    if (!m) return;
+    m->oneSided = 0;
+    m->nVertex = 0;
+    m->vertex = NULL;
+    m->normal = NULL;
+    m->color = NULL;
+    m->nFace = 0;
+    m->faceStart = NULL;
+    m->index = NULL;
+    m->zBuffer = 1;
+}
+
+/* frees the internal data of the Mesh and resets it to empty. */
+void mesh_clear(Mesh *m) {
+    if (!m) return;
+    free(m->vertex);
+    free(m->normal);
+    free(m->color);
+    free(m->faceStart);
+    free(m->index);
+    m->nVertex = 0;
+    m->vertex = NULL;
+    m->normal = NULL;
+    m->color = NULL;
+    m->nFace = 0;
+    m->faceStart = NULL;
+    m->index = NULL;
+}
+
+/**
+ * set the mesh to nVertex vertices from vlist and nFace faces, face f made of the
+ * indices index[faceStart[f]] up to index[faceStart[f + 1]]. nlist and clist may be
+ * NULL for a mesh without normals or vertex colors. Everything is copied.
+ */
+void mesh_set(Mesh *m, int nVertex, Point *vlist, Vector *nlist, Color *clist, int nFace, int *faceStart, int *index) {
+    int nIndex;
+    if (!m || !vlist || !faceStart || !index || nVertex < 0 || nFace < 0) return;
+    mesh_clear(m);
+    nIndex = faceStart[nFace];
+    m->vertex = (Point *)malloc(sizeof(Point) * nVertex);
+    m->faceStart = (int *)malloc(sizeof(int) * (nFace + 1));
+    m->index = (int *)malloc(sizeof(int) * nIndex);
+    if (nlist) m->normal = (Vector *)malloc(sizeof(Vector) * nVertex);
+    if (clist) m->color = (Color *)malloc(sizeof(Color) * nVertex);
+    if (!m->vertex || !m->faceStart || (nIndex && !m->index) || (nlist && !m->normal) || (clist && !m->color)) {
+        mesh_clear(m);
+        return;
+    }
+    memcpy(m->vertex, vlist, sizeof(Point) * nVertex);
+    memcpy(m->faceStart, faceStart, sizeof(int) * (nFace + 1));
+    memcpy(m->index, index, sizeof(int) * nIndex);
+    if (nlist) memcpy(m->normal, nlist, sizeof(Vector) * nVertex);
+    if (clist) memcpy(m->color, clist, sizeof(Color) * nVertex);
+    m->nVertex = nVertex;
+    m->nFace = nFace;
+}
+
+/**
+ * estimate a smooth normal for every vertex as the average of the normals of the
+ * faces around it, weighted by their area. Faces are oriented as in readPLY, the
+ * normal of the triangle a, b, c being (a - b) x (c - b).
+ */
+void mesh_setNormals(Mesh *m) {
+    Vector *n;
+    int f, i;
+    if (!m || m->nVertex < 1) return;
+    n = (Vector *)malloc(sizeof(Vector) * m->nVertex);
+    if (!n) return;
+    for (i = 0; i < m->nVertex; i++) vector_set(&n[i], 0, 0, 0);
+    for (f = 0; f < m->nFace; f++) {
+        int *v = &m->index[m->faceStart[f]];
+        int nv = m->faceStart[f + 1] - m->faceStart[f];
+        Vector tx, ty, tn, sum;
+        vector_set(&sum, 0, 0, 0);
+        // fan the face into triangles, the sum of their cross products is twice its area
+        for (i = 1; i + 1 < nv; i++) {
+            Point *a = &m->vertex[v[0]], *b = &m->vertex[v[i]], *c = &m->vertex[v[i + 1]];
+            vector_set(&tx, a->val[0] - b->val[0], a->val[1] - b->val[1], a->val[2] - b->val[2]);
+            vector_set(&ty, c->val[0] - b->val[0], c->val[1] - b->val[1], c->val[2] - b->val[2]);
+            vector_cross(&tx, &ty, &tn);
+            sum.val[0] += tn.val[0];
+            sum.val[1] += tn.val[1];
+            sum.val[2] += tn.val[2];
+        }
+        for (i = 0; i < nv; i++) {
+            n[v[i]].val[0] += sum.val[0];
+            n[v[i]].val[1] += sum.val[1];
+            n[v[i]].val[2] += sum.val[2];
+        }
+    }
+    for (i = 0; i < m->nVertex; i++) vector_normalize(&n[i]);
+    free(m->normal);
+    m->normal = n;
+}
+
+/* sets the oneSided field to the value. */
+void mesh_setSided(Mesh *m, int oneSided) {
+    if (m) m->oneSided = oneSided;
+}
+
+/* sets the z-buffer flag to the given value. */
+void mesh_zBuffer(Mesh *m, int flag) {
+    if (m) m->zBuffer = flag;
+}
+
+/* De-allocates/allocates space and copies the vertex, normal, color and index data from one mesh to the other. */
+void mesh_copy(Mesh *to, Mesh *from) {
+    if (!to || !from || to == from) return;
+    mesh_set(to, from->nVertex, from->vertex, from->normal, from->color, from->nFace, from->faceStart, from->index);
+    to->oneSided = from->oneSided;
+    to->zBuffer = from->zBuffer;
+}
+
+// tuning of the vertex cache optimization, from Forsyth's linear-speed vertex cache optimisation
+#define FORSYTH_CACHE_SIZE 32
+#define FORSYTH_CACHE_DECAY 1.5f
+#define FORSYTH_LAST_FACE 0.75f
+#define FORSYTH_VALENCE_SCALE 2.0f
+#define FORSYTH_VALENCE_POWER 0.5f
+
+/*
+    Score of a vertex at the given position of the simulated LRU cache (-1 if it
+    is not cached) with valence faces still to be emitted. The vertices of the
+    face just emitted, the first lastFace positions, get a fixed score so the
+    next face does not simply reuse all of them.
+ */
+static float forsythScore(int position, int lastFace, int cacheSize, int valence) {
+    float score = 0;
+    if (valence == 0) return -1.0f;
+    if (position >= 0 && position < cacheSize) {
+        if (position < lastFace) score = FORSYTH_LAST_FACE;
+        else score = powf(1.0f - (float)(position - lastFace) / (cacheSize - lastFace), FORSYTH_CACHE_DECAY);
+    }
+    return score + FORSYTH_VALENCE_SCALE * powf((float)valence, -FORSYTH_VALENCE_POWER);
+}
+
+/*
+    Greedy face order of Forsyth's algorithm for an LRU cache of cacheSize entries,
+    written to faceStart and index in the layout of the mesh. Returns 0 if the
+    working arrays cannot be allocated.
+ */
+static int forsythOrder(Mesh *m, int cacheSize, int maxFace, int *faceStart, int *index) {
+    int nIndex = m->faceStart[m->nFace], lruSize = cacheSize + maxFace, nCached = 0, lastFace;
+    int *valence = calloc(m->nVertex, sizeof(int));
+    int *adjStart = calloc(m->nVertex + 1, sizeof(int));
+    int *adj = malloc(sizeof(int) * nIndex);
+    int *cachePos = malloc(sizeof(int) * m->nVertex);
+    int *lru = malloc(sizeof(int) * lruSize);
+    int *next = malloc(sizeof(int) * (lruSize + maxFace));
+    float *vscore = malloc(sizeof(float) * m->nVertex);
+    float *fscore = malloc(sizeof(float) * m->nFace);
+    unsigned char *emitted = calloc(m->nFace, 1);
+    int ok = valence && adjStart && adj && cachePos && lru && next && vscore && fscore && emitted;
+    int i, j, k, f, t, v, n, best, out;
+
+    if (ok) {
+        // faces around each vertex
+        for (i = 0; i < nIndex; i++) valence[m->index[i]]++;
+        for (v = 0; v < m->nVertex; v++) adjStart[v + 1] = adjStart[v] + valence[v];
+        for (v = 0; v < m->nVertex; v++) cachePos[v] = adjStart[v];
+        for (f = 0; f < m->nFace; f++) {
+            for (i = m->faceStart[f]; i < m->faceStart[f + 1]; i++) adj[cachePos[m->index[i]]++] = f;
+        }
+        for (v = 0; v < m->nVertex; v++) {
+            cachePos[v] = -1;
+            vscore[v] = forsythScore(-1, 0, cacheSize, valence[v]);
+        }
+        for (f = 0; f < m->nFace; f++) {
+            fscore[f] = 0;
+            for (i = m->faceStart[f]; i < m->faceStart[f + 1]; i++) fscore[f] += vscore[m->index[i]];
+        }
+
+        best = -1;
+        for (out = 0, k = 0; k < m->nFace; k++) {
+            if (best < 0) {
+                // nothing in the cache touches a remaining face, take the best one anywhere
+                for (f = 0; f < m->nFace; f++) {
+                    if (!emitted[f] && (best < 0 || fscore[f] > fscore[best])) best = f;
+                }
+            }
+
+            // emit the face and move its vertices to the front of the cache
+            faceStart[k] = out;
+            emitted[best] = 1;
+            n = 0;
+            for (i = m->faceStart[best]; i < m->faceStart[best + 1]; i++) {
+                v = m->index[i];
+                index[out++] = v;
+                valence[v]--;
+                if (cachePos[v] == -2) continue;
+                next[n++] = v;
+                cachePos[v] = -2; // already placed in next
+            }
+            for (i = 0; i < nCached; i++) {
+                if (cachePos[lru[i]] != -2) next[n++] = lru[i];
+            }
+            for (i = 0; i < n; i++) {
+                if (i < lruSize) {
+                    lru[i] = next[i];
+                    cachePos[next[i]] = i;
+                } else {
+                    cachePos[next[i]] = -1;
+                }
+            }
+            nCached = n < lruSize ? n : lruSize;
+            lastFace = m->faceStart[best + 1] - m->faceStart[best];
+
+            // rescore the vertices that moved and the remaining faces around them
+            for (i = 0; i < n; i++) {
+                v = next[i];
+                vscore[v] = forsythScore(cachePos[v], lastFace, cacheSize, valence[v]);
+            }
+            best = -1;
+            for (i = 0; i < n; i++) {
+                v = next[i];
+                for (j = adjStart[v]; j < adjStart[v + 1]; j++) {
+                    f = adj[j];
+                    if (emitted[f]) continue;
+                    fscore[f] = 0;
+                    for (t = m->faceStart[f]; t < m->faceStart[f + 1]; t++) fscore[f] += vscore[m->index[t]];
+                    if (best < 0 || fscore[f] > fscore[best]) best = f;
+                }
+            }
+        }
+        faceStart[m->nFace] = out;
+    }
+
+    free(valence);
+    free(adjStart);
+    free(adj);
+    free(cachePos);
+    free(lru);
+    free(next);
+    free(vscore);
+    free(fscore);
+    free(emitted);
+    return ok;
+}
+
+/*
+    Renumber the vertices of the mesh in order of first use in index, which is
+    rewritten to match. Unused vertices go last. Returns 0 if allocation fails.
+ */
+static int renumberVertices(Mesh *m, int *index) {
+    int nIndex = m->faceStart[m->nFace];
+    int *remap = malloc(sizeof(int) * m->nVertex);
+    Point *vertex = malloc(sizeof(Point) * m->nVertex);
+    Vector *normal = m->normal ? malloc(sizeof(Vector) * m->nVertex) : NULL;
+    Color *color = m->color ? malloc(sizeof(Color) * m->nVertex) : NULL;
+    int i, k, v;
+
+    if (!remap || !vertex || (m->normal && !normal) || (m->color && !color)) {
+        free(remap);
+        free(vertex);
+        free(normal);
+        free(color);
+        return 0;
+    }
+    for (v = 0; v < m->nVertex; v++) remap[v] = -1;
+    for (k = 0, i = 0; i < nIndex; i++) {
+        if (remap[index[i]] < 0) remap[index[i]] = k++;
+    }
+    for (v = 0; v < m->nVertex; v++) {
+        if (remap[v] < 0) remap[v] = k++;
+    }
+    for (v = 0; v < m->nVertex; v++) {
+        vertex[remap[v]] = m->vertex[v];
+        if (normal) normal[remap[v]] = m->normal[v];
+        if (color) color[remap[v]] = m->color[v];
+    }
+    for (i = 0; i < nIndex; i++) index[i] = remap[index[i]];
+    free(m->vertex);
+    free(m->normal);
+    free(m->color);
+    m->vertex = vertex;
+    m->normal = normal;
+    m->color = color;
+    free(remap);
+    return 1;
+}
+
+/**
+ * reorder the faces of the mesh for a post-transform vertex cache of cacheSize entries
+ * (32 if cacheSize is not positive) with Forsyth's greedy algorithm, then renumber the
+ * vertices in order of first use so the vertex arrays are also read front to back.
+ * The faces and their winding are unchanged, only the order they are drawn in.
+ * The mesh is left as it was if memory runs out.
+ */
+void mesh_optimize(Mesh *m, int cacheSize) {
+    int *faceStart, *index;
+    int f, maxFace = 0;
+
+    if (!m || m->nFace < 1 || m->nVertex < 1) return;
+    if (cacheSize <= 0) cacheSize = FORSYTH_CACHE_SIZE;
+    for (f = 0; f < m->nFace; f++) {
+        if (m->faceStart[f + 1] - m->faceStart[f] > maxFace) maxFace = m->faceStart[f + 1] - m->faceStart[f];
+    }
+    if (cacheSize <= maxFace) cacheSize = maxFace + 1;
+
+    faceStart = malloc(sizeof(int) * (m->nFace + 1));
+    index = malloc(sizeof(int) * m->faceStart[m->nFace]);
+    if (!faceStart || !index || !forsythOrder(m, cacheSize, maxFace, faceStart, index) || !renumberVertices(m, index)) {
+        free(faceStart);
+        free(index);
+        return;
+    }
+    free(m->faceStart);
+    free(m->index);
+    m->faceStart = faceStart;
+    m->index = index;
+}
+
+/* Shared Mesh Functions */
+
+/**
+ * return a shared copy of m holding one reference, owned by the caller. Modules add
+ * their own references, so the caller may release its one as soon as it is done
+ * inserting. Returns NULL if the allocation fails.
+ */
+SharedMesh *sharedMesh_create(Mesh *m) {
+    SharedMesh *s;
+    if (!m) return NULL;
+    s = (SharedMesh *)malloc(sizeof(SharedMesh));
+    if (!s) return NULL;
+    mesh_init(&s->mesh);
+    mesh_copy(&s->mesh, m);
+    s->refCount = 1;
+    return s;
+}
+
+/* add a reference to s and return it. */
+SharedMesh *sharedMesh_retain(SharedMesh *s) {
+    if (s) s->refCount++;
+    return s;
+}
+
+/* drop a reference to s, freeing it with the last one. */
+void sharedMesh_release(SharedMesh *s) {
+    if (!s || --s->refCount > 0) return;
+    mesh_clear(&s->mesh);
+    free(s);
+}
+
+/* Vertex Cache Functions */
+
+/**
+ * allocate a post-transform cache of size entries for a mesh of nVertex vertices and
+ * empty it. A size that is not positive or above nVertex gives one entry per vertex,
+ * so nothing is ever evicted. Returns 0 if the allocation fails.
+ */
+int vertexCache_init(VertexCache *vc, int size, int nVertex) {
+    if (!vc || nVertex < 1) return 0;
+    if (size <= 0 || size > nVertex) size = nVertex;
+    vc->size = size;
+    vc->nVertex = nVertex;
+    vc->slot = malloc(sizeof(int) * nVertex);
+    vc->tag = malloc(sizeof(int) * size);
+    vc->clip = malloc(sizeof(Point) * size);
+    vc->screen = malloc(sizeof(Point) * size);
+    vc->color = malloc(sizeof(Color) * size);
+    vc->shaded = malloc(size);
+    vc->face = malloc(sizeof(int) * size);
+    if (!vc->slot || !vc->tag || !vc->clip || !vc->screen || !vc->color || !vc->shaded || !vc->face) {
+        vertexCache_clear(vc);
+        return 0;
+    }
+    vertexCache_reset(vc);
+    return 1;
+}
+
+/* free the arrays of the cache. */
+void vertexCache_clear(VertexCache *vc) {
+    if (!vc) return;
+    free(vc->slot);
+    free(vc->tag);
+    free(vc->clip);
+    free(vc->screen);
+    free(vc->color);
+    free(vc->shaded);
+    free(vc->face);
+    vc->slot = vc->tag = vc->face = NULL;
+    vc->clip = vc->screen = NULL;
+    vc->color = NULL;
+    vc->shaded = NULL;
+    vc->size = vc->nVertex = 0;
+}
+
+/* empty the cache and zero its counters, call at the start of each draw. */
+void vertexCache_reset(VertexCache *vc) {
+    if (!vc) return;
+    memset(vc->slot, 0xff, sizeof(int) * vc->nVertex);
+    memset(vc->tag, 0xff, sizeof(int) * vc->size);
+    memset(vc->face, 0xff, sizeof(int) * vc->size);
+    vc->next = 0;
+    vc->current = 0;
+    vc->lookups = vc->hits = 0;
+}
+
+/* start putting together the next face, the entries of the last one may be replaced again. */
+void vertexCache_nextFace(VertexCache *vc) {
+    if (vc) vc->current++;
+}
+
+/**
+ * return the entry of vertex v. On a hit hit is set to 1 and the entry holds the
+ * vertex's data. On a miss hit is set to 0 and the oldest entry not used by the
+ * current face is given to v with its color marked unshaded; the caller fills in
+ * the positions. The cache must have at least as many entries as a face has vertices.
+ */
+int vertexCache_lookup(VertexCache *vc, int v, int *hit) {
+    int e = vc->slot[v];
+    vc->lookups++;
+    if (e >= 0) {
+        vc->hits++;
+        vc->face[e] = vc->current;
+        *hit = 1;
+        return e;
+    }
+    do {
+        e = vc->next;
+        vc->next = e + 1 < vc->size ? e + 1 : 0;
+    } while (vc->face[e] == vc->current);
+    if (vc->tag[e] >= 0) vc->slot[vc->tag[e]] = -1;
+    vc->tag[e] = v;
+    vc->slot[v] = e;
+    vc->face[e] = vc->current;
+    vc->shaded[e] = 0;
+    *hit = 0;
+    return e;
+}
+
+/* fraction of the lookups since the last reset that were hits. */
+float vertexCache_hitRate(VertexCache *vc) {
+    if (!vc || vc->lookups == 0) return 0;
+    return (float)vc->hits / vc->lookups;
+}
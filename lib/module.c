@@ -3,87 +3,332 @@
  * Summer 2024
  */
 
+#include <string.h>
+#include <sys/mman.h>
 #include "graphics.h"
 
-/* 2D and Generic Module Functions */
+// source of edit stamps for modules, incremented on every change to any module
+static unsigned long moduleEpoch = 0;
+
+// counters of the work done by module_draw on each thread, see drawstats_get
+static __thread DrawStats drawStats;
+
+// scratch memory of the DrawStates that bring none, kept from draw to draw
+static Arena drawScratch;
+
+/* bytes of the Element union that an object of the given type uses. */
+static size_t objectBytes(ObjectType type) {
+    switch (type) {
+        case ObjLine: return sizeof(Line);
+        case ObjPoint: return sizeof(Point);
+        case ObjPolyline: return sizeof(Polyline);
+        case ObjPolygon: return sizeof(Polygon);
+        case ObjMesh: return sizeof(Mesh);
+        case ObjSharedMesh: return sizeof(SharedMesh *);
+        case ObjMeshLOD: return sizeof(MeshLOD *);
+        case ObjBezierCurve: return sizeof(BezierCurve);
+        case ObjBezierSurface: return sizeof(BezierSurface);
+        case ObjMatrix: return sizeof(Matrix);
+        case ObjColor:
+        case ObjBodyColor:
+        case ObjSurfaceColor: return sizeof(Color);
+        case ObjSurfaceCoeff: return sizeof(float);
+        case ObjModule: return sizeof(void *);
+        case ObjInstances: return sizeof(Instances);
+        case ObjIdentity: return 0; // the identity is implied by the type
+        default: return sizeof(Object);
+    }
+}
 
-/* Allocate and return an initialized but empty Element. */
-Element *element_create(void) {
-	Element *e = malloc(sizeof(Element));
+// an Element whose references or heap memory module_clear must give back, kept in the module's arena
+typedef struct {
+    void *next; // next record
+    Element *e; // the element
+    int owned; // whether e came from element_init and is freed with element_delete
+} ModuleRelease;
+
+/* Allocate an uninitialized Element large enough for an object of the given type, from the arena if there is one. */
+static Element *elementAlloc(ObjectType type, Arena *arena) {
+    Element *e = arena ? arena_alloc(arena, element_bytes(type)) : malloc(element_bytes(type));
     if (e) {
-        e->type = ObjNone;
-        e->obj.module = NULL;
+        e->type = type;
         e->next = NULL;
     }
     return e;
 }
 
-/* Allocate an Element and store a duplicate of the data pointed to by obj in the Element. 
- * Modules do not get duplicated.
- * The function needs to handle each type of object separately in a case statement.
-*/
-Element *element_init(ObjectType type, void *obj) {
-	Element *e = element_create();
+/* copy of bytes of src in the arena, NULL if src is NULL or the arena is out of memory. */
+static void *arenaCopy(Arena *arena, void *src, size_t bytes) {
+    void *p;
+    if (!src) return NULL;
+    p = arena_alloc(arena, bytes);
+    if (p) memcpy(p, src, bytes);
+    return p;
+}
+
+/*
+    Copy the polygon into the arena as polygon_copy would copy it, normals included:
+    a polygon given without normals gets the ones polygon_setNormals makes.
+    Returns 0 if the arena is out of memory.
+ */
+static int arenaPolygon(Arena *arena, Polygon *to, Polygon *from) {
+    int n = from->vertex ? from->nVertex : 0;
+
+    polygon_init(to);
+    to->oneSided = from->oneSided;
+    to->zBuffer = from->zBuffer;
+    if (n == 0) return 1;
+    to->nVertex = n;
+    to->vertex = arenaCopy(arena, from->vertex, sizeof(Point) * n);
+    to->color = arenaCopy(arena, from->color, sizeof(Color) * n);
+    if (from->normal) {
+        to->normal = arenaCopy(arena, from->normal, sizeof(Vector) * n);
+    } else if (to->vertex) {
+        Polygon made;
+        polygon_init(&made);
+        made.nVertex = n;
+        made.vertex = to->vertex;
+        polygon_setNormals(&made, n, NULL);
+        to->normal = arenaCopy(arena, made.normal, sizeof(Vector) * n);
+        free(made.normal);
+    }
+    return to->vertex && (!from->color || to->color) && to->normal;
+}
+
+/* Copy the mesh into the arena as mesh_copy would copy it. Returns 0 if the arena is out of memory. */
+static int arenaMesh(Arena *arena, Mesh *to, Mesh *from) {
+    mesh_init(to);
+    to->oneSided = from->oneSided;
+    to->zBuffer = from->zBuffer;
+    if (!from->vertex || !from->faceStart || !from->index) return 1;
+    to->vertex = arenaCopy(arena, from->vertex, sizeof(Point) * from->nVertex);
+    to->normal = arenaCopy(arena, from->normal, sizeof(Vector) * from->nVertex);
+    to->color = arenaCopy(arena, from->color, sizeof(Color) * from->nVertex);
+    to->faceStart = arenaCopy(arena, from->faceStart, sizeof(int) * (from->nFace + 1));
+    to->index = arenaCopy(arena, from->index, sizeof(int) * from->faceStart[from->nFace]);
+    if (!to->vertex || !to->faceStart || !to->index || (from->normal && !to->normal) || (from->color && !to->color)) return 0;
+    to->nVertex = from->nVertex;
+    to->nFace = from->nFace;
+    return 1;
+}
+
+/*
+    Make an Element holding a duplicate of obj, in the arena with its arrays if arena is
+    not NULL, otherwise on the heap. Returns NULL if it cannot be allocated.
+ */
+static Element *elementMake(ObjectType type, void *obj, Arena *arena) {
+	Element *e = elementAlloc(type, arena);
     if (!e) return NULL;
 
-    e->type = type;
     switch(type) {
         case ObjLine:
-            line_copy(&e->obj.line, (Line *)obj);
+            line_copy(&e->obj->line, (Line *)obj);
             break;
         case ObjPoint:
-            point_copy(&e->obj.point, (Point *)obj);
+            point_copy(&e->obj->point, (Point *)obj);
             break;
         case ObjPolyline:
-            polyline_init(&e->obj.polyline);
-            polyline_copy(&e->obj.polyline, (Polyline *)obj);
+            polyline_init(&e->obj->polyline);
+            if (arena) {
+                Polyline *from = (Polyline *)obj;
+                e->obj->polyline.zBuffer = from->zBuffer;
+                e->obj->polyline.numVertex = from->numVertex;
+                e->obj->polyline.vertex = arenaCopy(arena, from->vertex, sizeof(Point) * from->numVertex);
+                if (from->numVertex > 0 && !e->obj->polyline.vertex) return NULL;
+            } else {
+                polyline_copy(&e->obj->polyline, (Polyline *)obj);
+            }
             break;
         case ObjPolygon:
-            polygon_init(&e->obj.polygon);
-            polygon_copy(&e->obj.polygon, (Polygon *)obj);
+            if (arena) {
+                if (!arenaPolygon(arena, &e->obj->polygon, (Polygon *)obj)) return NULL;
+            } else {
+                polygon_init(&e->obj->polygon);
+                polygon_copy(&e->obj->polygon, (Polygon *)obj);
+            }
+            break;
+        case ObjMesh:
+            if (arena) {
+                if (!arenaMesh(arena, &e->obj->mesh, (Mesh *)obj)) return NULL;
+            } else {
+                mesh_init(&e->obj->mesh);
+                mesh_copy(&e->obj->mesh, (Mesh *)obj);
+            }
+            break;
+        case ObjSharedMesh:
+            e->obj->sharedMesh = sharedMesh_retain((SharedMesh *)obj); // shared, only referenced
+            break;
+        case ObjMeshLOD:
+            e->obj->meshLOD = meshLOD_retain((MeshLOD *)obj); // shared, only referenced
             break;
 		case ObjBezierCurve:
-			bezierCurve_copy(&e->obj.bezierCurve, (BezierCurve*)obj);
+			bezierCurve_copy(&e->obj->bezierCurve, (BezierCurve*)obj);
 			break;
 		case ObjBezierSurface:
-			bezierSurface_copy(&e->obj.bezierSurface, (BezierSurface*)obj);
+			bezierSurface_copy(&e->obj->bezierSurface, (BezierSurface*)obj);
 			break;
         case ObjMatrix:
-            matrix_copy(&e->obj.matrix, (Matrix *)obj);
+            matrix_copy(&e->obj->matrix, (Matrix *)obj);
             break;
         case ObjColor:
         case ObjBodyColor:
         case ObjSurfaceColor:
-            color_copy(&e->obj.color, (Color *)obj);
+            color_copy(&e->obj->color, (Color *)obj);
             break;
         case ObjSurfaceCoeff:
-            e->obj.coeff = *(float *)obj;  // Simple assignment for float
+            e->obj->coeff = *(float *)obj;  // Simple assignment for float
             break;
         case ObjModule:
-            e->obj.module = obj; // Modules don't get duplicated
+            e->obj->module = obj; // Modules don't get duplicated
+            break;
+        case ObjInstances: {
+            // the module is referenced, the per-instance arrays are copied
+            Instances *from = (Instances *)obj;
+            size_t matrices = sizeof(Matrix) * from->count, colors = sizeof(Color) * from->count;
+            e->obj->instances = *from;
+            if (arena) {
+                e->obj->instances.matrix = arenaCopy(arena, from->matrix, matrices);
+                e->obj->instances.body = arenaCopy(arena, from->body, colors);
+            } else {
+                e->obj->instances.matrix = malloc(matrices);
+                e->obj->instances.body = from->body ? malloc(colors) : NULL;
+                if (e->obj->instances.matrix) memcpy(e->obj->instances.matrix, from->matrix, matrices);
+                if (e->obj->instances.body) memcpy(e->obj->instances.body, from->body, colors);
+            }
+            if (!e->obj->instances.matrix || (from->body && !e->obj->instances.body)) {
+                if (!arena) {
+                    free(e->obj->instances.matrix);
+                    free(e->obj->instances.body);
+                    free(e);
+                }
+                return NULL;
+            }
             break;
+        }
 		case ObjIdentity:
-			matrix_copy(&e->obj.identity, (Matrix *)obj);
-			break;
+			break; // nothing to store, the identity is implied by the type
         default:
-            element_delete(e);
+            if (!arena) free(e);
             return NULL;
     }
     return e;
 }
 
+/* bytes of heap memory held by an Element made by element_init and the arrays it owns. */
+static size_t elementMemory(Element *e) {
+    size_t bytes = element_bytes(e->type);
+
+    switch (e->type) {
+        case ObjPolyline:
+            bytes += sizeof(Point) * e->obj->polyline.numVertex;
+            break;
+        case ObjPolygon:
+            bytes += sizeof(Point) * e->obj->polygon.nVertex;
+            if (e->obj->polygon.normal) bytes += sizeof(Vector) * e->obj->polygon.nVertex;
+            if (e->obj->polygon.color) bytes += sizeof(Color) * e->obj->polygon.nVertex;
+            break;
+        case ObjMesh:
+            bytes += sizeof(Point) * e->obj->mesh.nVertex;
+            if (e->obj->mesh.normal) bytes += sizeof(Vector) * e->obj->mesh.nVertex;
+            if (e->obj->mesh.color) bytes += sizeof(Color) * e->obj->mesh.nVertex;
+            if (e->obj->mesh.faceStart) bytes += sizeof(int) * (e->obj->mesh.nFace + 1 + e->obj->mesh.faceStart[e->obj->mesh.nFace]);
+            break;
+        case ObjInstances:
+            bytes += sizeof(Matrix) * e->obj->instances.count;
+            if (e->obj->instances.body) bytes += sizeof(Color) * e->obj->instances.count;
+            break;
+        default:
+            break;
+    }
+    return bytes;
+}
+
+/* link e in at the tail of the module's list. */
+static void moduleAppend(Module *md, Element *e) {
+    if (!md->head) {
+        md->head = md->tail = e;
+    } else {
+        md->tail->next = e;
+        md->tail = e;
+    }
+    e->next = NULL;
+    md->version = ++moduleEpoch;
+}
+
+/* note that module_clear must give back what e holds. Returns 0 if the arena is out of memory. */
+static int moduleRelease(Module *md, Element *e, int owned) {
+    ModuleRelease *r = arena_alloc(&md->arena, sizeof(ModuleRelease));
+    if (!r) return 0;
+    r->e = e;
+    r->owned = owned;
+    r->next = md->release;
+    md->release = r;
+    return 1;
+}
+
+/*
+    Add a duplicate of obj to the tail of the module's list, stored with its arrays in
+    the module's arena. This is what the module_* functions use to add their objects.
+ */
+static void moduleAdd(Module *md, ObjectType type, void *obj) {
+    Element *e = elementMake(type, obj, &md->arena);
+    if (!e) return;
+    // shared objects are referenced, the reference is given back when the module is cleared
+    if (type == ObjSharedMesh || type == ObjMeshLOD) {
+        if (!moduleRelease(md, e, 0)) {
+            if (type == ObjSharedMesh) sharedMesh_release(e->obj->sharedMesh);
+            else meshLOD_release(e->obj->meshLOD);
+            return;
+        }
+    }
+    moduleAppend(md, e);
+}
+
+/* 2D and Generic Module Functions */
+
+/* Allocate and return an initialized but empty Element, large enough to hold any type of object. */
+Element *element_create(void) {
+	Element *e = malloc(sizeof(Element) + sizeof(Object));
+    if (e) {
+        e->type = ObjNone;
+        e->obj->module = NULL;
+        e->next = NULL;
+    }
+    return e;
+}
+
+/* bytes of an Element made by element_init for an object of the given type, excluding arrays it points to. */
+size_t element_bytes(ObjectType type) {
+    return sizeof(Element) + objectBytes(type);
+}
+
+/* Allocate an Element and store a duplicate of the data pointed to by obj in the Element. 
+ * Modules do not get duplicated.
+ * The module_* functions store their Elements in the module's arena instead, see moduleAdd.
+*/
+Element *element_init(ObjectType type, void *obj) {
+    return elementMake(type, obj, NULL);
+}
+
 /* free the element and the object it contains, as appropriate.*/
 void element_delete(Element *e) {
 	if (e) {
         if (e->type == ObjPolyline) {
-            polyline_clear(&(e->obj.polyline));
+            polyline_clear(&(e->obj->polyline));
         } else if (e->type == ObjPolygon) {
-            polygon_clear(&(e->obj.polygon));
-        } else if (e->type == ObjModule) {
-			return;
-		} else {
-        	free(e);
-		}
+            polygon_clear(&(e->obj->polygon));
+        } else if (e->type == ObjMesh) {
+            mesh_clear(&(e->obj->mesh));
+        } else if (e->type == ObjSharedMesh) {
+            sharedMesh_release(e->obj->sharedMesh);
+        } else if (e->type == ObjMeshLOD) {
+            meshLOD_release(e->obj->meshLOD);
+        } else if (e->type == ObjInstances) {
+            free(e->obj->instances.matrix);
+            free(e->obj->instances.body);
+        }
+        // a sub-module is only referenced, so only the element itself is freed
+        free(e);
     }
 }
 
@@ -93,109 +338,168 @@ Module *module_create(void) {
     if (md) {
         md->head = NULL;
         md->tail = NULL;
+        md->version = ++moduleEpoch;
+        md->bounds.empty = 1;
+        md->bounds.version = 0;
+        md->bounds.epoch = 0;
+        arena_init(&md->arena);
+        md->release = NULL;
     }
     return md;
 }
 
-/* clear the module’s list of Elements, freeing memory as appropriate. */
+/**
+ * clear the module's list of Elements, freeing memory as appropriate. Only the Elements
+ * that reference shared meshes or LODs or were added with module_insert are visited;
+ * the rest go with their arena in one step, and its blocks are kept for the Elements
+ * added next.
+ */
 void module_clear(Module *md) {
+    ModuleRelease *r;
+
 	if (!md) return;
-    Element *current = md->head;
-    while (current) {
-        Element *next = current->next;
-        element_delete(current);
-        current = next;
+    for (r = md->release; r; r = r->next) {
+        if (r->owned) element_delete(r->e);
+        else if (r->e->type == ObjSharedMesh) sharedMesh_release(r->e->obj->sharedMesh);
+        else meshLOD_release(r->e->obj->meshLOD);
     }
+    arena_reset(&md->arena);
+    md->release = NULL;
     md->head = md->tail = NULL;
+    md->version = ++moduleEpoch;
 }
 
 /* Free all of the memory associated with a module, including the memory pointed to by md. */
 void module_delete(Module *md) {
 	if (md) {
         module_clear(md);
+        arena_free(&md->arena);
         free(md);
     }
 }
 
-/* Generic insert of an element into the module at the tail of the list. */
+/**
+ * Return the bytes of memory held by the module: its arena, which holds the Elements
+ * added by the module_* functions and their arrays, and the Elements added with
+ * module_insert. Sub-modules and shared meshes and LODs are not counted.
+ */
+size_t module_memory(Module *md) {
+    ModuleRelease *r;
+    size_t bytes;
+
+    if (!md) return 0;
+    bytes = sizeof(Module) + md->arena.held;
+    for (r = md->release; r; r = r->next) {
+        if (r->owned) bytes += elementMemory(r->e);
+    }
+    return bytes;
+}
+
+/**
+ * Generic insert of an element into the module at the tail of the list. The module
+ * takes e over and frees it with element_delete when it is cleared, so e must come
+ * from element_create or element_init.
+ */
 void module_insert(Module *md, Element *e) {
 	if (!md || !e) return;
-    if (!md->head) {
-        md->head = md->tail = e;
-    } else {
-        md->tail->next = e;
-        md->tail = e;
+    if (!moduleRelease(md, e, 1)) {
+        element_delete(e);
+        return;
     }
-    e->next = NULL;
+    moduleAppend(md, e);
 }
 
 /* Adds a pointer to the Module sub to the tail of the module’s list. */
 void module_module(Module *md, Module *sub) {
 	if (!md || !sub) return;
-    Element *e = element_init(ObjModule, sub);
-    if (e) module_insert(md, e);
+    moduleAdd(md, ObjModule, sub);
+}
+
+/**
+ * Adds count instances of the Module sub to the tail of the module's list, instance i
+ * drawn as if by module_module under the LTM in effect times matrix[i], with body[i]
+ * as its body color unless body is NULL. The arrays are copied, sub is referenced.
+ */
+void module_instances(Module *md, Module *sub, Matrix *matrix, Color *body, int count) {
+    Instances in;
+	if (!md || !sub || !matrix || count <= 0) return;
+    in.module = sub;
+    in.count = count;
+    in.matrix = matrix;
+    in.body = body;
+    moduleAdd(md, ObjInstances, &in);
 }
 
 /* Adds p to the tail of the module’s list. */
 void module_point(Module *md, Point *p) {
 	if (!md || !p) return;
-    Element *e = element_init(ObjPoint, p);
-    if (e) module_insert(md, e);
+    moduleAdd(md, ObjPoint, p);
 }
 
 /* Adds p to the tail of the module’s list. */
 void module_line(Module *md, Line *p) {
 	if (!md || !p) return;
-    Element *e = element_init(ObjLine, p);
-    if (e) module_insert(md, e);
+    moduleAdd(md, ObjLine, p);
 }
 
 /*  Adds p to the tail of the module’s list. */
 void module_polyline(Module *md, Polyline *p) {
 	if (!md || !p) return;
-    Element *e = element_init(ObjPolyline, p);
-    if (e) module_insert(md, e);
+    moduleAdd(md, ObjPolyline, p);
 }
 
 /* Adds p to the tail of the module’s list. */
 void module_polygon(Module *md, Polygon *p) {
 	if (!md || !p) return;
-    Element *e = element_init(ObjPolygon, p);
-    if (e) module_insert(md, e);
+    moduleAdd(md, ObjPolygon, p);
+}
+
+/* Adds a copy of the mesh m to the tail of the module's list. */
+void module_mesh(Module *md, Mesh *m) {
+	if (!md || !m) return;
+    moduleAdd(md, ObjMesh, m);
+}
+
+/* add a reference to the shared mesh s to the module, without copying it. */
+void module_sharedMesh(Module *md, SharedMesh *s) {
+	if (!md || !s) return;
+    moduleAdd(md, ObjSharedMesh, s);
+}
+
+/* add a reference to the levels of detail lod to the module, drawn at the level its screen size calls for. */
+void module_meshLOD(Module *md, MeshLOD *lod) {
+	if (!md || !lod) return;
+    moduleAdd(md, ObjMeshLOD, lod);
 }
 
 /**
- * use the de Casteljau algorithm to subdivide the Bezier curve divisions times, 
- * then add the lines connecting the control points to the module.
+ * add the Bezier curve to the module, drawn as 2^divisions segments found by forward
+ * differencing, or subdivided until flat to within half a pixel if divisions is 0.
  */
 void module_bezierCurve(Module *m, BezierCurve *b, int divisions) {
 	if (!m || !b) return;
-	Element *e = element_init(ObjBezierCurve, b);
-	if (e) module_insert(m, e);
+	bezierCurve_setDivisions(b, divisions);
+	moduleAdd(m, ObjBezierCurve, b);
 }
 
 /**
  * use the de Casteljau algorithm to subdivide the Bezier surface divisions times.
  * Add to the module either the lines connecting the control points, if solid is 0.
- * or triangles using the four corner control points if solid is number other than 0.
+ * or, if solid is number other than 0, a shaded triangle mesh evaluated on a grid with
+ * analytic normals, with as many cells as the patch needs on the screen up to
+ * 2^divisions in each direction.
  */
 void module_bezierSurface(Module *m, BezierSurface *b, int divisions, int solid) {
 	if (!m || !b) return;
 	bezierSurface_setDivisions(b, divisions);
 	bezierSurface_setSolid(b, solid);
-	Element *e = element_init(ObjBezierSurface, b);
-	if (e) module_insert(m, e);
+	moduleAdd(m, ObjBezierSurface, b);
 }
 
 /* Object that sets the current transform to the identity, placed at the tail of the module’s list. */
 void module_identity(Module *md) {
 	if (!md) return;
-	Matrix m;
-	matrix_identity(&m);
-    Element *e = element_init(ObjIdentity, &m);
-    if (e) {
-		module_insert(md, e);
-	}
+    moduleAdd(md, ObjIdentity, NULL);
 }
 
 /* Matrix operand to add a translation matrix to the tail of the module’s list. */
@@ -204,8 +508,7 @@ void module_translate2D(Module *md, double tx, double ty) {
     Matrix m;
     matrix_identity(&m);
     matrix_translate2D(&m, tx, ty);
-    Element *e = element_init(ObjMatrix, &m);
-    if (e) module_insert(md, e);
+    moduleAdd(md, ObjMatrix, &m);
 }
 
 /* Matrix operand to add a scale matrix to the tail of the module’s list. */
@@ -214,8 +517,7 @@ void module_scale2D(Module *md, double sx, double sy) {
     Matrix m;
     matrix_identity(&m);
     matrix_scale2D(&m, sx, sy);
-    Element *e = element_init(ObjMatrix, &m);
-    if (e) module_insert(md, e);
+    moduleAdd(md, ObjMatrix, &m);
 }
 
 /*  Matrix operand to add a rotation about the Z axis to the tail of the module’s list */
@@ -224,8 +526,7 @@ void module_rotateZ(Module *md, double cth, double sth) {
     Matrix m;
     matrix_identity(&m);
     matrix_rotateZ(&m, cth, sth);
-    Element *e = element_init(ObjMatrix, &m);
-    if (e) module_insert(md, e);
+    moduleAdd(md, ObjMatrix, &m);
 }
 
 
@@ -235,220 +536,1939 @@ void module_shear2D(Module *md, double shx, double shy) {
     Matrix m;
     matrix_identity(&m);
     matrix_shear2D(&m, shx, shy);
-    Element *e = element_init(ObjMatrix, &m);
-    if (e) module_insert(md, e);
+    moduleAdd(md, ObjMatrix, &m);
 }
 
-/**
- * Draw the module into the image using the given 
- * view transformation matrix [VTM],
- * Lighting and
- * DrawState 
- * by traversing the list of Elements. 
- * (For now, Lighting can be an empty structure.)
+/*
+    Screen bounding box of n normalized points, grown by a pixel on each side so
+    it covers every pixel the rasterizers may touch. box is xmin, ymin, xmax, ymax.
  */
-void module_draw(Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *lighting, Image *src) {
-    if (!md || !VTM || !GTM || !ds || !src) return;
-    
-    Matrix LTM;
-    Element *e;
-    
-    matrix_identity(&LTM);
-    
-    for (e = md->head; e != NULL; e = e->next) {
-        switch(e->type) {
-            case ObjColor:
-                ds->color = e->obj.color;
-                break;
-
-            case ObjBodyColor:
-                ds->body = e->obj.color;
-                break;
+static void screenBox(Point *v, int n, float *box) {
+    int i;
+    box[0] = box[2] = v[0].val[0];
+    box[1] = box[3] = v[0].val[1];
+    for (i = 1; i < n; i++) {
+        if (v[i].val[0] < box[0]) box[0] = v[i].val[0];
+        if (v[i].val[0] > box[2]) box[2] = v[i].val[0];
+        if (v[i].val[1] < box[1]) box[1] = v[i].val[1];
+        if (v[i].val[1] > box[3]) box[3] = v[i].val[1];
+    }
+    box[0] -= 1;
+    box[1] -= 1;
+    box[2] += 1;
+    box[3] += 1;
+}
 
-            case ObjSurfaceColor:
-                ds->surface = e->obj.color;
-                break;
-            
-            case ObjSurfaceCoeff:
-                ds->surfaceCoeff = e->obj.coeff;
-                break;
-            
-            case ObjPoint: {
-                Point temp;
-                matrix_xformPoint(&LTM, &e->obj.point, &temp);
-                matrix_xformPoint(GTM, &temp, &temp);
-                matrix_xformPoint(VTM, &temp, &temp);
-                point_normalize(&temp);
-                if (0 <= temp.val[0] && temp.val[0] < src->cols && 0 <= temp.val[1] && temp.val[1] < src->rows) {
-                    point_draw(&temp, src, ds->color);
-                }
-                break;
-            }
+/*
+    Test n normalized screen points against the depth pyramid of the DrawState and
+    fill in their screen box. Returns 1 if everything inside the points' box is hidden.
+    Points at or behind the viewer are never tested.
+ */
+static int hizOccluded(DrawState *ds, Point *v, int n, float *box) {
+    float zNear = 0;
+    int i, hidden;
+
+    screenBox(v, n, box);
+    if (!ds->zBufferFlag) return 0;
+    for (i = 0; i < n; i++) {
+        if (v[i].val[2] <= 0) return 0;
+        if (1.0f / v[i].val[2] > zNear) zNear = 1.0f / v[i].val[2];
+    }
+    hidden = depthPyramid_occluded(ds->hiz, box[0], box[1], box[2], box[3], zNear);
+    drawStats.hizTests++;
+    if (hidden) drawStats.hizHits++;
+    else drawStats.hizMisses++;
+    return hidden;
+}
 
-            case ObjLine: {
-                Line temp;
-				line_copy(&temp, &e->obj.line);
-                matrix_xformLine(&LTM, &temp);
-                matrix_xformLine(GTM, &temp);
-                matrix_xformLine(VTM, &temp);
-                line_normalize(&temp);
-                line_draw(&temp, src, ds->color);
-                break;
-            }
+/* mark the screen box of n normalized points dirty in the DrawState's depth pyramid, if any. */
+static void hizMark(DrawState *ds, Point *v, int n) {
+    float box[4];
+    if (!ds->hiz || n < 1) return;
+    screenBox(v, n, box);
+    depthPyramid_markDirty(ds->hiz, box[0], box[1], box[2], box[3]);
+}
 
-            case ObjPolyline: {
-                Polyline temp;
-				polyline_init(&temp);
-                polyline_copy(&temp, &e->obj.polyline);
-                matrix_xformPolyline(&LTM, &temp);
-                matrix_xformPolyline(GTM, &temp);
-                matrix_xformPolyline(VTM, &temp);
-                polyline_normalize(&temp);
-                polyline_draw(&temp, src, ds->color);
-                polyline_clear(&temp);
-                break;
-            }
+/* whether the shading method lights vertices in world space. */
+static int shadeLit(ShadeMethod shade) {
+    return shade == ShadeFlat || shade == ShadeGouraud || shade == ShadePhong;
+}
 
-            case ObjPolygon: {
-                Polygon temp;
-				polygon_init(&temp);
-                polygon_copy(&temp, &e->obj.polygon);
-                matrix_xformPolygon(&LTM, &temp);
-                matrix_xformPolygon(GTM, &temp);
-                
-                if (ds->shade == ShadeGouraud || ds->shade == ShadePhong) {
-                    printf("shading polygon\n");
-                    polygon_shade(&temp, ds, lighting);
-                }
-                matrix_xformPolygon(VTM, &temp);
-                polygon_normalize(&temp);
-                polygon_drawShade(&temp, src, ds, lighting);
-                polygon_clear(&temp);
-                break;
-            }
+/* set the flat fill color of the DrawState to the average of the n vertex colors. */
+static void flatColor(DrawState *ds, Color *c, int n) {
+    int i;
+    color_set(&ds->flatColor, 0, 0, 0);
+    for (i = 0; i < n; i++) {
+        ds->flatColor.c[0] += c[i].c[0] / n;
+        ds->flatColor.c[1] += c[i].c[1] / n;
+        ds->flatColor.c[2] += c[i].c[2] / n;
+    }
+}
 
-			case ObjBezierCurve: {
-				BezierCurve temp; 
-				bezierCurve_init(&temp);
-				bezierCurve_copy(&temp, &e->obj.bezierCurve);
-				matrix_xformBezierCurve(&LTM, &temp);
-                matrix_xformBezierCurve(GTM, &temp);
-                matrix_xformBezierCurve(VTM, &temp);
-				bezierCurve_normalize(&temp);
-				bezierCurve_draw(&temp, src, ds->color);
-				break;
-			}
-
-			case ObjBezierSurface: {
-				BezierSurface temp;
-				bezierSurface_init(&temp);
-				bezierSurface_copy(&temp, &e->obj.bezierSurface);
-				matrix_xformBezierSurface(&LTM, &temp);
-                matrix_xformBezierSurface(GTM, &temp);
-                matrix_xformBezierSurface(VTM, &temp);
-				bezierSurface_normalize(&temp);
-				bezierSurface_drawLines(&temp, src, ds->color);
-				break;
-			}
+/*
+    Depth-only drawing of a polygon already in screen coordinates: recorded if the
+    DrawState has a draw list, skipped if the depth pyramid hides it, counted into the
+    active occlusion query if there is one, otherwise written to the depth plane.
+ */
+static void drawDepthOnly(DrawState *ds, Polygon *p, Image *src) {
+    float box[4];
+    if (ds->drawList) {
+        drawList_depth(ds->drawList, p);
+    } else if (ds->hiz && p->nVertex > 0) {
+        if (hizOccluded(ds, p->vertex, p->nVertex, box)) {
+            drawStats.hizPolygonsCulled++;
+        } else if (ds->query) {
+            ds->query->samples += polygon_countDepth(p, src, ds->scratch);
+        } else {
+            polygon_drawDepth(p, src, ds->scratch);
+            depthPyramid_markDirty(ds->hiz, box[0], box[1], box[2], box[3]);
+        }
+    } else if (ds->query) {
+        ds->query->samples += polygon_countDepth(p, src, ds->scratch);
+    } else {
+        polygon_drawDepth(p, src, ds->scratch);
+    }
+}
 
-            case ObjMatrix:
-                matrix_multiply(&e->obj.matrix, &LTM, &LTM);
-                break;
+/*
+    fill or frame a polygon already in screen coordinates. With ds->drawList it is recorded,
+    transformed and shaded, in drawing order instead, as every primitive is, for drawList_draw.
+ */
+static void drawShaded(Polygon *p, DrawState *ds, Lighting *lighting, Image *src) {
+    if (ds->drawList) drawList_polygon(ds->drawList, p, ds);
+    else polygon_drawShade(p, src, ds, lighting);
+}
 
-			case ObjIdentity: {
-				matrix_identity(&LTM);
-				break;
-			}
+/* set up the vertex cache as vertexCache_init would, with its arrays in the scratch arena. */
+static int scratchCache(VertexCache *vc, int size, int nVertex, Arena *scratch) {
+    if (size <= 0 || size > nVertex) size = nVertex;
+    vc->size = size;
+    vc->nVertex = nVertex;
+    vc->slot = arena_alloc(scratch, sizeof(int) * nVertex);
+    vc->tag = arena_alloc(scratch, sizeof(int) * size);
+    vc->clip = arena_alloc(scratch, sizeof(Point) * size);
+    vc->screen = arena_alloc(scratch, sizeof(Point) * size);
+    vc->color = arena_alloc(scratch, sizeof(Color) * size);
+    vc->shaded = arena_alloc(scratch, size);
+    vc->face = arena_alloc(scratch, sizeof(int) * size);
+    if (!vc->slot || !vc->tag || !vc->clip || !vc->screen || !vc->color || !vc->shaded || !vc->face) return 0;
+    vertexCache_reset(vc);
+    return 1;
+}
 
-            case ObjModule: {
-                Matrix GTMpass;
-                DrawState tempDS;
-                
-                matrix_multiply(GTM, &LTM, &GTMpass);
-                drawstate_copy(&tempDS, ds);
-                module_draw(e->obj.module, VTM, &GTMpass, &tempDS, lighting, src); 
-                break;
+/*
+    Draw an indexed mesh. Faces are put together from a post-transform cache keyed
+    by vertex index with ds->vertexCacheSize entries: a vertex goes to the screen
+    through all the first time a face uses it and is taken from the cache while it
+    stays there. For flat, Gouraud and Phong shading a cached vertex is also lit once
+    in world space, with its normal taken through normalXform, the first time a face
+    using it is actually drawn, so faces the depth pyramid skips are never lit. When
+    worldVertex is not NULL the world space vertices and unit normals are taken from
+    it and worldNormal instead.
+    Flat shading fills each face with the average of its vertex colors.
+ */
+static void meshDraw(Mesh *mesh, Matrix *world, Matrix *all, Matrix *normalXform, Point *worldVertex, Vector *worldNormal,
+                     DrawState *ds, Lighting *lighting, Image *src) {
+    VertexCache cache;
+    Point *vertex;
+    Color *color = NULL;
+    Polygon face;
+    int *entry;
+    int i, j, f, hit, size, maxFace = 0, lit;
+
+    if (mesh->nVertex < 1 || mesh->nFace < 1) return;
+    for (f = 0; f < mesh->nFace; f++) {
+        if (mesh->faceStart[f + 1] - mesh->faceStart[f] > maxFace) maxFace = mesh->faceStart[f + 1] - mesh->faceStart[f];
+    }
+    // a face must fit in the cache, the entries it has looked up are not replaced until the next face
+    size = ds->vertexCacheSize;
+    if (size > 0 && size < maxFace) size = maxFace;
+    if (!scratchCache(&cache, size, mesh->nVertex, ds->scratch)) return;
+    lit = shadeLit(ds->shade) && lighting && mesh->normal;
+
+    vertex = arena_alloc(ds->scratch, sizeof(Point) * maxFace);
+    entry = arena_alloc(ds->scratch, sizeof(int) * maxFace);
+    if (lit) color = arena_alloc(ds->scratch, sizeof(Color) * maxFace);
+    polygon_init(&face);
+    face.vertex = vertex;
+    face.color = color;
+    face.oneSided = mesh->oneSided;
+    face.zBuffer = mesh->zBuffer;
+    for (f = 0; vertex && entry && (color || !lit) && f < mesh->nFace; f++) {
+        int *v = &mesh->index[mesh->faceStart[f]];
+        face.nVertex = mesh->faceStart[f + 1] - mesh->faceStart[f];
+        vertexCache_nextFace(&cache);
+        for (j = 0; j < face.nVertex; j++) {
+            i = entry[j] = vertexCache_lookup(&cache, v[j], &hit);
+            if (!hit) {
+                matrix_xformPoint(all, &mesh->vertex[v[j]], &cache.clip[i]);
+                cache.screen[i] = cache.clip[i];
+                point_normalize(&cache.screen[i]);
+                drawStats.vertexTransforms++;
+                drawStats.meshVertices++;
+            }
+            vertex[j] = cache.screen[i];
+        }
+        drawStats.meshFaces++;
+        if (ds->shade == ShadeDepthOnly) {
+            drawDepthOnly(ds, &face, src);
+            continue;
+        }
+        if (ds->hiz && face.nVertex > 0) {
+            float box[4];
+            if (hizOccluded(ds, vertex, face.nVertex, box)) {
+                drawStats.hizPolygonsCulled++;
+                continue;
             }
+        }
+        for (j = 0; lit && j < face.nVertex; j++) {
+            i = entry[j];
+            if (!cache.shaded[i]) {
+                Point p;
+                Vector N, V;
+                if (worldVertex) {
+                    p = worldVertex[v[j]];
+                    N = worldNormal[v[j]];
+                } else {
+                    matrix_xformPoint(world, &mesh->vertex[v[j]], &p);
+                    matrix_xformVector(normalXform, &mesh->normal[v[j]], &N);
+                    vector_normalize(&N);
+                    drawStats.vertexTransforms++;
+                }
+                vector_set(&V, ds->viewer.val[0] - p.val[0], ds->viewer.val[1] - p.val[1], ds->viewer.val[2] - p.val[2]);
+                vector_normalize(&V);
+                lighting_shadingUnit(lighting, &N, &V, &p, mesh->color ? &mesh->color[v[j]] : &ds->body,
+                                     &ds->surface, ds->surfaceCoeff, mesh->oneSided, &cache.color[i]);
+                cache.shaded[i] = 1;
+                drawStats.meshVerticesShaded++;
+            }
+            color[j] = cache.color[i];
+        }
+        if (lit && ds->shade == ShadeFlat) flatColor(ds, color, face.nVertex);
+        drawShaded(&face, ds, lighting, src);
+        hizMark(ds, vertex, face.nVertex);
+    }
+    drawStats.meshCacheLookups += cache.lookups;
+    drawStats.meshCacheHits += cache.hits;
+    drawStats.meshCacheHitRate = vertexCache_hitRate(&cache);
+}
 
-            default:
-                break;
+/*
+    Grid of a solid Bezier patch drawn through all. Along each direction the longest
+    row or column of the control net, which is never shorter than the curve, is cut
+    into a power of two of pieces no longer than BEZIER_PATCH_PIXELS on the screen,
+    with at most 2^divisions cells. Patches reaching behind the viewer get the most
+    cells. The grid is the LOD bucket the tessellation cache keys patches by.
+ */
+#define BEZIER_PATCH_PIXELS 8.0f
+static void patchGrid(BezierSurface *b, Matrix *all, int *nu, int *nv) {
+    Point screen[4][4];
+    float lu = 0, lv = 0;
+    int i, j, cap = 1 << (b->divisions < 0 ? 0 : b->divisions > 8 ? 8 : b->divisions);
+
+    *nu = *nv = cap;
+    for (i = 0; i < 4; i++) {
+        for (j = 0; j < 4; j++) {
+            matrix_xformPoint(all, &b->vertex[i][j], &screen[i][j]);
+            if (screen[i][j].val[3] <= 0) return;
+            point_normalize(&screen[i][j]);
+        }
+    }
+    drawStats.vertexTransforms += 16;
+    for (i = 0; i < 4; i++) {
+        float row = 0, col = 0;
+        for (j = 0; j < 3; j++) {
+            row += hypotf(screen[i][j + 1].val[0] - screen[i][j].val[0], screen[i][j + 1].val[1] - screen[i][j].val[1]);
+            col += hypotf(screen[j + 1][i].val[0] - screen[j][i].val[0], screen[j + 1][i].val[1] - screen[j][i].val[1]);
         }
+        if (row > lu) lu = row;
+        if (col > lv) lv = col;
     }
+    // round up to a power of two so small camera moves stay in the same LOD bucket
+    for (*nu = 1; *nu < cap && *nu * BEZIER_PATCH_PIXELS < lu; *nu *= 2);
+    for (*nv = 1; *nv < cap && *nv * BEZIER_PATCH_PIXELS < lv; *nv *= 2);
 }
 
-/* 3D Module Functions */
+// transforms of the module being drawn, kept across its elements and composed only when needed
+typedef struct {
+    Matrix *VTM; // view transformation
+    Matrix *GTM; // transformation of the parent module
+    Matrix LTM; // product of the module's matrix elements so far
+    Matrix world; // GTM * LTM, valid while current is set
+    Matrix all; // VTM * world, valid while current is set
+    Matrix normalXform; // inverse transpose of world, valid while normalCurrent is set
+    int current;
+    int normalCurrent;
+    Point *worldVertex; // world space vertices of the element being drawn from the world cache, NULL if not cached
+    Vector *worldNormal; // unit world space normals of the element being drawn, with worldVertex
+} DrawXform;
+
+/* start the transforms of a module drawn under VTM and GTM. */
+static void xformInit(DrawXform *x, Matrix *VTM, Matrix *GTM) {
+    x->VTM = VTM;
+    x->GTM = GTM;
+    matrix_identity(&x->LTM);
+    x->current = x->normalCurrent = 0;
+    x->worldVertex = NULL;
+    x->worldNormal = NULL;
+}
 
-/* Matrix operand to add a 3D translation to the Module. */
-void module_translate(Module *md, double tx, double ty, double tz) {
-    if (!md) return;
-    Matrix m;
-    matrix_identity(&m);
-    matrix_translate(&m, tx, ty, tz);
-    Element *e = element_init(ObjMatrix, &m);
-    if (e) module_insert(md, e);
+/*
+    Bring the composed transforms up to date unless current is already set:
+    world = GTM * LTM takes the module's coordinates to world space and
+    all = VTM * world takes them straight to the screen. They are rebuilt only
+    after a transform element, so every vertex goes to the screen in one transform.
+ */
+static void xformCompose(DrawXform *x) {
+    if (x->current) return;
+    matrix_multiply(x->GTM, &x->LTM, &x->world);
+    matrix_multiply(x->VTM, &x->world, &x->all);
+    drawStats.matrixMultiplies += 2;
+    x->current = 1;
 }
-/* Matrix operand to add a 3D scale to the Module. */
-void module_scale(Module *md, double sx, double sy, double sz) {
-	if (!md) return;
-    Matrix m;
-    matrix_identity(&m);
-    matrix_scale(&m, sx, sy, sz);
-    Element *e = element_init(ObjMatrix, &m);
-    if (e) module_insert(md, e);
+
+/* bring the normal transform up to date for shading, after the composed transforms. */
+static void xformNormal(DrawXform *x) {
+    if (x->normalCurrent) return;
+    matrix_normal(&x->world, &x->normalXform);
+    drawStats.normalMatrices++;
+    x->normalCurrent = 1;
 }
-/* Matrix operand to add a rotation about the X-axis to the Module. */
-void module_rotateX(Module *md, double cth, double sth) {
-	if (!md) return;
-    Matrix m;
-    matrix_identity(&m);
-    matrix_rotateX(&m, cth, sth);
-    Element *e = element_init(ObjMatrix, &m);
-    if (e) module_insert(md, e);
+
+/* premultiply the local transform by m, or reset it to the identity if m is NULL. */
+static void xformApply(DrawXform *x, Matrix *m) {
+    if (m) {
+        matrix_multiply(m, &x->LTM, &x->LTM);
+        drawStats.matrixMultiplies++;
+    } else {
+        matrix_identity(&x->LTM);
+    }
+    x->current = x->normalCurrent = 0;
 }
 
-/* Matrix operand to add a rotation about the Y-axis to the Module. */
-void module_rotateY(Module *md, double cth, double sth) {
-	if (!md) return;
-    Matrix m;
-    matrix_identity(&m);
-    matrix_rotateY(&m, cth, sth);
-    Element *e = element_init(ObjMatrix, &m);
-    if (e) module_insert(md, e);
+/* set the local transform to m, as compiled from the module's transform elements. */
+static void xformLoad(DrawXform *x, Matrix *m) {
+    x->LTM = *m;
+    x->current = x->normalCurrent = 0;
 }
 
-/* Matrix operand to add a rotation that orients to the orthonormal axes ~u, ~v, w~. */
-void module_rotateXYZ(Module *md, Vector *u, Vector *v, Vector *w) {
-	if (!md || !u || !v || !w) return;
-    Matrix m;
-    matrix_identity(&m);
-    matrix_rotateXYZ(&m, u, v, w);
-    Element *e = element_init(ObjMatrix, &m);
-    if (e) module_insert(md, e);
+static void drawPoint(Point *p, DrawXform *x, DrawState *ds, Image *src) {
+    Point temp;
+    if (ds->shade == ShadeDepthOnly) return;
+    xformCompose(x);
+    matrix_xformPoint(&x->all, p, &temp);
+    drawStats.vertexTransforms++;
+    point_normalize(&temp);
+    if (0 <= temp.val[0] && temp.val[0] < src->cols && 0 <= temp.val[1] && temp.val[1] < src->rows) {
+        if (ds->drawList) drawList_point(ds->drawList, &temp, ds->color);
+        else point_draw(&temp, src, ds->color);
+        hizMark(ds, &temp, 1);
+    }
 }
 
-/**
- * Adds a unit cube, axis-aligned and centered on zero to the Module. 
- * If solid is zero, add only lines.
- * If solid is non-zero, use polygons.
- * Make sure each polygon has surface normals defined for it.
+static void drawLine(Line *l, DrawXform *x, DrawState *ds, Image *src) {
+    Line temp;
+    if (ds->shade == ShadeDepthOnly) return;
+    xformCompose(x);
+    line_copy(&temp, l);
+    matrix_xformLine(&x->all, &temp);
+    drawStats.vertexTransforms += 2;
+    line_normalize(&temp);
+    if (ds->drawList) drawList_line(ds->drawList, &temp, ds->color);
+    else line_draw(&temp, src, ds->color);
+    hizMark(ds, &temp.a, 1);
+    hizMark(ds, &temp.b, 1);
+}
+
+static void drawPolyline(Polyline *p, DrawXform *x, DrawState *ds, Image *src) {
+    Polyline temp;
+    if (ds->shade == ShadeDepthOnly) return;
+    xformCompose(x);
+    temp = *p;
+    temp.vertex = arena_alloc(ds->scratch, sizeof(Point) * p->numVertex);
+    if (!temp.vertex) return;
+    memcpy(temp.vertex, p->vertex, sizeof(Point) * p->numVertex);
+    matrix_xformPolyline(&x->all, &temp);
+    drawStats.vertexTransforms += temp.numVertex;
+    polyline_normalize(&temp);
+    if (ds->drawList) drawList_polyline(ds->drawList, &temp, ds->color);
+    else polyline_draw(&temp, src, ds->color);
+    hizMark(ds, temp.vertex, temp.numVertex);
+}
+
+/*
+    The n world space vertices and unit normals of the polygon under x, into vertex and
+    normal. A polygon without normals gets the ones polygon_setNormals makes, as
+    polygon_copy would give it. Returns 0 if those cannot be made.
  */
-void module_cube(Module *md, int solid) {
-  if (solid==0) {
-	//use lines
-	Point a, b, c, d, e, f, g, h;
+static int polygonWorld(Polygon *poly, DrawXform *x, Point *vertex, Vector *normal) {
+    Point tmp;
+    int i, n = poly->nVertex;
 
-	point_set3D(&a, -0.5, -0.5, -0.5);
-	point_set3D(&b, 0.5, -0.5, -0.5);
-	point_set3D(&c, -0.5, 0.5, -0.5);
-	point_set3D(&d, 0.5, 0.5, -0.5);
-	point_set3D(&e, -0.5, 0.5, 0.5);
-	point_set3D(&f, 0.5, 0.5, 0.5);
-	point_set3D(&g, -0.5, -0.5, 0.5);
-	point_set3D(&h, 0.5, -0.5, 0.5);
+    if (poly->normal) {
+        memcpy(normal, poly->normal, sizeof(Vector) * n);
+    } else {
+        Polygon made;
+        polygon_init(&made);
+        made.nVertex = n;
+        made.vertex = poly->vertex;
+        polygon_setNormals(&made, n, NULL);
+        drawStats.heapAllocations++;
+        if (!made.normal) return 0;
+        memcpy(normal, made.normal, sizeof(Vector) * n);
+        free(made.normal);
+    }
+    xformCompose(x);
+    xformNormal(x);
+    for (i = 0; i < n; i++) {
+        matrix_xformPoint(&x->world, &poly->vertex[i], &vertex[i]);
+    }
+    for (i = 0; i < n; i++) {
+        matrix_xformVector(&x->normalXform, &normal[i], &tmp);
+        vector_normalize(&tmp);
+        normal[i] = tmp;
+    }
+    drawStats.vertexTransforms += n;
+    return 1;
+}
 
-	Point abdc[5], abhg[5], efhg[5], efdc[5], geca[5], hfdb[5];
-	abdc[0] = abhg[0] = geca[3] = abdc[4] = abhg[4] = a;
-	abdc[1] = abhg[1] = hfdb[3] = b;
+/* the world space vertices and unit normals of the mesh under x, into vertex and normal. */
+static void meshWorld(Mesh *mesh, DrawXform *x, Point *vertex, Vector *normal) {
+    int i;
+
+    xformCompose(x);
+    xformNormal(x);
+    for (i = 0; i < mesh->nVertex; i++) {
+        matrix_xformPoint(&x->world, &mesh->vertex[i], &vertex[i]);
+        matrix_xformVector(&x->normalXform, &mesh->normal[i], &normal[i]);
+        vector_normalize(&normal[i]);
+    }
+    drawStats.vertexTransforms += mesh->nVertex;
+}
+
+/*
+    Draw a polygon through copies of its arrays in the scratch arena. Normals are copied
+    only for lit shading, and colors are made there for polygon_shade to fill. The world
+    space geometry lit shading needs is taken from x->worldVertex when it is there.
+ */
+static void drawPolygon(Polygon *poly, DrawXform *x, DrawState *ds, Lighting *lighting, Image *src) {
+    Arena *scratch = ds->scratch;
+    Polygon temp;
+    int i, n = poly->nVertex;
+
+    if (n < 1 || !poly->vertex) return;
+    xformCompose(x);
+    polygon_init(&temp);
+    temp.nVertex = n;
+    temp.oneSided = poly->oneSided;
+    temp.zBuffer = poly->zBuffer;
+    temp.vertex = arena_alloc(scratch, sizeof(Point) * n);
+    if (!temp.vertex) return;
+    if (ds->shade == ShadeDepthOnly) {
+        // depth-only fast path, transform positions only and skip colors and normals
+        for (i = 0; i < n; i++) {
+            matrix_xformPoint(&x->all, &poly->vertex[i], &temp.vertex[i]);
+        }
+        drawStats.vertexTransforms += n;
+        polygon_normalize(&temp);
+        drawDepthOnly(ds, &temp, src);
+        return;
+    }
+
+    if (ds->hiz) {
+        // test the screen footprint before paying for the shading
+        float box[4];
+        for (i = 0; i < n; i++) {
+            matrix_xformPoint(&x->all, &poly->vertex[i], &temp.vertex[i]);
+            point_normalize(&temp.vertex[i]);
+        }
+        drawStats.vertexTransforms += n;
+        if (hizOccluded(ds, temp.vertex, n, box)) {
+            drawStats.hizPolygonsCulled++;
+            return;
+        }
+    }
+    memcpy(temp.vertex, poly->vertex, sizeof(Point) * n);
+    if (poly->color) {
+        temp.color = arena_alloc(scratch, sizeof(Color) * n);
+        if (!temp.color) return;
+        memcpy(temp.color, poly->color, sizeof(Color) * n);
+    }
+
+    if (shadeLit(ds->shade)) {
+        // shading happens in world space, so stop there on the way to the screen
+        if (lighting && !temp.color && !(temp.color = arena_alloc(scratch, sizeof(Color) * n))) return;
+        temp.normal = arena_alloc(scratch, sizeof(Vector) * n);
+        if (!temp.normal) return;
+        if (x->worldVertex) {
+            memcpy(temp.vertex, x->worldVertex, sizeof(Point) * n);
+            memcpy(temp.normal, x->worldNormal, sizeof(Vector) * n);
+        } else if (!polygonWorld(poly, x, temp.vertex, temp.normal)) {
+            return;
+        }
+        polygon_shade(&temp, ds, lighting);
+        if (ds->shade == ShadeFlat && temp.color) flatColor(ds, temp.color, n);
+        matrix_xformPolygon(x->VTM, &temp);
+        drawStats.vertexTransforms += n;
+    } else {
+        matrix_xformPolygon(&x->all, &temp);
+        drawStats.vertexTransforms += n;
+    }
+    polygon_normalize(&temp);
+    drawShaded(&temp, ds, lighting, src);
+    hizMark(ds, temp.vertex, n);
+}
+
+static void drawMesh(Mesh *mesh, DrawXform *x, DrawState *ds, Lighting *lighting, Image *src) {
+    xformCompose(x);
+    if (shadeLit(ds->shade) && !x->worldVertex) xformNormal(x);
+    meshDraw(mesh, &x->world, &x->all, &x->normalXform, x->worldVertex, x->worldNormal, ds, lighting, src);
+}
+
+/* the level of lod its screen size calls for, full detail if it reaches behind the viewer. */
+static int lodLevel(MeshLOD *lod, DrawXform *x) {
+    Point p, corner[8];
+    float box[4];
+    int i, level = 0, behind = 0;
+    xformCompose(x);
+    for (i = 0; i < 8; i++) {
+        point_set3D(&p, i & 1 ? lod->max.val[0] : lod->min.val[0],
+                       i & 2 ? lod->max.val[1] : lod->min.val[1],
+                       i & 4 ? lod->max.val[2] : lod->min.val[2]);
+        matrix_xformPoint(&x->all, &p, &corner[i]);
+        if (corner[i].val[3] <= 0) behind = 1;
+        else point_normalize(&corner[i]);
+    }
+    drawStats.vertexTransforms += 8;
+    if (!behind) {
+        screenBox(corner, 8, box);
+        level = meshLOD_select(lod, (box[2] - box[0]) * (box[3] - box[1]));
+    }
+    drawStats.lodSelected[level]++;
+    return level;
+}
+
+static void drawMeshLOD(MeshLOD *lod, DrawXform *x, DrawState *ds, Lighting *lighting, Image *src) {
+    drawMesh(&lod->level[lodLevel(lod, x)], x, ds, lighting, src);
+}
+
+static void drawBezierCurve(BezierCurve *b, DrawXform *x, DrawState *ds, Image *src) {
+    BezierCurve temp;
+    if (ds->shade == ShadeDepthOnly) return;
+    xformCompose(x);
+    bezierCurve_init(&temp);
+    bezierCurve_copy(&temp, b);
+    matrix_xformBezierCurve(&x->all, &temp);
+    drawStats.vertexTransforms += 4;
+    bezierCurve_normalize(&temp);
+    if (ds->drawList) drawList_bezierCurve(ds->drawList, &temp, ds->color);
+    else bezierCurve_draw(&temp, src, ds->color);
+    hizMark(ds, temp.vertex, 4);
+}
+
+/*
+    draw a Bezier surface. A solid one is tessellated into patch, or taken from
+    ds->tessCache when there is one, so it is only tessellated again when its control
+    points or LOD bucket change.
+ */
+static void drawBezierSurface(BezierSurface *b, DrawXform *x, DrawState *ds, Lighting *lighting, Image *src, Mesh *patch) {
+    BezierSurface temp;
+    xformCompose(x);
+    if (b->solid) {
+        // tessellate to the screen size of the patch and draw it as a mesh
+        Mesh *m = patch;
+        int nu, nv, hit = 0;
+        patchGrid(b, &x->all, &nu, &nv);
+        if (ds->tessCache) m = tessCache_lookup(ds->tessCache, b, nu, nv, &hit);
+        else if (!bezierSurface_tessellate(b, nu, nv, patch)) m = NULL;
+        if (!m) return;
+        if (hit) drawStats.patchCacheHits++;
+        else {
+            drawStats.patchTessellations++;
+            drawStats.heapAllocations++;
+        }
+        // the tessellation changes with the LOD bucket, so it is never in the world cache
+        if (shadeLit(ds->shade)) xformNormal(x);
+        meshDraw(m, &x->world, &x->all, &x->normalXform, NULL, NULL, ds, lighting, src);
+        return;
+    }
+    if (ds->shade == ShadeDepthOnly) return;
+    bezierSurface_init(&temp);
+    bezierSurface_copy(&temp, b);
+    matrix_xformBezierSurface(&x->all, &temp);
+    drawStats.vertexTransforms += 16;
+    bezierSurface_normalize(&temp);
+    if (ds->drawList) drawList_bezierSurface(ds->drawList, &temp, ds->color);
+    else bezierSurface_drawLines(&temp, src, ds->color);
+    hizMark(ds, &temp.vertex[0][0], 16);
+}
+
+/* whether a sub-module with the bounding box min max is hidden behind the depth pyramid. */
+static int moduleHidden(Point *min, Point *max, DrawXform *x, DrawState *ds) {
+    Point corner[8], p;
+    float box[4];
+    int i, behind = 0;
+    xformCompose(x);
+    for (i = 0; i < 8; i++) {
+        point_set3D(&p, i & 1 ? max->val[0] : min->val[0],
+                       i & 2 ? max->val[1] : min->val[1],
+                       i & 4 ? max->val[2] : min->val[2]);
+        matrix_xformPoint(&x->all, &p, &corner[i]);
+        if (corner[i].val[3] <= 0) behind = 1;
+        else point_normalize(&corner[i]);
+    }
+    drawStats.vertexTransforms += 8;
+    if (!behind && hizOccluded(ds, corner, 8, box)) {
+        drawStats.hizModulesCulled++;
+        return 1;
+    }
+    return 0;
+}
+
+/*
+    Whether a sub-module with the bounding box min, max and the bounding sphere center,
+    radius is outside the view volume: wholly behind the eye or wholly off one side of the
+    image, with a pixel to spare. The planes are taken from the rows of the composite
+    transform, so the test is made in the sub-module's own coordinates. The sphere is
+    tried first and the tighter box only if the sphere reaches inside every plane.
+    There is no far plane, since geometry past it is still drawn. Sub-modules and single
+    instances are tested when ds->frustumCull is set.
+ */
+static int moduleOutside(Point *min, Point *max, Point *center, double radius, DrawXform *x, Image *src) {
+    double plane[5][4], d, n;
+    int i, j;
+
+    xformCompose(x);
+    for (j = 0; j < 4; j++) {
+        plane[0][j] = x->all.m[0][j] + x->all.m[3][j]; // x >= -1
+        plane[1][j] = (src->cols + 1) * x->all.m[3][j] - x->all.m[0][j]; // x <= cols + 1
+        plane[2][j] = x->all.m[1][j] + x->all.m[3][j]; // y >= -1
+        plane[3][j] = (src->rows + 1) * x->all.m[3][j] - x->all.m[1][j]; // y <= rows + 1
+        plane[4][j] = x->all.m[3][j]; // w >= 0, in front of the eye
+    }
+    drawStats.frustumTests++;
+    for (i = 0; i < 5; i++) {
+        d = plane[i][3];
+        n = 0;
+        for (j = 0; j < 3; j++) {
+            d += plane[i][j] * center->val[j];
+            n += plane[i][j] * plane[i][j];
+        }
+        if (d < -radius * sqrt(n)) {
+            drawStats.frustumSphereCulls++;
+            drawStats.frustumModulesCulled++;
+            return 1;
+        }
+    }
+    for (i = 0; i < 5; i++) {
+        // the corner furthest inside the plane
+        d = plane[i][3];
+        for (j = 0; j < 3; j++) d += plane[i][j] * (plane[i][j] > 0 ? max->val[j] : min->val[j]);
+        if (d < 0) {
+            drawStats.frustumModulesCulled++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+    Draw a sub-module under VTM and world with its own copy of the DrawState. When ds is
+    recording into the draw list of a DrawPool, shallow sub-modules are handed to the
+    pool as tasks of their own and leave only a place holder in the list.
+ */
+static void drawSubmodule(Module *md, Matrix *VTM, Matrix *world, DrawState *ds, Lighting *lighting, Image *src) {
+    DrawList *dl = ds->drawList;
+
+    if (dl && drawList_task(dl, md, world, ds)) return;
+    if (dl) dl->depth++;
+    module_draw(md, VTM, world, ds, lighting, src);
+    if (dl) dl->depth--;
+}
+
+/*
+    Place one instance, under the composed transforms of x times place, into ix and say
+    whether it can be skipped: test is set when the bounds min, max and sphere center,
+    radius are valid, and then it is tested like a sub-module.
+ */
+static int instanceSkipped(DrawXform *x, Matrix *place, DrawXform *ix, int test, Point *min, Point *max,
+                           Point *center, double radius, DrawState *ds, Image *src) {
+    // world = GTM * LTM * place, the transforms the instance is drawn under
+    xformInit(ix, x->VTM, &ix->world);
+    matrix_multiply(&x->world, place, &ix->world);
+    matrix_multiply(x->VTM, &ix->world, &ix->all);
+    drawStats.matrixMultiplies += 2;
+    ix->current = 1;
+    if (test && ((ds->frustumCull && moduleOutside(min, max, center, radius, ix, src)) ||
+                 (ds->hiz && moduleHidden(min, max, ix, ds)))) {
+        drawStats.instancesCulled++;
+        return 1;
+    }
+    drawStats.instancesDrawn++;
+    return 0;
+}
+
+/*
+    Draw the instances of one module under the composed transforms of x. The sub-module's
+    bounds are looked up once, then each instance costs one matrix product to place it and
+    the same culling tests as a sub-module before it is drawn like module_module would.
+ */
+static void drawInstances(Instances *in, DrawXform *x, DrawState *ds, Lighting *lighting, Image *src) {
+    DrawState tempDS;
+    DrawXform ix;
+    Point min, max, center;
+    double radius = 0;
+    int i, test = ds->frustumCull || ds->hiz;
+
+    xformCompose(x);
+    if (test) {
+        if (!module_bounds(in->module, &min, &max)) return;
+        if (ds->frustumCull) module_sphere(in->module, &center, &radius);
+    }
+    for (i = 0; i < in->count; i++) {
+        if (instanceSkipped(x, &in->matrix[i], &ix, test, &min, &max, &center, radius, ds, src)) continue;
+        drawstate_copy(&tempDS, ds);
+        if (in->body) tempDS.body = in->body[i];
+        drawSubmodule(in->module, x->VTM, &ix.world, &tempDS, lighting, src);
+    }
+}
+
+/* number of vertices the world cache holds for the element, 0 for none. */
+static int worldVertices(Element *e) {
+    switch (e->type) {
+        case ObjPolygon:
+            return e->obj->polygon.vertex ? e->obj->polygon.nVertex : 0;
+        case ObjMesh:
+            return e->obj->mesh.normal ? e->obj->mesh.nVertex : 0;
+        case ObjSharedMesh:
+            return e->obj->sharedMesh->mesh.normal ? e->obj->sharedMesh->mesh.nVertex : 0;
+        default:
+            return 0;
+    }
+}
+
+/*
+    The world space vertices and unit normals of the polygons and meshes of md drawn
+    under VTM and GTM, found in wc or made into it on a miss through the same code the
+    drawing uses, so the image is the same either way. LOD meshes and Bezier patches
+    are left out, since what is drawn of them depends on the screen. module_draw uses
+    it with ds->worldCache and lit shading, so from one frame to the next only the
+    modules edited or moved since pay for their world space geometry. Returns NULL if
+    the entry cannot be made.
+ */
+static WorldEntry *worldGeometry(Module *md, Matrix *VTM, Matrix *GTM, WorldCache *wc) {
+    WorldEntry *w = worldCache_lookup(wc, md, md->version, GTM);
+    DrawXform x;
+    Element *e;
+    int k, n, nElement = 0, nVertex = 0;
+
+    if (w) return w;
+    for (e = md->head; e != NULL; e = e->next, nElement++) nVertex += worldVertices(e);
+    w = worldCache_insert(wc, md, md->version, GTM, nElement, nVertex);
+    if (!w) return NULL;
+    xformInit(&x, VTM, GTM);
+    for (e = md->head, k = 0, nVertex = 0; e != NULL; e = e->next, k++) {
+        w->first[k] = -1;
+        n = worldVertices(e);
+        switch (e->type) {
+            case ObjMatrix:
+                xformApply(&x, &e->obj->matrix);
+                break;
+            case ObjIdentity:
+                xformApply(&x, NULL);
+                break;
+            case ObjPolygon:
+                if (n > 0 && polygonWorld(&e->obj->polygon, &x, &w->vertex[nVertex], &w->normal[nVertex])) w->first[k] = nVertex;
+                break;
+            case ObjMesh:
+            case ObjSharedMesh:
+                if (n > 0) {
+                    meshWorld(e->type == ObjMesh ? &e->obj->mesh : &e->obj->sharedMesh->mesh, &x, &w->vertex[nVertex], &w->normal[nVertex]);
+                    w->first[k] = nVertex;
+                }
+                break;
+            default:
+                break;
+        }
+        nVertex += n;
+    }
+    return w;
+}
+
+/*
+    Give back the scratch memory used by the element just drawn, counting any blocks the
+    arena had to take from the heap for it since *blocks was read. Copies of the geometry
+    are made in ds->scratch, or the library's own arena when that is NULL, so once it has
+    grown to the largest element nothing is taken from the heap while drawing.
+ */
+static void scratchRelease(DrawState *ds, long *blocks) {
+    drawStats.heapAllocations += ds->scratch->allocations - *blocks;
+    *blocks = ds->scratch->allocations;
+    arena_reset(ds->scratch);
+}
+
+/**
+ * Draw the module into the image using the given 
+ * view transformation matrix [VTM],
+ * Lighting and
+ * DrawState 
+ * by traversing the list of Elements. 
+ * (For now, Lighting can be an empty structure.)
+ * A caller changing an Element in place says so with module_invalidate.
+ */
+void module_draw(Module *md, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *lighting, Image *src) {
+    if (!md || !VTM || !GTM || !ds || !src) return;
+    
+    DrawXform x;
+    Mesh patch;
+    Element *e;
+    WorldEntry *cached = NULL;
+    int own = !ds->scratch, k;
+    long blocks, evictions = 0;
+    
+    if (own) ds->scratch = &drawScratch;
+    blocks = ds->scratch->allocations;
+    xformInit(&x, VTM, GTM);
+    mesh_init(&patch);
+    if (ds->worldCache && shadeLit(ds->shade)) {
+        cached = worldGeometry(md, VTM, GTM, ds->worldCache);
+        evictions = ds->worldCache->evictions;
+    }
+    
+    for (e = md->head, k = 0; e != NULL; e = e->next, k++) {
+        if (cached && cached->first[k] >= 0) {
+            x.worldVertex = &cached->vertex[cached->first[k]];
+            x.worldNormal = &cached->normal[cached->first[k]];
+        } else {
+            x.worldVertex = NULL;
+            x.worldNormal = NULL;
+        }
+        switch(e->type) {
+            case ObjColor:
+                ds->color = e->obj->color;
+                break;
+
+            case ObjBodyColor:
+                ds->body = e->obj->color;
+                break;
+
+            case ObjSurfaceColor:
+                ds->surface = e->obj->color;
+                break;
+            
+            case ObjSurfaceCoeff:
+                ds->surfaceCoeff = e->obj->coeff;
+                break;
+            
+            case ObjPoint:
+                drawPoint(&e->obj->point, &x, ds, src);
+                break;
+
+            case ObjLine:
+                drawLine(&e->obj->line, &x, ds, src);
+                break;
+
+            case ObjPolyline:
+                drawPolyline(&e->obj->polyline, &x, ds, src);
+                break;
+
+            case ObjPolygon:
+                drawPolygon(&e->obj->polygon, &x, ds, lighting, src);
+                break;
+
+            case ObjMesh:
+                drawMesh(&e->obj->mesh, &x, ds, lighting, src);
+                break;
+
+            case ObjSharedMesh:
+                drawMesh(&e->obj->sharedMesh->mesh, &x, ds, lighting, src);
+                break;
+
+            case ObjMeshLOD:
+                drawMeshLOD(e->obj->meshLOD, &x, ds, lighting, src);
+                break;
+
+			case ObjBezierCurve:
+				drawBezierCurve(&e->obj->bezierCurve, &x, ds, src);
+				break;
+
+			case ObjBezierSurface:
+				drawBezierSurface(&e->obj->bezierSurface, &x, ds, lighting, src, &patch);
+				break;
+
+            case ObjMatrix:
+                xformApply(&x, &e->obj->matrix);
+                break;
+
+			case ObjIdentity:
+				xformApply(&x, NULL);
+				break;
+
+            case ObjModule: {
+                DrawState tempDS;
+                Point min, max, center;
+                double radius = 0;
+                
+                xformCompose(&x);
+                // skip the whole sub-module if it is empty, outside the view or hidden
+                if (ds->frustumCull || ds->hiz) {
+                    if (!module_bounds(e->obj->module, &min, &max)) break;
+                    if (ds->frustumCull) {
+                        module_sphere(e->obj->module, &center, &radius);
+                        if (moduleOutside(&min, &max, &center, radius, &x, src)) break;
+                    }
+                    if (ds->hiz && moduleHidden(&min, &max, &x, ds)) break;
+                }
+                drawstate_copy(&tempDS, ds);
+                drawSubmodule(e->obj->module, VTM, &x.world, &tempDS, lighting, src);
+                // the sub-module counted its own blocks
+                blocks = ds->scratch->allocations;
+                break;
+            }
+
+            case ObjInstances:
+                drawInstances(&e->obj->instances, &x, ds, lighting, src);
+                blocks = ds->scratch->allocations;
+                break;
+
+            default:
+                break;
+        }
+        scratchRelease(ds, &blocks);
+        // entries the sub-modules made may have pushed this module's out of the cache
+        if (cached && ds->worldCache->evictions != evictions) {
+            cached = worldGeometry(md, VTM, GTM, ds->worldCache);
+            evictions = ds->worldCache->evictions;
+        }
+    }
+    mesh_clear(&patch);
+    if (own) ds->scratch = NULL;
+}
+
+/* Command Buffer Functions */
+
+// a module or shared object already placed in the buffer being compiled, and where
+typedef struct {
+    void *key;
+    int offset;
+    int bounds; // index of a module's bounds in point, -1 if it has none, -2 until found
+} CompileEntry;
+
+// working state of module_compile
+typedef struct {
+    CommandBuffer *cb;
+    CompileEntry *routine; // modules to compile, offset is the first command or -1 until compiled
+    int nRoutine, routineCap;
+    CompileEntry *shared; // shared meshes and LODs already recorded, offset is their record
+    int nShared, sharedCap;
+    int ok; // cleared by the first failed allocation
+} Compiler;
+
+/*
+    Make room for need more items of size bytes in the array *a holding n of cap.
+    Returns 0 if it cannot grow.
+ */
+static int growArray(void **a, int n, int *cap, int need, size_t size) {
+    void *grown;
+    int c = *cap ? *cap : 64;
+    if (n + need <= *cap) return 1;
+    while (c < n + need) c *= 2;
+    grown = realloc(*a, size * c);
+    if (!grown) return 0;
+    *a = grown;
+    *cap = c;
+    return 1;
+}
+
+/* append n points, returning the index of the first or -1 for none or on failure. */
+static int compilePoints(Compiler *c, Point *p, int n) {
+    CommandBuffer *cb = c->cb;
+    int i, at = cb->nPoint;
+    if (!p || n < 1) return -1;
+    if (!growArray((void **)&cb->point, cb->nPoint, &cb->pointCap, n, sizeof(Point))) {
+        c->ok = 0;
+        return -1;
+    }
+    for (i = 0; i < n; i++) cb->point[at + i] = p[i];
+    cb->nPoint += n;
+    return at;
+}
+
+/* append n colors, returning the index of the first or -1 for none or on failure. */
+static int compileColors(Compiler *c, Color *p, int n) {
+    CommandBuffer *cb = c->cb;
+    int i, at = cb->nColor;
+    if (!p || n < 1) return -1;
+    if (!growArray((void **)&cb->color, cb->nColor, &cb->colorCap, n, sizeof(Color))) {
+        c->ok = 0;
+        return -1;
+    }
+    for (i = 0; i < n; i++) cb->color[at + i] = p[i];
+    cb->nColor += n;
+    return at;
+}
+
+/* append n integers, returning the index of the first, or -1 on failure. */
+static int compileInts(Compiler *c, int *v, int n) {
+    CommandBuffer *cb = c->cb;
+    int i, at = cb->nInteger;
+    if (!growArray((void **)&cb->integer, cb->nInteger, &cb->integerCap, n, sizeof(int))) {
+        c->ok = 0;
+        return -1;
+    }
+    for (i = 0; i < n; i++) cb->integer[at + i] = v[i];
+    cb->nInteger += n;
+    return at;
+}
+
+/* the divisions of a Bezier record kept within [0, BEZIER_MAX_DEPTH], the range a buffer is read back with. */
+static int compileDivisions(int d) {
+    return d < 0 ? 0 : d > BEZIER_MAX_DEPTH ? BEZIER_MAX_DEPTH : d;
+}
+
+static void compileCommand(Compiler *c, int op, int arg, int count) {
+    CommandBuffer *cb = c->cb;
+    if (!growArray((void **)&cb->command, cb->nCommand, &cb->commandCap, 1, sizeof(Command))) {
+        c->ok = 0;
+        return;
+    }
+    cb->command[cb->nCommand].op = op;
+    cb->command[cb->nCommand].arg = arg;
+    cb->command[cb->nCommand].count = count;
+    cb->nCommand++;
+}
+
+/* index of key in the table, added with offset -1 if it is not there yet. */
+static int compileFind(Compiler *c, CompileEntry **table, int *n, int *cap, void *key) {
+    int i;
+    for (i = 0; i < *n; i++) {
+        if ((*table)[i].key == key) return i;
+    }
+    if (!growArray((void **)table, *n, cap, 1, sizeof(CompileEntry))) {
+        c->ok = 0;
+        return -1;
+    }
+    (*table)[*n].key = key;
+    (*table)[*n].offset = -1;
+    (*table)[*n].bounds = -2;
+    return (*n)++;
+}
+
+/* record the mesh, returning the index of its record in integer. */
+static int compileMesh(Compiler *c, Mesh *m) {
+    int rec[9];
+    rec[0] = m->nVertex;
+    rec[1] = m->nFace;
+    rec[2] = compilePoints(c, m->vertex, m->nVertex);
+    rec[3] = compilePoints(c, m->normal, m->nVertex);
+    rec[4] = compileColors(c, m->color, m->nVertex);
+    rec[5] = m->faceStart ? compileInts(c, m->faceStart, m->nFace + 1) : -1;
+    rec[6] = m->faceStart && m->index ? compileInts(c, m->index, m->faceStart[m->nFace]) : -1;
+    rec[7] = m->oneSided;
+    rec[8] = m->zBuffer;
+    return compileInts(c, rec, 9);
+}
+
+/* record a shared mesh or LOD once, returning the index of its record in integer. */
+static int compileShared(Compiler *c, void *key, int lod) {
+    int i = compileFind(c, &c->shared, &c->nShared, &c->sharedCap, key);
+    if (i < 0) return -1;
+    if (c->shared[i].offset < 0) {
+        if (lod) {
+            MeshLOD *l = key;
+            int rec[3 + LOD_MAX_LEVELS], j, at;
+            CommandBuffer *cb = c->cb;
+            rec[0] = l->nLevel;
+            rec[1] = cb->nReal;
+            if (growArray((void **)&cb->real, cb->nReal, &cb->realCap, 1, sizeof(float))) cb->real[cb->nReal++] = l->facePixels;
+            else c->ok = 0;
+            rec[2] = compilePoints(c, &l->min, 1);
+            compilePoints(c, &l->max, 1);
+            for (j = 0; j < l->nLevel; j++) rec[3 + j] = compileMesh(c, &l->level[j]);
+            at = compileInts(c, rec, 3 + l->nLevel);
+            c->shared[i].offset = at;
+        } else {
+            c->shared[i].offset = compileMesh(c, &((SharedMesh *)key)->mesh);
+        }
+    }
+    return c->shared[i].offset;
+}
+
+/*
+    The routine table entry for the sub-module md, with its bounds recorded the first time
+    it is referenced. The entry's index stands for the routine until every routine is placed.
+    Returns -1 on failure.
+ */
+static int compileCall(Compiler *c, Module *md) {
+    Point bounds[3];
+    double radius = 0;
+    int r = compileFind(c, &c->routine, &c->nRoutine, &c->routineCap, md);
+    if (r < 0) return -1;
+    if (c->routine[r].bounds == -2) {
+        c->routine[r].bounds = -1;
+        if (module_bounds(md, &bounds[0], &bounds[1])) {
+            module_sphere(md, &bounds[2], &radius);
+            bounds[2].val[3] = radius;
+            c->routine[r].bounds = compilePoints(c, bounds, 3);
+        }
+    }
+    return r;
+}
+
+/*
+    compile the elements of md into a routine, sub-modules become calls to routines compiled later.
+    The local transform depends only on the module's own elements, so it is multiplied out here
+    in the order module_draw would and set with one CmdLoad before the next element that needs it.
+ */
+static void compileRoutine(Compiler *c, Module *md) {
+    CommandBuffer *cb = c->cb;
+    Element *e;
+    Matrix local;
+    int rec[6], moved = 0;
+
+    matrix_identity(&local);
+    for (e = md->head; e != NULL && c->ok; e = e->next) {
+        if (moved && e->type != ObjMatrix && e->type != ObjIdentity) {
+            if (!growArray((void **)&cb->matrix, cb->nMatrix, &cb->matrixCap, 1, sizeof(Matrix))) {
+                c->ok = 0;
+                break;
+            }
+            cb->matrix[cb->nMatrix] = local;
+            compileCommand(c, CmdLoad, cb->nMatrix++, 0);
+            moved = 0;
+        }
+        switch (e->type) {
+            case ObjColor:
+            case ObjBodyColor:
+            case ObjSurfaceColor:
+                compileCommand(c, e->type == ObjColor ? CmdColor : e->type == ObjBodyColor ? CmdBodyColor : CmdSurfaceColor,
+                               compileColors(c, &e->obj->color, 1), 0);
+                break;
+            case ObjSurfaceCoeff:
+                if (!growArray((void **)&cb->real, cb->nReal, &cb->realCap, 1, sizeof(float))) {
+                    c->ok = 0;
+                    break;
+                }
+                cb->real[cb->nReal] = e->obj->coeff;
+                compileCommand(c, CmdSurfaceCoeff, cb->nReal++, 0);
+                break;
+            case ObjMatrix:
+                matrix_multiply(&e->obj->matrix, &local, &local);
+                moved = 1;
+                break;
+            case ObjIdentity:
+                matrix_identity(&local);
+                moved = 1;
+                break;
+            case ObjPoint:
+                compileCommand(c, CmdPoint, compilePoints(c, &e->obj->point, 1), 0);
+                break;
+            case ObjLine:
+                rec[0] = compilePoints(c, &e->obj->line.a, 1);
+                compilePoints(c, &e->obj->line.b, 1);
+                rec[1] = e->obj->line.zBuffer;
+                compileCommand(c, CmdLine, compileInts(c, rec, 2), 0);
+                break;
+            case ObjPolyline:
+                rec[0] = e->obj->polyline.numVertex;
+                rec[1] = compilePoints(c, e->obj->polyline.vertex, e->obj->polyline.numVertex);
+                rec[2] = e->obj->polyline.zBuffer;
+                compileCommand(c, CmdPolyline, compileInts(c, rec, 3), 0);
+                break;
+            case ObjPolygon:
+                rec[0] = e->obj->polygon.nVertex;
+                rec[1] = compilePoints(c, e->obj->polygon.vertex, e->obj->polygon.nVertex);
+                rec[2] = compilePoints(c, e->obj->polygon.normal, e->obj->polygon.nVertex);
+                rec[3] = compileColors(c, e->obj->polygon.color, e->obj->polygon.nVertex);
+                rec[4] = e->obj->polygon.oneSided;
+                rec[5] = e->obj->polygon.zBuffer;
+                compileCommand(c, CmdPolygon, compileInts(c, rec, 6), 0);
+                break;
+            case ObjMesh:
+                compileCommand(c, CmdMesh, compileMesh(c, &e->obj->mesh), 0);
+                break;
+            case ObjSharedMesh:
+                compileCommand(c, CmdMesh, compileShared(c, e->obj->sharedMesh, 0), 0);
+                break;
+            case ObjMeshLOD:
+                compileCommand(c, CmdMeshLOD, compileShared(c, e->obj->meshLOD, 1), 0);
+                break;
+            case ObjBezierCurve:
+                rec[0] = compilePoints(c, e->obj->bezierCurve.vertex, 4);
+                rec[1] = compileDivisions(e->obj->bezierCurve.divisions);
+                rec[2] = e->obj->bezierCurve.zBuffer;
+                compileCommand(c, CmdBezierCurve, compileInts(c, rec, 3), 0);
+                break;
+            case ObjBezierSurface:
+                rec[0] = compilePoints(c, &e->obj->bezierSurface.vertex[0][0], 16);
+                rec[1] = compileDivisions(e->obj->bezierSurface.divisions);
+                rec[2] = e->obj->bezierSurface.solid;
+                rec[3] = e->obj->bezierSurface.zBuffer;
+                compileCommand(c, CmdBezierSurface, compileInts(c, rec, 4), 0);
+                break;
+            case ObjModule: {
+                int r = compileCall(c, e->obj->module);
+                if (r >= 0) compileCommand(c, CmdCall, r, c->routine[r].bounds);
+                break;
+            }
+            case ObjInstances: {
+                Instances *in = &e->obj->instances;
+                int r = compileCall(c, in->module), i;
+                if (r < 0) break;
+                if (!growArray((void **)&cb->matrix, cb->nMatrix, &cb->matrixCap, in->count, sizeof(Matrix))) {
+                    c->ok = 0;
+                    break;
+                }
+                rec[0] = r;
+                rec[1] = in->count;
+                rec[2] = cb->nMatrix;
+                for (i = 0; i < in->count; i++) cb->matrix[cb->nMatrix++] = in->matrix[i];
+                rec[3] = compileColors(c, in->body, in->count);
+                compileCommand(c, CmdInstances, compileInts(c, rec, 4), c->routine[r].bounds);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+    compileCommand(c, CmdReturn, 0, 0);
+}
+
+/* allocate an empty command buffer. Returns NULL if the allocation fails. */
+CommandBuffer *commandBuffer_create(void) {
+    CommandBuffer *cb = (CommandBuffer *)calloc(1, sizeof(CommandBuffer));
+    return cb;
+}
+
+/* free the command buffer and its arrays, or unmap them if they were read from a snapshot. */
+void commandBuffer_free(CommandBuffer *cb) {
+    if (!cb) return;
+    if (cb->mapping) {
+        munmap(cb->mapping, cb->mappingBytes);
+    } else {
+        free(cb->command);
+        free(cb->point);
+        free(cb->color);
+        free(cb->matrix);
+        free(cb->real);
+        free(cb->integer);
+    }
+    free(cb);
+}
+
+/*
+    empty the command buffer, keeping its arrays for the next compile. Arrays mapped
+    from a snapshot are unmapped, so the next compile makes its own.
+ */
+void commandBuffer_clear(CommandBuffer *cb) {
+    if (!cb) return;
+    if (cb->mapping) {
+        munmap(cb->mapping, cb->mappingBytes);
+        cb->mapping = NULL;
+        cb->mappingBytes = 0;
+        cb->command = NULL;
+        cb->point = NULL;
+        cb->color = NULL;
+        cb->matrix = NULL;
+        cb->real = NULL;
+        cb->integer = NULL;
+        cb->commandCap = cb->pointCap = cb->colorCap = cb->matrixCap = cb->realCap = cb->integerCap = 0;
+    }
+    cb->nCommand = cb->nPoint = cb->nColor = cb->nMatrix = cb->nReal = cb->nInteger = 0;
+    cb->version = 0;
+}
+
+/**
+ * Flatten the module graph rooted at md into cb, replacing what it held. Each module
+ * becomes a routine of commands ending in CmdReturn, compiled once however often it
+ * is referenced, with md's routine first. Geometry is copied into the packed arrays
+ * and shared meshes and LODs are recorded once. Every reference is an index, so the
+ * buffer can be moved or copied whole. cb->version is set to the graph's version, so
+ * the buffer is stale once module_version(md) differs. Returns 0 if an allocation
+ * fails, leaving cb empty.
+ */
+int module_compile(Module *md, CommandBuffer *cb) {
+    Compiler c;
+    int i, r;
+
+    if (!md || !cb) return 0;
+    commandBuffer_clear(cb);
+    memset(&c, 0, sizeof(Compiler));
+    c.cb = cb;
+    c.ok = 1;
+    compileFind(&c, &c.routine, &c.nRoutine, &c.routineCap, md);
+    for (r = 0; r < c.nRoutine && c.ok; r++) {
+        c.routine[r].offset = cb->nCommand;
+        compileRoutine(&c, c.routine[r].key);
+    }
+    for (i = 0; i < cb->nCommand && c.ok; i++) {
+        if (cb->command[i].op == CmdCall) cb->command[i].arg = c.routine[cb->command[i].arg].offset;
+        else if (cb->command[i].op == CmdInstances) cb->integer[cb->command[i].arg] = c.routine[cb->integer[cb->command[i].arg]].offset;
+    }
+    free(c.routine);
+    free(c.shared);
+    if (!c.ok) {
+        commandBuffer_clear(cb);
+        return 0;
+    }
+    cb->version = module_version(md);
+    return 1;
+}
+
+/* a mesh over the record at integer[rec], its arrays pointing into the buffer. */
+static void commandMesh(CommandBuffer *cb, int rec, Mesh *m) {
+    int *r = &cb->integer[rec];
+    m->nVertex = r[0];
+    m->nFace = r[1];
+    m->vertex = r[2] < 0 ? NULL : &cb->point[r[2]];
+    m->normal = r[3] < 0 ? NULL : &cb->point[r[3]];
+    m->color = r[4] < 0 ? NULL : &cb->color[r[4]];
+    m->faceStart = r[5] < 0 ? NULL : &cb->integer[r[5]];
+    m->index = r[6] < 0 ? NULL : &cb->integer[r[6]];
+    m->oneSided = r[7];
+    m->zBuffer = r[8];
+}
+
+static void commandRun(CommandBuffer *cb, int pc, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *lighting, Image *src);
+
+/*
+    Run the routine at pc with body as its body color if it is not NULL. A routine
+    sets no other DrawState fields than its colors, the flat fill color its lit faces
+    leave behind and its surface coefficient, so only those are put back afterwards
+    instead of running it on a copy of ds.
+ */
+static void commandCall(CommandBuffer *cb, int pc, Matrix *VTM, Matrix *GTM, DrawState *ds, Color *body, Lighting *lighting, Image *src) {
+    Color color = ds->color, flat = ds->flatColor, saved = ds->body, surface = ds->surface;
+    float coeff = ds->surfaceCoeff;
+
+    if (body) ds->body = *body;
+    commandRun(cb, pc, VTM, GTM, ds, lighting, src);
+    ds->color = color;
+    ds->flatColor = flat;
+    ds->body = saved;
+    ds->surface = surface;
+    ds->surfaceCoeff = coeff;
+}
+
+/*
+    Replay the routine starting at pc under VTM and GTM, the way module_draw draws the
+    module it was compiled from. Geometry is drawn through the same code over views of
+    the packed arrays, so the output is the same.
+ */
+static void commandRun(CommandBuffer *cb, int pc, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *lighting, Image *src) {
+    DrawXform x;
+    Mesh patch;
+    Command *c;
+    long blocks = ds->scratch->allocations;
+    int *r;
+
+    xformInit(&x, VTM, GTM);
+    mesh_init(&patch);
+    for (c = &cb->command[pc]; c->op != CmdReturn; c++) {
+        switch (c->op) {
+            case CmdColor:
+                ds->color = cb->color[c->arg];
+                break;
+            case CmdBodyColor:
+                ds->body = cb->color[c->arg];
+                break;
+            case CmdSurfaceColor:
+                ds->surface = cb->color[c->arg];
+                break;
+            case CmdSurfaceCoeff:
+                ds->surfaceCoeff = cb->real[c->arg];
+                break;
+            case CmdLoad:
+                xformLoad(&x, &cb->matrix[c->arg]);
+                break;
+            case CmdPoint:
+                drawPoint(&cb->point[c->arg], &x, ds, src);
+                break;
+            case CmdLine: {
+                Line l;
+                r = &cb->integer[c->arg];
+                l.a = cb->point[r[0]];
+                l.b = cb->point[r[0] + 1];
+                l.zBuffer = r[1];
+                drawLine(&l, &x, ds, src);
+                break;
+            }
+            case CmdPolyline: {
+                Polyline p;
+                r = &cb->integer[c->arg];
+                p.numVertex = r[0];
+                p.vertex = r[1] < 0 ? NULL : &cb->point[r[1]];
+                p.zBuffer = r[2];
+                drawPolyline(&p, &x, ds, src);
+                break;
+            }
+            case CmdPolygon: {
+                Polygon p;
+                r = &cb->integer[c->arg];
+                p.nVertex = r[0];
+                p.vertex = r[1] < 0 ? NULL : &cb->point[r[1]];
+                p.normal = r[2] < 0 ? NULL : &cb->point[r[2]];
+                p.color = r[3] < 0 ? NULL : &cb->color[r[3]];
+                p.oneSided = r[4];
+                p.zBuffer = r[5];
+                drawPolygon(&p, &x, ds, lighting, src);
+                break;
+            }
+            case CmdMesh: {
+                Mesh m;
+                commandMesh(cb, c->arg, &m);
+                drawMesh(&m, &x, ds, lighting, src);
+                break;
+            }
+            case CmdMeshLOD: {
+                MeshLOD lod;
+                Mesh m;
+                int i;
+                // selection reads only the face counts, so only the level drawn is put together
+                r = &cb->integer[c->arg];
+                lod.nLevel = r[0];
+                lod.facePixels = cb->real[r[1]];
+                lod.min = cb->point[r[2]];
+                lod.max = cb->point[r[2] + 1];
+                for (i = 0; i < lod.nLevel; i++) lod.level[i].nFace = cb->integer[r[3 + i] + 1];
+                commandMesh(cb, r[3 + lodLevel(&lod, &x)], &m);
+                drawMesh(&m, &x, ds, lighting, src);
+                break;
+            }
+            case CmdBezierCurve: {
+                BezierCurve b;
+                int i;
+                r = &cb->integer[c->arg];
+                for (i = 0; i < 4; i++) b.vertex[i] = cb->point[r[0] + i];
+                b.divisions = r[1];
+                b.zBuffer = r[2];
+                drawBezierCurve(&b, &x, ds, src);
+                break;
+            }
+            case CmdBezierSurface: {
+                BezierSurface b;
+                int i;
+                r = &cb->integer[c->arg];
+                for (i = 0; i < 16; i++) b.vertex[i / 4][i % 4] = cb->point[r[0] + i];
+                b.divisions = r[1];
+                b.solid = r[2];
+                b.zBuffer = r[3];
+                drawBezierSurface(&b, &x, ds, lighting, src, &patch);
+                break;
+            }
+            case CmdCall: {
+                Point *b;
+                // a module with no geometry draws nothing, so it is never entered
+                if (c->count < 0) break;
+                xformCompose(&x);
+                b = &cb->point[c->count];
+                if (ds->frustumCull && moduleOutside(&b[0], &b[1], &b[2], b[2].val[3], &x, src)) break;
+                if (ds->hiz && moduleHidden(&b[0], &b[1], &x, ds)) break;
+                commandCall(cb, c->arg, VTM, &x.world, ds, NULL, lighting, src);
+                blocks = ds->scratch->allocations;
+                break;
+            }
+            case CmdInstances: {
+                DrawXform ix;
+                Point *b;
+                int i;
+                if (c->count < 0) break;
+                xformCompose(&x);
+                b = &cb->point[c->count];
+                r = &cb->integer[c->arg];
+                for (i = 0; i < r[1]; i++) {
+                    if (instanceSkipped(&x, &cb->matrix[r[2] + i], &ix, 1, &b[0], &b[1], &b[2], b[2].val[3], ds, src)) continue;
+                    commandCall(cb, r[0], VTM, &ix.world, ds, r[3] >= 0 ? &cb->color[r[3] + i] : NULL, lighting, src);
+                }
+                blocks = ds->scratch->allocations;
+                break;
+            }
+            default:
+                break;
+        }
+        scratchRelease(ds, &blocks);
+    }
+    mesh_clear(&patch);
+}
+
+/**
+ * Draw a compiled module graph as module_draw would draw the module it was compiled
+ * from, walking arrays of commands instead of lists of elements.
+ */
+void commandBuffer_draw(CommandBuffer *cb, Matrix *VTM, Matrix *GTM, DrawState *ds, Lighting *lighting, Image *src) {
+    int own;
+
+    if (!cb || cb->nCommand == 0 || !VTM || !GTM || !ds || !src) return;
+    own = !ds->scratch;
+    if (own) ds->scratch = &drawScratch;
+    commandRun(cb, 0, VTM, GTM, ds, lighting, src);
+    if (own) ds->scratch = NULL;
+}
+
+/* whether n items starting at at lie inside an array of count items. */
+static int inside(int at, int n, int count) {
+    return at >= 0 && n >= 0 && at <= count - n;
+}
+
+/* whether at is -1 for a missing array or n items starting at at lie inside count. */
+static int insideOrNone(int at, int n, int count) {
+    return at == -1 || inside(at, n, count);
+}
+
+/* whether the mesh record at integer[rec] refers only to items inside cb's arrays. */
+static int meshValid(CommandBuffer *cb, int rec) {
+    int *r, *faceStart, f;
+
+    if (!inside(rec, 9, cb->nInteger)) return 0;
+    r = &cb->integer[rec];
+    if (r[0] < 0 || r[1] < 0 || !insideOrNone(r[2], r[0], cb->nPoint) || !insideOrNone(r[3], r[0], cb->nPoint) ||
+        !insideOrNone(r[4], r[0], cb->nColor) || !insideOrNone(r[5], r[1] + 1, cb->nInteger)) return 0;
+    // meshDraw draws nothing without vertices and faces, and needs every array but the normals and colors otherwise
+    if (r[0] == 0 || r[1] == 0) return 1;
+    if (r[2] < 0 || r[5] < 0) return 0;
+    faceStart = &cb->integer[r[5]];
+    if (faceStart[0] < 0) return 0;
+    for (f = 0; f < r[1]; f++) {
+        if (faceStart[f + 1] < faceStart[f]) return 0;
+    }
+    if (!inside(r[6], faceStart[r[1]], cb->nInteger)) return 0;
+    for (f = faceStart[0]; f < faceStart[r[1]]; f++) {
+        if (cb->integer[r[6] + f] < 0 || cb->integer[r[6] + f] >= r[0]) return 0;
+    }
+    return 1;
+}
+
+/* whether the command c refers only to items inside cb's arrays. */
+static int commandValid(CommandBuffer *cb, Command *c) {
+    int *r = NULL, i;
+
+    switch (c->op) {
+        case CmdReturn:
+            return 1;
+        case CmdCall:
+            return inside(c->arg, 1, cb->nCommand) && insideOrNone(c->count, 3, cb->nPoint);
+        case CmdColor:
+        case CmdBodyColor:
+        case CmdSurfaceColor:
+            return inside(c->arg, 1, cb->nColor);
+        case CmdSurfaceCoeff:
+            return inside(c->arg, 1, cb->nReal);
+        case CmdLoad:
+            return inside(c->arg, 1, cb->nMatrix);
+        case CmdPoint:
+            return inside(c->arg, 1, cb->nPoint);
+        case CmdMesh:
+            return meshValid(cb, c->arg);
+        default:
+            break;
+    }
+    // the rest are records in integer, at least as long as the shortest
+    if (!inside(c->arg, 2, cb->nInteger)) return 0;
+    r = &cb->integer[c->arg];
+    switch (c->op) {
+        case CmdLine:
+            return inside(r[0], 2, cb->nPoint);
+        case CmdPolyline:
+            return inside(c->arg, 3, cb->nInteger) && r[0] >= 0 && (r[0] == 0 ? insideOrNone(r[1], 0, cb->nPoint) : inside(r[1], r[0], cb->nPoint));
+        case CmdPolygon:
+            return inside(c->arg, 6, cb->nInteger) && r[0] >= 0 && insideOrNone(r[1], r[0], cb->nPoint) &&
+                   insideOrNone(r[2], r[0], cb->nPoint) && insideOrNone(r[3], r[0], cb->nColor);
+        case CmdMeshLOD:
+            if (r[0] < 1 || r[0] > LOD_MAX_LEVELS || !inside(c->arg, 3 + r[0], cb->nInteger) ||
+                !inside(r[1], 1, cb->nReal) || !inside(r[2], 2, cb->nPoint)) return 0;
+            for (i = 0; i < r[0]; i++) {
+                if (!meshValid(cb, r[3 + i])) return 0;
+            }
+            return 1;
+        case CmdBezierCurve:
+            return inside(c->arg, 3, cb->nInteger) && inside(r[0], 4, cb->nPoint) && r[1] >= 0 && r[1] <= BEZIER_MAX_DEPTH;
+        case CmdBezierSurface:
+            return inside(c->arg, 4, cb->nInteger) && inside(r[0], 16, cb->nPoint) && r[1] >= 0 && r[1] <= BEZIER_MAX_DEPTH;
+        case CmdInstances:
+            return inside(c->arg, 4, cb->nInteger) && inside(r[0], 1, cb->nCommand) && r[1] >= 0 &&
+                   inside(r[2], r[1], cb->nMatrix) && insideOrNone(r[3], r[1], cb->nColor) && insideOrNone(c->count, 3, cb->nPoint);
+        default:
+            return 0;
+    }
+}
+
+/* whether the routine at pc and the routines it calls return without calling themselves again. */
+static int routineReturns(CommandBuffer *cb, int pc, unsigned char *mark) {
+    Command *c;
+    int to;
+
+    if (mark[pc] == 2) return 1;
+    if (mark[pc] == 1) return 0;
+    mark[pc] = 1;
+    for (c = &cb->command[pc]; c->op != CmdReturn; c++) {
+        to = c->op == CmdCall ? c->arg : c->op == CmdInstances ? cb->integer[c->arg] : -1;
+        if (to >= 0 && !routineReturns(cb, to, mark)) return 0;
+    }
+    mark[pc] = 2;
+    return 1;
+}
+
+/**
+ * Check that every index in cb's commands and records lies inside the array it refers
+ * to, that every routine ends in CmdReturn and that no routine calls itself, however
+ * indirectly, so commandBuffer_draw reads only inside the buffer and returns. For
+ * buffers that did not come from module_compile, such as a snapshot from a file.
+ * Returns 1 if cb is valid, 0 if it is not or the check cannot allocate its marks.
+ */
+int commandBuffer_valid(CommandBuffer *cb) {
+    unsigned char *mark;
+    int i, ok;
+
+    if (!cb || cb->nCommand < 1 || cb->command[cb->nCommand - 1].op != CmdReturn) return 0;
+    for (i = 0; i < cb->nCommand; i++) {
+        if (!commandValid(cb, &cb->command[i])) return 0;
+    }
+    mark = (unsigned char *)calloc(cb->nCommand, 1);
+    if (!mark) return 0;
+    ok = routineReturns(cb, 0, mark);
+    free(mark);
+    return ok;
+}
+
+/**
+ * Return the edit stamp of the module graph rooted at md, the newest version of md and
+ * every module it references. The value changes whenever anything in the graph is
+ * inserted or cleared, so it can be used to validate data cached from the graph.
+ */
+unsigned long module_version(Module *md) {
+    unsigned long version, sub;
+    Element *e;
+
+    if (!md) return 0;
+    version = md->version;
+    for (e = md->head; e != NULL; e = e->next) {
+        if (e->type == ObjModule || e->type == ObjInstances) {
+            sub = module_version(e->type == ObjModule ? e->obj->module : e->obj->instances.module);
+            if (sub > version) version = sub;
+        }
+    }
+    return version;
+}
+
+/**
+ * Note that an Element of md was changed in place through its object, say a matrix
+ * of an animation, rather than through the module_* functions. Bumps md's version,
+ * so bounds, compiled command buffers, shadow maps and world space geometry cached
+ * from the graph are made again. A shared mesh changed in place needs this on every
+ * module that holds it.
+ */
+void module_invalidate(Module *md) {
+    if (!md) return;
+    md->version = ++moduleEpoch;
+}
+
+/*
+    Add n points, transformed by LTM, to the bounds b: on the first pass grow the box,
+    on the second (sphere set) grow the squared radius about the center of that box.
+ */
+static void boundsExtend(Bounds *b, Matrix *LTM, Point *v, int n, int *empty, int sphere) {
+    Point t;
+    double d, r2;
+    int i, j;
+    for (i = 0; i < n; i++) {
+        matrix_xformPoint(LTM, &v[i], &t);
+        if (sphere) {
+            for (j = 0, r2 = 0; j < 3; j++) {
+                d = t.val[j] - b->center.val[j];
+                r2 += d * d;
+            }
+            if (r2 > b->radius) b->radius = r2;
+            continue;
+        }
+        for (j = 0; j < 3; j++) {
+            if (*empty || t.val[j] < b->min.val[j]) b->min.val[j] = t.val[j];
+            if (*empty || t.val[j] > b->max.val[j]) b->max.val[j] = t.val[j];
+        }
+        *empty = 0;
+    }
+}
+
+/* the 8 corners of the box min, max. */
+static void boxCorners(Point *min, Point *max, Point corner[8]) {
+    int i;
+    for (i = 0; i < 8; i++) {
+        point_set3D(&corner[i], i & 1 ? max->val[0] : min->val[0],
+                                i & 2 ? max->val[1] : min->val[1],
+                                i & 4 ? max->val[2] : min->val[2]);
+    }
+}
+
+/*
+    Add the geometry of md, under the LTMs in effect in it, to the bounds b. Sub-modules
+    and each of their instances contribute the corners of their own boxes.
+ */
+static void boundsWalk(Module *md, Bounds *b, int *empty, int sphere) {
+    Matrix LTM;
+    Element *e;
+    Point lo, hi, corner[8];
+
+    matrix_identity(&LTM);
+    for (e = md->head; e != NULL; e = e->next) {
+        switch (e->type) {
+            case ObjPoint:
+                boundsExtend(b, &LTM, &e->obj->point, 1, empty, sphere);
+                break;
+            case ObjLine:
+                boundsExtend(b, &LTM, &e->obj->line.a, 1, empty, sphere);
+                boundsExtend(b, &LTM, &e->obj->line.b, 1, empty, sphere);
+                break;
+            case ObjPolyline:
+                boundsExtend(b, &LTM, e->obj->polyline.vertex, e->obj->polyline.numVertex, empty, sphere);
+                break;
+            case ObjPolygon:
+                boundsExtend(b, &LTM, e->obj->polygon.vertex, e->obj->polygon.nVertex, empty, sphere);
+                break;
+            case ObjMesh:
+                boundsExtend(b, &LTM, e->obj->mesh.vertex, e->obj->mesh.nVertex, empty, sphere);
+                break;
+            case ObjSharedMesh:
+                boundsExtend(b, &LTM, e->obj->sharedMesh->mesh.vertex, e->obj->sharedMesh->mesh.nVertex, empty, sphere);
+                break;
+            case ObjMeshLOD:
+                boxCorners(&e->obj->meshLOD->min, &e->obj->meshLOD->max, corner);
+                boundsExtend(b, &LTM, corner, 8, empty, sphere);
+                break;
+            case ObjBezierCurve:
+                boundsExtend(b, &LTM, e->obj->bezierCurve.vertex, 4, empty, sphere);
+                break;
+            case ObjBezierSurface:
+                boundsExtend(b, &LTM, &e->obj->bezierSurface.vertex[0][0], 16, empty, sphere);
+                break;
+            case ObjMatrix:
+                matrix_multiply(&e->obj->matrix, &LTM, &LTM);
+                break;
+            case ObjIdentity:
+                matrix_identity(&LTM);
+                break;
+            case ObjModule:
+                if (!module_bounds(e->obj->module, &lo, &hi)) break;
+                boxCorners(&lo, &hi, corner);
+                boundsExtend(b, &LTM, corner, 8, empty, sphere);
+                break;
+            case ObjInstances: {
+                Matrix place;
+                int i;
+                if (!module_bounds(e->obj->instances.module, &lo, &hi)) break;
+                boxCorners(&lo, &hi, corner);
+                for (i = 0; i < e->obj->instances.count; i++) {
+                    matrix_multiply(&LTM, &e->obj->instances.matrix[i], &place);
+                    boundsExtend(b, &place, corner, 8, empty, sphere);
+                }
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
+
+/**
+ * Compute the axis-aligned bounding box of the geometry in md, in the coordinates md
+ * is drawn in (before the GTM), into min and max. Sub-modules contribute the box of
+ * their own bounds transformed by the LTM in effect where they are referenced.
+ * The result is cached in the module and only recomputed after an edit to the graph,
+ * together with the bounding sphere returned by module_sphere.
+ * Returns 0 if the module holds no geometry, 1 otherwise.
+ */
+int module_bounds(Module *md, Point *min, Point *max) {
+    unsigned long version;
+    int j, empty = 1;
+
+    if (!md) return 0;
+    if (md->bounds.version == 0 || md->bounds.epoch != moduleEpoch) {
+        version = module_version(md);
+        if (md->bounds.version != version) {
+            boundsWalk(md, &md->bounds, &empty, 0);
+            if (!empty) {
+                // a second pass finds how far the geometry reaches from the box center
+                for (j = 0; j < 3; j++) md->bounds.center.val[j] = (md->bounds.min.val[j] + md->bounds.max.val[j]) / 2;
+                md->bounds.center.val[3] = 1;
+                md->bounds.radius = 0;
+                boundsWalk(md, &md->bounds, &empty, 1);
+                md->bounds.radius = sqrt(md->bounds.radius);
+            }
+            md->bounds.empty = empty;
+            md->bounds.version = version;
+        }
+        md->bounds.epoch = moduleEpoch;
+    }
+    if (md->bounds.empty) return 0;
+    if (min) *min = md->bounds.min;
+    if (max) *max = md->bounds.max;
+    return 1;
+}
+
+/**
+ * Put the bounding sphere of the geometry in md, in the coordinates md is drawn in,
+ * into center and radius. The sphere is centered on the box of module_bounds and is
+ * cached with it. Returns 0 if the module holds no geometry, 1 otherwise.
+ */
+int module_sphere(Module *md, Point *center, double *radius) {
+    if (!module_bounds(md, NULL, NULL)) return 0;
+    if (center) *center = md->bounds.center;
+    if (radius) *radius = md->bounds.radius;
+    return 1;
+}
+
+/* DrawStats Functions */
+
+/* Return the counters of the work done by module_draw on the calling thread since the last drawstats_reset. */
+DrawStats *drawstats_get(void) {
+    return &drawStats;
+}
+
+/* Zero the module_draw counters of the calling thread. */
+void drawstats_reset(void) {
+    memset(&drawStats, 0, sizeof(DrawStats));
+}
+
+/* Add the counters s, say of a traversal on another thread, to those of the calling thread. */
+void drawstats_add(DrawStats *s) {
+    int i;
+
+    if (!s) return;
+    drawStats.hizTests += s->hizTests;
+    drawStats.hizHits += s->hizHits;
+    drawStats.hizMisses += s->hizMisses;
+    drawStats.hizPolygonsCulled += s->hizPolygonsCulled;
+    drawStats.hizModulesCulled += s->hizModulesCulled;
+    drawStats.frustumTests += s->frustumTests;
+    drawStats.frustumSphereCulls += s->frustumSphereCulls;
+    drawStats.frustumModulesCulled += s->frustumModulesCulled;
+    drawStats.instancesDrawn += s->instancesDrawn;
+    drawStats.instancesCulled += s->instancesCulled;
+    drawStats.matrixMultiplies += s->matrixMultiplies;
+    drawStats.vertexTransforms += s->vertexTransforms;
+    drawStats.normalMatrices += s->normalMatrices;
+    drawStats.meshVertices += s->meshVertices;
+    drawStats.meshFaces += s->meshFaces;
+    drawStats.meshCacheLookups += s->meshCacheLookups;
+    drawStats.meshCacheHits += s->meshCacheHits;
+    drawStats.meshVerticesShaded += s->meshVerticesShaded;
+    if (s->meshCacheLookups) drawStats.meshCacheHitRate = s->meshCacheHitRate;
+    drawStats.patchTessellations += s->patchTessellations;
+    drawStats.patchCacheHits += s->patchCacheHits;
+    for (i = 0; i < LOD_MAX_LEVELS; i++) drawStats.lodSelected[i] += s->lodSelected[i];
+    drawStats.heapAllocations += s->heapAllocations;
+}
+
+/* 3D Module Functions */
+
+/* Matrix operand to add a 3D translation to the Module. */
+void module_translate(Module *md, double tx, double ty, double tz) {
+    if (!md) return;
+    Matrix m;
+    matrix_identity(&m);
+    matrix_translate(&m, tx, ty, tz);
+    moduleAdd(md, ObjMatrix, &m);
+}
+/* Matrix operand to add a 3D scale to the Module. */
+void module_scale(Module *md, double sx, double sy, double sz) {
+	if (!md) return;
+    Matrix m;
+    matrix_identity(&m);
+    matrix_scale(&m, sx, sy, sz);
+    moduleAdd(md, ObjMatrix, &m);
+}
+/* Matrix operand to add a rotation about the X-axis to the Module. */
+void module_rotateX(Module *md, double cth, double sth) {
+	if (!md) return;
+    Matrix m;
+    matrix_identity(&m);
+    matrix_rotateX(&m, cth, sth);
+    moduleAdd(md, ObjMatrix, &m);
+}
+
+/* Matrix operand to add a rotation about the Y-axis to the Module. */
+void module_rotateY(Module *md, double cth, double sth) {
+	if (!md) return;
+    Matrix m;
+    matrix_identity(&m);
+    matrix_rotateY(&m, cth, sth);
+    moduleAdd(md, ObjMatrix, &m);
+}
+
+/* Matrix operand to add a rotation that orients to the orthonormal axes ~u, ~v, w~. */
+void module_rotateXYZ(Module *md, Vector *u, Vector *v, Vector *w) {
+	if (!md || !u || !v || !w) return;
+    Matrix m;
+    matrix_identity(&m);
+    matrix_rotateXYZ(&m, u, v, w);
+    moduleAdd(md, ObjMatrix, &m);
+}
+
+// shared meshes of the solid primitives, made on first use; each holds a reference for the registry
+static SharedMesh *cubeMesh = NULL;
+static SharedMesh *pyramidMesh = NULL;
+static SharedMesh *tetrahedronMesh = NULL;
+static SharedMesh **cylinderMesh = NULL; // indexed by the number of sides, NULL where not made yet
+static int cylinderSides = 0; // length of cylinderMesh
+
+// corners of the six faces of the unit cube, four per face
+static const float cubeCorner[24][3] = {
+  {-0.5, -0.5, -0.5}, {-0.5, -0.5, 0.5}, {-0.5, 0.5, 0.5}, {-0.5, 0.5, -0.5},
+  {0.5, -0.5, -0.5}, {0.5, -0.5, 0.5}, {0.5, 0.5, 0.5}, {0.5, 0.5, -0.5},
+  {-0.5, -0.5, -0.5}, {-0.5, -0.5, 0.5}, {0.5, -0.5, 0.5}, {0.5, -0.5, -0.5},
+  {-0.5, 0.5, -0.5}, {-0.5, 0.5, 0.5}, {0.5, 0.5, 0.5}, {0.5, 0.5, -0.5},
+  {-0.5, -0.5, -0.5}, {-0.5, 0.5, -0.5}, {0.5, 0.5, -0.5}, {0.5, -0.5, -0.5},
+  {-0.5, -0.5, 0.5}, {-0.5, 0.5, 0.5}, {0.5, 0.5, 0.5}, {0.5, -0.5, 0.5}
+};
+
+/*
+    Share a primitive of nVertex corners and nFace faces indexing them as in Mesh.
+    Normals come from mesh_setNormals, so corners shared by faces are smooth and
+    corners listed once per face keep the face normal. Each is then turned away from
+    the point (0, centerY, 0) inside the primitive. Returns NULL if allocation fails.
+ */
+static SharedMesh *primitiveShare(int nVertex, Point *pt, int nFace, int *faceStart, int *index, float centerY) {
+    SharedMesh *s = NULL;
+    Mesh m;
+    int i;
+
+    mesh_init(&m);
+    mesh_set(&m, nVertex, pt, NULL, NULL, nFace, faceStart, index);
+    mesh_setNormals(&m);
+    if (m.normal) {
+        for (i = 0; i < m.nVertex; i++) {
+            Vector *n = &m.normal[i];
+            if (m.vertex[i].val[0] * n->val[0] + (m.vertex[i].val[1] - centerY) * n->val[1] + m.vertex[i].val[2] * n->val[2] < 0) {
+                vector_set(n, -n->val[0], -n->val[1], -n->val[2]);
+            }
+        }
+        s = sharedMesh_create(&m);
+    }
+    mesh_clear(&m);
+    return s;
+}
+
+/**
+ * Adds a unit cube, axis-aligned and centered on zero to the Module. 
+ * If solid is zero, add only lines.
+ * If solid is non-zero, add a reference to the shared mesh of the cube, a quadrilateral
+ * per face with the face normal at its corners.
+ */
+void module_cube(Module *md, int solid) {
+  if (solid==0) {
+	//use lines
+	Point a, b, c, d, e, f, g, h;
+
+	point_set3D(&a, -0.5, -0.5, -0.5);
+	point_set3D(&b, 0.5, -0.5, -0.5);
+	point_set3D(&c, -0.5, 0.5, -0.5);
+	point_set3D(&d, 0.5, 0.5, -0.5);
+	point_set3D(&e, -0.5, 0.5, 0.5);
+	point_set3D(&f, 0.5, 0.5, 0.5);
+	point_set3D(&g, -0.5, -0.5, 0.5);
+	point_set3D(&h, 0.5, -0.5, 0.5);
+
+	Point abdc[5], abhg[5], efhg[5], efdc[5], geca[5], hfdb[5];
+	abdc[0] = abhg[0] = geca[3] = abdc[4] = abhg[4] = a;
+	abdc[1] = abhg[1] = hfdb[3] = b;
 	abdc[2] = efdc[2] = hfdb[2] = d;
 	abdc[3] = efdc[3] = geca[2] = c;
 	abhg[2] = efhg[2] = hfdb[0] = hfdb[4] = h;
@@ -471,58 +2491,18 @@ void module_cube(Module *md, int solid) {
 	module_polyline(md, GECA);
 	module_polyline(md, HFDB);
   } else {
-	//use polygons
-	Point pt[4];
-	Polygon p;
-
-	polygon_init( &p );
-	point_set3D( &pt[0], -0.5, -0.5, -0.5 );
-	point_set3D( &pt[1], -0.5, -0.5, 0.5 );
-	point_set3D( &pt[2], -0.5, 0.5, 0.5 );
-	point_set3D( &pt[3], -0.5, 0.5, -0.5);
-	polygon_set( &p, 4, pt );
-    polygon_setNormals( &p, 4, NULL);
-	module_polygon( md, &p );
-
-	point_set3D( &pt[0], 0.5, -0.5, -0.5 );
-	point_set3D( &pt[1], 0.5, -0.5, 0.5);
-	point_set3D( &pt[2], 0.5, 0.5, 0.5);
-	point_set3D( &pt[3], 0.5, 0.5, -0.5);
-	polygon_set( &p, 4, pt );
-    polygon_setNormals( &p, 4, NULL);
-	module_polygon( md, &p );
-
-	point_set3D( &pt[0], -0.5, -0.5, -0.5 );
-	point_set3D( &pt[1], -0.5, -0.5, 0.5 );
-	point_set3D( &pt[2], 0.5, -0.5, 0.5 );
-	point_set3D( &pt[3], 0.5, -0.5, -0.5 );
-	polygon_set( &p, 4, pt );
-    polygon_setNormals( &p, 4, NULL);
-	module_polygon( md, &p );
-
-	point_set3D( &pt[0], -0.5, 0.5, -0.5 );
-	point_set3D( &pt[1], -0.5, 0.5, 0.5 );
-	point_set3D( &pt[2], 0.5, 0.5, 0.5 );
-	point_set3D( &pt[3], 0.5, 0.5, -0.5 );
-	polygon_set( &p, 4, pt );
-    polygon_setNormals( &p, 4, NULL);  
-	module_polygon( md, &p );
-
-	point_set3D( &pt[0], -0.5, -0.5, -0.5 );
-	point_set3D( &pt[1], -0.5, 0.5, -0.5);
-	point_set3D( &pt[2], 0.5, 0.5, -0.5 );
-	point_set3D( &pt[3], 0.5, -0.5, -0.5 );
-	polygon_set( &p, 4, pt );
-    polygon_setNormals( &p, 4, NULL);
-	module_polygon( md, &p );
-
-	point_set3D( &pt[0], -0.5, -0.5, 0.5 );
-	point_set3D( &pt[1], -0.5, 0.5, 0.5 );
-	point_set3D( &pt[2], 0.5, 0.5, 0.5 );
-	point_set3D( &pt[3], 0.5, -0.5, 0.5);
-	polygon_set( &p, 4, pt );
-    polygon_setNormals( &p, 4, NULL);
-	module_polygon( md, &p );
+	//use the shared mesh, made on first use
+	if (!cubeMesh) {
+		Point pt[24];
+		int faceStart[7], index[24], i;
+		for (i = 0; i < 24; i++) {
+			point_set3D(&pt[i], cubeCorner[i][0], cubeCorner[i][1], cubeCorner[i][2]);
+			index[i] = i;
+		}
+		for (i = 0; i <= 6; i++) faceStart[i] = 4 * i;
+		cubeMesh = primitiveShare(24, pt, 6, faceStart, index, 0.0);
+	}
+	module_sharedMesh(md, cubeMesh);
   }
 }
 
@@ -530,134 +2510,219 @@ void module_cube(Module *md, int solid) {
  * Adds a unit cylinder, axis-aligned along the Y-axis and centered on zero to the Module. 
  * Takes in the number of subdivisions to use when creating the cylinder.
  * from test6b.c by Professor Bruce Maxwell
+ * The sides share their vertices, so they get smooth normals, while the fans of the
+ * top and bottom have their own with the normals of the caps. One shared mesh is made
+ * per number of sides.
  */
 void module_cylinder( Module *mod, int sides ) {
-  Polygon p;
-  Point xtop, xbot;
-  double x1, x2, z1, z2;
-  int i;
-
-  polygon_init( &p );
-  point_set3D( &xtop, 0, 1.0, 0.0 );
-  point_set3D( &xbot, 0, 0.0, 0.0 );
-
-  // make a fan for the top and bottom sides
-  // and quadrilaterals for the sides
-  for(i=0;i<sides;i++) {
-    Point pt[4];
-
-    x1 = cos( i * M_PI * 2.0 / sides ); 
-    z1 = sin( i * M_PI * 2.0 / sides );
-    x2 = cos( ( (i+1)%sides ) * M_PI * 2.0 / sides );
-    z2 = sin( ( (i+1)%sides ) * M_PI * 2.0 / sides );
-
-    point_copy( &pt[0], &xtop );
-    point_set3D( &pt[1], x1, 1.0, z1 );
-    point_set3D( &pt[2], x2, 1.0, z2 );
-
-    polygon_set( &p, 3, pt );
-    module_polygon( mod, &p );
-
-    point_copy( &pt[0], &xbot );
-    point_set3D( &pt[1], x1, 0.0, z1 );
-    point_set3D( &pt[2], x2, 0.0, z2 );
+  if (sides < 3) return;
+  if (sides >= cylinderSides) {
+    SharedMesh **grown = realloc(cylinderMesh, sizeof(SharedMesh *) * (sides + 1));
+    if (!grown) return;
+    while (cylinderSides <= sides) grown[cylinderSides++] = NULL;
+    cylinderMesh = grown;
+  }
 
-    polygon_set( &p, 3, pt );
-    module_polygon( mod, &p );
+  if (!cylinderMesh[sides]) {
+    // ring at y = 0, ring at y = 1, top center and ring, bottom center and ring
+    int nVertex = 4 * sides + 2, nFace = 3 * sides;
+    int top = 2 * sides, bot = 3 * sides + 1;
+    Point *pt = malloc(sizeof(Point) * nVertex);
+    int *faceStart = malloc(sizeof(int) * (nFace + 1));
+    int *index = malloc(sizeof(int) * 10 * sides);
+    int i, j, f, n;
+    double x, z;
+
+    if (!pt || !faceStart || !index) {
+      free(pt);
+      free(faceStart);
+      free(index);
+      return;
+    }
+    point_set3D( &pt[top], 0, 1.0, 0.0 );
+    point_set3D( &pt[bot], 0, 0.0, 0.0 );
+    for(i=0;i<sides;i++) {
+      x = cos( i * M_PI * 2.0 / sides ); 
+      z = sin( i * M_PI * 2.0 / sides );
+      point_set3D( &pt[i], x, 0.0, z );
+      point_set3D( &pt[sides + i], x, 1.0, z );
+      point_set3D( &pt[top + 1 + i], x, 1.0, z );
+      point_set3D( &pt[bot + 1 + i], x, 0.0, z );
+    }
 
-    point_set3D( &pt[0], x1, 0.0, z1 );
-    point_set3D( &pt[1], x2, 0.0, z2 );
-    point_set3D( &pt[2], x2, 1.0, z2 );
-    point_set3D( &pt[3], x1, 1.0, z1 );
-    
-    polygon_set( &p, 4, pt );
-    module_polygon( mod, &p );
+    // a fan triangle for the top and bottom sides and a quadrilateral for the side, in the order of the polygons
+    for(i=0, f=0, n=0;i<sides;i++) {
+      j = (i+1)%sides;
+      faceStart[f++] = n;
+      index[n++] = top;
+      index[n++] = top + 1 + i;
+      index[n++] = top + 1 + j;
+      faceStart[f++] = n;
+      index[n++] = bot;
+      index[n++] = bot + 1 + i;
+      index[n++] = bot + 1 + j;
+      faceStart[f++] = n;
+      index[n++] = i;
+      index[n++] = j;
+      index[n++] = sides + j;
+      index[n++] = sides + i;
+    }
+    faceStart[f] = n;
+    cylinderMesh[sides] = primitiveShare(nVertex, pt, nFace, faceStart, index, 0.5);
+    free(pt);
+    free(faceStart);
+    free(index);
   }
-
-  polygon_clear( &p );
+  module_sharedMesh(mod, cylinderMesh[sides]);
 }
 
 /**
  * Adds a unit pyramid, axis-aligned along the Y-axis and centered on zero to the Module. 
  */
 void module_pyramid( Module *md ) {
-  Polygon p;
-  Point xtop, pt[4];
-
-  point_set3D( &xtop, 0, 1.0, 0.0 );
-
-  polygon_init( &p );
-  
-  // bottom part of pyramid
-  point_set3D( &pt[0], -0.5, 0, -0.5 ); //bottom left
-  point_set3D( &pt[1], -0.5, 0, 0.5 ); // top left
-  point_set3D( &pt[2], 0.5, 0, 0.5 ); // top right
-  point_set3D( &pt[3], 0.5, 0, -0.5); //bottom right
-  polygon_set( &p, 4, pt );
-  module_polygon( md, &p );
-
-  // left side triangle
-  point_set3D( &pt[0], -0.5, 0, -0.5 ); //bottom left
-  point_set3D( &pt[1], -0.5, 0, 0.5 ); // top left
-  point_copy( &pt[2], &xtop);
-  polygon_set( &p, 3, pt);
-  module_polygon( md, &p );
-
-  // top side triangle
-  point_set3D( &pt[0], -0.5, 0, 0.5 ); // top left
-  point_set3D( &pt[1], 0.5, 0, 0.5 ); // top right
-  polygon_set( &p, 3, pt);
-  module_polygon( md, &p );
-
-  // right side triangle
-  point_set3D( &pt[0], 0.5, 0, -0.5); //bottom right
-  point_set3D( &pt[1], 0.5, 0, 0.5 ); // top right
-  polygon_set( &p, 3, pt);
-  module_polygon( md, &p );
-
-  // bottom side triangle
-  point_set3D( &pt[0], 0.5, 0, -0.5); //bottom right
-  point_set3D( &pt[1], -0.5, 0, -0.5 ); //bottom left
-  polygon_set( &p, 3, pt);
-  module_polygon( md, &p );
-
-  polygon_clear( &p );
+  if (!pyramidMesh) {
+    // bottom, then the left, top, right and bottom side triangles
+    static const float corner[16][3] = {
+      {-0.5, 0, -0.5}, {-0.5, 0, 0.5}, {0.5, 0, 0.5}, {0.5, 0, -0.5},
+      {-0.5, 0, -0.5}, {-0.5, 0, 0.5}, {0, 1.0, 0},
+      {-0.5, 0, 0.5}, {0.5, 0, 0.5}, {0, 1.0, 0},
+      {0.5, 0, -0.5}, {0.5, 0, 0.5}, {0, 1.0, 0},
+      {0.5, 0, -0.5}, {-0.5, 0, -0.5}, {0, 1.0, 0}
+    };
+    int faceStart[6] = {0, 4, 7, 10, 13, 16};
+    int index[16], i;
+    Point pt[16];
+
+    for (i = 0; i < 16; i++) {
+      point_set3D(&pt[i], corner[i][0], corner[i][1], corner[i][2]);
+      index[i] = i;
+    }
+    pyramidMesh = primitiveShare(16, pt, 5, faceStart, index, 0.25);
+  }
+  module_sharedMesh(md, pyramidMesh);
 }
 
 /**
  * Adds a unit tetrahedron, centered on zero to the Module, and inscribed in the unit cube
  */
 void module_tetrahedron( Module *md ) {
-  Polygon p;
-  Point xtop, pt[4];
-
-  point_set3D( &xtop, 0, 1.0, 0.0 );
-
-  polygon_init( &p );
-  
-  point_set3D( &pt[0], -0.5, 0, 0.5 ); // bottom upper left
-  point_set3D( &pt[1], 0.5, 0, -0.5); // bottom lower right
-  point_set3D( &pt[2], -0.5, 1, -0.5 ); // top lower left
-  point_set3D( &pt[3], 0.5, 1, 0.5); // top upper right
-
-  polygon_set( &p, 3, pt); // bottom upper left, bottom lower right, top lower left
-  module_polygon( md, &p );
-
-  point_set3D( &pt[2], 0.5, 1, 0.5); // top upper right
-  polygon_set( &p, 3, pt); // bottom upper left, bottom lower right, top upper right
-  module_polygon( md, &p );
+  if (!tetrahedronMesh) {
+    // bottom upper left, bottom lower right, top lower left and top upper right corners
+    static const float corner[12][3] = {
+      {-0.5, 0, 0.5}, {0.5, 0, -0.5}, {-0.5, 1, -0.5},
+      {-0.5, 0, 0.5}, {0.5, 0, -0.5}, {0.5, 1, 0.5},
+      {-0.5, 1, -0.5}, {0.5, 1, 0.5}, {-0.5, 0, 0.5},
+      {-0.5, 1, -0.5}, {0.5, 1, 0.5}, {0.5, 0, -0.5}
+    };
+    int faceStart[5] = {0, 3, 6, 9, 12};
+    int index[12], i;
+    Point pt[12];
+
+    for (i = 0; i < 12; i++) {
+      point_set3D(&pt[i], corner[i][0], corner[i][1], corner[i][2]);
+      index[i] = i;
+    }
+    tetrahedronMesh = primitiveShare(12, pt, 4, faceStart, index, 0.5);
+  }
+  module_sharedMesh(md, tetrahedronMesh);
+}
 
-  point_set3D( &pt[0], -0.5, 1, -0.5 ); // top lower left
-  point_set3D( &pt[1], 0.5, 1, 0.5); // top upper right
-  point_set3D( &pt[2], -0.5, 0, 0.5 ); // bottom upper left
-  polygon_set( &p, 3, pt); // top lower left, top upper right, bottom upper left
-  module_polygon( md, &p );
+/**
+ * Release the shared meshes of the solid primitives. Modules still using them keep
+ * them alive until they are cleared; the next call to a primitive makes a new one.
+ */
+void module_freePrimitives(void) {
+  int i;
+  sharedMesh_release(cubeMesh);
+  sharedMesh_release(pyramidMesh);
+  sharedMesh_release(tetrahedronMesh);
+  cubeMesh = pyramidMesh = tetrahedronMesh = NULL;
+  for (i = 0; i < cylinderSides; i++) sharedMesh_release(cylinderMesh[i]);
+  free(cylinderMesh);
+  cylinderMesh = NULL;
+  cylinderSides = 0;
+}
 
-  point_set3D( &pt[2], 0.5, 0, -0.5); // bottom lower right
-  polygon_set( &p, 3, pt); // top lower left, top upper right, bottom lower right
-  module_polygon( md, &p );
+// control points of the teapot patches, from the GLUT teapot (z up)
+static const float teapotPoint[127][3] = {
+    {0.2, 0, 2.7}, {0.2, -0.112, 2.7}, {0.112, -0.2, 2.7}, {0, -0.2, 2.7},
+    {1.3375, 0, 2.53125}, {1.3375, -0.749, 2.53125}, {0.749, -1.3375, 2.53125}, {0, -1.3375, 2.53125},
+    {1.4375, 0, 2.53125}, {1.4375, -0.805, 2.53125}, {0.805, -1.4375, 2.53125}, {0, -1.4375, 2.53125},
+    {1.5, 0, 2.4}, {1.5, -0.84, 2.4}, {0.84, -1.5, 2.4}, {0, -1.5, 2.4},
+    {1.75, 0, 1.875}, {1.75, -0.98, 1.875}, {0.98, -1.75, 1.875}, {0, -1.75, 1.875},
+    {2, 0, 1.35}, {2, -1.12, 1.35}, {1.12, -2, 1.35}, {0, -2, 1.35},
+    {2, 0, 0.9}, {2, -1.12, 0.9}, {1.12, -2, 0.9}, {0, -2, 0.9},
+    {-2, 0, 0.9}, {2, 0, 0.45}, {2, -1.12, 0.45}, {1.12, -2, 0.45},
+    {0, -2, 0.45}, {1.5, 0, 0.225}, {1.5, -0.84, 0.225}, {0.84, -1.5, 0.225},
+    {0, -1.5, 0.225}, {1.5, 0, 0.15}, {1.5, -0.84, 0.15}, {0.84, -1.5, 0.15},
+    {0, -1.5, 0.15}, {-1.6, 0, 2.025}, {-1.6, -0.3, 2.025}, {-1.5, -0.3, 2.25},
+    {-1.5, 0, 2.25}, {-2.3, 0, 2.025}, {-2.3, -0.3, 2.025}, {-2.5, -0.3, 2.25},
+    {-2.5, 0, 2.25}, {-2.7, 0, 2.025}, {-2.7, -0.3, 2.025}, {-3, -0.3, 2.25},
+    {-3, 0, 2.25}, {-2.7, 0, 1.8}, {-2.7, -0.3, 1.8}, {-3, -0.3, 1.8},
+    {-3, 0, 1.8}, {-2.7, 0, 1.575}, {-2.7, -0.3, 1.575}, {-3, -0.3, 1.35},
+    {-3, 0, 1.35}, {-2.5, 0, 1.125}, {-2.5, -0.3, 1.125}, {-2.65, -0.3, 0.9375},
+    {-2.65, 0, 0.9375}, {-2, -0.3, 0.9}, {-1.9, -0.3, 0.6}, {-1.9, 0, 0.6},
+    {1.7, 0, 1.425}, {1.7, -0.66, 1.425}, {1.7, -0.66, 0.6}, {1.7, 0, 0.6},
+    {2.6, 0, 1.425}, {2.6, -0.66, 1.425}, {3.1, -0.66, 0.825}, {3.1, 0, 0.825},
+    {2.3, 0, 2.1}, {2.3, -0.25, 2.1}, {2.4, -0.25, 2.025}, {2.4, 0, 2.025},
+    {2.7, 0, 2.4}, {2.7, -0.25, 2.4}, {3.3, -0.25, 2.4}, {3.3, 0, 2.4},
+    {2.8, 0, 2.475}, {2.8, -0.25, 2.475}, {3.525, -0.25, 2.49375}, {3.525, 0, 2.49375},
+    {2.9, 0, 2.475}, {2.9, -0.15, 2.475}, {3.45, -0.15, 2.5125}, {3.45, 0, 2.5125},
+    {2.8, 0, 2.4}, {2.8, -0.15, 2.4}, {3.2, -0.15, 2.4}, {3.2, 0, 2.4},
+    {0, 0, 3.15}, {0.8, 0, 3.15}, {0.8, -0.45, 3.15}, {0.45, -0.8, 3.15},
+    {0, -0.8, 3.15}, {0, 0, 2.85}, {1.4, 0, 2.4}, {1.4, -0.784, 2.4},
+    {0.784, -1.4, 2.4}, {0, -1.4, 2.4}, {0.4, 0, 2.55}, {0.4, -0.224, 2.55},
+    {0.224, -0.4, 2.55}, {0, -0.4, 2.55}, {1.3, 0, 2.55}, {1.3, -0.728, 2.55},
+    {0.728, -1.3, 2.55}, {0, -1.3, 2.55}, {1.3, 0, 2.4}, {1.3, -0.728, 2.4},
+    {0.728, -1.3, 2.4}, {0, -1.3, 2.4}, {0, 0, 0}, {1.425, -0.798, 0},
+    {1.5, 0, 0.075}, {1.425, 0, 0}, {0.798, -1.425, 0}, {0, -1.5, 0.075},
+    {0, -1.425, 0}, {1.5, -0.84, 0.075}, {0.84, -1.5, 0.075}
+};
+
+// patches of one quarter of the teapot, indices into teapotPoint
+static const int teapotPatch[10][16] = {
+    // rim
+    {102, 103, 104, 105, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    // body
+    {12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27},
+    {24, 25, 26, 27, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40},
+    // lid
+    {96, 96, 96, 96, 97, 98, 99, 100, 101, 101, 101, 101, 0, 1, 2, 3},
+    {0, 1, 2, 3, 106, 107, 108, 109, 110, 111, 112, 113, 114, 115, 116, 117},
+    // bottom
+    {118, 118, 118, 118, 124, 122, 119, 121, 123, 126, 125, 120, 40, 39, 38, 37},
+    // handle
+    {41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55, 56},
+    {53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63, 64, 28, 65, 66, 67},
+    // spout
+    {68, 69, 70, 71, 72, 73, 74, 75, 76, 77, 78, 79, 80, 81, 82, 83},
+    {80, 81, 82, 83, 84, 85, 86, 87, 88, 89, 90, 91, 92, 93, 94, 95}
+};
 
-  polygon_clear( &p );
+/**
+ * Adds the Utah teapot to the Module as 32 Bezier surfaces, standing on the X-Y plane
+ * with Z up, about 6.4 long and 3.15 tall. The rim, body, lid and bottom patches are
+ * mirrored into all four quadrants and the handle and spout across the X-Z plane.
+ * divisions and solid are passed on to module_bezierSurface.
+ */
+void module_teapot(Module *md, int divisions, int solid) {
+    BezierSurface b;
+    int i, j, k, m;
+    if (!md) return;
+    bezierSurface_init(&b);
+    for (i = 0; i < 10; i++) {
+        // m = 0 as given, 1 mirrored in y, 2 mirrored in x, 3 mirrored in both
+        for (m = 0; m < (i < 6 ? 4 : 2); m++) {
+            for (j = 0; j < 4; j++) {
+                for (k = 0; k < 4; k++) {
+                    // a single mirror flips the patch, so reverse the columns to keep the winding
+                    const float *p = teapotPoint[teapotPatch[i][j * 4 + (m == 1 || m == 2 ? 3 - k : k)]];
+                    point_set3D(&b.vertex[j][k], m >= 2 ? -p[0] : p[0], m == 1 || m == 3 ? -p[1] : p[1], p[2]);
+                }
+            }
+            module_bezierSurface(md, &b, divisions, solid);
+        }
+    }
 }
 
 /* Shading/Color Module Functions */
@@ -665,27 +2730,23 @@ void module_tetrahedron( Module *md ) {
 /* Adds the foreground color value to the tail of the module’s list. */
 void module_color(Module *md, Color *c) {
     if (!md || !c) return;
-    Element *e = element_init(ObjColor, c);
-    if (e) module_insert(md, e);
+    moduleAdd(md, ObjColor, c);
 }
 
 /* Adds the body color value to the tail of the module’s list. */
 void module_bodyColor(Module *md, Color *c) {
 	if (!md || !c) return;
-    Element *e = element_init(ObjBodyColor, c);
-    if (e) module_insert(md, e);
+    moduleAdd(md, ObjBodyColor, c);
 }
 
 /*  Adds the surface color value to the tail of the module’s list. */
 void module_surfaceColor(Module *md, Color *c) {
 	if (!md || !c) return;
-    Element *e = element_init(ObjSurfaceColor, c);
-    if (e) module_insert(md, e);
+    moduleAdd(md, ObjSurfaceColor, c);
 }
 
 /* Adds the specular coefficient to the tail of the module’s list.*/
 void module_surfaceCoeff(Module *md, float coeff) {
 	if (!md) return;
-    Element *e = element_init(ObjSurfaceCoeff, &coeff);
-    if (e) module_insert(md, e);
+    moduleAdd(md, ObjSurfaceCoeff, &coeff);
 }
\ No newline at end of file
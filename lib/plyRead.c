@@ -52,25 +52,21 @@ ply_type plyType(char *buffer) {
 
 #define MaxVertices (10)
 
-int readPLY(char filename[], int *nPolygons, Polygon **plist, Color **clist, int estNormals) {
+/*
+  Reads the header of an open .ply file up to end_header, returning the
+  number of vertices and faces.  Returns 0 on success, -1 on a bad header.
+*/
+static int plyReadHeader(FILE *fp, char filename[], int *nVertex, int *nFace) {
 	char buffer[256];
-	Point *vertex;
-	Vector *normal;
-	//  Point *texture;
-	Color *color;
-	Polygon *p;
-	int numPoly;
-	int numVertex;
+	int numPoly = 0;
+	int numVertex = 0;
 	int vertexProp = 0;
 	int faceProp = 0;
+	int status = 0;
 	ply_property *vertexproplist = NULL;
 	ply_property *vertexproptail = NULL;
 	ply_property *faceproplist = NULL;
 	ply_property *faceproptail = NULL;
-	int nv;
-	int vid[MaxVertices];
-	int i, j;
-	Color tcolor;
 
 	// first line ought to be "ply"
 	// format ought to be "ascii 1.0"
@@ -90,106 +86,177 @@ int readPLY(char filename[], int *nPolygons, Polygon **plist, Color **clist, int
 	// end_header means the first element type starts
 
 	int doneWithHeader = 0;
-	FILE *fp = fopen(filename, "r");
-	if(fp) {
-		// check if it's a .ply file
-		fscanf(fp, "%s", buffer);
-		if(strcmp(buffer, "ply")) {
-			printf("%s doesn't look like a .ply file\n", filename);
-			fclose(fp);
-			return(-1);
-		}
 
-		while(!doneWithHeader) {
-			fscanf(fp, "%s", buffer);
-			switch(buffer[0]) {
-			case 'f':
-				// format statement
-				for(;fgetc(fp) != '\n';);
-				break;
+	// check if it's a .ply file
+	fscanf(fp, "%s", buffer);
+	if(strcmp(buffer, "ply")) {
+		printf("%s doesn't look like a .ply file\n", filename);
+		return(-1);
+	}
+
+	while(!doneWithHeader) {
+		fscanf(fp, "%s", buffer);
+		switch(buffer[0]) {
+		case 'f':
+			// format statement
+			for(;fgetc(fp) != '\n';);
+			break;
 	
-			case 'c':
-				// comment
-				for(;fgetc(fp) != '\n';);
+		case 'c':
+			// comment
+			for(;fgetc(fp) != '\n';);
+			break;
+
+		case 'p':
+			// property statement
+		{
+			ply_property *prop = malloc(sizeof(ply_property));
+			prop->listCardType = type_none;
+			prop->listDataType = type_none;
+			prop->next = NULL;
+
+			fscanf(fp, "%s", buffer); // get the data type
+			prop->type = plyType(buffer);
+			if(prop->type == type_list) {
+				fscanf(fp, "%s", buffer); // get the first data type
+				prop->listCardType = plyType(buffer);
+				fscanf(fp, "%s", buffer); // get the first data type
+				prop->listDataType = plyType(buffer);
+			}
+			else if(prop->type == type_none) {
+				printf("Unrecognized property type %s", buffer);
+				free(prop);
+				status = -1;
+				doneWithHeader = 1;
 				break;
+			}
+			printf("Read property type %d\n", prop->type);
+
+			fscanf(fp, "%s", prop->name);
+			printf("Read property name %s\n", prop->name);
 
-			case 'p':
-				// property statement
-			{
-				ply_property *prop = malloc(sizeof(ply_property));
-				prop->listCardType = type_none;
-				prop->listDataType = type_none;
-				prop->next = NULL;
-
-				fscanf(fp, "%s", buffer); // get the data type
-				prop->type = plyType(buffer);
-				if(prop->type == type_list) {
-					fscanf(fp, "%s", buffer); // get the first data type
-					prop->listCardType = plyType(buffer);
-					fscanf(fp, "%s", buffer); // get the first data type
-					prop->listDataType = plyType(buffer);
+			// add the property entry to the list
+			if(vertexProp) {
+				if(vertexproplist == NULL) {
+					vertexproplist = prop;
+					vertexproptail = prop;
 				}
-				else if(prop->type == type_none) {
-					printf("Unrecognized property type %s", buffer);
-					fclose(fp);
-					return(-1);
+				else {
+					vertexproptail->next = prop;
+					vertexproptail = prop;
 				}
-				printf("Read property type %d\n", prop->type);
-
-				fscanf(fp, "%s", prop->name);
-				printf("Read property name %s\n", prop->name);
-
-				// add the property entry to the list
-				if(vertexProp) {
-					if(vertexproplist == NULL) {
-						vertexproplist = prop;
-						vertexproptail = prop;
-					}
-					else {
-						vertexproptail->next = prop;
-						vertexproptail = prop;
-					}
+			}
+			else if(faceProp) {
+				if(faceproplist == NULL) {
+					faceproplist = prop;
+					faceproptail = prop;
 				}
-				else if(faceProp) {
-					if(faceproplist == NULL) {
-						faceproplist = prop;
-						faceproptail = prop;
-					}
-					else {
-						faceproptail->next = prop;
-						faceproptail = prop;
-					}
+				else {
+					faceproptail->next = prop;
+					faceproptail = prop;
 				}
 			}
-			break;
-
-			case 'e':
-				if(!strcmp(buffer, "end_header")) {
-					doneWithHeader = 1;
-					break;
-				}
+			else {
+				free(prop);
+			}
+		}
+		break;
 
-				// otherwise it's an element statement
-				fscanf(fp, "%s", buffer);
-				if(!strcmp(buffer, "vertex")) {
-					printf("Read element vertex\n");
-					vertexProp = 1;
-					faceProp = 0;
-					fscanf(fp, "%d", &numVertex);
-				}
-				else if(!strcmp(buffer, "face")) {
-					printf("Read element face\n");
-					faceProp = 1;
-					vertexProp = 0;
-					fscanf(fp, "%d", &numPoly);
-				}
+		case 'e':
+			if(!strcmp(buffer, "end_header")) {
+				doneWithHeader = 1;
 				break;
+			}
 
-			default: // don't know what to do with it
-				for(;fgetc(fp) != '\n';);
-				break;
+			// otherwise it's an element statement
+			fscanf(fp, "%s", buffer);
+			if(!strcmp(buffer, "vertex")) {
+				printf("Read element vertex\n");
+				vertexProp = 1;
+				faceProp = 0;
+				fscanf(fp, "%d", &numVertex);
+			}
+			else if(!strcmp(buffer, "face")) {
+				printf("Read element face\n");
+				faceProp = 1;
+				vertexProp = 0;
+				fscanf(fp, "%d", &numPoly);
 			}
+			break;
+
+		default: // don't know what to do with it
+			for(;fgetc(fp) != '\n';);
+			break;
+		}
+	}
+
+	{
+		ply_property *q;
+
+		while(vertexproplist != NULL) {
+			q = (ply_property *)vertexproplist->next;
+			free(vertexproplist);
+			vertexproplist = q;
+		}
+
+		while(faceproplist != NULL) {
+			q = (ply_property *)faceproplist->next;
+			free(faceproplist);
+			faceproplist = q;
 		}
+	}
+
+	*nVertex = numVertex;
+	*nFace = numPoly;
+	return(status);
+}
+
+/*
+  Reads numVertex vertices of the form x y z nx ny nz s t red green blue,
+  colors in 0-255.  Texture coordinates are skipped.
+*/
+static void plyReadVertices(FILE *fp, int numVertex, Point *vertex, Vector *normal, Color *color) {
+	int i, j;
+
+	for(i=0;i<numVertex;i++) {
+		for(j=0;j<3;j++)
+			fscanf(fp, "%f", &(vertex[i].val[j]));
+		vertex[i].val[3] = 1.0;
+
+		for(j=0;j<3;j++)
+			fscanf(fp, "%f", &(normal[i].val[j]));
+		normal[i].val[3] = 0.0;
+
+		for(j=0;j<2;j++)
+			fscanf(fp, "%*f");
+      
+		for(j=0;j<3;j++) {
+			fscanf(fp, "%f", &(color[i].c[j]));
+			color[i].c[j] /= 255.0;
+		}
+	}
+}
+
+int readPLY(char filename[], int *nPolygons, Polygon **plist, Color **clist, int estNormals) {
+	Point *vertex;
+	Vector *normal;
+	//  Point *texture;
+	Color *color;
+	Polygon *p;
+	int numPoly;
+	int numVertex;
+	int nv;
+	int vid[MaxVertices];
+	int i, j;
+	Color tcolor;
+
+	FILE *fp = fopen(filename, "r");
+	if(fp) {
+		if(plyReadHeader(fp, filename, &numVertex, &numPoly)) {
+			fclose(fp);
+			return(-1);
+		}
+
 		// finished with the header
 		vertex = malloc(sizeof(Point) * numVertex);
 		normal = malloc(sizeof(Vector) * numVertex);
@@ -197,23 +264,7 @@ int readPLY(char filename[], int *nPolygons, Polygon **plist, Color **clist, int
 		color = malloc(sizeof(Color) * numVertex); // apparently not written by Blender
 
 		// read the vertices
-		for(i=0;i<numVertex;i++) {
-			for(j=0;j<3;j++)
-				fscanf(fp, "%f", &(vertex[i].val[j]));
-			vertex[i].val[3] = 1.0;
-
-			for(j=0;j<3;j++)
-				fscanf(fp, "%f", &(normal[i].val[j]));
-			normal[i].val[3] = 0.0;
-
-			for(j=0;j<2;j++)
-				fscanf(fp, "%*f");
-      
-			for(j=0;j<3;j++) {
-				fscanf(fp, "%f", &(color[i].c[j]));
-				color[i].c[j] /= 255.0;
-			}
-		}
+		plyReadVertices(fp, numVertex, vertex, normal, color);
 
 		p = malloc(sizeof(Polygon) * numPoly);
 		*clist = malloc(sizeof(Color) * numPoly);
@@ -289,22 +340,6 @@ int readPLY(char filename[], int *nPolygons, Polygon **plist, Color **clist, int
 		//    free(texture);
 		free(color);
 
-		{
-			ply_property *q;
-
-			while(vertexproplist != NULL) {
-				q = (ply_property *)vertexproplist->next;
-				free(vertexproplist);
-				vertexproplist = q;
-			}
-
-			while(faceproplist != NULL) {
-				q = (ply_property *)faceproplist->next;
-				free(faceproplist);
-				faceproplist = q;
-			}
-		}
-
 		fclose(fp);
 	}
 	else {
@@ -314,3 +349,85 @@ int readPLY(char filename[], int *nPolygons, Polygon **plist, Color **clist, int
 
 	return(0);
 }
+
+/*
+  Reads a .ply file into an indexed mesh, keeping the vertices shared
+  between faces instead of copying them into each polygon.
+
+  If estNormals is set, the file's normals are replaced by smooth vertex
+  normals averaged from the faces around each vertex (see mesh_setNormals).
+  Vertex colors are kept per vertex.
+
+  Returns 0 on success, -1 on failure.
+*/
+int readPLYMesh(char filename[], Mesh *m, int estNormals) {
+	Point *vertex;
+	Vector *normal;
+	Color *color;
+	int *faceStart;
+	int *index;
+	int numPoly;
+	int numVertex;
+	int numIndex = 0;
+	int maxIndex;
+	int nv;
+	int i, j;
+
+	FILE *fp = fopen(filename, "r");
+	if(!fp) {
+		printf("Unable to open %s\n", filename);
+		return(-1);
+	}
+
+	if(plyReadHeader(fp, filename, &numVertex, &numPoly)) {
+		fclose(fp);
+		return(-1);
+	}
+
+	vertex = malloc(sizeof(Point) * numVertex);
+	normal = malloc(sizeof(Vector) * numVertex);
+	color = malloc(sizeof(Color) * numVertex);
+	plyReadVertices(fp, numVertex, vertex, normal, color);
+
+	// faces are usually triangles or quads, grow the index buffer if not
+	maxIndex = 4 * numPoly;
+	faceStart = malloc(sizeof(int) * (numPoly + 1));
+	index = malloc(sizeof(int) * maxIndex);
+	for(i=0;i<numPoly;i++) {
+		nv = 0;
+		fscanf(fp, "%d", &nv);
+		if(numIndex + nv > maxIndex) {
+			maxIndex = 2 * (numIndex + nv);
+			index = realloc(index, sizeof(int) * maxIndex);
+		}
+		faceStart[i] = numIndex;
+		for(j=0;j<nv;j++) {
+			fscanf(fp, "%d", &(index[numIndex]));
+			if(index[numIndex] < 0 || index[numIndex] >= numVertex) {
+				printf("Vertex index %d out of range in %s\n", index[numIndex], filename);
+				free(vertex);
+				free(normal);
+				free(color);
+				free(faceStart);
+				free(index);
+				fclose(fp);
+				return(-1);
+			}
+			numIndex++;
+		}
+	}
+	faceStart[numPoly] = numIndex;
+	fclose(fp);
+
+	mesh_set(m, numVertex, vertex, normal, color, numPoly, faceStart, index);
+	if(estNormals)
+		mesh_setNormals(m);
+
+	free(vertex);
+	free(normal);
+	free(color);
+	free(faceStart);
+	free(index);
+
+	return(0);
+}
@@ -855,26 +855,24 @@ static int compXIntersect(const void *a, const void *b)
 }
 
 /*
-    Allocates, creates, fills out, and returns an Edge structure given
-    the inputs.
+    Fills out the Edge structure edge given the inputs. Returns 0 if the
+    edge is skipped, 1 if it was filled out.
 
     Current inputs are just the start and end location in image space.
     Eventually, the points will be 3D and we'll add color and texture
     coordinates.
  */
-static Edge *makeEdgeRec(Point start, Point end, Color *c0, Color *c1, Image *src) {
-    Edge *edge;
+static int makeEdgeRec(Point start, Point end, Color *c0, Color *c1, Image *src, Edge *edge) {
     float dscan = end.val[1] - start.val[1];
 
     // Check if the starting row is below the image or the end row is
     // above the image and skip the edge if either is true
     if (start.val[1] < 0 || end.val[1] > src->rows)
     {
-        return NULL;
+        return 0;
     }
 
-    // allocate an edge structure and set the x0, y0, x1, y1 values
-    edge = malloc(sizeof(Edge));
+    // set the x0, y0, x1, y1 values
     edge->x0 = start.val[0];
     edge->y0 = start.val[1];
     edge->z0 = start.val[2];
@@ -939,22 +937,34 @@ static Edge *makeEdgeRec(Point start, Point end, Color *c0, Color *c1, Image *sr
     if (edge->xIntersect >= edge->x1 && edge->xIntersect >= edge->x0) {
         edge->xIntersect = edge->x1;
     }
-    // return the newly created edge data structure
-    return (edge);
+    return (1);
 }
 
 /*
-    Returns a list of all the edges in the polygon in sorted order by
-    smallest row.
+    Inserts the edge into the sorted array of n edges before the first
+    edge it does not come after, the same place ll_insert would put it.
+ */
+static void edgeInsert(Edge **list, int *n, Edge *edge, int (*comp)(const void *, const void *)) {
+    int k = 0, i;
+
+    while (k < *n && comp(edge, list[k]) > 0)
+        k++;
+    for (i = *n; i > k; i--)
+        list[i] = list[i - 1];
+    list[k] = edge;
+    (*n)++;
+}
+
+/*
+    Fills out the edges of the polygon in store and puts them in sorted
+    order by smallest row in sorted. Returns the number of edges, 0 if
+    there are none (like nothing in the viewport).
 */
-static LinkedList *setupEdgeList(Polygon *p, Image *src)
+static int setupEdgeList(Polygon *p, Image *src, Edge *store, Edge **sorted)
 {
-    LinkedList *edges = NULL;
     Point v1, v2;
     Color c1, c2;
-    int i;
-    // create a linked list
-    edges = ll_new();
+    int i, n = 0;
 
     // walk around the polygon, starting with the last point
     v1 = p->vertex[p->nVertex - 1];
@@ -973,15 +983,16 @@ static LinkedList *setupEdgeList(Polygon *p, Image *src)
         // if it is not a horizontal line
         if ((int)(v1.val[1] + 0.5) != (int)(v2.val[1] + 0.5))
         {
-            Edge *edge;
+            Edge *edge = &store[n];
+            int made;
             // if the first coordinate is smaller (top edge)
             if (v1.val[1] < v2.val[1])
-                edge = makeEdgeRec(v1, v2, &c1, &c2, src);
+                made = makeEdgeRec(v1, v2, &c1, &c2, src, edge);
             else
-                edge = makeEdgeRec(v2, v1, &c2, &c1, src);
-            // insert the edge into the list of edges if it's not null
-            if (edge)
-                ll_insert(edges, edge, compYStart);
+                made = makeEdgeRec(v2, v1, &c2, &c1, src, edge);
+            // insert the edge into the list of edges if it was made
+            if (made)
+                edgeInsert(sorted, &n, edge, compYStart);
         }
         v1 = v2;
         if (p->color) {
@@ -989,36 +1000,28 @@ static LinkedList *setupEdgeList(Polygon *p, Image *src)
         }
     }
 
-    // check for empty edges (like nothing in the viewport)
-    if (ll_empty(edges))
-    {
-        ll_delete(edges, NULL);
-        edges = NULL;
-    }
-
-    return (edges);
+    return (n);
 }
 
 /*
     Draw one scanline of a polygon given the scanline, the active edges,
     a DrawState, the image, and some Lights (for Phong shading only).
  */
-static void fillScan(int scan, LinkedList *active, Image *src, DrawState *ds) {
+static void fillScan(int scan, Edge **active, int nActive, Image *src, DrawState *ds) {
     Edge *p1, *p2;
-    int i, f;
+    int i, f, k;
     float dzPerColumn, curZ;
     Color curColor, dcPerColumn, trueColor;
-    // loop over the list
-    p1 = ll_head(active);
-    while (p1)
+    // loop over the list, a pair of edges at a time
+    for (k = 0; k < nActive; k += 2)
     {
-        p2 = ll_next(active);
-        if (!p2) {
+        p1 = active[k];
+        if (k + 1 == nActive) {
             printf("bad bad bad (your edges are not coming in pairs), and p1 is: (%f, %f), (%f, %f)\n", p1->x0, p1->y0, p1->x1, p1->y1);
             break;
         }
+        p2 = active[k + 1];
         if (p2->xIntersect == p1->xIntersect) {
-            p1 = ll_next(active);
             continue;
         }
         i = (int)p1->xIntersect + 0.5;
@@ -1047,6 +1050,9 @@ static void fillScan(int scan, LinkedList *active, Image *src, DrawState *ds) {
                         image_setColor(src, scan, cur, 
                             (Color){{ds->color.c[0]*scaleFactor, ds->color.c[1]*scaleFactor, ds->color.c[2]*scaleFactor}});
                         break;
+                    case ShadeFlat:
+                        image_setColor(src, scan, cur, ds->flatColor);
+                        break;
                     case ShadeGouraud:
                         color_set(&trueColor, curColor.c[0]/curZ, curColor.c[1]/curZ, curColor.c[2]/curZ);
                         image_setColor(src, scan, cur, trueColor);
@@ -1060,55 +1066,46 @@ static void fillScan(int scan, LinkedList *active, Image *src, DrawState *ds) {
             curColor.c[1] += dcPerColumn.c[1];
             curColor.c[2] += dcPerColumn.c[2];
         }
-        p1 = ll_next(active);
     }
     return;
 }
 
 /*
-     Process the edge list, assumes the edges list has at least one entry
+     Process the n edges in sorted, assumes there is at least one. active
+     and tmplist must each have room for n edges.
 */
-static int processEdgeList(LinkedList *edges, Image *src, DrawState *ds) {
-    LinkedList *active = NULL;
-    LinkedList *tmplist = NULL;
-    LinkedList *transfer = NULL;
-    Edge *current;
+static int processEdgeList(Edge **edges, int n, Image *src, DrawState *ds, Edge **active, Edge **tmplist) {
+    Edge **transfer;
     Edge *tedge;
+    int current = 0, nActive = 0, nTmp, k;
     int scan = 0;
 
-    active = ll_new();
-    tmplist = ll_new();
-
-    // get a pointer to the first item on the list and reset the current pointer
-    current = ll_head(edges);
-
     // start at the first scanline and go until the active list is empty
-    for (scan = current->yStart; scan < src->rows; scan++)
+    for (scan = edges[0]->yStart; scan < src->rows; scan++)
     {
-        // printf("processing current scan: %d\n", scan);
         // grab all edges starting on this row
-        while (current != NULL && current->yStart == scan)
+        while (current < n && edges[current]->yStart == scan)
         {
-            ll_insert(active, current, compXIntersect);
-            current = ll_next(edges);
+            edgeInsert(active, &nActive, edges[current], compXIntersect);
+            current++;
         }
-        // current is either null, or the first edge to be handled on some future scanline
+        // current is either past the end, or the first edge to be handled on some future scanline
 
-        if (ll_empty(active)) {
+        if (nActive == 0) {
             break;
         }
         // if there are active edges
         // fill out the scanline
-        fillScan(scan, active, src, ds);
+        fillScan(scan, active, nActive, src, ds);
 
         // remove any ending edges and update the rest
-        for (tedge = ll_pop(active); tedge != NULL; tedge = ll_pop(active))
+        nTmp = 0;
+        for (k = 0; k < nActive; k++)
         {
+            tedge = active[k];
 
             // keep anything that's not ending
             if (tedge->yEnd > scan) {
-                float a;
-
                 // update the edge information with the dPerScan values
                 tedge->xIntersect += tedge->dxPerScan;
                 tedge->zIntersect += tedge->dzPerScan;
@@ -1118,47 +1115,60 @@ static int processEdgeList(LinkedList *edges, Image *src, DrawState *ds) {
 
                 // adjust in the case of partial overlap
                 if (tedge->dxPerScan < 0.0 && tedge->xIntersect < tedge->x1) {
-                    a = (tedge->xIntersect - tedge->x1) / tedge->dxPerScan;
                     tedge->xIntersect = tedge->x1;
                 }
                 else if (tedge->dxPerScan > 0.0 && tedge->xIntersect > tedge->x1) {
-                    a = (tedge->xIntersect - tedge->x1) / tedge->dxPerScan;
                     tedge->xIntersect = tedge->x1;
                 }
 
-                ll_insert(tmplist, tedge, compXIntersect);
+                edgeInsert(tmplist, &nTmp, tedge, compXIntersect);
             }
         }
 
         transfer = active;
         active = tmplist;
         tmplist = transfer;
+        nActive = nTmp;
     }
 
-    // get rid of the lists, but not the edge records
-    ll_delete(active, NULL);
-    ll_delete(tmplist, NULL);
-
     return (0);
 }
+
+// edges a polygon can have before the fill needs memory beyond the stack
+#define FILL_EDGES 16
+
 void _polygon_drawFill(Polygon *p, Image *src, DrawState *ds, Lighting *ls);
 /***
- * helper method for polygon_drawFill
+ * helper method for polygon_drawFill. The edge records live on the stack, or for
+ * polygons with more than FILL_EDGES vertices in the DrawState's scratch arena if
+ * it has one, and only otherwise on the heap.
  */
 void _polygon_drawFill(Polygon *p, Image *src, DrawState *ds, Lighting *ls) {
-    LinkedList *edges = NULL;
+    Edge stackStore[FILL_EDGES], *store = stackStore;
+    Edge *stackList[3 * FILL_EDGES], **list = stackList;
+    int n;
 
-    // set up the edge list
-    edges = setupEdgeList(p, src);
-    printf("edge list created\n");
-    if (!edges){
+    if (p->nVertex < 1) {
         return;
     }
-    // process the edge list (should be able to take an arbitrary edge list)
-    processEdgeList(edges, src, ds);
-// clean up
-    ll_delete(edges, (void (*)(const void *))free);
+    if (p->nVertex > FILL_EDGES) {
+        size_t bytes = sizeof(Edge) * p->nVertex + sizeof(Edge *) * 3 * p->nVertex;
+        store = ds->scratch ? arena_alloc(ds->scratch, bytes) : malloc(bytes);
+        if (!store) {
+            return;
+        }
+        list = (Edge **)(store + p->nVertex);
+    }
 
+    // set up the edge list, then process it (should be able to take an arbitrary edge list)
+    n = setupEdgeList(p, src, store, list);
+    if (n > 0) {
+        processEdgeList(list, n, src, ds, list + p->nVertex, list + 2 * p->nVertex);
+    }
+
+    if (store != stackStore && !ds->scratch) {
+        free(store);
+    }
     return;
 }
 
@@ -1168,7 +1178,7 @@ void _polygon_drawFill(Polygon *p, Image *src, DrawState *ds, Lighting *ls) {
 void polygon_drawFill(Polygon *p, Image *src, Color c, Lighting *ls)
 {
     DrawState ds;
-    ds = *drawstate_create();
+    drawstate_init(&ds);
     drawstate_setColor(&ds, c);
     _polygon_drawFill(p, src, &ds, ls);
 }
@@ -1177,6 +1187,350 @@ void polygon_drawFill(Polygon *p, Image *src, Color c, Lighting *ls)
 End Scanline Fill
 *****************************************/
 
+/********************
+Depth-only Fill
+********************/
+
+// a lean edge record for depth-only filling, only 1/z is interpolated
+typedef struct
+{
+    float x0, y0;     /* top end point of the edge */
+    float dxPerScan;  /* change in x per scanline */
+    float z0;         /* 1/z at the top end point */
+    float dzPerScan;  /* change in 1/z per scanline */
+    int yStart, yEnd; /* first and last row covered by the edge */
+} DepthEdge;
+
+#define DEPTH_EDGES (16)
+
+/*
+    Fill the row from column i (inclusive) to f (exclusive) with 1/z values
+    starting at z and changing by dz per column, keeping the nearest value.
+    The nearest of two 1/z values is the larger one, so the compare-and-store
+    is a max, which the SIMD versions below do several pixels at a time.
+ */
+static void depthSpanScalar(float *row, int i, int f, float z, float dz)
+{
+    for (int cur = i; cur < f; cur++) {
+        if (z >= row[cur]) {
+            row[cur] = z;
+        }
+        z += dz;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/*
+    SSE version of depthSpanScalar, four pixels per step.
+ */
+__attribute__((target("sse2")))
+static void depthSpanSSE(float *row, int i, int f, float z, float dz)
+{
+    __m128 step = _mm_set_ps(3 * dz, 2 * dz, dz, 0.0f);
+    int cur = i;
+    for (; cur + 4 <= f; cur += 4) {
+        __m128 zv = _mm_add_ps(_mm_set1_ps(z + (cur - i) * dz), step);
+        _mm_storeu_ps(&row[cur], _mm_max_ps(zv, _mm_loadu_ps(&row[cur])));
+    }
+    depthSpanScalar(row, cur, f, z + (cur - i) * dz, dz);
+}
+
+/*
+    AVX version of depthSpanScalar, eight pixels per step.
+ */
+__attribute__((target("avx")))
+static void depthSpanAVX(float *row, int i, int f, float z, float dz)
+{
+    __m256 step = _mm256_set_ps(7 * dz, 6 * dz, 5 * dz, 4 * dz, 3 * dz, 2 * dz, dz, 0.0f);
+    int cur = i;
+    for (; cur + 8 <= f; cur += 8) {
+        __m256 zv = _mm256_add_ps(_mm256_set1_ps(z + (cur - i) * dz), step);
+        _mm256_storeu_ps(&row[cur], _mm256_max_ps(zv, _mm256_loadu_ps(&row[cur])));
+    }
+    depthSpanScalar(row, cur, f, z + (cur - i) * dz, dz);
+}
+#endif
+
+/*
+    Count the pixels from column i (inclusive) to f (exclusive) that would pass the
+    depth test with 1/z values starting at z and changing by dz, writing nothing.
+ */
+static long depthCountScalar(float *row, int i, int f, float z, float dz)
+{
+    long n = 0;
+    for (int cur = i; cur < f; cur++) {
+        n += z >= row[cur];
+        z += dz;
+    }
+    return n;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+    SSE version of depthCountScalar, four pixels per step.
+ */
+__attribute__((target("sse2")))
+static long depthCountSSE(float *row, int i, int f, float z, float dz)
+{
+    __m128 step = _mm_set_ps(3 * dz, 2 * dz, dz, 0.0f);
+    long n = 0;
+    int cur = i;
+    for (; cur + 4 <= f; cur += 4) {
+        __m128 zv = _mm_add_ps(_mm_set1_ps(z + (cur - i) * dz), step);
+        n += __builtin_popcount(_mm_movemask_ps(_mm_cmpge_ps(zv, _mm_loadu_ps(&row[cur]))));
+    }
+    return n + depthCountScalar(row, cur, f, z + (cur - i) * dz, dz);
+}
+
+/*
+    AVX version of depthCountScalar, eight pixels per step.
+ */
+__attribute__((target("avx")))
+static long depthCountAVX(float *row, int i, int f, float z, float dz)
+{
+    __m256 step = _mm256_set_ps(7 * dz, 6 * dz, 5 * dz, 4 * dz, 3 * dz, 2 * dz, dz, 0.0f);
+    long n = 0;
+    int cur = i;
+    for (; cur + 8 <= f; cur += 8) {
+        __m256 zv = _mm256_add_ps(_mm256_set1_ps(z + (cur - i) * dz), step);
+        n += __builtin_popcount(_mm256_movemask_ps(_mm256_cmp_ps(zv, _mm256_loadu_ps(&row[cur]), _CMP_GE_OQ)));
+    }
+    return n + depthCountScalar(row, cur, f, z + (cur - i) * dz, dz);
+}
+#endif
+
+/*
+    Fill a depth span with the widest kernel the processor supports,
+    chosen once on the first call.
+ */
+static void depthSpan(float *row, int i, int f, float z, float dz)
+{
+    static void (*kernel)(float *, int, int, float, float) = NULL;
+    if (!kernel) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx"))
+            kernel = depthSpanAVX;
+        else if (__builtin_cpu_supports("sse2"))
+            kernel = depthSpanSSE;
+        else
+#endif
+            kernel = depthSpanScalar;
+    }
+    kernel(row, i, f, z, dz);
+}
+
+/*
+    Count the passing pixels of a depth span with the widest kernel the processor
+    supports, chosen once on the first call.
+ */
+static long depthCount(float *row, int i, int f, float z, float dz)
+{
+    static long (*kernel)(float *, int, int, float, float) = NULL;
+    if (!kernel) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx"))
+            kernel = depthCountAVX;
+        else if (__builtin_cpu_supports("sse2"))
+            kernel = depthCountSSE;
+        else
+#endif
+            kernel = depthCountScalar;
+    }
+    return kernel(row, i, f, z, dz);
+}
+
+/*
+    Fill one row of a depth image between the crossings xa and xb, which have 1/z
+    values za and zb. Pixels whose centers are within [xa, xb) are covered.
+    If count is not NULL the row is only tested and the passing pixels are added to it.
+ */
+static void depthRow(Image *src, int scan, float xa, float za, float xb, float zb, long *count)
+{
+    float dx = xb - xa, dz;
+    int start, end;
+    if (dx <= 0) return;
+    dz = (zb - za) / dx;
+    start = (int)ceilf(xa - 0.5f);
+    end = (int)ceilf(xb - 0.5f);
+    if (start < 0) start = 0;
+    if (end > src->cols) end = src->cols;
+    if (start >= end) return;
+    if (count)
+        *count += depthCount(src->depth[scan], start, end, za + (start + 0.5f - xa) * dz, dz);
+    else
+        depthSpan(src->depth[scan], start, end, za + (start + 0.5f - xa) * dz, dz);
+}
+
+/*
+    Triangle fast path of polygon_drawDepth. The vertices are sorted by y so each
+    row is bounded by the long edge and one of the two short edges, with no
+    edge list and no sorting of crossings.
+ */
+static void triangleDepth(Point *a, Point *b, Point *c, Image *src, long *count)
+{
+    Point *t;
+    float za, zb, zc, dxLong, dzLong, dxUpper = 0, dzUpper = 0, dxLower = 0, dzLower = 0;
+    int scan, yStart, yMid, yEnd;
+
+    if (a->val[1] > b->val[1]) { t = a; a = b; b = t; }
+    if (b->val[1] > c->val[1]) { t = b; b = c; c = t; }
+    if (a->val[1] > b->val[1]) { t = a; a = b; b = t; }
+
+    // rows whose centers are within [ya, yc), switching short edges at yb
+    yStart = (int)ceilf(a->val[1] - 0.5f);
+    yMid = (int)ceilf(b->val[1] - 0.5f);
+    yEnd = (int)ceilf(c->val[1] - 0.5f);
+    if (yEnd <= yStart || yEnd <= 0 || yStart >= src->rows) return;
+
+    za = 1 / a->val[2];
+    zb = 1 / b->val[2];
+    zc = 1 / c->val[2];
+    dxLong = (c->val[0] - a->val[0]) / (c->val[1] - a->val[1]);
+    dzLong = (zc - za) / (c->val[1] - a->val[1]);
+    if (b->val[1] > a->val[1]) {
+        dxUpper = (b->val[0] - a->val[0]) / (b->val[1] - a->val[1]);
+        dzUpper = (zb - za) / (b->val[1] - a->val[1]);
+    }
+    if (c->val[1] > b->val[1]) {
+        dxLower = (c->val[0] - b->val[0]) / (c->val[1] - b->val[1]);
+        dzLower = (zc - zb) / (c->val[1] - b->val[1]);
+    }
+
+    if (yStart < 0) yStart = 0;
+    if (yEnd > src->rows) yEnd = src->rows;
+    for (scan = yStart; scan < yEnd; scan++) {
+        float y = scan + 0.5f;
+        float xl = a->val[0] + (y - a->val[1]) * dxLong;
+        float zl = za + (y - a->val[1]) * dzLong;
+        float xs, zs;
+        if (scan < yMid) {
+            xs = a->val[0] + (y - a->val[1]) * dxUpper;
+            zs = za + (y - a->val[1]) * dzUpper;
+        } else {
+            xs = b->val[0] + (y - b->val[1]) * dxLower;
+            zs = zb + (y - b->val[1]) * dzLower;
+        }
+        if (xl < xs)
+            depthRow(src, scan, xl, zl, xs, zs, count);
+        else
+            depthRow(src, scan, xs, zs, xl, zl, count);
+    }
+}
+
+/*
+    Shared body of polygon_drawDepth and polygon_countDepth, writes the depth plane
+    when count is NULL and otherwise only adds the passing pixels to count.
+ */
+static void polygonDepth(Polygon *p, Image *src, long *count, Arena *scratch)
+{
+    DepthEdge stackEdges[DEPTH_EDGES], *edges = stackEdges;
+    float stackX[DEPTH_EDGES], stackZ[DEPTH_EDGES], *xs = stackX, *zs = stackZ;
+    int nEdges = 0, yMin = src->rows, yMax = -1;
+    int i, j, scan;
+
+    if (p == NULL || p->nVertex < 3 || src->depth == NULL) return;
+    if (p->nVertex == 3) {
+        triangleDepth(&p->vertex[0], &p->vertex[1], &p->vertex[2], src, count);
+        return;
+    }
+    if (p->nVertex > DEPTH_EDGES) {
+        size_t bytes = (sizeof(DepthEdge) + 2 * sizeof(float)) * p->nVertex;
+        edges = scratch ? arena_alloc(scratch, bytes) : malloc(bytes);
+        if (!edges) return;
+        xs = (float *)(edges + p->nVertex);
+        zs = xs + p->nVertex;
+    }
+
+    // build the edge records, walking around the polygon starting with the last point
+    for (i = 0, j = p->nVertex - 1; i < p->nVertex; j = i++) {
+        Point *a = &p->vertex[j], *b = &p->vertex[i];
+        DepthEdge *e = &edges[nEdges];
+        float dscan;
+
+        if (a->val[1] > b->val[1]) {
+            Point *t = a;
+            a = b;
+            b = t;
+        }
+        // a row is covered when its center is within [y0, y1)
+        e->yStart = (int)ceilf(a->val[1] - 0.5f);
+        e->yEnd = (int)ceilf(b->val[1] - 0.5f) - 1;
+        if (e->yEnd < e->yStart || e->yEnd < 0 || e->yStart >= src->rows) continue;
+
+        dscan = b->val[1] - a->val[1];
+        e->x0 = a->val[0];
+        e->y0 = a->val[1];
+        e->z0 = 1 / a->val[2];
+        e->dxPerScan = (b->val[0] - a->val[0]) / dscan;
+        e->dzPerScan = (1 / b->val[2] - e->z0) / dscan;
+        if (e->yStart < 0) e->yStart = 0;
+        if (e->yEnd > src->rows - 1) e->yEnd = src->rows - 1;
+        if (e->yStart < yMin) yMin = e->yStart;
+        if (e->yEnd > yMax) yMax = e->yEnd;
+        nEdges++;
+    }
+
+    for (scan = yMin; scan <= yMax; scan++) {
+        float y = scan + 0.5f;
+        int n = 0;
+
+        // gather the crossings of the active edges in x order
+        for (i = 0; i < nEdges; i++) {
+            float x, z;
+            if (scan < edges[i].yStart || scan > edges[i].yEnd) continue;
+            x = edges[i].x0 + (y - edges[i].y0) * edges[i].dxPerScan;
+            z = edges[i].z0 + (y - edges[i].y0) * edges[i].dzPerScan;
+            for (j = n; j > 0 && xs[j - 1] > x; j--) {
+                xs[j] = xs[j - 1];
+                zs[j] = zs[j - 1];
+            }
+            xs[j] = x;
+            zs[j] = z;
+            n++;
+        }
+
+        // fill between pairs of crossings
+        for (i = 0; i + 1 < n; i += 2) {
+            depthRow(src, scan, xs[i], zs[i], xs[i + 1], zs[i + 1], count);
+        }
+    }
+
+    if (edges != stackEdges && !scratch) free(edges);
+}
+
+/***
+ * Draw the polygon, given in screen coordinates, into the depth plane of src only.
+ * Interpolates 1/z along the edges and spans and keeps the nearest value per pixel,
+ * with no color work, so src can be a depth-only image made by image_createDepth.
+ * Triangles take a dedicated path and spans are written with SIMD compare-and-store.
+ * The edges of polygons with more than DEPTH_EDGES vertices are kept in scratch, or
+ * on the heap if it is NULL.
+ */
+void polygon_drawDepth(Polygon *p, Image *src, Arena *scratch)
+{
+    polygonDepth(p, src, NULL, scratch);
+}
+
+/***
+ * Return the number of pixels of the polygon, given in screen coordinates, that would
+ * pass the depth test against src, without writing anything. Covers exactly the pixels
+ * polygon_drawDepth would, so it serves as the sample count of an occlusion query.
+ */
+long polygon_countDepth(Polygon *p, Image *src, Arena *scratch)
+{
+    long count = 0;
+    polygonDepth(p, src, &count, scratch);
+    return count;
+}
+
+/****************************************
+End Depth-only Fill
+*****************************************/
+
 /***
  * returns an allocated Polygon pointer initialized so that numVertex is 0 and vertex is NULL.
  */
@@ -1475,15 +1829,18 @@ void polygon_draw(Polygon *p, Image *src, Color c)
 
 /**
  * calculates the color of each vertex of the polygon based on the lighting model.
+ * The normals must already be unit length, as module_draw leaves them, so only the
+ * view vectors are normalized here.
  */
 void polygon_shade(Polygon *p, DrawState *ds, Lighting *ls) {
-    polygon_print(p, stdout);
     if (p != NULL && ds != NULL && ls != NULL) {
         Vector V;
-        p->color = (Color *)malloc(sizeof(Color) * p->nVertex);
+        if (p->color == NULL)
+            p->color = (Color *)malloc(sizeof(Color) * p->nVertex);
         for (int i = 0; i < p->nVertex; i++) {
             vector_set(&V, ds->viewer.val[0] - p->vertex[i].val[0], ds->viewer.val[1] - p->vertex[i].val[1], ds->viewer.val[2] - p->vertex[i].val[2]);
-            lighting_shading(ls, &p->normal[i], &V, &p->vertex[i], &ds->body, &ds->surface, ds->surfaceCoeff, p->oneSided, &p->color[i]);
+            vector_normalize(&V);
+            lighting_shadingUnit(ls, &p->normal[i], &V, &p->vertex[i], &ds->body, &ds->surface, ds->surfaceCoeff, p->oneSided, &p->color[i]);
         }
     }
 }
@@ -1504,10 +1861,14 @@ void polygon_drawShade(Polygon *p, Image *src, DrawState *ds, Lighting *ls) {
     case ShadeDepth:
         _polygon_drawFill(p, src, ds, NULL);
         break;
+    case ShadeFlat:
     case ShadeGouraud:
     case ShadePhong:
         _polygon_drawFill(p, src, ds, ls);
         break;
+    case ShadeDepthOnly:
+        polygon_drawDepth(p, src, ds->scratch);
+        break;
     default:
         break;
     }
@@ -1615,6 +1976,7 @@ void polygon_drawFillAA(Polygon *p, Image *src, Color c)
 void bezierCurve_init(BezierCurve *b) {
     if (b != NULL) {
         b->zBuffer = 1;
+        b->divisions = 0;
         for (int i = 0; i < 4; i++) {
             b->vertex[i] = (Point){.val = {0.0, 0.0, 0.0, 1.0}};
         }
@@ -1622,14 +1984,17 @@ void bezierCurve_init(BezierCurve *b) {
 }
 
 /**
- * sets the zbuffer flag to 1 and the surface to the X-Z plane between (0, 0) and (1, 1).
+ * sets the zbuffer flag to 1 and the surface to the X-Z plane between (0, 0) and (1, 1),
+ * the rows of control points along Z and the columns along X.
  */
 void bezierSurface_init(BezierSurface *b) {
     if (b != NULL) {
         b->zBuffer = 1;
+        b->divisions = 0;
+        b->solid = 0;
         for (int i = 0; i < 4; i++) {
             for (int j=0; j < 4; j++) {
-                b->vertex[i][j] = (Point){.val = {0.0, 0.0, 0.0, 1.0}};
+                b->vertex[i][j] = (Point){.val = {j / 3.0, 0.0, i / 3.0, 1.0}};
             }
         }
     }
@@ -1686,6 +2051,7 @@ void bezierCurve_copy(BezierCurve *to, BezierCurve *from) {
         point_copy(&to->vertex[i], &from->vertex[i]);
     }
     bezierCurve_zBuffer(to, from->zBuffer);
+    bezierCurve_setDivisions(to, from->divisions);
 }
 
 /**
@@ -1725,6 +2091,13 @@ void bezierSurface_normalize(BezierSurface *b) {
     }
 }
 
+/**
+ * set divisions attribute for the bezierCurve, 0 to tessellate adaptively
+ */
+void bezierCurve_setDivisions(BezierCurve *b, int d) {
+    b->divisions = d;
+}
+
 /**
  * set divisions attribute for the bezierSurface
  */
@@ -1739,6 +2112,123 @@ void bezierSurface_setSolid(BezierSurface *b, int s) {
     b->solid = s;
 }
 
+/**
+ * copy the control point in the given row and column of the bezierSurface to p.
+ */
+void bezierSurface_getPoint(BezierSurface *b, Point *p, int row, int col) {
+    if (b && p && row >= 0 && row < 4 && col >= 0 && col < 4) {
+        point_copy(p, &b->vertex[row][col]);
+    }
+}
+
+/**
+ * set the control point in the given row and column of the bezierSurface to p.
+ */
+void bezierSurface_setPoint(BezierSurface *b, Point *p, int row, int col) {
+    if (b && p && row >= 0 && row < 4 && col >= 0 && col < 4) {
+        point_copy(&b->vertex[row][col], p);
+    }
+}
+
+/*
+    Cubic Bernstein basis at t and its derivative.
+ */
+static void bernstein(float t, float *b, float *db) {
+    float s = 1 - t;
+    b[0] = s * s * s;
+    b[1] = 3 * t * s * s;
+    b[2] = 3 * t * t * s;
+    b[3] = t * t * t;
+    db[0] = -3 * s * s;
+    db[1] = 3 * s * s - 6 * t * s;
+    db[2] = 6 * t * s - 3 * t * t;
+    db[3] = 3 * t * t;
+}
+
+/*
+    Point p of the patch at (u, v) and its normal n, the cross product of the partial
+    derivatives along u (the columns) and v (the rows). Where that vanishes, as at a
+    row of coincident control points, the normal is taken a little inside the patch.
+ */
+static void bezierSurfaceEval(BezierSurface *b, float u, float v, Point *p, Vector *n) {
+    float bu[4], dbu[4], bv[4], dbv[4];
+    Vector du, dv;
+    int i, j, k, tries;
+
+    for (tries = 0; tries < 3; tries++) {
+        bernstein(u, bu, dbu);
+        bernstein(v, bv, dbv);
+        vector_set(&du, 0, 0, 0);
+        vector_set(&dv, 0, 0, 0);
+        if (tries == 0) point_set3D(p, 0, 0, 0);
+        for (i = 0; i < 4; i++) {
+            for (j = 0; j < 4; j++) {
+                for (k = 0; k < 3; k++) {
+                    float c = b->vertex[i][j].val[k];
+                    if (tries == 0) p->val[k] += bv[i] * bu[j] * c;
+                    du.val[k] += bv[i] * dbu[j] * c;
+                    dv.val[k] += dbv[i] * bu[j] * c;
+                }
+            }
+        }
+        vector_cross(&du, &dv, n);
+        if (vector_length(n) > 1e-6) break;
+        u = u < 0.5f ? u + 1e-3f : u - 1e-3f;
+        v = v < 0.5f ? v + 1e-3f : v - 1e-3f;
+    }
+    vector_normalize(n);
+}
+
+/**
+ * evaluate the Bezier surface on a grid of nu by nv cells, u along the columns of control
+ * points and v along the rows, and store it in m as an indexed triangle mesh of
+ * (nu + 1) * (nv + 1) vertices, two triangles per cell. Every vertex gets the analytic
+ * normal of the patch. The arrays of m are reused when it already has the same grid.
+ * Returns 0 if the mesh cannot be allocated.
+ */
+int bezierSurface_tessellate(BezierSurface *b, int nu, int nv, Mesh *m) {
+    int nVertex, nFace, r, c, i;
+
+    if (!b || !m) return 0;
+    if (nu < 1) nu = 1;
+    if (nv < 1) nv = 1;
+    nVertex = (nu + 1) * (nv + 1);
+    nFace = 2 * nu * nv;
+    if (m->nVertex != nVertex || m->nFace != nFace || !m->normal || m->color) {
+        mesh_clear(m);
+        m->vertex = (Point *)malloc(sizeof(Point) * nVertex);
+        m->normal = (Vector *)malloc(sizeof(Vector) * nVertex);
+        m->faceStart = (int *)malloc(sizeof(int) * (nFace + 1));
+        m->index = (int *)malloc(sizeof(int) * 3 * nFace);
+        if (!m->vertex || !m->normal || !m->faceStart || !m->index) {
+            mesh_clear(m);
+            return 0;
+        }
+        m->nVertex = nVertex;
+        m->nFace = nFace;
+    }
+    // rebuilt every time, a reused mesh of the same size may have had nu and nv swapped
+    for (i = 0, r = 0; r < nv; r++) {
+        for (c = 0; c < nu; c++) {
+            int a = r * (nu + 1) + c;
+            m->index[i++] = a;
+            m->index[i++] = a + 1;
+            m->index[i++] = a + nu + 2;
+            m->index[i++] = a;
+            m->index[i++] = a + nu + 2;
+            m->index[i++] = a + nu + 1;
+        }
+    }
+    for (i = 0; i <= nFace; i++) m->faceStart[i] = 3 * i;
+    for (r = 0; r <= nv; r++) {
+        for (c = 0; c <= nu; c++) {
+            bezierSurfaceEval(b, (float)c / nu, (float)r / nv, &m->vertex[r * (nu + 1) + c], &m->normal[r * (nu + 1) + c]);
+        }
+    }
+    m->zBuffer = b->zBuffer;
+    return 1;
+}
+
 void point_mid(Point *p1, Point *p2, Point *mid);
 void drawLine(Image *src, Color c, Point p1, Point p2);
 
@@ -1780,10 +2270,132 @@ void deCasteljau(BezierCurve *b, Point* q, Point* r) {
     r[0] = q[3];
 }
 
+// largest distance in pixels of the control points from the chord of a curve piece drawn as a line
+#define BEZIER_FLATNESS 0.5f
+
+/*
+    Whether the control points p1 and p2 are within tolerance of the chord p0-p3 in x and y,
+    compared squared so no square root is needed.
+ */
+static int bezierFlat(Point *p, float tolerance) {
+    float dx = p[3].val[0] - p[0].val[0], dy = p[3].val[1] - p[0].val[1];
+    float len2 = dx * dx + dy * dy, tol2 = tolerance * tolerance;
+    int i;
+    for (i = 1; i < 3; i++) {
+        float ex = p[i].val[0] - p[0].val[0], ey = p[i].val[1] - p[0].val[1];
+        if (len2 > 0) {
+            float cross = ex * dy - ey * dx;
+            if (cross * cross > tol2 * len2) return 0;
+        } else if (ex * ex + ey * ey > tol2) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+    2^divisions segments of the curve by forward differencing, three adds per
+    coordinate per point, at most 2^BEZIER_MAX_DEPTH. The last point is set to the
+    end control point exactly.
+ */
+static int bezierForwardDifference(Point *p, int divisions, Point *out, int max) {
+    int n = 1 << (divisions > BEZIER_MAX_DEPTH ? BEZIER_MAX_DEPTH : divisions), i, k;
+    float h = 1.0f / n, f[4], df[4], ddf[4], dddf[4];
+    while (n + 1 > max && n > 1) {
+        n /= 2;
+        h *= 2;
+    }
+    for (k = 0; k < 4; k++) {
+        float a = -p[0].val[k] + 3 * p[1].val[k] - 3 * p[2].val[k] + p[3].val[k];
+        float b = 3 * p[0].val[k] - 6 * p[1].val[k] + 3 * p[2].val[k];
+        float c = -3 * p[0].val[k] + 3 * p[1].val[k];
+        f[k] = p[0].val[k];
+        df[k] = a * h * h * h + b * h * h + c * h;
+        ddf[k] = 6 * a * h * h * h + 2 * b * h * h;
+        dddf[k] = 6 * a * h * h * h;
+    }
+    for (i = 0; i < n; i++) {
+        for (k = 0; k < 4; k++) out[i].val[k] = f[k];
+        for (k = 0; k < 4; k++) {
+            f[k] += df[k];
+            df[k] += ddf[k];
+            ddf[k] += dddf[k];
+        }
+    }
+    out[n] = p[3];
+    return n + 1;
+}
+
+/**
+ * tessellate the Bezier curve into a polyline of at most max points written to out,
+ * returning the number of points. With divisions set the curve is evaluated at
+ * 2^divisions even steps by forward differencing (fewer if max is too small),
+ * otherwise it is split with de Casteljau until every piece's control points are
+ * within tolerance (in x and y) of its chord, using an explicit stack of control
+ * points instead of recursion on BezierCurve copies.
+ */
+int bezierCurve_tessellate(BezierCurve *b, float tolerance, Point *out, int max) {
+    Point stack[BEZIER_MAX_DEPTH + 1][4], *p;
+    int depth[BEZIER_MAX_DEPTH + 1], top = 0, n = 1, d, i, maxDepth = 0;
+
+    if (!b || !out || max < 2) return 0;
+    if (b->divisions > 0) return bezierForwardDifference(b->vertex, b->divisions, out, max);
+    while (maxDepth < BEZIER_MAX_DEPTH && (2 << maxDepth) + 1 <= max) maxDepth++;
+
+    // pieces are pushed right half first so they pop off in order along the curve
+    out[0] = b->vertex[0];
+    for (i = 0; i < 4; i++) stack[0][i] = b->vertex[i];
+    depth[0] = 0;
+    while (top >= 0) {
+        p = stack[top];
+        d = depth[top];
+        if (d >= maxDepth || bezierFlat(p, tolerance)) {
+            out[n++] = p[3];
+            top--;
+            continue;
+        }
+        {
+            Point q1, q2, mid, r1, r2, m;
+            point_mid(&p[0], &p[1], &q1);
+            point_mid(&p[1], &p[2], &mid);
+            point_mid(&p[2], &p[3], &r2);
+            point_mid(&q1, &mid, &q2);
+            point_mid(&mid, &r2, &r1);
+            point_mid(&q2, &r1, &m);
+            // right half replaces the piece, left half goes on top of it
+            stack[top + 1][0] = p[0];
+            stack[top + 1][1] = q1;
+            stack[top + 1][2] = q2;
+            stack[top + 1][3] = m;
+            p[0] = m;
+            p[1] = r1;
+            p[2] = r2;
+            depth[top] = depth[top + 1] = d + 1;
+            top++;
+        }
+    }
+    return n;
+}
+
 /**
  * draws the Bezier curve, given in screen coordinates, into the image using the given color.
+ * The curve is tessellated into a polyline within half a pixel of the curve, or into
+ * 2^divisions segments if divisions is set, and drawn with one polyline_draw.
  */
 void bezierCurve_draw(BezierCurve *b, Image *src, Color c) {
+    Point vertex[(1 << BEZIER_MAX_DEPTH) + 1];
+    Polyline line;
+    line.zBuffer = b->zBuffer;
+    line.numVertex = bezierCurve_tessellate(b, BEZIER_FLATNESS, vertex, (1 << BEZIER_MAX_DEPTH) + 1);
+    line.vertex = vertex;
+    polyline_draw(&line, src, c);
+}
+
+/**
+ * draws the Bezier curve, given in screen coordinates, by recursive subdivision until the
+ * bounding box of the control points is under 10 pixels. Kept for comparison with bezierCurve_draw.
+ */
+void bezierCurve_drawRecursive(BezierCurve *b, Image *src, Color c) {
     // Calculate bounding box
     float minX = b->vertex[0].val[0];
     float maxX = b->vertex[0].val[0];
@@ -1816,8 +2428,8 @@ void bezierCurve_draw(BezierCurve *b, Image *src, Color c) {
     bezierCurve_set(&leftCurve, q);
     bezierCurve_set(&rightCurve, r);
 
-    bezierCurve_draw(&leftCurve, src, c);
-    bezierCurve_draw(&rightCurve, src, c);
+    bezierCurve_drawRecursive(&leftCurve, src, c);
+    bezierCurve_drawRecursive(&rightCurve, src, c);
 }
 
 void bezierSurface_subdivide(BezierSurface *b, BezierSurface *subsurfaces);
@@ -0,0 +1,128 @@
+/***
+ * written by - Jiafeng
+ *
+ * occlusion query apis
+ */
+
+#include "graphics.h"
+
+/* Occlusion Query Functions */
+
+/**
+ * start counting visible samples into q. While the query is active, module_draw with
+ * ShadeDepthOnly depth-tests the polygons it is given and adds the passing pixels to
+ * q instead of writing them, so proxy geometry can be tested without disturbing the
+ * depth plane. The other shading methods draw as usual.
+ */
+void occlusionQuery_begin(OcclusionQuery *q, DrawState *ds) {
+    if (!q || !ds) return;
+    q->samples = 0;
+    q->active = 1;
+    ds->query = q;
+}
+
+/* stop the query and return the number of visible samples it counted. */
+long occlusionQuery_end(OcclusionQuery *q, DrawState *ds) {
+    if (!q) return 0;
+    if (ds && ds->query == q) ds->query = NULL;
+    q->active = 0;
+    return q->samples;
+}
+
+// corners of each face of a box, indexed with bit 0 for x, bit 1 for y and bit 2 for z
+static const int boxFace[6][4] = {
+    {0, 2, 6, 4}, {1, 3, 7, 5},
+    {0, 1, 5, 4}, {2, 3, 7, 6},
+    {0, 1, 3, 2}, {4, 5, 7, 6}
+};
+
+/**
+ * occlusion query with the bounding box of md as proxy geometry. The box is taken
+ * through GTM and VTM and its front faces are depth-tested against src without
+ * writing, so the result is the number of pixels of the box that are visible.
+ * If hiz is not NULL, a box the pyramid proves hidden returns 0 without rasterizing.
+ * A box reaching behind the viewer cannot be tested and counts as the whole image.
+ */
+long module_queryBounds(Module *md, Matrix *VTM, Matrix *GTM, Image *src, DepthPyramid *hiz) {
+    Point min, max, corner[8], center, p;
+    Point quad[4];
+    Polygon face;
+    Matrix xform;
+    float box[4], zNear = 0;
+    long samples = 0;
+    int i, j;
+
+    if (!md || !VTM || !src || !src->depth) return 0;
+    if (!module_bounds(md, &min, &max)) return 0;
+
+    if (GTM) matrix_multiply(VTM, GTM, &xform);
+    else matrix_copy(&xform, VTM);
+    box[0] = box[1] = HUGE_VALF;
+    box[2] = box[3] = -HUGE_VALF;
+    for (i = 0; i < 8; i++) {
+        point_set3D(&p, i & 1 ? max.val[0] : min.val[0],
+                       i & 2 ? max.val[1] : min.val[1],
+                       i & 4 ? max.val[2] : min.val[2]);
+        matrix_xformPoint(&xform, &p, &corner[i]);
+        if (corner[i].val[3] <= 0 || corner[i].val[2] <= 0) return (long)src->rows * src->cols;
+        point_normalize(&corner[i]);
+        if (corner[i].val[0] < box[0]) box[0] = corner[i].val[0];
+        if (corner[i].val[1] < box[1]) box[1] = corner[i].val[1];
+        if (corner[i].val[0] > box[2]) box[2] = corner[i].val[0];
+        if (corner[i].val[1] > box[3]) box[3] = corner[i].val[1];
+        if (1.0f / corner[i].val[2] > zNear) zNear = 1.0f / corner[i].val[2];
+    }
+    if (box[2] < 0 || box[3] < 0 || box[0] >= src->cols || box[1] >= src->rows) return 0;
+    if (hiz && depthPyramid_occluded(hiz, box[0] - 1, box[1] - 1, box[2] + 1, box[3] + 1, zNear)) return 0;
+
+    /*
+        In (x, y, 1/z) the projected box is still a convex solid, with the viewer
+        towards larger 1/z. A face is in front when its outward normal, oriented
+        away from an interior point, has a positive 1/z component. The front faces
+        cover the silhouette exactly once.
+     */
+    point_set3D(&center, 0, 0, 0);
+    for (i = 0; i < 8; i++) {
+        center.val[0] += corner[i].val[0] / 8;
+        center.val[1] += corner[i].val[1] / 8;
+        center.val[2] += 1.0f / corner[i].val[2] / 8;
+    }
+    polygon_init(&face);
+    face.nVertex = 4;
+    face.vertex = quad;
+    for (i = 0; i < 6; i++) {
+        float a[3], b[3], n[3], out = 0;
+        for (j = 0; j < 4; j++) quad[j] = corner[boxFace[i][j]];
+        for (j = 0; j < 3; j++) {
+            float q0 = j < 2 ? quad[0].val[j] : 1.0f / quad[0].val[2];
+            a[j] = (j < 2 ? quad[1].val[j] : 1.0f / quad[1].val[2]) - q0;
+            b[j] = (j < 2 ? quad[3].val[j] : 1.0f / quad[3].val[2]) - q0;
+        }
+        n[0] = a[1] * b[2] - a[2] * b[1];
+        n[1] = a[2] * b[0] - a[0] * b[2];
+        n[2] = a[0] * b[1] - a[1] * b[0];
+        for (j = 0; j < 4; j++) {
+            out += n[0] * (quad[j].val[0] - center.val[0]) + n[1] * (quad[j].val[1] - center.val[1]) +
+                   n[2] * (1.0f / quad[j].val[2] - center.val[2]);
+        }
+        if (out < 0) n[2] = -n[2];
+        if (n[2] <= 0) continue;
+        samples += polygon_countDepth(&face, src, NULL);
+    }
+    return samples;
+}
+
+/**
+ * run module_queryBounds for n modules against the same depth plane, the i-th one
+ * placed with GTM[i] (GTM may be NULL for identity transforms). The sample count
+ * of each is stored in samples, the return value is how many have any visible pixel.
+ */
+int module_queryBatch(Module **md, Matrix *GTM, int n, Matrix *VTM, Image *src, DepthPyramid *hiz, long *samples) {
+    int i, visible = 0;
+    if (!md || !samples) return 0;
+    for (i = 0; i < n; i++) {
+        samples[i] = module_queryBounds(md[i], VTM, GTM ? &GTM[i] : NULL, src, hiz);
+        if (samples[i] > 0) visible++;
+    }
+    return visible;
+}
@@ -0,0 +1,479 @@
+/***
+ * written by - Jiafeng
+ *
+ * shadow map apis
+ */
+
+#include <string.h>
+#include "graphics.h"
+
+// smallest homogeneous coordinate kept by the near plane clip of the depth pass
+#define SHADOW_NEAR (1e-4)
+
+/* Shadow Map Functions */
+
+/**
+ * allocate a shadow map with the given number of faces (1 or 6) of size x size pixels.
+ * Returns NULL if the allocation fails.
+ */
+ShadowMap *shadowMap_create(int faces, int size) {
+    ShadowMap *sm;
+    int i;
+
+    if (faces != 1 && faces != 6) return NULL;
+    sm = (ShadowMap *)malloc(sizeof(ShadowMap));
+    if (!sm) return NULL;
+    sm->faces = faces;
+    sm->size = size;
+    sm->bias = 0.02;
+    sm->valid = 0;
+    sm->module = NULL;
+    sm->version = 0;
+    for (i = 0; i < 6; i++) {
+        sm->depth[i] = NULL;
+        matrix_identity(&sm->vtm[i]);
+    }
+    for (i = 0; i < faces; i++) {
+        sm->depth[i] = image_createDepth(size, size);
+        if (!sm->depth[i]) {
+            shadowMap_free(sm);
+            return NULL;
+        }
+    }
+    return sm;
+}
+
+/* free the shadow map and its depth images. */
+void shadowMap_free(ShadowMap *sm) {
+    int i;
+    if (!sm) return;
+    for (i = 0; i < 6; i++) {
+        image_free(sm->depth[i]);
+    }
+    free(sm);
+}
+
+/**
+ * returns 1 if the shadow map already holds the depth render of module md under GTM
+ * from the given light, 0 if it has to be re-rendered.
+ */
+int shadowMap_current(ShadowMap *sm, Light *light, Module *md, Matrix *GTM) {
+    if (!sm->valid || sm->module != md || sm->type != light->type || sm->cutoff != light->cutoff) return 0;
+    if (memcmp(&sm->position, &light->position, sizeof(Point)) != 0) return 0;
+    if (memcmp(&sm->direction, &light->direction, sizeof(Vector)) != 0) return 0;
+    if (memcmp(&sm->gtm, GTM, sizeof(Matrix)) != 0) return 0;
+    return sm->version == module_version(md);
+}
+
+/**
+ * helper function to grow the bounding box [min, max] by the n points of v taken through world.
+ */
+static void shadowGrow(Matrix *world, Point *v, int n, Point *min, Point *max) {
+    Point q;
+    int i, j;
+
+    for (i = 0; i < n; i++) {
+        matrix_xformPoint(world, &v[i], &q);
+        for (j = 0; j < 3; j++) {
+            if (q.val[j] < min->val[j]) min->val[j] = q.val[j];
+            if (q.val[j] > max->val[j]) max->val[j] = q.val[j];
+        }
+    }
+}
+
+/**
+ * helper function to get the mesh an element casts its shadow with: meshes as they are,
+ * the finest level of an LOD mesh and solid Bezier patches tessellated into patch with
+ * the most cells module_draw gives them. Returns NULL for every other element.
+ */
+static Mesh *shadowMesh(Element *e, Mesh *patch) {
+    BezierSurface *b;
+    int cells;
+
+    switch (e->type) {
+        case ObjMesh:
+            return &e->obj->mesh;
+        case ObjSharedMesh:
+            return &e->obj->sharedMesh->mesh;
+        case ObjMeshLOD:
+            return &e->obj->meshLOD->level[0];
+        case ObjBezierSurface:
+            b = &e->obj->bezierSurface;
+            if (!b->solid) return NULL;
+            cells = 1 << (b->divisions < 0 ? 0 : b->divisions > 8 ? 8 : b->divisions);
+            return bezierSurface_tessellate(b, cells, cells, patch) ? patch : NULL;
+        default:
+            return NULL;
+    }
+}
+
+/**
+ * helper function to grow the world space bounding box [min, max] by the shadow casters of the module.
+ */
+static void shadowBounds(Module *md, Matrix *GTM, Point *min, Point *max) {
+    Matrix LTM, world;
+    Element *e;
+    Mesh *m;
+    int i;
+
+    matrix_identity(&LTM);
+    for (e = md->head; e != NULL; e = e->next) {
+        switch (e->type) {
+            case ObjMatrix:
+                matrix_multiply(&e->obj->matrix, &LTM, &LTM);
+                break;
+            case ObjIdentity:
+                matrix_identity(&LTM);
+                break;
+            case ObjModule:
+                matrix_multiply(GTM, &LTM, &world);
+                shadowBounds(e->obj->module, &world, min, max);
+                break;
+            case ObjInstances: {
+                Matrix place;
+                matrix_multiply(GTM, &LTM, &world);
+                for (i = 0; i < e->obj->instances.count; i++) {
+                    matrix_multiply(&world, &e->obj->instances.matrix[i], &place);
+                    shadowBounds(e->obj->instances.module, &place, min, max);
+                }
+                break;
+            }
+            case ObjPolygon:
+                matrix_multiply(GTM, &LTM, &world);
+                shadowGrow(&world, e->obj->polygon.vertex, e->obj->polygon.nVertex, min, max);
+                break;
+            case ObjBezierSurface:
+                // the patch lies inside the hull of its control points
+                if (!e->obj->bezierSurface.solid) break;
+                matrix_multiply(GTM, &LTM, &world);
+                shadowGrow(&world, &e->obj->bezierSurface.vertex[0][0], 16, min, max);
+                break;
+            case ObjMesh:
+            case ObjSharedMesh:
+            case ObjMeshLOD:
+                m = shadowMesh(e, NULL);
+                matrix_multiply(GTM, &LTM, &world);
+                shadowGrow(&world, m->vertex, m->nVertex, min, max);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/**
+ * helper function to set up the perspective view of one shadow map face,
+ * looking from the light position along dir with the given half angle tangent.
+ */
+static void shadowPerspective(ShadowMap *sm, int face, Point *pos, Vector *dir, double halfTan, double range) {
+    View3D view;
+
+    vector_copy(&view.vpn, dir);
+    vector_normalize(&view.vpn);
+    if (fabs(view.vpn.val[1]) > 0.9) {
+        vector_set(&view.vup, 0.0, 0.0, 1.0);
+    } else {
+        vector_set(&view.vup, 0.0, 1.0, 0.0);
+    }
+    // put the center of projection on the light
+    view.d = 1.0;
+    point_set3D(&view.vrp, pos->val[0] + view.vpn.val[0], pos->val[1] + view.vpn.val[1], pos->val[2] + view.vpn.val[2]);
+    view.du = view.dv = 2.0 * halfTan;
+    view.f = 0.0;
+    view.b = range > 1.0 ? range : 1.0;
+    view.screenx = view.screeny = sm->size;
+    matrix_setView3D(&sm->vtm[face], &view);
+}
+
+/**
+ * helper function to set up the orthographic view of a directional light so that the
+ * bounding box [min, max] fits the map. Depth runs from 1 to 2 so 1/z stays finite.
+ */
+static void shadowOrthographic(ShadowMap *sm, Vector *dir, Point *min, Point *max) {
+    Vector u, v, w;
+    Matrix *vtm = &sm->vtm[0];
+    double r = 0.0;
+    int i;
+
+    // the light travels opposite to its direction
+    vector_set(&w, -dir->val[0], -dir->val[1], -dir->val[2]);
+    vector_normalize(&w);
+    if (fabs(w.val[1]) > 0.9) {
+        vector_set(&v, 0.0, 0.0, 1.0);
+    } else {
+        vector_set(&v, 0.0, 1.0, 0.0);
+    }
+    vector_cross(&v, &w, &u);
+    vector_normalize(&u);
+    vector_cross(&w, &u, &v);
+    for (i = 0; i < 3; i++) {
+        r += (max->val[i] - min->val[i]) * (max->val[i] - min->val[i]);
+    }
+    r = r > 0.0 ? sqrt(r) / 2.0 : 1.0;
+
+    matrix_identity(vtm);
+    matrix_translate(vtm, -(min->val[0] + max->val[0]) / 2, -(min->val[1] + max->val[1]) / 2, -(min->val[2] + max->val[2]) / 2);
+    matrix_rotateXYZ(vtm, &u, &v, &w);
+    matrix_scale(vtm, sm->size / (2 * r), sm->size / (2 * r), 1 / (2 * r));
+    matrix_translate(vtm, sm->size / 2.0, sm->size / 2.0, 1.5);
+}
+
+/**
+ * helper function to clip the homogeneous polygon in against the near plane w >= SHADOW_NEAR,
+ * writing the result to out (room for n+1 points). Returns the number of vertices kept.
+ */
+static int shadowClip(Point *in, int n, Point *out) {
+    int i, j, k, count = 0;
+    for (i = 0, j = n - 1; i < n; j = i++) {
+        double wa = in[j].val[3] - SHADOW_NEAR, wb = in[i].val[3] - SHADOW_NEAR;
+        if ((wa >= 0) != (wb >= 0)) {
+            double t = wa / (wa - wb);
+            for (k = 0; k < 4; k++) {
+                out[count].val[k] = in[j].val[k] + t * (in[i].val[k] - in[j].val[k]);
+            }
+            count++;
+        }
+        if (wb >= 0) {
+            out[count++] = in[i];
+        }
+    }
+    return count;
+}
+
+/**
+ * helper function to scan convert the polygon of n world space points wv into the depth
+ * images of all faces. in and out have room for n + 1 points.
+ */
+static void shadowPolygon(ShadowMap *sm, Point *wv, int n, Point *in, Point *out) {
+    Polygon clipped;
+    int i, f, k;
+
+    for (f = 0; f < sm->faces; f++) {
+        for (i = 0; i < n; i++) {
+            matrix_xformPoint(&sm->vtm[f], &wv[i], &in[i]);
+        }
+        k = shadowClip(in, n, out);
+        if (k < 3) continue;
+        polygon_init(&clipped);
+        clipped.nVertex = k;
+        clipped.vertex = out;
+        polygon_normalize(&clipped);
+        polygon_drawDepth(&clipped, sm->depth[f], NULL);
+    }
+}
+
+/**
+ * helper function to scan convert every face of the mesh under world into the depth images,
+ * taking each shared vertex to world space once.
+ */
+static void shadowMeshDepth(ShadowMap *sm, Mesh *m, Matrix *world) {
+    Point *wv, *face, *in, *out;
+    int i, j, n, maxFace = 0;
+
+    for (i = 0; i < m->nFace; i++) {
+        if (m->faceStart[i + 1] - m->faceStart[i] > maxFace) maxFace = m->faceStart[i + 1] - m->faceStart[i];
+    }
+    if (maxFace < 3) return;
+    wv = malloc(sizeof(Point) * m->nVertex);
+    face = malloc(sizeof(Point) * maxFace);
+    in = malloc(sizeof(Point) * (maxFace + 1));
+    out = malloc(sizeof(Point) * (maxFace + 1));
+    if (wv && face && in && out) {
+        for (i = 0; i < m->nVertex; i++) {
+            matrix_xformPoint(world, &m->vertex[i], &wv[i]);
+        }
+        for (i = 0; i < m->nFace; i++) {
+            n = m->faceStart[i + 1] - m->faceStart[i];
+            if (n < 3) continue;
+            for (j = 0; j < n; j++) {
+                face[j] = wv[m->index[m->faceStart[i] + j]];
+            }
+            shadowPolygon(sm, face, n, in, out);
+        }
+    }
+    free(wv);
+    free(face);
+    free(in);
+    free(out);
+}
+
+/**
+ * helper function to traverse the module like module_draw and scan convert every
+ * polygon, mesh and solid Bezier patch into the depth images of all faces, without
+ * any shading or color work.
+ */
+static void shadowDepthPass(ShadowMap *sm, Module *md, Matrix *GTM) {
+    Matrix LTM, world;
+    Element *e;
+    Point stackWorld[8], stackClip[2][9];
+    Mesh patch, *m;
+    int i;
+
+    matrix_identity(&LTM);
+    mesh_init(&patch);
+    for (e = md->head; e != NULL; e = e->next) {
+        switch (e->type) {
+            case ObjMatrix:
+                matrix_multiply(&e->obj->matrix, &LTM, &LTM);
+                break;
+            case ObjIdentity:
+                matrix_identity(&LTM);
+                break;
+            case ObjModule:
+                matrix_multiply(GTM, &LTM, &world);
+                shadowDepthPass(sm, e->obj->module, &world);
+                break;
+            case ObjInstances: {
+                Matrix place;
+                matrix_multiply(GTM, &LTM, &world);
+                for (i = 0; i < e->obj->instances.count; i++) {
+                    matrix_multiply(&world, &e->obj->instances.matrix[i], &place);
+                    shadowDepthPass(sm, e->obj->instances.module, &place);
+                }
+                break;
+            }
+            case ObjPolygon: {
+                Polygon *p = &e->obj->polygon;
+                Point *wv = stackWorld, *in = stackClip[0], *out = stackClip[1];
+                if (p->nVertex < 3) break;
+                if (p->nVertex > 8) {
+                    wv = malloc(sizeof(Point) * p->nVertex);
+                    in = malloc(sizeof(Point) * (p->nVertex + 1));
+                    out = malloc(sizeof(Point) * (p->nVertex + 1));
+                }
+                // transform to world space once, then into each face
+                matrix_multiply(GTM, &LTM, &world);
+                if (wv && in && out) {
+                    for (i = 0; i < p->nVertex; i++) {
+                        matrix_xformPoint(&world, &p->vertex[i], &wv[i]);
+                    }
+                    shadowPolygon(sm, wv, p->nVertex, in, out);
+                }
+                if (wv != stackWorld) {
+                    free(wv);
+                    free(in);
+                    free(out);
+                }
+                break;
+            }
+            case ObjMesh:
+            case ObjSharedMesh:
+            case ObjMeshLOD:
+            case ObjBezierSurface:
+                m = shadowMesh(e, &patch);
+                if (!m) break;
+                matrix_multiply(GTM, &LTM, &world);
+                shadowMeshDepth(sm, m, &world);
+                break;
+            default:
+                break;
+        }
+    }
+    mesh_clear(&patch);
+}
+
+/**
+ * render the depth of the module graph md under GTM from the viewpoint of the light
+ * into the shadow map and remember what it was rendered from.
+ * Point lights render a cube map, spot lights a frustum covering the cutoff angle and
+ * directional lights an orthographic view fitted to the bounds of the geometry.
+ * Polygons, meshes and solid Bezier patches cast shadows, LOD meshes at their finest level.
+ */
+void shadowMap_render(ShadowMap *sm, Light *light, Module *md, Matrix *GTM) {
+    Point min, max;
+    double range = 0.0;
+    int i, f;
+
+    point_set3D(&min, HUGE_VAL, HUGE_VAL, HUGE_VAL);
+    point_set3D(&max, -HUGE_VAL, -HUGE_VAL, -HUGE_VAL);
+    shadowBounds(md, GTM, &min, &max);
+    if (min.val[0] > max.val[0]) {
+        point_set3D(&min, 0.0, 0.0, 0.0);
+        point_set3D(&max, 0.0, 0.0, 0.0);
+    }
+    // farthest the geometry can be from a positional light
+    for (i = 0; i < 3; i++) {
+        double d = fmax(fabs(min.val[i] - light->position.val[i]), fabs(max.val[i] - light->position.val[i]));
+        range += d * d;
+    }
+    range = sqrt(range);
+
+    switch (light->type) {
+        case LightPoint: {
+            static const float axes[6][3] = {{1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+            Vector dir;
+            for (f = 0; f < 6; f++) {
+                vector_set(&dir, axes[f][0], axes[f][1], axes[f][2]);
+                shadowPerspective(sm, f, &light->position, &dir, 1.0, range);
+            }
+            break;
+        }
+        case LightSpot: {
+            double angle = acos(fmax(-1.0, fmin(1.0, light->cutoff)));
+            double halfTan = tan(fmin(angle, 80.0 * M_PI / 180.0));
+            shadowPerspective(sm, 0, &light->position, &light->direction, halfTan, range);
+            break;
+        }
+        case LightDirect:
+            shadowOrthographic(sm, &light->direction, &min, &max);
+            break;
+        default:
+            sm->valid = 0;
+            return;
+    }
+
+    for (f = 0; f < sm->faces; f++) {
+        memset(sm->depth[f]->depth[0], 0, sizeof(float) * sm->size * sm->size);
+    }
+    shadowDepthPass(sm, md, GTM);
+
+    sm->valid = 1;
+    sm->type = light->type;
+    sm->position = light->position;
+    sm->direction = light->direction;
+    sm->cutoff = light->cutoff;
+    sm->module = md;
+    matrix_copy(&sm->gtm, GTM);
+    sm->version = module_version(md);
+}
+
+/**
+ * returns the fraction of the light reaching the world space point p, from 0 (in shadow)
+ * to 1 (lit), using 3x3 percentage closer filtering around p's location in the map.
+ * Points outside the map are lit.
+ */
+float shadowMap_lookup(ShadowMap *sm, Point *p) {
+    Point q;
+    float x, y, z, **depth;
+    int face = 0, lit = 0, r, c, dr, dc;
+
+    if (!sm || !sm->valid) return 1.0;
+    if (sm->faces == 6) {
+        // pick the cube face by the major axis of the direction from the light
+        float d[3], best = -1.0;
+        int i;
+        for (i = 0; i < 3; i++) {
+            d[i] = p->val[i] - sm->position.val[i];
+            if (fabsf(d[i]) > best) {
+                best = fabsf(d[i]);
+                face = 2 * i + (d[i] < 0);
+            }
+        }
+    }
+    matrix_xformPoint(&sm->vtm[face], p, &q);
+    if (q.val[3] <= SHADOW_NEAR || q.val[2] <= 0.0) return 1.0;
+    x = q.val[0] / q.val[3];
+    y = q.val[1] / q.val[3];
+    z = (1 / q.val[2]) * (1 + sm->bias);
+    depth = sm->depth[face]->depth;
+    for (dr = -1; dr <= 1; dr++) {
+        for (dc = -1; dc <= 1; dc++) {
+            r = (int)floorf(y) + dr;
+            c = (int)floorf(x) + dc;
+            if (r < 0 || c < 0 || r >= sm->size || c >= sm->size || depth[r][c] <= z) {
+                lit++;
+            }
+        }
+    }
+    return lit / 9.0f;
+}
@@ -0,0 +1,190 @@
+/***
+ * written by - Jiafeng
+ *
+ * scene snapshot apis, a module graph compiled into a command buffer and the lights
+ * it is drawn with, saved in a binary file laid out as the buffer's arrays are in
+ * memory. Reading a snapshot maps the file and points the buffer's arrays into it,
+ * so nothing is copied per element and commandBuffer_draw walks the file in place.
+ * Loading still checks every command and record, so it touches the command and
+ * integer arrays once and grows with the size of the buffer; the points, colors and
+ * matrices are only paged in as they are drawn.
+ *
+ * The file is a SnapshotHeader followed by the command, point, color, matrix, real,
+ * integer and light arrays, each at a multiple of SNAPSHOT_ALIGN. Every reference
+ * in the arrays is an index, so the file can be mapped anywhere. Files are native
+ * byte order and item sizes, and a reader refuses any other layout or version.
+ */
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "graphics.h"
+
+/* the size of an item of each snapshot array in this build. */
+static void snapshotSizes(int *size) {
+    size[SnapshotCommands] = sizeof(Command);
+    size[SnapshotPoints] = sizeof(Point);
+    size[SnapshotColors] = sizeof(Color);
+    size[SnapshotMatrices] = sizeof(Matrix);
+    size[SnapshotReals] = sizeof(float);
+    size[SnapshotIntegers] = sizeof(int);
+    size[SnapshotLights] = sizeof(SnapshotLight);
+}
+
+/* lay out the arrays of h after the header, each aligned, and set the file length. */
+static void snapshotLayout(SnapshotHeader *h) {
+    long at = sizeof(SnapshotHeader);
+    int i;
+
+    for (i = 0; i < SnapshotArrays; i++) {
+        at = (at + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN * SNAPSHOT_ALIGN;
+        h->offset[i] = at;
+        at += (long)h->size[i] * h->count[i];
+    }
+    h->bytes = at;
+}
+
+/* Snapshot Functions */
+
+/**
+ * write the compiled module graph in cb and the lights of lighting, which may be NULL,
+ * to filename as a snapshot. Shadow maps are not saved. Returns 0 on success, -1 if
+ * the buffer is empty or the file cannot be written.
+ */
+int snapshot_write(char *filename, CommandBuffer *cb, Lighting *lighting) {
+    static const char pad[SNAPSHOT_ALIGN];
+    SnapshotHeader h;
+    SnapshotLight light[MAX_LIGHTS];
+    void *array[SnapshotArrays];
+    long at;
+    FILE *fp;
+    int i, ok;
+
+    if (!filename || !cb || cb->nCommand < 1) return -1;
+    memset(&h, 0, sizeof(SnapshotHeader));
+    h.magic = SNAPSHOT_MAGIC;
+    h.version = SNAPSHOT_VERSION;
+    snapshotSizes(h.size);
+    h.count[SnapshotCommands] = cb->nCommand;
+    h.count[SnapshotPoints] = cb->nPoint;
+    h.count[SnapshotColors] = cb->nColor;
+    h.count[SnapshotMatrices] = cb->nMatrix;
+    h.count[SnapshotReals] = cb->nReal;
+    h.count[SnapshotIntegers] = cb->nInteger;
+    h.count[SnapshotLights] = lighting ? lighting->nLights : 0;
+    snapshotLayout(&h);
+
+    memset(light, 0, sizeof(light));
+    for (i = 0; i < h.count[SnapshotLights]; i++) {
+        light[i].type = lighting->light[i].type;
+        light[i].cutoff = lighting->light[i].cutoff;
+        light[i].sharpness = lighting->light[i].sharpness;
+        light[i].color = lighting->light[i].color;
+        light[i].direction = lighting->light[i].direction;
+        light[i].position = lighting->light[i].position;
+    }
+    array[SnapshotCommands] = cb->command;
+    array[SnapshotPoints] = cb->point;
+    array[SnapshotColors] = cb->color;
+    array[SnapshotMatrices] = cb->matrix;
+    array[SnapshotReals] = cb->real;
+    array[SnapshotIntegers] = cb->integer;
+    array[SnapshotLights] = light;
+
+    fp = fopen(filename, "wb");
+    if (!fp) return -1;
+    ok = fwrite(&h, sizeof(SnapshotHeader), 1, fp) == 1;
+    at = sizeof(SnapshotHeader);
+    for (i = 0; i < SnapshotArrays && ok; i++) {
+        size_t n = (size_t)h.size[i] * h.count[i];
+        ok = fwrite(pad, 1, h.offset[i] - at, fp) == (size_t)(h.offset[i] - at);
+        if (ok && n > 0) ok = fwrite(array[i], 1, n, fp) == n;
+        at = h.offset[i] + n;
+    }
+    if (fclose(fp) != 0) ok = 0;
+    return ok ? 0 : -1;
+}
+
+/**
+ * map the snapshot in filename and return a command buffer whose arrays are views of
+ * the file, to draw with commandBuffer_draw and free with commandBuffer_free. The
+ * lights saved with it replace those of lighting unless lighting is NULL. Returns NULL
+ * if the file cannot be mapped or is not a snapshot of this version and layout, or if
+ * any index in its commands and records falls outside its array, as checked by
+ * commandBuffer_valid, or any light has an unknown type. The arrays are read only;
+ * compiling into the buffer unmaps them first.
+ */
+CommandBuffer *snapshot_read(char *filename, Lighting *lighting) {
+    SnapshotHeader *h;
+    SnapshotLight *light;
+    CommandBuffer *cb;
+    struct stat st;
+    char *base;
+    int size[SnapshotArrays];
+    int fd, i;
+
+    if (!filename) return NULL;
+    fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(SnapshotHeader)) {
+        close(fd);
+        return NULL;
+    }
+    base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return NULL;
+
+    // the header first, so the arrays can be found and checked
+    h = (SnapshotHeader *)base;
+    snapshotSizes(size);
+    if (h->magic != SNAPSHOT_MAGIC || h->version != SNAPSHOT_VERSION || h->bytes != st.st_size ||
+        h->count[SnapshotCommands] < 1 || h->count[SnapshotLights] > MAX_LIGHTS) {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+    for (i = 0; i < SnapshotArrays; i++) {
+        if (h->size[i] != size[i] || h->count[i] < 0 || h->offset[i] % SNAPSHOT_ALIGN ||
+            h->offset[i] < (long)sizeof(SnapshotHeader) || h->offset[i] + (long)size[i] * h->count[i] > h->bytes) {
+            munmap(base, st.st_size);
+            return NULL;
+        }
+    }
+    cb = commandBuffer_create();
+    if (!cb) {
+        munmap(base, st.st_size);
+        return NULL;
+    }
+    cb->command = (Command *)(base + h->offset[SnapshotCommands]);
+    cb->nCommand = h->count[SnapshotCommands];
+    cb->point = (Point *)(base + h->offset[SnapshotPoints]);
+    cb->nPoint = h->count[SnapshotPoints];
+    cb->color = (Color *)(base + h->offset[SnapshotColors]);
+    cb->nColor = h->count[SnapshotColors];
+    cb->matrix = (Matrix *)(base + h->offset[SnapshotMatrices]);
+    cb->nMatrix = h->count[SnapshotMatrices];
+    cb->real = (float *)(base + h->offset[SnapshotReals]);
+    cb->nReal = h->count[SnapshotReals];
+    cb->integer = (int *)(base + h->offset[SnapshotIntegers]);
+    cb->nInteger = h->count[SnapshotIntegers];
+    cb->mapping = base;
+    cb->mappingBytes = st.st_size;
+    light = (SnapshotLight *)(base + h->offset[SnapshotLights]);
+    for (i = 0; i < h->count[SnapshotLights]; i++) {
+        if (light[i].type < LightNone || light[i].type > LightSpot) break;
+    }
+    if (i < h->count[SnapshotLights] || !commandBuffer_valid(cb)) {
+        commandBuffer_free(cb);
+        return NULL;
+    }
+
+    if (lighting) {
+        lighting_clear(lighting);
+        for (i = 0; i < h->count[SnapshotLights]; i++) {
+            lighting_add(lighting, (LightType)light[i].type, &light[i].color, &light[i].direction,
+                         &light[i].position, light[i].cutoff, light[i].sharpness);
+        }
+    }
+    return cb;
+}
@@ -0,0 +1,110 @@
+/***
+ * written by - Jiafeng
+ *
+ * tessellation cache apis, object space meshes of solid Bezier patches kept across
+ * frames. Entries are found through a hash of the control points and the grid and
+ * are evicted least recently used first once the cache holds more than its budget.
+ */
+
+#include <string.h>
+#include "graphics.h"
+
+// what a lookup is for: a patch and the grid it is tessellated on
+typedef struct {
+    BezierSurface *b;
+    int nu, nv;
+} TessKey;
+
+/* hash of the control points and the grid of a patch. */
+static unsigned int tessHash(TessKey *k) {
+    unsigned int h = lruCache_hash(LRU_HASH_SEED, k->b->vertex, sizeof(k->b->vertex));
+    h = lruCache_hash(h, &k->nu, sizeof(int));
+    return lruCache_hash(h, &k->nv, sizeof(int));
+}
+
+/* whether the entry e was tessellated from the patch and grid of the TessKey key. */
+static int tessMatch(CacheEntry *e, void *key) {
+    TessEntry *t = (TessEntry *)e;
+    TessKey *k = (TessKey *)key;
+    return t->nu == k->nu && t->nv == k->nv && !memcmp(t->key, k->b->vertex, sizeof(t->key));
+}
+
+/* free the mesh of an entry leaving the cache. */
+static void tessRelease(CacheEntry *e) {
+    mesh_clear(&((TessEntry *)e)->mesh);
+}
+
+/* memory held by an entry and the arrays of its mesh. */
+static size_t tessBytes(TessEntry *t) {
+    Mesh *m = &t->mesh;
+    size_t bytes = sizeof(TessEntry);
+
+    if (m->vertex) bytes += sizeof(Point) * m->nVertex;
+    if (m->normal) bytes += sizeof(Vector) * m->nVertex;
+    if (m->color) bytes += sizeof(Color) * m->nVertex;
+    if (m->faceStart) bytes += sizeof(int) * (m->nFace + 1) + sizeof(int) * m->faceStart[m->nFace];
+    return bytes;
+}
+
+/* Tessellation Cache Functions */
+
+/**
+ * allocate an empty tessellation cache that holds at most budget bytes of meshes.
+ * Returns NULL if the allocation fails.
+ */
+TessCache *tessCache_create(size_t budget) {
+    return lruCache_create(budget, tessRelease);
+}
+
+/* free the cache and every mesh it holds. */
+void tessCache_free(TessCache *tc) {
+    lruCache_free(tc);
+}
+
+/* drop every entry and zero the counters. */
+void tessCache_reset(TessCache *tc) {
+    lruCache_reset(tc);
+}
+
+/**
+ * return the mesh of the patch b tessellated on a grid of nu by nv cells, as made by
+ * bezierSurface_tessellate. On a hit hit is set to 1 and the stored mesh is returned.
+ * On a miss hit is set to 0 and the patch is tessellated into a new entry, evicting
+ * the least recently used entries while the cache is over its budget. The entry just
+ * used is never evicted, so the mesh stays valid until the next lookup or reset.
+ * Returns NULL if the mesh cannot be allocated.
+ */
+Mesh *tessCache_lookup(TessCache *tc, BezierSurface *b, int nu, int nv, int *hit) {
+    unsigned int hash;
+    TessKey k;
+    TessEntry *t;
+
+    if (!tc || !b) return NULL;
+    k.b = b;
+    k.nu = nu < 1 ? 1 : nu;
+    k.nv = nv < 1 ? 1 : nv;
+    hash = tessHash(&k);
+    t = (TessEntry *)lruCache_find(tc, hash, tessMatch, &k);
+    if (hit) *hit = t != NULL;
+    if (t) return &t->mesh;
+
+    t = (TessEntry *)malloc(sizeof(TessEntry));
+    if (!t) return NULL;
+    mesh_init(&t->mesh);
+    if (!bezierSurface_tessellate(b, k.nu, k.nv, &t->mesh)) {
+        free(t);
+        return NULL;
+    }
+    memcpy(t->key, b->vertex, sizeof(t->key));
+    t->nu = k.nu;
+    t->nv = k.nv;
+    t->entry.hash = hash;
+    t->entry.bytes = tessBytes(t);
+    lruCache_insert(tc, &t->entry);
+    return &t->mesh;
+}
+
+/* fraction of the lookups since the cache was created or reset that were hits. */
+float tessCache_hitRate(TessCache *tc) {
+    return lruCache_hitRate(tc);
+}
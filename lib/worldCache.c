@@ -0,0 +1,107 @@
+/***
+ * written by - Jiafeng
+ *
+ * world cache apis, world space vertices and unit normals of the polygons and meshes
+ * of a module kept across frames. An entry is found through the module, its version
+ * and the GTM it was drawn under, so it goes stale on its own when the module is
+ * edited or moved. Stale entries are never looked up again and are evicted least
+ * recently used first once the cache holds more than its budget.
+ */
+
+#include <string.h>
+#include "graphics.h"
+
+// what a lookup is for: a module at a version drawn under a transform
+typedef struct {
+    void *module;
+    unsigned long version;
+    Matrix *GTM;
+} WorldKey;
+
+/* hash of the module, the version and the bits of the transform. */
+static unsigned int worldHash(WorldKey *k) {
+    unsigned int h = lruCache_hash(LRU_HASH_SEED, &k->module, sizeof(void *));
+    h = lruCache_hash(h, &k->version, sizeof(unsigned long));
+    return lruCache_hash(h, k->GTM, sizeof(Matrix));
+}
+
+/* whether the entry e holds the module, version and transform of the WorldKey key. */
+static int worldMatch(CacheEntry *e, void *key) {
+    WorldEntry *w = (WorldEntry *)e;
+    WorldKey *k = (WorldKey *)key;
+    return w->module == k->module && w->version == k->version && !memcmp(&w->GTM, k->GTM, sizeof(Matrix));
+}
+
+/* World Cache Functions */
+
+/**
+ * allocate an empty world cache that holds at most budget bytes of geometry.
+ * Returns NULL if the allocation fails.
+ */
+WorldCache *worldCache_create(size_t budget) {
+    // the arrays of an entry live in its own block, so there is nothing else to release
+    return lruCache_create(budget, NULL);
+}
+
+/* free the cache and every entry it holds. */
+void worldCache_free(WorldCache *wc) {
+    lruCache_free(wc);
+}
+
+/* drop every entry and zero the counters. */
+void worldCache_reset(WorldCache *wc) {
+    lruCache_reset(wc);
+}
+
+/**
+ * return the entry holding the world space geometry of module at the given version
+ * drawn under GTM, or NULL if there is none. The entry stays valid until the next
+ * insert or reset.
+ */
+WorldEntry *worldCache_lookup(WorldCache *wc, void *module, unsigned long version, Matrix *GTM) {
+    WorldKey k;
+
+    if (!wc || !module || !GTM) return NULL;
+    k.module = module;
+    k.version = version;
+    k.GTM = GTM;
+    return (WorldEntry *)lruCache_find(wc, worldHash(&k), worldMatch, &k);
+}
+
+/**
+ * make an entry for module at the given version drawn under GTM, with room for the
+ * first vertex of nElement elements and nVertex vertices and normals, for the caller
+ * to fill. Evicts the least recently used entries while the cache is over its budget,
+ * never the entry just made. Returns the entry, or NULL if it cannot be allocated.
+ */
+WorldEntry *worldCache_insert(WorldCache *wc, void *module, unsigned long version, Matrix *GTM, int nElement, int nVertex) {
+    WorldEntry *w;
+    WorldKey k;
+    size_t bytes;
+
+    if (!wc || !module || !GTM || nElement < 0 || nVertex < 0) return NULL;
+    // the arrays follow the entry in one block, the points first to keep them aligned
+    bytes = sizeof(WorldEntry) + (sizeof(Point) + sizeof(Vector)) * nVertex + sizeof(int) * nElement;
+    w = (WorldEntry *)malloc(bytes);
+    if (!w) return NULL;
+    k.module = module;
+    k.version = version;
+    k.GTM = GTM;
+    w->module = module;
+    w->version = version;
+    w->GTM = *GTM;
+    w->nElement = nElement;
+    w->nVertex = nVertex;
+    w->vertex = (Point *)(w + 1);
+    w->normal = (Vector *)(w->vertex + nVertex);
+    w->first = (int *)(w->normal + nVertex);
+    w->entry.hash = worldHash(&k);
+    w->entry.bytes = bytes;
+    lruCache_insert(wc, &w->entry);
+    return w;
+}
+
+/* fraction of the lookups since the cache was created or reset that were hits. */
+float worldCache_hitRate(WorldCache *wc) {
+    return lruCache_hitRate(wc);
+}
@@ -0,0 +1,209 @@
+/***
+ * written by - Jiafeng
+ *
+ * batched vertex transform apis, points are kept as a structure of arrays so
+ * several of them go through a matrix at once with SSE or AVX
+ */
+
+#include "graphics.h"
+
+/* Vertex Stream Functions */
+
+/* copy the double matrix m into the float matrix f. */
+void matrix4f_set(Matrix4f *f, Matrix *m) {
+    int i, j;
+    for (i = 0; i < 4; i++)
+        for (j = 0; j < 4; j++)
+            f->m[i][j] = (float)m->m[i][j];
+}
+
+/* allocate an empty vertex stream able to hold capacity points without growing. */
+VertexStream *vertexStream_create(int capacity) {
+    VertexStream *vs = (VertexStream *)malloc(sizeof(VertexStream));
+    if (!vs) return NULL;
+    vs->n = 0;
+    vs->capacity = 0;
+    vs->x = vs->y = vs->z = vs->w = NULL;
+    if (capacity > 0 && !vertexStream_reserve(vs, capacity)) {
+        free(vs);
+        return NULL;
+    }
+    return vs;
+}
+
+/* free the vertex stream and its arrays. */
+void vertexStream_free(VertexStream *vs) {
+    if (!vs) return;
+    free(vs->x);
+    free(vs);
+}
+
+/**
+ * make room for at least capacity points, keeping the points already in the stream.
+ * The four arrays share one allocation. Returns 0 if the allocation fails.
+ */
+int vertexStream_reserve(VertexStream *vs, int capacity) {
+    float *buf;
+    int i;
+    if (capacity <= vs->capacity) return 1;
+    buf = (float *)malloc(sizeof(float) * 4 * capacity);
+    if (!buf) return 0;
+    for (i = 0; i < vs->n; i++) {
+        buf[i] = vs->x[i];
+        buf[capacity + i] = vs->y[i];
+        buf[2 * capacity + i] = vs->z[i];
+        buf[3 * capacity + i] = vs->w[i];
+    }
+    free(vs->x);
+    vs->x = buf;
+    vs->y = buf + capacity;
+    vs->z = buf + 2 * capacity;
+    vs->w = buf + 3 * capacity;
+    vs->capacity = capacity;
+    return 1;
+}
+
+/* fill the stream with the n points p, growing it as needed. */
+void vertexStream_setPoints(VertexStream *vs, Point *p, int n) {
+    int i;
+    if (!vertexStream_reserve(vs, n)) return;
+    for (i = 0; i < n; i++) {
+        vs->x[i] = p[i].val[0];
+        vs->y[i] = p[i].val[1];
+        vs->z[i] = p[i].val[2];
+        vs->w[i] = p[i].val[3];
+    }
+    vs->n = n;
+}
+
+/* copy the points of the stream out to p, which must hold vs->n points. */
+void vertexStream_getPoints(VertexStream *vs, Point *p) {
+    int i;
+    for (i = 0; i < vs->n; i++) {
+        p[i].val[0] = vs->x[i];
+        p[i].val[1] = vs->y[i];
+        p[i].val[2] = vs->z[i];
+        p[i].val[3] = vs->w[i];
+    }
+}
+
+/*
+    Transform points i to f (exclusive) one at a time, used on its own and for the
+    leftover points of the SIMD versions.
+ */
+static void xformScalar(Matrix4f *m, VertexStream *in, VertexStream *out, int i, int f, int normalize) {
+    for (; i < f; i++) {
+        float x = in->x[i], y = in->y[i], z = in->z[i], w = in->w[i];
+        float tx = m->m[0][0] * x + m->m[0][1] * y + m->m[0][2] * z + m->m[0][3] * w;
+        float ty = m->m[1][0] * x + m->m[1][1] * y + m->m[1][2] * z + m->m[1][3] * w;
+        float tz = m->m[2][0] * x + m->m[2][1] * y + m->m[2][2] * z + m->m[2][3] * w;
+        float tw = m->m[3][0] * x + m->m[3][1] * y + m->m[3][2] * z + m->m[3][3] * w;
+        if (normalize) {
+            tx /= tw;
+            ty /= tw;
+            tw = 1.0f;
+        }
+        out->x[i] = tx;
+        out->y[i] = ty;
+        out->z[i] = tz;
+        out->w[i] = tw;
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+/*
+    SSE version of xformScalar, four points per step.
+ */
+__attribute__((target("sse2")))
+static void xformSSE(Matrix4f *m, VertexStream *in, VertexStream *out, int n, int normalize) {
+    __m128 c[4][4];
+    int i, r, k;
+    for (r = 0; r < 4; r++)
+        for (k = 0; k < 4; k++)
+            c[r][k] = _mm_set1_ps(m->m[r][k]);
+    for (i = 0; i + 4 <= n; i += 4) {
+        __m128 x = _mm_loadu_ps(&in->x[i]), y = _mm_loadu_ps(&in->y[i]);
+        __m128 z = _mm_loadu_ps(&in->z[i]), w = _mm_loadu_ps(&in->w[i]);
+        __m128 t[4];
+        for (r = 0; r < 4; r++) {
+            t[r] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c[r][0], x), _mm_mul_ps(c[r][1], y)),
+                              _mm_add_ps(_mm_mul_ps(c[r][2], z), _mm_mul_ps(c[r][3], w)));
+        }
+        if (normalize) {
+            t[0] = _mm_div_ps(t[0], t[3]);
+            t[1] = _mm_div_ps(t[1], t[3]);
+            t[3] = _mm_set1_ps(1.0f);
+        }
+        _mm_storeu_ps(&out->x[i], t[0]);
+        _mm_storeu_ps(&out->y[i], t[1]);
+        _mm_storeu_ps(&out->z[i], t[2]);
+        _mm_storeu_ps(&out->w[i], t[3]);
+    }
+    xformScalar(m, in, out, i, n, normalize);
+}
+
+/*
+    AVX version of xformScalar, eight points per step.
+ */
+__attribute__((target("avx")))
+static void xformAVX(Matrix4f *m, VertexStream *in, VertexStream *out, int n, int normalize) {
+    __m256 c[4][4];
+    int i, r, k;
+    for (r = 0; r < 4; r++)
+        for (k = 0; k < 4; k++)
+            c[r][k] = _mm256_set1_ps(m->m[r][k]);
+    for (i = 0; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_loadu_ps(&in->x[i]), y = _mm256_loadu_ps(&in->y[i]);
+        __m256 z = _mm256_loadu_ps(&in->z[i]), w = _mm256_loadu_ps(&in->w[i]);
+        __m256 t[4];
+        for (r = 0; r < 4; r++) {
+            t[r] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c[r][0], x), _mm256_mul_ps(c[r][1], y)),
+                                 _mm256_add_ps(_mm256_mul_ps(c[r][2], z), _mm256_mul_ps(c[r][3], w)));
+        }
+        if (normalize) {
+            t[0] = _mm256_div_ps(t[0], t[3]);
+            t[1] = _mm256_div_ps(t[1], t[3]);
+            t[3] = _mm256_set1_ps(1.0f);
+        }
+        _mm256_storeu_ps(&out->x[i], t[0]);
+        _mm256_storeu_ps(&out->y[i], t[1]);
+        _mm256_storeu_ps(&out->z[i], t[2]);
+        _mm256_storeu_ps(&out->w[i], t[3]);
+    }
+    xformScalar(m, in, out, i, n, normalize);
+}
+#endif
+
+/* scalar fallback with the same signature as the SIMD kernels. */
+static void xformAll(Matrix4f *m, VertexStream *in, VertexStream *out, int n, int normalize) {
+    xformScalar(m, in, out, 0, n, normalize);
+}
+
+/**
+ * transform the points of in by m into out, which may be the same stream. If normalize
+ * is set, x and y are divided by the homogeneous coordinate afterwards and it is set
+ * to 1, as in point_normalize, so screen-space points come out ready to draw.
+ * Uses the widest SIMD kernel the processor supports, chosen on the first call.
+ */
+void vertexStream_xform(Matrix4f *m, VertexStream *in, VertexStream *out, int normalize) {
+    static void (*kernel)(Matrix4f *, VertexStream *, VertexStream *, int, int) = NULL;
+    if (!m || !in || !out) return;
+    if (out != in) {
+        if (!vertexStream_reserve(out, in->n)) return;
+        out->n = in->n;
+    }
+    if (!kernel) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx"))
+            kernel = xformAVX;
+        else if (__builtin_cpu_supports("sse2"))
+            kernel = xformSSE;
+        else
+#endif
+            kernel = xformAll;
+    }
+    kernel(m, in, out, in->n, normalize);
+}
@@ -0,0 +1,108 @@
+/*
+	Jiafeng
+	Summer 2024
+
+	Microbenchmark of transform composition in a scene graph. Each node builds
+	a local transform from a scale, two rotations and a translation and composes
+	it with its parent, using
+	  - a full 4x4 matrix per step and matrix_multiply (how the builders used to work)
+	  - the in-place matrix_ builders
+	  - the float Affine builders and affine_multiply
+	Reports nodes per second and the largest difference from the double result.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "graphics.h"
+#include "benchUtil.h"
+
+// premultiply m by a general 4x4 built from the given rows, as the old builders did
+static void premultiply(Matrix *m, double r[4][4]) {
+	Matrix t;
+	int i, j;
+	for (i = 0; i < 4; i++)
+		for (j = 0; j < 4; j++)
+			t.m[i][j] = r[i][j];
+	matrix_multiply(&t, m, m);
+}
+
+int main(int argc, char *argv[]) {
+	int n = argc > 1 ? atoi(argv[1]) : 1000000;
+	double *cs = malloc(sizeof(double) * n), *sn = malloc(sizeof(double) * n);
+	Matrix parent, local, *world = malloc(sizeof(Matrix) * n);
+	Affine aparent, alocal, *aworld = malloc(sizeof(Affine) * n);
+	double t, err = 0;
+	clock_t start;
+	int i, r, c;
+
+	// touch the outputs first so page faults are not timed
+	memset(world, 0, sizeof(Matrix) * n);
+	memset(aworld, 0, sizeof(Affine) * n);
+	srand(7);
+	for (i = 0; i < n; i++) {
+		double angle = (double)rand() / RAND_MAX * 6.28;
+		cs[i] = cos(angle);
+		sn[i] = sin(angle);
+	}
+	matrix_identity(&parent);
+	matrix_rotateY(&parent, cos(0.4), sin(0.4));
+	matrix_translate(&parent, 1, 2, 3);
+	affine_set(&aparent, &parent);
+
+	start = clock();
+	for (i = 0; i < n; i++) {
+		double ca = cs[i], sa = sn[i];
+		double S[4][4] = {{1.5, 0, 0, 0}, {0, 0.5, 0, 0}, {0, 0, 2, 0}, {0, 0, 0, 1}};
+		double RX[4][4] = {{1, 0, 0, 0}, {0, ca, -sa, 0}, {0, sa, ca, 0}, {0, 0, 0, 1}};
+		double RY[4][4] = {{ca, 0, sa, 0}, {0, 1, 0, 0}, {-sa, 0, ca, 0}, {0, 0, 0, 1}};
+		double T[4][4] = {{1, 0, 0, i * 0.001}, {0, 1, 0, 1}, {0, 0, 1, -1}, {0, 0, 0, 1}};
+		matrix_identity(&local);
+		premultiply(&local, S);
+		premultiply(&local, RX);
+		premultiply(&local, RY);
+		premultiply(&local, T);
+		matrix_multiply(&parent, &local, &world[i]);
+	}
+	t = seconds(start);
+	printf("full 4x4 per step:   %8.2f Mnodes/s\n", n / t / 1e6);
+
+	start = clock();
+	for (i = 0; i < n; i++) {
+		double ca = cs[i], sa = sn[i];
+		matrix_identity(&local);
+		matrix_scale(&local, 1.5, 0.5, 2);
+		matrix_rotateX(&local, ca, sa);
+		matrix_rotateY(&local, ca, sa);
+		matrix_translate(&local, i * 0.001, 1, -1);
+		matrix_multiply(&parent, &local, &world[i]);
+	}
+	t = seconds(start);
+	printf("in-place matrix_:    %8.2f Mnodes/s\n", n / t / 1e6);
+
+	start = clock();
+	for (i = 0; i < n; i++) {
+		float ca = cs[i], sa = sn[i];
+		affine_identity(&alocal);
+		affine_scale(&alocal, 1.5f, 0.5f, 2.0f);
+		affine_rotateX(&alocal, ca, sa);
+		affine_rotateY(&alocal, ca, sa);
+		affine_translate(&alocal, i * 0.001f, 1.0f, -1.0f);
+		affine_multiply(&aparent, &alocal, &aworld[i]);
+	}
+	t = seconds(start);
+	printf("affine_:             %8.2f Mnodes/s\n", n / t / 1e6);
+
+	for (i = 0; i < n; i++)
+		for (r = 0; r < 3; r++)
+			for (c = 0; c < 4; c++)
+				if (fabs(aworld[i].m[r][c] - world[i].m[r][c]) > err) err = fabs(aworld[i].m[r][c] - world[i].m[r][c]);
+	printf("largest difference from the double result: %g\n", err);
+
+	free(cs);
+	free(sn);
+	free(world);
+	free(aworld);
+	return 0;
+}
@@ -0,0 +1,72 @@
+/*
+	Jiafeng
+	Summer 2024
+
+	Benchmark of module construction and teardown: builds a module of n
+	tiles, each an identity, a translation, a color, a surface coefficient
+	and a polygon, so five elements per tile, then clears it, builds it again
+	into the memory the clear kept, and deletes it. Reports the time of each
+	step and the memory the module holds.
+
+	usage: benchArena [elements]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "graphics.h"
+#include "benchUtil.h"
+
+/*
+	Add n tiles of the polygon p to the module.
+ */
+static void build(Module *md, Polygon *p, int n) {
+	Color c;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		color_set(&c, (i % 7) / 7.0, (i % 5) / 5.0, (i % 3) / 3.0);
+		module_identity(md);
+		module_translate(md, i % 1000, i / 1000, 0);
+		module_color(md, &c);
+		module_surfaceCoeff(md, 10 + i % 20);
+		module_polygon(md, p);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	int n = (argc > 1 ? atoi(argv[1]) : 1000000) / 5;
+	Module *md;
+	Polygon p;
+	Point pt[4];
+	clock_t start;
+
+	point_set3D(&pt[0], 0, 0, 0);
+	point_set3D(&pt[1], 1, 0, 0);
+	point_set3D(&pt[2], 1, 1, 0);
+	point_set3D(&pt[3], 0, 1, 0);
+	polygon_init(&p);
+	polygon_set(&p, 4, pt);
+
+	printf("%d elements\n", 5 * n);
+	start = clock();
+	md = module_create();
+	build(md, &p, n);
+	printf("build   %8.1f ms  %6.1f MB\n", 1000 * seconds(start), module_memory(md) / 1048576.0);
+
+	start = clock();
+	module_clear(md);
+	printf("clear   %8.1f ms\n", 1000 * seconds(start));
+
+	start = clock();
+	build(md, &p, n);
+	printf("rebuild %8.1f ms  %6.1f MB\n", 1000 * seconds(start), module_memory(md) / 1048576.0);
+
+	start = clock();
+	module_delete(md);
+	printf("delete  %8.1f ms\n", 1000 * seconds(start));
+
+	polygon_clear(&p);
+
+	return(0);
+}
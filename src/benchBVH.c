@@ -0,0 +1,227 @@
+/*
+	Jiafeng
+	Summer 2024
+
+	Benchmark of the scene BVH: builds a field of n x n of the creature
+	formations of portfolio, optionally with a PLY model in the middle,
+	and builds a BVH over it with one thread and with several. Then picks
+	every pixel of the view, checks the hits against testing every triangle
+	on a sample of the pixels and against the pixels module_draw covers,
+	casts shadow rays from the hits with any-hit queries, and finally
+	turns every formation and refits the BVH instead of rebuilding it.
+	Reports times, rays per second and the number of disagreements.
+
+	usage: benchBVH [n] [threads] [file.ply]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include "graphics.h"
+#include "benchUtil.h"
+
+/*
+	Wall clock seconds since start, since the threads of a build share the CPU time.
+ */
+static double elapsed(struct timeval *start) {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+/*
+	Nearest triangle the ray meets by testing all of them, or -1, with its distance in t.
+ */
+static int bruteHit(BVH *bvh, Point *o, Vector *d, double *t) {
+	int i, j, best = -1;
+
+	*t = HUGE_VAL;
+	for (i = 0; i < bvh->nTriangle; i++) {
+		Point *v = bvh->triangle[i].vertex;
+		double e1[3], e2[3], s[3], p[3], q[3], det, a, b, c;
+		for (j = 0; j < 3; j++) {
+			e1[j] = v[1].val[j] - v[0].val[j];
+			e2[j] = v[2].val[j] - v[0].val[j];
+			s[j] = o->val[j] - v[0].val[j];
+		}
+		p[0] = d->val[1] * e2[2] - d->val[2] * e2[1];
+		p[1] = d->val[2] * e2[0] - d->val[0] * e2[2];
+		p[2] = d->val[0] * e2[1] - d->val[1] * e2[0];
+		det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+		if (det == 0) continue;
+		a = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) / det;
+		if (a < 0 || a > 1) continue;
+		q[0] = s[1] * e1[2] - s[2] * e1[1];
+		q[1] = s[2] * e1[0] - s[0] * e1[2];
+		q[2] = s[0] * e1[1] - s[1] * e1[0];
+		b = (d->val[0] * q[0] + d->val[1] * q[1] + d->val[2] * q[2]) / det;
+		if (b < 0 || a + b > 1) continue;
+		c = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) / det;
+		if (c > 1e-6 && c < *t) {
+			*t = c;
+			best = i;
+		}
+	}
+	return best;
+}
+
+int main(int argc, char *argv[]) {
+	int n = argc > 1 ? atoi(argv[1]) : 20;
+	int threads = argc > 2 ? atoi(argv[2]) : 4;
+	Module *field, *formation, *model = NULL;
+	Formation form;
+	BVH *bvh, *other;
+	BVHHit hit;
+	Mesh mesh;
+	Image *src;
+	Color blue = {{0.3, 0.3, 1}};
+	View3D view;
+	Matrix VTM, GTM;
+	DrawState *ds;
+	Point light, origin, p;
+	Vector dir, toLight;
+	struct timeval start;
+	double t, one, many, bt;
+	long hits = 0, shadowed = 0, covered = 0, disagree = 0, brute = 0, wrong = 0, rays;
+	int i, j, k, b;
+
+	// looking down on the field at an angle, all of it in front of the viewer
+	point_set3D(&view.vrp, 0, -500, 500);
+	vector_set(&view.vpn, 0, 1, -1);
+	vector_set(&view.vup, 0, 0, 1);
+	view.d = 2;
+	view.du = 1.6;
+	view.dv = 0.9;
+	view.f = 1;
+	view.b = 1000;
+	view.screenx = 640;
+	view.screeny = 360;
+	matrix_setView3D(&VTM, &view);
+
+	buildFormation(&form, NULL, 0);
+	formation = form.formation;
+
+	if (argc > 3) {
+		mesh_init(&mesh);
+		if (readPLYMesh(argv[3], &mesh, 0)) {
+			printf("unable to read %s\n", argv[3]);
+			return(-1);
+		}
+		model = module_create();
+		module_mesh(model, &mesh);
+		mesh_clear(&mesh);
+	}
+
+	field = module_create();
+	buildField(field, formation, model, n, 0);
+	matrix_identity(&GTM);
+
+	// build with one thread and with several, the trees must be the same
+	gettimeofday(&start, NULL);
+	other = bvh_create(field, &GTM, 1);
+	one = elapsed(&start);
+	gettimeofday(&start, NULL);
+	bvh = bvh_create(field, &GTM, threads);
+	many = elapsed(&start);
+	if (!bvh || !other) {
+		printf("unable to build the BVH\n");
+		return(-1);
+	}
+	printf("%d triangles, %d nodes, built in %.1f ms on 1 thread and %.1f ms on %d, trees %s\n",
+		   bvh->nTriangle, bvh->nNode, 1000 * one, 1000 * many, threads,
+		   other->nNode == bvh->nNode && !memcmp(other->node, bvh->node, sizeof(BVHNode) * bvh->nNode) ? "same" : "DIFFER");
+	bvh_free(other);
+
+	src = image_create(view.screeny, view.screenx);
+	ds = drawstate_create();
+	ds->shade = ShadeConstant;
+	ds->color = blue;
+	image_reset(src);
+	module_draw(field, &VTM, &GTM, ds, NULL, src);
+
+	// pick every pixel, and compare with module_draw's coverage
+	gettimeofday(&start, NULL);
+	for (i = 0; i < src->rows; i++) {
+		for (j = 0; j < src->cols; j++) {
+			int hitHere = bvh_pick(bvh, &view, i, j, &hit);
+			int drawn = src->data[i][j].rgb[2] > 0;
+			hits += hitHere;
+			covered += drawn;
+			disagree += hitHere != drawn;
+		}
+	}
+	t = elapsed(&start);
+	rays = (long)src->rows * src->cols;
+	printf("closest hit: %ld rays in %.1f ms, %.2f Mrays/s, %ld hits, %ld pixels drawn, %ld disagree (edges)\n",
+		   rays, 1000 * t, rays / t / 1e6, hits, covered, disagree);
+
+	// every 97th pixel against testing every triangle
+	gettimeofday(&start, NULL);
+	for (k = 0; k < rays; k += 97) {
+		double tb;
+		view3D_ray(&view, k / src->cols + 0.5, k % src->cols + 0.5, &origin, &dir);
+		b = bruteHit(bvh, &origin, &dir, &tb);
+		if (bvh_closestHit(bvh, &origin, &dir, HUGE_VAL, &hit) ? b < 0 || fabs(hit.t - tb) > 1e-6 * tb : b >= 0) wrong++;
+		brute++;
+	}
+	bt = elapsed(&start);
+	printf("brute force: %ld rays, %.4f Mrays/s, %ld differ from the BVH\n", brute, brute / bt / 1e6, wrong);
+
+	// shadow rays from each hit toward a light
+	point_set3D(&light, 300, -200, 600);
+	gettimeofday(&start, NULL);
+	for (k = 0, rays = 0; k < (long)src->rows * src->cols; k++) {
+		view3D_ray(&view, k / src->cols + 0.5, k % src->cols + 0.5, &origin, &dir);
+		if (!bvh_closestHit(bvh, &origin, &dir, HUGE_VAL, &hit)) continue;
+		// start a little off the surface, toward the viewer
+		for (j = 0; j < 3; j++) {
+			p.val[j] = hit.point.val[j] + 1e-3 * hit.normal.val[j];
+			toLight.val[j] = light.val[j] - p.val[j];
+		}
+		p.val[3] = 1;
+		shadowed += bvh_anyHit(bvh, &p, &toLight, 1.0);
+		rays++;
+	}
+	t = elapsed(&start);
+	printf("any hit: %ld primary and shadow ray pairs in %.1f ms, %ld in shadow\n", rays, 1000 * t, shadowed);
+
+	// turn every formation and refit instead of rebuilding
+	buildField(field, formation, model, n, 0.5);
+	gettimeofday(&start, NULL);
+	k = bvh_refit(bvh, field, &GTM);
+	t = elapsed(&start);
+	gettimeofday(&start, NULL);
+	other = bvh_create(field, &GTM, threads);
+	many = elapsed(&start);
+	for (i = 0, wrong = 0; i < src->rows; i += 3) {
+		for (j = 0; j < src->cols; j += 3) {
+			BVHHit fresh;
+			int a = bvh_pick(bvh, &view, i, j, &hit), c = bvh_pick(other, &view, i, j, &fresh);
+			if (a != c || (a && hit.t != fresh.t)) wrong++;
+		}
+	}
+	gettimeofday(&start, NULL);
+	for (i = 0; i < src->rows; i++) {
+		for (j = 0; j < src->cols; j++) bvh_pick(bvh, &view, i, j, &hit);
+	}
+	one = elapsed(&start);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < src->rows; i++) {
+		for (j = 0; j < src->cols; j++) bvh_pick(other, &view, i, j, &hit);
+	}
+	bt = elapsed(&start);
+	printf("refit %s in %.1f ms, rebuild %.1f ms, %ld sampled picks differ; picking %.1f ms refit, %.1f ms rebuilt\n",
+		   k ? "done" : "FAILED", 1000 * t, 1000 * many, wrong, 1000 * one, 1000 * bt);
+	bvh_free(other);
+
+	bvh_free(bvh);
+	module_delete(field);
+	deleteFormation(&form);
+	if (model) module_delete(model);
+	free(ds);
+	image_free(src);
+
+	return(0);
+}
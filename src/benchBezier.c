@@ -0,0 +1,76 @@
+/*
+	Jiafeng
+	Summer 2024
+
+	Benchmark of Bezier curve drawing: the recursive bounding-box subdivision
+	(bezierCurve_drawRecursive) against the flatness-based tessellator drawn as
+	one polyline (bezierCurve_draw), adaptively and with a fixed number of
+	forward-differenced segments. Also times the tessellation alone.
+	Reports curves per second.
+
+	usage: benchBezier [curves] [divisions]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "graphics.h"
+#include "benchUtil.h"
+
+int main(int argc, char *argv[]) {
+	int n = argc > 1 ? atoi(argv[1]) : 20000;
+	int divisions = argc > 2 ? atoi(argv[2]) : 4;
+	int rows = 480, cols = 640;
+	BezierCurve *curves = malloc(sizeof(BezierCurve) * n);
+	Point out[1025];
+	Image *src = image_create(rows, cols);
+	Color white = {{1.0, 1.0, 1.0}};
+	long points = 0;
+	clock_t start;
+	double t;
+	int i, j;
+
+	// curves spanning a few hundred pixels, the size the old 10-pixel threshold was tuned for
+	srand(11);
+	for (i = 0; i < n; i++) {
+		bezierCurve_init(&curves[i]);
+		for (j = 0; j < 4; j++) {
+			point_set3D(&curves[i].vertex[j], 20 + (float)rand() / RAND_MAX * (cols - 40),
+						20 + (float)rand() / RAND_MAX * (rows - 40), 1 + (float)rand() / RAND_MAX);
+		}
+	}
+
+	start = clock();
+	for (i = 0; i < n; i++) bezierCurve_drawRecursive(&curves[i], src, white);
+	t = seconds(start);
+	printf("recursive draw:          %10.0f curves/s\n", n / t);
+
+	image_reset(src);
+	start = clock();
+	for (i = 0; i < n; i++) bezierCurve_draw(&curves[i], src, white);
+	t = seconds(start);
+	printf("adaptive draw:           %10.0f curves/s\n", n / t);
+
+	start = clock();
+	for (i = 0; i < n; i++) points += bezierCurve_tessellate(&curves[i], 0.5f, out, 1025);
+	t = seconds(start);
+	printf("adaptive tessellate:     %10.0f curves/s  %6.1f points/curve\n", n / t, (double)points / n);
+
+	for (i = 0; i < n; i++) bezierCurve_setDivisions(&curves[i], divisions);
+	image_reset(src);
+	start = clock();
+	for (i = 0; i < n; i++) bezierCurve_draw(&curves[i], src, white);
+	t = seconds(start);
+	printf("forward diff draw (%2d):  %10.0f curves/s\n", 1 << divisions, n / t);
+
+	points = 0;
+	start = clock();
+	for (i = 0; i < n; i++) points += bezierCurve_tessellate(&curves[i], 0.5f, out, 1025);
+	t = seconds(start);
+	printf("forward diff tessellate: %10.0f curves/s  %6.1f points/curve\n", n / t, (double)points / n);
+
+	image_free(src);
+	free(curves);
+
+	return(0);
+}
@@ -0,0 +1,225 @@
+/*
+	Jiafeng
+	Summer 2024
+
+	Benchmark of compiled modules: builds the creature formations of
+	portfolio, a crowd of n x n of them drawn small, a flat shaded scene
+	whose sub-module sets the flat fill color and a tree of modules four
+	deep per level ending in single points, then draws each scene for
+	a number of frames walking the module graph with module_draw and
+	replaying it from a command buffer made by module_compile, taking
+	turns frame by frame. Reports milliseconds per frame spent drawing,
+	the time to compile, the size of the buffer and whether the two images
+	match exactly. The tree draws almost nothing, so it measures traversal.
+
+	usage: benchCompile [frames] [crowd n] [tree depth]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "graphics.h"
+#include "benchUtil.h"
+
+/*
+	A module holding four copies of a tree one level shallower, each shrunk, turned
+	and moved to a corner, with a point at the bottom. Every level sets its own color.
+ */
+static Module *tree(int depth, Point *p) {
+	Module *md = module_create(), *sub;
+	Color c = {{0.2 + 0.1 * depth, 0.5, 0.8}};
+	int i;
+
+	module_color(md, &c);
+	if (depth == 0) {
+		module_point(md, p);
+		return md;
+	}
+	sub = tree(depth - 1, p);
+	for (i = 0; i < 4; i++) {
+		module_identity(md);
+		module_scale(md, 0.5, 0.5, 0.5);
+		module_rotateZ(md, cos(i * M_PI / 2), sin(i * M_PI / 2));
+		module_translate(md, i & 1 ? 10 : -10, i & 2 ? 10 : -10, 0);
+		module_module(md, sub);
+	}
+	return md;
+}
+
+/*
+	Delete a tree made by tree.
+ */
+static void treeDelete(Module *md, int depth) {
+	if (depth > 0) treeDelete(md->tail->obj->module, depth - 1);
+	module_delete(md);
+}
+
+/*
+	A module holding a small triangle with a color at each corner. Flat shading fills
+	it with their average, which it leaves behind as the flat fill color.
+ */
+static Module *colorBadge(void) {
+	Color corner[3] = {{{1, 0, 0}}, {{0, 1, 0}}, {{0, 0.5, 1}}};
+	Module *md = module_create();
+	Point v[3];
+	Polygon p;
+
+	point_set3D(&v[0], 0, 0, 5);
+	point_set3D(&v[1], 10, 0, 5);
+	point_set3D(&v[2], 5, 10, 5);
+	polygon_init(&p);
+	polygon_set(&p, 3, v);
+	polygon_setColors(&p, 3, corner);
+	module_polygon(md, &p);
+	polygon_clear(&p);
+	return md;
+}
+
+/*
+	A module for flat shading without lights: a sub-module holding a polygon with
+	vertex colors, which sets the flat fill color, then the formation and a polygon
+	without colors, which are filled with whatever flat color the DrawState holds.
+ */
+static Module *flatScene(Module *formation, Module *badge) {
+	Module *md = module_create();
+	Point v[4];
+	Polygon p;
+
+	point_set3D(&v[0], -60, -60, 0);
+	point_set3D(&v[1], 60, -60, 0);
+	point_set3D(&v[2], 60, 60, 0);
+	point_set3D(&v[3], -60, 60, 0);
+	polygon_init(&p);
+	polygon_set(&p, 4, v);
+	module_module(md, badge);
+	module_module(md, formation);
+	module_polygon(md, &p);
+	polygon_clear(&p);
+	return md;
+}
+
+/*
+	Draw scene frames times each way, a walk and a replay in turn so both see the
+	same machine state, and report the time per frame spent drawing alone.
+ */
+static void bench(char *name, Module *scene, Matrix *VTM, DrawState *ds, Image *walked, Image *replayed, int frames) {
+	CommandBuffer *cb = commandBuffer_create();
+	DrawState tempDS;
+	Matrix GTM;
+	clock_t start;
+	double walk = 0, replay = 0, compile;
+	int i;
+
+	matrix_identity(&GTM);
+	start = clock();
+	module_compile(scene, cb);
+	compile = seconds(start);
+
+	for (i = 0; i < frames; i++) {
+		image_reset(walked);
+		drawstate_copy(&tempDS, ds);
+		start = clock();
+		module_draw(scene, VTM, &GTM, &tempDS, NULL, walked);
+		walk += seconds(start);
+
+		image_reset(replayed);
+		drawstate_copy(&tempDS, ds);
+		start = clock();
+		commandBuffer_draw(cb, VTM, &GTM, &tempDS, NULL, replayed);
+		replay += seconds(start);
+	}
+
+	printf("%-10s walk %8.3f ms/frame  replay %8.3f ms/frame  compile %7.3f ms  %6d commands %7d points  %s\n",
+		   name, 1000 * walk / frames, 1000 * replay / frames, 1000 * compile, cb->nCommand, cb->nPoint,
+		   sameImage(walked, replayed) ? "same image" : "IMAGES DIFFER");
+	commandBuffer_free(cb);
+}
+
+int main(int argc, char *argv[]) {
+	int frames = argc > 1 ? atoi(argv[1]) : 50;
+	int n = argc > 2 ? atoi(argv[2]) : 24;
+	int depth = argc > 3 ? atoi(argv[3]) : 6;
+	Module *scene, *crowd, *deep, *flat, *badge, *formation;
+	Formation form;
+	Image *walked, *replayed;
+	Color blue = {{0.3, 0.3, 1}};
+	View3D view;
+	Matrix VTM;
+	DrawState *ds;
+	Point p;
+	int i, j;
+
+	point_set3D(&view.vrp, 160, 140, 120);
+	vector_set(&view.vpn, -20, -20, -20);
+	vector_set(&view.vup, 0, 1, 0);
+	view.d = 1.5;
+	view.du = 1.6;
+	view.dv = 0.9;
+	view.f = 1;
+	view.b = 400;
+	view.screenx = 640;
+	view.screeny = 360;
+	matrix_setView3D(&VTM, &view);
+
+	// the portfolio creature and its formations
+	buildFormation(&form, NULL, 0);
+	formation = form.formation;
+
+	scene = module_create();
+	module_translate(scene, -80, 20, 0);
+	module_module(scene, formation);
+	module_translate(scene, 80, 20, 0);
+	module_module(scene, formation);
+	module_translate(scene, 0, 0, 0);
+	module_module(scene, formation);
+
+	// n x n formations shrunk to fit, so traversal rather than filling dominates
+	crowd = module_create();
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < n; j++) {
+			module_identity(crowd);
+			module_translate(crowd, -40, -30, -30);
+			module_scale(crowd, 1.5 / n, 1.5 / n, 1.5 / n);
+			module_translate(crowd, 120.0 * (i + 0.5) / n - 60, 120.0 * (j + 0.5) / n - 60, 0);
+			module_module(crowd, formation);
+		}
+	}
+
+	point_set3D(&p, 1, 1, 0);
+	deep = tree(depth, &p);
+
+	badge = colorBadge();
+	flat = flatScene(formation, badge);
+
+	walked = image_create(360, 640);
+	replayed = image_create(360, 640);
+	ds = drawstate_create();
+	ds->shade = ShadeDepth;
+	ds->color = blue;
+
+	printf("%d frames of 640x360, clearing not counted\n", frames);
+	bench("portfolio", scene, &VTM, ds, walked, replayed, frames);
+	image_write(replayed, "benchCompile-portfolio.ppm");
+	bench("crowd", crowd, &VTM, ds, walked, replayed, frames);
+	image_write(replayed, "benchCompile-crowd.ppm");
+	ds->shade = ShadeFlat;
+	ds->flatColor = blue;
+	bench("flat", flat, &VTM, ds, walked, replayed, frames);
+	image_write(replayed, "benchCompile-flat.ppm");
+	ds->shade = ShadeFrame;
+	bench("wireframe", crowd, &VTM, ds, walked, replayed, frames);
+	bench("tree", deep, &VTM, ds, walked, replayed, frames);
+
+	treeDelete(deep, depth);
+	module_delete(flat);
+	module_delete(badge);
+	module_delete(crowd);
+	module_delete(scene);
+	deleteFormation(&form);
+	free(ds);
+	image_free(walked);
+	image_free(replayed);
+
+	return(0);
+}
@@ -0,0 +1,106 @@
+/*
+	Jiafeng
+	Summer 2024
+
+	Benchmark of frustum culling: builds a field of n x n of the creature
+	formations of portfolio and looks down on the middle of it through a
+	narrow view, so most formations are off screen. Draws the field for a
+	number of frames with culling off and on, walking the module graph and
+	replaying it from a command buffer. Reports milliseconds per frame, the
+	sub-modules tested and culled per frame and whether the images match.
+
+	usage: benchCull [frames] [field n]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "graphics.h"
+#include "benchUtil.h"
+
+/*
+	Draw the scene, or the command buffer when cb is not NULL, frames times with
+	culling set to cull and report the time and culling counters per frame.
+ */
+static void bench(char *name, Module *scene, CommandBuffer *cb, int cull, Matrix *VTM, DrawState *ds, Image *src, int frames) {
+	DrawStats *stats;
+	Matrix GTM;
+	clock_t start;
+	double t;
+	int i;
+
+	matrix_identity(&GTM);
+	ds->frustumCull = cull;
+	drawstats_reset();
+	start = clock();
+	for (i = 0; i < frames; i++) {
+		image_reset(src);
+		if (cb) commandBuffer_draw(cb, VTM, &GTM, ds, NULL, src);
+		else module_draw(scene, VTM, &GTM, ds, NULL, src);
+	}
+	t = seconds(start);
+	stats = drawstats_get();
+	printf("%-7s cull %-3s %8.3f ms/frame  %6ld tested  %6ld culled (%6ld by sphere)  %8ld vertices per frame\n",
+		   name, cull ? "on" : "off", 1000 * t / frames, stats->frustumTests / frames, stats->frustumModulesCulled / frames,
+		   stats->frustumSphereCulls / frames, stats->vertexTransforms / frames);
+}
+
+int main(int argc, char *argv[]) {
+	int frames = argc > 1 ? atoi(argv[1]) : 20;
+	int n = argc > 2 ? atoi(argv[2]) : 40;
+	Module *field, *formation;
+	Formation form;
+	CommandBuffer *cb;
+	Image *unculled, *culled;
+	Color blue = {{0.3, 0.3, 1}};
+	View3D view;
+	Matrix VTM;
+	DrawState *ds;
+
+	// looking straight down on the middle of the field
+	point_set3D(&view.vrp, 0, 0, 300);
+	vector_set(&view.vpn, 0, 0, -1);
+	vector_set(&view.vup, 0, 1, 0);
+	view.d = 2;
+	view.du = 1.6;
+	view.dv = 0.9;
+	view.f = 1;
+	view.b = 400;
+	view.screenx = 640;
+	view.screeny = 360;
+	matrix_setView3D(&VTM, &view);
+
+	// the portfolio creature and its formation
+	buildFormation(&form, NULL, 0);
+	formation = form.formation;
+
+	// n x n formations 60 units apart, each turned a little
+	field = module_create();
+	buildField(field, formation, NULL, n, 0);
+	cb = commandBuffer_create();
+	module_compile(field, cb);
+
+	unculled = image_create(360, 640);
+	culled = image_create(360, 640);
+	ds = drawstate_create();
+	ds->shade = ShadeDepth;
+	ds->color = blue;
+
+	printf("%d frames of 640x360, %d x %d formations\n", frames, n, n);
+	bench("walk", field, NULL, 0, &VTM, ds, unculled, frames);
+	bench("walk", field, NULL, 1, &VTM, ds, culled, frames);
+	printf("%s\n", sameImage(unculled, culled) ? "same image" : "IMAGES DIFFER");
+	bench("replay", NULL, cb, 0, &VTM, ds, unculled, frames);
+	bench("replay", NULL, cb, 1, &VTM, ds, culled, frames);
+	printf("%s\n", sameImage(unculled, culled) ? "same image" : "IMAGES DIFFER");
+	image_write(culled, "benchCull.ppm");
+
+	commandBuffer_free(cb);
+	module_delete(field);
+	deleteFormation(&form);
+	free(ds);
+	image_free(unculled);
+	image_free(culled);
+
+	return(0);
+}
@@ -0,0 +1,76 @@
+/*
+	Jiafeng
+	Summer 2024
+
+	Report of Element memory: prints the bytes an Element of each type takes,
+	then builds a module of n small textured-looking tiles, each a transform,
+	a color, a surface coefficient and a polygon, and reports the memory its
+	elements hold against what they held when every Element carried the
+	whole Object union.
+
+	usage: benchElement [n]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "graphics.h"
+#include "benchUtil.h"
+
+int main(int argc, char *argv[]) {
+	int n = argc > 1 ? atoi(argv[1]) : 100000;
+	char *name[] = {"none", "line", "point", "polyline", "polygon", "bezier curve", "bezier surface", "identity",
+					"matrix", "color", "body color", "surface color", "surface coeff", "light", "module", "mesh",
+					"shared mesh", "mesh LOD"};
+	ObjectType types[] = {ObjLine, ObjPoint, ObjPolyline, ObjPolygon, ObjBezierCurve, ObjBezierSurface, ObjIdentity,
+						  ObjMatrix, ObjColor, ObjBodyColor, ObjSurfaceColor, ObjSurfaceCoeff, ObjModule, ObjMesh,
+						  ObjSharedMesh, ObjMeshLOD};
+	Module *md;
+	Polygon p;
+	Point pt[4];
+	Color c;
+	Element *e;
+	size_t before, after;
+	clock_t start;
+	long count = 0;
+	int i;
+
+	printf("%-15s %8s %8s\n", "element", "before", "after");
+	for (i = 0; i < (int)(sizeof(types) / sizeof(types[0])); i++) {
+		printf("%-15s %8lu %8lu\n", name[types[i]], (unsigned long)(sizeof(Element) + sizeof(Object)), (unsigned long)element_bytes(types[i]));
+	}
+
+	point_set3D(&pt[0], 0, 0, 0);
+	point_set3D(&pt[1], 1, 0, 0);
+	point_set3D(&pt[2], 1, 1, 0);
+	point_set3D(&pt[3], 0, 1, 0);
+	polygon_init(&p);
+	polygon_set(&p, 4, pt);
+
+	start = clock();
+	md = module_create();
+	for (i = 0; i < n; i++) {
+		color_set(&c, (i % 7) / 7.0, (i % 5) / 5.0, (i % 3) / 3.0);
+		module_identity(md);
+		module_translate(md, i % 100, i / 100, 0);
+		module_color(md, &c);
+		module_surfaceCoeff(md, 10 + i % 20);
+		module_polygon(md, &p);
+	}
+	printf("\nbuilt %d tiles in %.1f ms\n", n, 1000 * seconds(start));
+
+	// the arrays the elements point to are the same either way
+	after = module_memory(md);
+	before = after;
+	for (e = md->head; e; e = e->next) {
+		before += sizeof(Element) + sizeof(Object) - element_bytes(e->type);
+		count++;
+	}
+	printf("%ld elements: before %.1f MB (%.0f bytes/element)  after %.1f MB (%.0f bytes/element)\n", count,
+		   before / 1048576.0, (double)before / count, after / 1048576.0, (double)after / count);
+
+	module_delete(md);
+	polygon_clear(&p);
+
+	return(0);
+}
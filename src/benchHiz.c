@@ -0,0 +1,128 @@
+/*
+	Jiafeng
+	Summer 2024
+
+	Benchmark of depth pyramid culling: looks down on a field of n x n of
+	the creature formations of portfolio through a wall drawn first, which
+	hides most of the field. Draws the scene with Gouraud shading for a
+	number of frames without and with a depth pyramid over the image.
+	Reports milliseconds per frame, the pyramid tests and the polygons and
+	sub-modules culled per frame and whether the images match.
+
+	usage: benchHiz [frames] [field n] [tile]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "graphics.h"
+#include "benchUtil.h"
+
+/*
+	Draw the scene frames times with the depth pyramid hiz, which may be NULL,
+	and report the time and culling counters per frame.
+ */
+static void bench(char *name, Module *scene, DepthPyramid *hiz, Matrix *VTM, DrawState *ds, Lighting *light, Image *src, int frames) {
+	DrawStats *stats;
+	Matrix GTM;
+	clock_t start;
+	double t;
+	int i;
+
+	matrix_identity(&GTM);
+	ds->hiz = hiz;
+	drawstats_reset();
+	start = clock();
+	for (i = 0; i < frames; i++) {
+		image_reset(src);
+		depthPyramid_reset(hiz);
+		module_draw(scene, VTM, &GTM, ds, light, src);
+	}
+	t = seconds(start);
+	stats = drawstats_get();
+	printf("%-8s %8.3f ms/frame  %6ld tests  %6ld polygons culled  %5ld modules culled  %8ld vertices per frame\n",
+		   name, 1000 * t / frames, stats->hizTests / frames, stats->hizPolygonsCulled / frames,
+		   stats->hizModulesCulled / frames, stats->vertexTransforms / frames);
+	ds->hiz = NULL;
+}
+
+int main(int argc, char *argv[]) {
+	int frames = argc > 1 ? atoi(argv[1]) : 20;
+	int n = argc > 2 ? atoi(argv[2]) : 4;
+	int tile = argc > 3 ? atoi(argv[3]) : 8;
+	Module *scene, *wall, *field, *formation;
+	Formation form;
+	Color blue = {{0.3, 0.3, 1}}, red = {{0.8, 0.2, 0.2}}, grey = {{0.6, 0.6, 0.6}};
+	Color ambient = {{0.2, 0.2, 0.2}}, sun = {{0.8, 0.75, 0.7}};
+	DepthPyramid *hiz;
+	Lighting *light;
+	Image *plain, *culled;
+	View3D view;
+	Matrix VTM;
+	DrawState *ds;
+	Point pos;
+
+	// looking straight down on the middle of the field
+	point_set3D(&view.vrp, 0, 0, 300);
+	vector_set(&view.vpn, 0, 0, -1);
+	vector_set(&view.vup, 0, 1, 0);
+	view.d = 2;
+	view.du = 1.6;
+	view.dv = 0.9;
+	view.f = 1;
+	view.b = 400;
+	view.screenx = 640;
+	view.screeny = 360;
+	matrix_setView3D(&VTM, &view);
+
+	// the portfolio creature and its formation
+	buildFormation(&form, &red, 1);
+	formation = form.formation;
+
+	// n x n formations 60 units apart, each turned a little
+	field = module_create();
+	buildField(field, formation, NULL, n, 0);
+
+	// a wall 100 units above the field covering most of the view, drawn first
+	wall = module_create();
+	module_bodyColor(wall, &grey);
+	module_scale(wall, 70, 36, 2);
+	module_translate(wall, 0, -4, 200);
+	module_cube(wall, 1);
+
+	scene = module_create();
+	module_module(scene, wall);
+	module_module(scene, field);
+
+	light = lighting_create();
+	point_set3D(&pos, 100, 200, 400);
+	lighting_add(light, LightPoint, &sun, NULL, &pos, 0, 0);
+	lighting_add(light, LightAmbient, &ambient, NULL, NULL, 0, 0);
+
+	plain = image_create(view.screeny, view.screenx);
+	culled = image_create(view.screeny, view.screenx);
+	hiz = depthPyramid_create(culled, tile);
+	ds = drawstate_create();
+	point_copy(&ds->viewer, &view.vrp);
+	ds->shade = ShadeGouraud;
+	ds->body = blue;
+
+	printf("%d frames of 640x360, %d x %d formations behind a wall, %dx%d pixel tiles\n", frames, n, n, tile, tile);
+	bench("no hiz", scene, NULL, &VTM, ds, light, plain, frames);
+	bench("hiz", scene, hiz, &VTM, ds, light, culled, frames);
+	printf("%s\n", sameImage(plain, culled) ? "same image" : "IMAGES DIFFER");
+	image_write(culled, "benchHiz.ppm");
+
+	module_delete(scene);
+	module_delete(wall);
+	module_delete(field);
+	deleteFormation(&form);
+	module_freePrimitives();
+	depthPyramid_free(hiz);
+	lighting_delete(light);
+	free(ds);
+	image_free(plain);
+	image_free(culled);
+
+	return(0);
+}
@@ -0,0 +1,177 @@
+/*
+	Jiafeng
+	Summer 2024
+
+	Benchmark of instanced drawing: places n x n copies of a lit model, a
+	cube with a cylinder on top, on a turning grid, each with its own body
+	color, once as a module holding a transform, a body color and a
+	module_module per copy and once as a single instancing element. Draws
+	both for a number of frames with culling off and on, walking the module
+	graph and replaying it from a command buffer. Reports milliseconds per
+	frame, the instances drawn and culled per frame and whether the images
+	match. Then places a model holding a single point the same ways and
+	draws it depth only, which draws nothing, to show what placing and
+	walking the instances costs on its own.
+
+	usage: benchInstance [frames] [n]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "graphics.h"
+#include "benchUtil.h"
+
+/*
+	Build n x n copies of model on a turning grid, each with its own body color,
+	as a module with a module_module per copy into *copies and as one instancing
+	element into *instanced.
+ */
+static void build(Module *model, int n, Module **copies, Module **instanced) {
+	Matrix *place = malloc(sizeof(Matrix) * n * n);
+	Color *tint = malloc(sizeof(Color) * n * n);
+	int i, j, k;
+
+	*copies = module_create();
+	for (i = 0, k = 0; i < n; i++) {
+		for (j = 0; j < n; j++, k++) {
+			double a = 0.4 * i + 0.7 * j;
+
+			matrix_identity(&place[k]);
+			matrix_rotateZ(&place[k], cos(a), sin(a));
+			matrix_translate(&place[k], 2.0 * (i - (n - 1) / 2.0), 2.0 * (j - (n - 1) / 2.0), 0);
+			color_set(&tint[k], (float)i / n, (float)j / n, 0.5);
+
+			module_identity(*copies);
+			module_rotateZ(*copies, cos(a), sin(a));
+			module_translate(*copies, 2.0 * (i - (n - 1) / 2.0), 2.0 * (j - (n - 1) / 2.0), 0);
+			module_bodyColor(*copies, &tint[k]);
+			module_module(*copies, model);
+		}
+	}
+	*instanced = module_create();
+	module_instances(*instanced, model, place, tint, n * n);
+	free(place);
+	free(tint);
+}
+
+/*
+	Draw the scene, or the command buffer when cb is not NULL, frames times with
+	culling set to cull and report the time and instance counters per frame.
+ */
+static void bench(char *name, Module *scene, CommandBuffer *cb, int cull, Matrix *VTM, DrawState *ds,
+				  Lighting *light, Image *src, int frames) {
+	DrawStats *stats;
+	Matrix GTM;
+	clock_t start;
+	double t;
+	int i;
+
+	matrix_identity(&GTM);
+	ds->frustumCull = cull;
+	drawstats_reset();
+	start = clock();
+	for (i = 0; i < frames; i++) {
+		image_reset(src);
+		if (cb) commandBuffer_draw(cb, VTM, &GTM, ds, light, src);
+		else module_draw(scene, VTM, &GTM, ds, light, src);
+	}
+	t = seconds(start);
+	stats = drawstats_get();
+	printf("%-16s cull %-3s %8.3f ms/frame  %6ld instances drawn  %6ld culled  %6ld modules culled per frame\n",
+		   name, cull ? "on" : "off", 1000 * t / frames, stats->instancesDrawn / frames,
+		   stats->instancesCulled / frames, stats->frustumModulesCulled / frames);
+}
+
+int main(int argc, char *argv[]) {
+	int frames = argc > 1 ? atoi(argv[1]) : 10;
+	int n = argc > 2 ? atoi(argv[2]) : 100;
+	Module *model, *copies, *instanced, *marker, *markerCopies, *markerInstanced;
+	CommandBuffer *cb;
+	Color blue = {{0.3, 0.3, 1}}, grey = {{0.2, 0.2, 0.2}};
+	Color ambient = {{0.2, 0.2, 0.2}}, sun = {{0.8, 0.75, 0.7}};
+	Lighting *light;
+	View3D view;
+	Matrix VTM;
+	DrawState *ds;
+	Image *a, *b;
+	Point pos;
+	int k;
+
+	// looking across the grid at an angle, the far rows off the top of the image
+	point_set3D(&view.vrp, 0, -3.0 * n, 1.2 * n);
+	vector_set(&view.vpn, 0, 1, -0.6);
+	vector_set(&view.vup, 0, 0, 1);
+	view.d = 2;
+	view.du = 1.6;
+	view.dv = 0.9;
+	view.f = 1;
+	view.b = 10 * n;
+	view.screenx = 640;
+	view.screeny = 360;
+	matrix_setView3D(&VTM, &view);
+
+	model = module_create();
+	module_cube(model, 1);
+	module_scale(model, 0.3, 1, 0.3);
+	module_rotateX(model, 0, 1);
+	module_translate(model, 0, 0, 0.5);
+	module_cylinder(model, 8);
+
+	// the same placements and colors both ways
+	build(model, n, &copies, &instanced);
+
+	// a point, so only placing, culling and walking the instances is left
+	marker = module_create();
+	point_set3D(&pos, 0, 0, 0.5);
+	module_point(marker, &pos);
+	build(marker, n, &markerCopies, &markerInstanced);
+
+	light = lighting_create();
+	point_set3D(&pos, -n, -2.0 * n, 2.0 * n);
+	lighting_add(light, LightPoint, &sun, NULL, &pos, 0, 0);
+	lighting_add(light, LightAmbient, &ambient, NULL, NULL, 0, 0);
+
+	a = image_create(360, 640);
+	b = image_create(360, 640);
+	ds = drawstate_create();
+	point_copy(&ds->viewer, &view.vrp);
+	ds->shade = ShadeGouraud;
+	ds->color = blue;
+	ds->surface = grey;
+	ds->surfaceCoeff = 10;
+
+	printf("%d frames of 640x360, %d x %d instances\n", frames, n, n);
+	for (k = 0; k < 2; k++) {
+		bench("copies", copies, NULL, k, &VTM, ds, light, a, frames);
+		bench("instances", instanced, NULL, k, &VTM, ds, light, b, frames);
+		printf("%s\n", sameImage(a, b) ? "same image" : "IMAGES DIFFER");
+	}
+	cb = commandBuffer_create();
+	module_compile(instanced, cb);
+	bench("instances replay", NULL, cb, 1, &VTM, ds, light, a, frames);
+	printf("%s\n", sameImage(a, b) ? "same image" : "IMAGES DIFFER");
+	image_write(b, "benchInstance.ppm");
+
+	ds->shade = ShadeDepthOnly;
+	for (k = 0; k < 2; k++) {
+		bench("points copies", markerCopies, NULL, k, &VTM, ds, light, a, frames);
+		bench("points instances", markerInstanced, NULL, k, &VTM, ds, light, b, frames);
+	}
+
+	commandBuffer_free(cb);
+	module_delete(instanced);
+	module_delete(copies);
+	module_delete(model);
+	module_delete(markerInstanced);
+	module_delete(markerCopies);
+	module_delete(marker);
+	module_freePrimitives();
+	lighting_delete(light);
+	free(ds);
+	image_free(a);
+	image_free(b);
+
+	return(0);
+}
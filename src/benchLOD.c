@@ -0,0 +1,148 @@
+/*
+	Jiafeng
+	Summer 2024
+
+	Benchmark of level of detail selection: simplifies a PLY model into a
+	chain of levels with the quadric error simplifier, then draws fleets of
+	n x n copies of it scaled to fill the same part of the screen, first
+	always at full detail and then at the level each copy's screen size
+	calls for. Reports milliseconds per frame, the faces drawn per frame and
+	how many copies were drawn at each level. Each level is also written out
+	on its own, full screen, to check the simplification.
+
+	usage: benchLOD <file.ply> [frames] [largest n]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "graphics.h"
+#include "benchUtil.h"
+
+/*
+	Draw an n x n fleet of lod frames times and report the time and faces per frame.
+ */
+static void bench(char *name, MeshLOD *lod, int n, Matrix *VTM, DrawState *ds, Lighting *light, Image *src, int frames) {
+	Module *scene = module_create();
+	Matrix GTM;
+	DrawStats *stats;
+	clock_t start;
+	double t;
+	int i, j;
+
+	// copies 6 units apart, the whole fleet scaled down to the size of one
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < n; j++) {
+			module_identity(scene);
+			module_translate(scene, 6.0 * (i - (n - 1) / 2.0), 6.0 * (j - (n - 1) / 2.0), 0);
+			module_scale(scene, 1.0 / n, 1.0 / n, 1.0 / n);
+			module_meshLOD(scene, lod);
+		}
+	}
+
+	matrix_identity(&GTM);
+	drawstats_reset();
+	start = clock();
+	for (i = 0; i < frames; i++) {
+		image_reset(src);
+		module_draw(scene, VTM, &GTM, ds, light, src);
+	}
+	t = seconds(start);
+	stats = drawstats_get();
+	printf("%-5s %3dx%-3d %8.2f ms/frame  %7ld faces/frame  levels", name, n, n, 1000 * t / frames, stats->meshFaces / frames);
+	for (i = 0; i < lod->nLevel; i++) printf(" %5ld", stats->lodSelected[i] / frames);
+	printf("\n");
+	module_delete(scene);
+}
+
+int main(int argc, char *argv[]) {
+	int frames = argc > 2 ? atoi(argv[2]) : 10;
+	int largest = argc > 3 ? atoi(argv[3]) : 16;
+	int size = 500;
+	Image *src;
+	Matrix VTM, GTM;
+	View3D view;
+	Mesh model;
+	MeshLOD *lod, *full;
+	Module *one;
+	Lighting *light;
+	DrawState *ds;
+	Color AmbientColor, PointColor, SurfaceColor;
+	Point pos;
+	clock_t start;
+	int i, n;
+
+	if (argc < 2) {
+		printf("usage: %s <file.ply> [frames] [largest n]\n", argv[0]);
+		return(-1);
+	}
+
+	mesh_init(&model);
+	if (readPLYMesh(argv[1], &model, 0)) {
+		printf("unable to read %s\n", argv[1]);
+		return(-1);
+	}
+	start = clock();
+	lod = meshLOD_create(&model, LOD_MAX_LEVELS);
+	printf("simplified into %d levels in %.1f ms, faces:", lod->nLevel, 1000 * seconds(start));
+	for (i = 0; i < lod->nLevel; i++) printf(" %d", lod->level[i].nFace);
+	printf("\n");
+	full = meshLOD_create(&model, 1);
+
+	color_set(&AmbientColor, 0.1, 0.1, 0.1);
+	color_set(&PointColor, 0.7, 0.6, 0.45);
+	color_set(&SurfaceColor, 0.2, 0.2, 0.2);
+
+	point_set3D(&view.vrp, 0.0, 0.0, -15.0);
+	vector_set(&view.vpn, 0.0, 0.0, 1.0);
+	vector_set(&view.vup, 0.0, 1.0, 0.0);
+	view.d = 2.0;
+	view.du = 1.4;
+	view.dv = 1.4;
+	view.f = 0.0;
+	view.b = 100;
+	view.screenx = size;
+	view.screeny = size;
+	matrix_setView3D(&VTM, &view);
+
+	light = lighting_create();
+	point_set3D(&pos, 0.0, 0.0, -50.0);
+	lighting_add(light, LightPoint, &PointColor, NULL, &pos, 0.0, 0.0);
+	lighting_add(light, LightAmbient, &AmbientColor, NULL, NULL, 0.0, 0.0);
+
+	ds = drawstate_create();
+	point_copy(&ds->viewer, &view.vrp);
+	ds->shade = ShadeGouraud;
+	ds->surface = SurfaceColor;
+	src = image_create(size, size);
+
+	// every level on its own, rotated to show its shape
+	matrix_identity(&GTM);
+	matrix_rotateY(&GTM, cos(0.6), sin(0.6));
+	matrix_rotateX(&GTM, cos(0.4), sin(0.4));
+	one = module_create();
+	for (i = 0; i < lod->nLevel; i++) {
+		char name[64];
+		module_clear(one);
+		module_mesh(one, &lod->level[i]);
+		image_reset(src);
+		module_draw(one, &VTM, &GTM, ds, light, src);
+		sprintf(name, "benchLOD-level%d.ppm", i);
+		image_write(src, name);
+	}
+	module_delete(one);
+
+	for (n = 1; n <= largest; n *= 2) {
+		bench("full", full, n, &VTM, ds, light, src, frames);
+		bench("lod", lod, n, &VTM, ds, light, src, frames);
+	}
+
+	meshLOD_release(lod);
+	meshLOD_release(full);
+	mesh_clear(&model);
+	lighting_delete(light);
+	free(ds);
+	image_free(src);
+
+	return(0);
+}
@@ -0,0 +1,163 @@
+/*
+	Jiafeng
+	Summer 2024
+
+	Benchmark of the indexed mesh against the per-polygon path: loads a PLY
+	model both with readPLY (one Polygon per face, vertices copied) and with
+	readPLYMesh (shared vertices), then draws the test9c starfury scene with
+	Gouraud shading for a number of frames with each. Reports milliseconds per
+	frame and the vertices each path transforms and lights. The mesh is then
+	drawn through a small post-transform cache, before and after reordering
+	its faces with mesh_optimize, to show the cache hit rate of each order,
+	and each cached image is checked against the one drawn with a cache
+	entry for every vertex.
+
+	usage: benchMesh <file.ply> [frames] [size]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "graphics.h"
+#include "benchUtil.h"
+
+/*
+	Draw the scene frames times into src and report the time per frame, and
+	whether src matches ref if ref is not NULL.
+ */
+static void bench(char *name, Module *scene, Matrix *VTM, DrawState *ds, Lighting *light, Image *src, Image *ref, int frames) {
+	Matrix GTM;
+	DrawStats *stats;
+	clock_t start;
+	double t;
+	int i;
+
+	matrix_identity(&GTM);
+	drawstats_reset();
+	start = clock();
+	for (i = 0; i < frames; i++) {
+		image_reset(src);
+		module_draw(scene, VTM, &GTM, ds, light, src);
+	}
+	t = seconds(start);
+	stats = drawstats_get();
+	printf("%-10s %8.2f ms/frame  %8ld vertex transforms/frame  %8ld mesh faces/frame  %5.1f%% cache hits", name,
+		   1000 * t / frames, stats->vertexTransforms / frames, stats->meshFaces / frames, 100 * stats->meshCacheHitRate);
+	if (ref) printf("  image %s", sameImage(ref, src) ? "same" : "differs");
+	printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+	int frames = argc > 2 ? atoi(argv[2]) : 20;
+	int size = argc > 3 ? atoi(argv[3]) : 500;
+	Image *src, *ref;
+	Matrix VTM;
+	View3D view;
+	Module *polygons, *mesh, *scene;
+	Polygon *plist;
+	Color *clist;
+	Mesh starfury;
+	Lighting *light;
+	DrawState *ds;
+	Color AmbientColor, PointColor, PointColor2, SurfaceColor;
+	Point pos;
+	int nPolygons, i;
+
+	if (argc < 2) {
+		printf("usage: %s <file.ply> [frames] [size]\n", argv[0]);
+		return(-1);
+	}
+
+	color_set(&AmbientColor, 0.1, 0.1, 0.1);
+	color_set(&PointColor, 0.7, 0.6, 0.45);
+	color_set(&PointColor2, 0.2, 0.3, 0.45);
+	color_set(&SurfaceColor, 0.2, 0.2, 0.2);
+
+	point_set3D(&view.vrp, 0.0, 0.0, -15.0);
+	vector_set(&view.vpn, 0.0, 0.0, 1.0);
+	vector_set(&view.vup, 0.0, 1.0, 0.0);
+	view.d = 2.0;
+	view.du = 1.4;
+	view.dv = 1.4;
+	view.f = 0.0;
+	view.b = 100;
+	view.screenx = size;
+	view.screeny = size;
+	matrix_setView3D(&VTM, &view);
+
+	// both versions use the normals stored in the file
+	mesh_init(&starfury);
+	if (readPLY(argv[1], &nPolygons, &plist, &clist, 0) || readPLYMesh(argv[1], &starfury, 0)) {
+		printf("unable to read %s\n", argv[1]);
+		return(-1);
+	}
+
+	polygons = module_create();
+	module_surfaceColor(polygons, &SurfaceColor);
+	for (i = 0; i < nPolygons; i++) {
+		module_bodyColor(polygons, &clist[i]);
+		module_polygon(polygons, &plist[i]);
+		polygon_clear(&plist[i]);
+	}
+	free(plist);
+	free(clist);
+
+	mesh = module_create();
+	module_surfaceColor(mesh, &SurfaceColor);
+	module_mesh(mesh, &starfury);
+
+	light = lighting_create();
+	point_set3D(&pos, 0.0, 0.0, -50.0);
+	lighting_add(light, LightPoint, &PointColor, NULL, &pos, 0.0, 0.0);
+	point_set3D(&pos, 50.0, -20.0, -50.0);
+	lighting_add(light, LightPoint, &PointColor2, NULL, &pos, 0.0, 0.0);
+	lighting_add(light, LightAmbient, &AmbientColor, NULL, NULL, 0.0, 0.0);
+
+	ds = drawstate_create();
+	point_copy(&ds->viewer, &view.vrp);
+	ds->shade = ShadeGouraud;
+
+	src = image_create(size, size);
+	ref = image_create(size, size);
+	printf("%d faces, %d shared vertices, %d frames of %dx%d\n", starfury.nFace, starfury.nVertex, frames, size, size);
+
+	// the test9c scene, two copies of the model
+	scene = module_create();
+	module_translate(scene, -1.0, -2.0, 0.0);
+	module_module(scene, polygons);
+	module_translate(scene, 3, 3, 3);
+	module_module(scene, polygons);
+	bench("polygon", scene, &VTM, ds, light, src, NULL, frames);
+	image_write(src, "benchMesh-polygon.ppm");
+
+	module_clear(scene);
+	module_translate(scene, -1.0, -2.0, 0.0);
+	module_module(scene, mesh);
+	module_translate(scene, 3, 3, 3);
+	module_module(scene, mesh);
+	bench("mesh", scene, &VTM, ds, light, ref, NULL, frames);
+	image_write(ref, "benchMesh-mesh.ppm");
+
+	// a GPU-sized cache, with the file's face order and then an optimized one
+	ds->vertexCacheSize = 32;
+	bench("mesh/32", scene, &VTM, ds, light, src, ref, frames);
+	mesh_optimize(&starfury, 32);
+	module_clear(mesh);
+	module_surfaceColor(mesh, &SurfaceColor);
+	module_mesh(mesh, &starfury);
+	ds->vertexCacheSize = 0;
+	bench("opt", scene, &VTM, ds, light, ref, NULL, frames);
+	ds->vertexCacheSize = 32;
+	bench("opt/32", scene, &VTM, ds, light, src, ref, frames);
+
+	module_delete(scene);
+	module_delete(polygons);
+	module_delete(mesh);
+	mesh_clear(&starfury);
+	lighting_delete(light);
+	free(ds);
+	image_free(src);
+	image_free(ref);
+
+	return(0);
+}
@@ -0,0 +1,154 @@
+/*
+	Jiafeng
+	Summer 2024
+
+	Benchmark of the parallel traversal: draws a lit field of n x n of the
+	creature formations of portfolio, optionally with a PLY model in the
+	middle, with module_draw, by recording a draw list and drawing it, and
+	with draw pools of 1 up to the given number of threads. A pool starts
+	its threads when it is created, before its frames are timed, and they
+	wait between frames. Reports wall clock milliseconds per frame, the
+	vertex transforms each way and whether every image matches the one
+	module_draw makes.
+
+	usage: benchParallel [n] [threads] [frames] [file.ply]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include "graphics.h"
+#include "benchUtil.h"
+
+/*
+	Wall clock seconds since start, since the threads of a draw share the CPU time.
+ */
+static double elapsed(struct timeval *start) {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+int main(int argc, char *argv[]) {
+	int n = argc > 1 ? atoi(argv[1]) : 12;
+	int threads = argc > 2 ? atoi(argv[2]) : 4;
+	int frames = argc > 3 ? atoi(argv[3]) : 10;
+	Module *field, *formation, *model = NULL;
+	Formation form;
+	Color blue = {{0.3, 0.3, 1}}, red = {{0.8, 0.2, 0.2}}, ambient = {{0.2, 0.2, 0.2}}, sun = {{0.8, 0.75, 0.7}};
+	Lighting *light;
+	DrawList *list;
+	DrawPool *pool;
+	View3D view;
+	Matrix VTM, GTM;
+	DrawState *ds;
+	Image *ref, *src;
+	Point pos;
+	Mesh mesh;
+	struct timeval start;
+	double t;
+	long vertices;
+	int i, k, differ;
+
+	// looking down on the field at an angle, all of it in front of the viewer
+	point_set3D(&view.vrp, 0, -40.0 * n, 40.0 * n);
+	vector_set(&view.vpn, 0, 1, -1);
+	vector_set(&view.vup, 0, 0, 1);
+	view.d = 2;
+	view.du = 1.6;
+	view.dv = 0.9;
+	view.f = 1;
+	view.b = 100.0 * n;
+	view.screenx = 640;
+	view.screeny = 360;
+	matrix_setView3D(&VTM, &view);
+	matrix_identity(&GTM);
+
+	buildFormation(&form, &red, 1);
+	formation = form.formation;
+
+	if (argc > 4) {
+		mesh_init(&mesh);
+		if (readPLYMesh(argv[4], &mesh, 1)) {
+			printf("unable to read %s\n", argv[4]);
+			return(-1);
+		}
+		model = module_create();
+		module_mesh(model, &mesh);
+		mesh_clear(&mesh);
+	}
+
+	field = module_create();
+	buildField(field, formation, model, n, 0);
+
+	light = lighting_create();
+	point_set3D(&pos, -20.0 * n, -30.0 * n, 50.0 * n);
+	lighting_add(light, LightPoint, &sun, NULL, &pos, 0, 0);
+	lighting_add(light, LightAmbient, &ambient, NULL, NULL, 0, 0);
+
+	ds = drawstate_create();
+	point_copy(&ds->viewer, &view.vrp);
+	ds->shade = ShadeGouraud;
+	ds->color = blue;
+	ref = image_create(view.screeny, view.screenx);
+	src = image_create(view.screeny, view.screenx);
+
+	printf("%d frames of 640x360, %d x %d formations\n", frames, n, n);
+	drawstats_reset();
+	gettimeofday(&start, NULL);
+	for (k = 0; k < frames; k++) {
+		image_reset(ref);
+		module_draw(field, &VTM, &GTM, ds, light, ref);
+	}
+	t = elapsed(&start);
+	printf("module_draw       %8.3f ms/frame  %8ld vertex transforms per frame\n",
+		   1000 * t / frames, drawstats_get()->vertexTransforms / frames);
+
+	// recorded into one list on this thread, then drawn
+	list = drawList_create();
+	drawstats_reset();
+	differ = 0;
+	gettimeofday(&start, NULL);
+	for (k = 0; k < frames; k++) {
+		image_reset(src);
+		drawList_clear(list);
+		ds->drawList = list;
+		module_draw(field, &VTM, &GTM, ds, light, src);
+		ds->drawList = NULL;
+		drawList_draw(list, ds, src);
+		differ += !sameImage(ref, src);
+	}
+	t = elapsed(&start);
+	printf("draw list         %8.3f ms/frame  %8ld vertex transforms per frame  %d items  %d of %d frames differ\n",
+		   1000 * t / frames, drawstats_get()->vertexTransforms / frames, list->nItem, differ, frames);
+	drawList_free(list);
+
+	for (i = 1; i <= threads; i++) {
+		pool = drawPool_create(i, 0);
+		drawstats_reset();
+		differ = 0;
+		gettimeofday(&start, NULL);
+		for (k = 0; k < frames; k++) {
+			image_reset(src);
+			drawPool_draw(pool, field, &VTM, &GTM, ds, light, src);
+			differ += !sameImage(ref, src);
+		}
+		t = elapsed(&start);
+		vertices = drawstats_get()->vertexTransforms;
+		printf("pool of %2d        %8.3f ms/frame  %8ld vertex transforms per frame  %d of %d frames differ\n",
+			   i, 1000 * t / frames, vertices / frames, differ, frames);
+		drawPool_free(pool);
+	}
+	image_write(src, "benchParallel.ppm");
+
+	module_delete(field);
+	deleteFormation(&form);
+	if (model) module_delete(model);
+	module_freePrimitives();
+	lighting_delete(light);
+	free(ds);
+	image_free(ref);
+	image_free(src);
+
+	return(0);
+}
@@ -0,0 +1,145 @@
+/*
+	Jiafeng
+	Summer 2024
+
+	Benchmark of occlusion queries: draws a wall into the depth plane and
+	queries the bounding boxes of n x n of the creature formations of
+	portfolio behind it with module_queryBatch, without and with a depth
+	pyramid, and against an empty depth plane. Reports milliseconds per
+	batch, how many formations each batch finds visible and whether the
+	sample counts agree. Every formation reported hidden is then drawn to
+	check that it does not change the image.
+
+	usage: benchQuery [batches] [field n]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "graphics.h"
+#include "benchUtil.h"
+
+/*
+	Run the batch of queries batches times and report the time per batch and the
+	number of modules found visible.
+ */
+static void bench(char *name, Module **md, Matrix *GTM, int n, Matrix *VTM, Image *src, DepthPyramid *hiz, long *samples, int batches) {
+	clock_t start;
+	double t;
+	long total = 0;
+	int i, visible = 0;
+
+	start = clock();
+	for (i = 0; i < batches; i++) {
+		visible = module_queryBatch(md, GTM, n, VTM, src, hiz, samples);
+	}
+	t = seconds(start);
+	for (i = 0; i < n; i++) total += samples[i];
+	printf("%-12s %8.3f ms/batch  %4d of %d visible  %8ld samples\n", name, 1000 * t / batches, visible, n, total);
+}
+
+int main(int argc, char *argv[]) {
+	int batches = argc > 1 ? atoi(argv[1]) : 100;
+	int n = argc > 2 ? atoi(argv[2]) : 4;
+	Module *wall, *formation, **md;
+	Formation form;
+	Color blue = {{0.3, 0.3, 1}};
+	DepthPyramid *hiz;
+	Image *empty, *occluded, *check;
+	long *plain, *pyramid, *open;
+	Matrix VTM, GTM, *place;
+	View3D view;
+	DrawState *ds;
+	int i, j, k, differ = 0, leaks = 0;
+
+	// looking straight down on the middle of the field
+	point_set3D(&view.vrp, 0, 0, 300);
+	vector_set(&view.vpn, 0, 0, -1);
+	vector_set(&view.vup, 0, 1, 0);
+	view.d = 2;
+	view.du = 1.6;
+	view.dv = 0.9;
+	view.f = 1;
+	view.b = 400;
+	view.screenx = 640;
+	view.screeny = 360;
+	matrix_setView3D(&VTM, &view);
+	matrix_identity(&GTM);
+
+	// the portfolio creature and its formation
+	buildFormation(&form, NULL, 1);
+	formation = form.formation;
+
+	// n x n placements of the formation 60 units apart, each turned a little
+	md = malloc(sizeof(Module *) * n * n);
+	place = malloc(sizeof(Matrix) * n * n);
+	plain = malloc(sizeof(long) * n * n);
+	pyramid = malloc(sizeof(long) * n * n);
+	open = malloc(sizeof(long) * n * n);
+	for (i = 0, k = 0; i < n; i++) {
+		for (j = 0; j < n; j++, k++) {
+			double a = 0.3 * (i + 2 * j);
+			md[k] = formation;
+			matrix_identity(&place[k]);
+			matrix_translate(&place[k], -40, -30, -30);
+			matrix_rotateZ(&place[k], cos(a), sin(a));
+			matrix_translate(&place[k], 60.0 * (i - (n - 1) / 2.0), 60.0 * (j - (n - 1) / 2.0), 0);
+		}
+	}
+
+	// a wall 100 units above the field covering most of the view
+	wall = module_create();
+	module_scale(wall, 70, 36, 2);
+	module_translate(wall, 0, -4, 200);
+	module_cube(wall, 1);
+
+	ds = drawstate_create();
+	ds->shade = ShadeDepthOnly;
+	ds->color = blue;
+	empty = image_create(view.screeny, view.screenx);
+	occluded = image_create(view.screeny, view.screenx);
+	check = image_create(view.screeny, view.screenx);
+	image_reset(empty);
+	image_reset(occluded);
+	module_draw(wall, &VTM, &GTM, ds, NULL, occluded);
+	hiz = depthPyramid_create(occluded, 8);
+
+	printf("%d batches of %d queries against 640x360\n", batches, n * n);
+	bench("no occluder", md, place, n * n, &VTM, empty, NULL, open, batches);
+	bench("wall", md, place, n * n, &VTM, occluded, NULL, plain, batches);
+	bench("wall + hiz", md, place, n * n, &VTM, occluded, hiz, pyramid, batches);
+	for (k = 0; k < n * n; k++) {
+		if (plain[k] != pyramid[k]) differ++;
+	}
+	printf("%d of %d sample counts differ with the depth pyramid\n", differ, n * n);
+
+	// a formation whose box has no visible sample must not change the image
+	ds->shade = ShadeDepth;
+	image_reset(empty);
+	module_draw(wall, &VTM, &GTM, ds, NULL, empty);
+	for (k = 0; k < n * n; k++) {
+		if (plain[k] > 0) continue;
+		image_reset(check);
+		module_draw(wall, &VTM, &GTM, ds, NULL, check);
+		module_draw(md[k], &VTM, &place[k], ds, NULL, check);
+		if (!sameImage(empty, check)) leaks++;
+	}
+	printf("%d hidden formations change the image\n", leaks);
+
+	module_delete(wall);
+	deleteFormation(&form);
+	module_freePrimitives();
+	depthPyramid_free(hiz);
+	free(md);
+	free(place);
+	free(plain);
+	free(pyramid);
+	free(open);
+	free(ds);
+	image_free(empty);
+	image_free(occluded);
+	image_free(check);
+
+	return(0);
+}
@@ -0,0 +1,159 @@
+/*
+	Jiafeng
+	Summer 2024
+
+	Benchmark of drawing through scratch memory: builds an n x n field of
+	lit cubes, of lit 20 sided polygons and of polylines, then draws each
+	scene for a number of frames. Reports milliseconds per frame and the
+	heap allocations module_draw made in the first frame and in all of the
+	frames after it, which should be none once the scratch arena has grown.
+
+	usage: benchScratch [frames] [n]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "graphics.h"
+#include "benchUtil.h"
+
+#define SIDES 20
+
+/*
+	Draw scene frames times and report the time per frame and the heap allocations.
+ */
+static void bench(char *name, Module *scene, Matrix *VTM, DrawState *ds, Lighting *light, Image *src, int frames) {
+	Matrix GTM;
+	clock_t start;
+	long first;
+	double t;
+	int i;
+
+	matrix_identity(&GTM);
+	drawstats_reset();
+	image_reset(src);
+	module_draw(scene, VTM, &GTM, ds, light, src);
+	first = drawstats_get()->heapAllocations;
+
+	drawstats_reset();
+	start = clock();
+	for (i = 0; i < frames; i++) {
+		image_reset(src);
+		module_draw(scene, VTM, &GTM, ds, light, src);
+	}
+	t = seconds(start);
+	printf("%-10s %8.3f ms/frame  heap allocations: first frame %5ld  next %d frames %5ld\n",
+		   name, 1000 * t / frames, first, frames, drawstats_get()->heapAllocations);
+}
+
+int main(int argc, char *argv[]) {
+	int frames = argc > 1 ? atoi(argv[1]) : 50;
+	int n = argc > 2 ? atoi(argv[2]) : 20;
+	Module *cubes, *polygons, *lines, *disc, *zigzag;
+	Point ring[SIDES], path[SIDES];
+	Polygon p;
+	Polyline l;
+	Color blue = {{0.3, 0.3, 1}}, white = {{1, 1, 1}}, grey = {{0.2, 0.2, 0.2}};
+	Color ambient = {{0.2, 0.2, 0.2}}, sun = {{0.8, 0.75, 0.7}};
+	Lighting *light;
+	View3D view;
+	Matrix VTM;
+	DrawState *ds;
+	Image *src;
+	Point pos;
+	int i, j;
+
+	point_set3D(&view.vrp, 0, 0, -40);
+	vector_set(&view.vpn, 0, 0, 1);
+	vector_set(&view.vup, 0, 1, 0);
+	view.d = 2.0;
+	view.du = 1.6;
+	view.dv = 0.9;
+	view.f = 1;
+	view.b = 100;
+	view.screenx = 640;
+	view.screeny = 360;
+	matrix_setView3D(&VTM, &view);
+
+	// a disc and a zigzag with one vertex per side
+	for (i = 0; i < SIDES; i++) {
+		double a = 2 * M_PI * i / SIDES;
+		point_set3D(&ring[i], cos(a), sin(a), 0);
+		point_set3D(&path[i], 2.0 * i / SIDES - 1, i % 2 ? 0.5 : -0.5, 0);
+	}
+	polygon_init(&p);
+	polygon_set(&p, SIDES, ring);
+	disc = module_create();
+	module_polygon(disc, &p);
+	polygon_clear(&p);
+	polyline_init(&l);
+	polyline_set(&l, SIDES, path);
+	zigzag = module_create();
+	module_polyline(zigzag, &l);
+	polyline_clear(&l);
+
+	// n x n copies of each, tilted so the lighting varies across them
+	cubes = module_create();
+	polygons = module_create();
+	lines = module_create();
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < n; j++) {
+			double x = 30.0 * (i + 0.5) / n - 15, y = 16.0 * (j + 0.5) / n - 8;
+			double s = 0.6 * 16.0 / n;
+
+			module_identity(cubes);
+			module_rotateY(cubes, cos(0.5), sin(0.5));
+			module_rotateX(cubes, cos(0.4), sin(0.4));
+			module_scale(cubes, s, s, s);
+			module_translate(cubes, x, y, 0);
+			module_cube(cubes, 1);
+
+			module_identity(polygons);
+			module_rotateY(polygons, cos(0.3 * i), sin(0.3 * i));
+			module_scale(polygons, s, s, s);
+			module_translate(polygons, x, y, 0);
+			module_module(polygons, disc);
+
+			module_identity(lines);
+			module_scale(lines, s, s, s);
+			module_translate(lines, x, y, 0);
+			module_module(lines, zigzag);
+		}
+	}
+
+	light = lighting_create();
+	point_set3D(&pos, -20, 20, -40);
+	lighting_add(light, LightPoint, &sun, NULL, &pos, 0, 0);
+	lighting_add(light, LightAmbient, &ambient, NULL, NULL, 0, 0);
+
+	src = image_create(360, 640);
+	ds = drawstate_create();
+	point_copy(&ds->viewer, &view.vrp);
+	ds->color = blue;
+	ds->body = white;
+	ds->surface = grey;
+	ds->surfaceCoeff = 10;
+
+	printf("%d frames of 640x360, %d x %d copies\n", frames, n, n);
+	ds->shade = ShadeGouraud;
+	bench("cubes", cubes, &VTM, ds, light, src, frames);
+	image_write(src, "benchScratch-cubes.ppm");
+	bench("polygons", polygons, &VTM, ds, light, src, frames);
+	image_write(src, "benchScratch-polygons.ppm");
+	ds->shade = ShadeConstant;
+	bench("flat", polygons, &VTM, ds, light, src, frames);
+	ds->shade = ShadeFrame;
+	bench("polylines", lines, &VTM, ds, light, src, frames);
+
+	module_delete(cubes);
+	module_delete(polygons);
+	module_delete(lines);
+	module_delete(disc);
+	module_delete(zigzag);
+	lighting_delete(light);
+	free(ds);
+	image_free(src);
+
+	return(0);
+}
@@ -0,0 +1,238 @@
+/*
+	Jiafeng
+	Summer 2024
+
+	Benchmark of shadow maps: hangs each kind of shadow caster in turn, a
+	polygon, the solid primitives, a mesh, an LOD mesh and a solid Bezier
+	patch, over a tessellated floor lit by a directional light, and counts
+	the pixels a shadow map changes. Then puts them all over the floor with
+	a shadowed point light as well and reports milliseconds to render the
+	maps and to draw a frame with and without shadows, and the maps each
+	lighting_updateShadows renders when nothing changed, when a light moved
+	and when a module was invalidated.
+
+	usage: benchShadow [frames] [size]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include "graphics.h"
+#include "benchUtil.h"
+
+#define CASTERS 8
+
+/*
+	Number of pixels whose colors differ between the two images.
+ */
+static int pixelsDiffer(Image *a, Image *b) {
+	int i, j, n = 0;
+
+	for (i = 0; i < a->rows; i++) {
+		for (j = 0; j < a->cols; j++) {
+			n += memcmp(&a->data[i][j], &b->data[i][j], sizeof(FPixel)) != 0;
+		}
+	}
+	return n;
+}
+
+/*
+	Draw the scene into src after bringing its shadow maps up to date.
+ */
+static void draw(Module *scene, Matrix *VTM, DrawState *ds, Lighting *light, Image *src) {
+	Matrix GTM;
+
+	matrix_identity(&GTM);
+	lighting_updateShadows(light, scene, &GTM);
+	image_reset(src);
+	module_draw(scene, VTM, &GTM, ds, light, src);
+}
+
+/*
+	Fill floor with an n x n grid of unit quads facing up, centered on the origin.
+ */
+static void buildFloor(Module *floor, int n) {
+	Polygon quad;
+	Point v[4];
+	Vector up[4];
+	int i, j, k;
+
+	polygon_init(&quad);
+	for (k = 0; k < 4; k++) vector_set(&up[k], 0, 1, 0);
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < n; j++) {
+			double x = i - n / 2.0, z = j - n / 2.0;
+			point_set3D(&v[0], x, 0, z);
+			point_set3D(&v[1], x, 0, z + 1);
+			point_set3D(&v[2], x + 1, 0, z + 1);
+			point_set3D(&v[3], x + 1, 0, z);
+			polygon_set(&quad, 4, v);
+			polygon_setNormals(&quad, 4, up);
+			module_polygon(floor, &quad);
+		}
+	}
+	polygon_clear(&quad);
+}
+
+/*
+	Set b to a dome over the unit square in x and z, one unit high.
+ */
+static void buildDome(BezierSurface *b) {
+	Point p;
+	int i, j;
+
+	bezierSurface_init(b);
+	for (i = 0; i < 4; i++) {
+		for (j = 0; j < 4; j++) {
+			point_set3D(&p, j / 3.0 - 0.5, (i % 3 ? 1.0 : 0.0) * (j % 3 ? 1.0 : 0.0), i / 3.0 - 0.5);
+			bezierSurface_setPoint(b, &p, i, j);
+		}
+	}
+}
+
+int main(int argc, char *argv[]) {
+	int frames = argc > 1 ? atoi(argv[1]) : 10;
+	int size = argc > 2 ? atoi(argv[2]) : 512;
+	char *name[CASTERS] = {"polygon", "cube", "cylinder", "pyramid", "tetrahedron", "mesh", "lod", "patch"};
+	Module *caster[CASTERS], *floor, *scene, *all;
+	Color grey = {{0.6, 0.6, 0.6}}, ambient = {{0.2, 0.2, 0.2}}, sun = {{0.7, 0.7, 0.6}}, lamp = {{0.3, 0.3, 0.4}};
+	BezierSurface dome;
+	Polygon square;
+	Point v[4], pos;
+	Vector sunward;
+	Mesh bump;
+	MeshLOD *lod;
+	Lighting *light;
+	View3D view;
+	Matrix VTM, GTM;
+	DrawState *ds;
+	Image *off, *on;
+	clock_t start;
+	double tRender, tOff, tOn;
+	int i, k, n, update;
+
+	point_set3D(&view.vrp, 0, 9, -12);
+	vector_set(&view.vpn, 0, -0.6, 1);
+	vector_set(&view.vup, 0, 1, 0);
+	view.d = 2;
+	view.du = 1.6;
+	view.dv = 0.9;
+	view.f = 0;
+	view.b = 100;
+	view.screenx = 640;
+	view.screeny = 360;
+	matrix_setView3D(&VTM, &view);
+
+	floor = module_create();
+	module_bodyColor(floor, &grey);
+	buildFloor(floor, 16);
+
+	// one of each kind of caster, about a unit across
+	for (i = 0; i < CASTERS; i++) caster[i] = module_create();
+	point_set3D(&v[0], -0.5, 0, -0.5);
+	point_set3D(&v[1], -0.5, 0, 0.5);
+	point_set3D(&v[2], 0.5, 0, 0.5);
+	point_set3D(&v[3], 0.5, 0, -0.5);
+	polygon_init(&square);
+	polygon_set(&square, 4, v);
+	module_polygon(caster[0], &square);
+	polygon_clear(&square);
+	module_cube(caster[1], 1);
+	module_cylinder(caster[2], 16);
+	module_pyramid(caster[3]);
+	module_tetrahedron(caster[4]);
+	buildDome(&dome);
+	mesh_init(&bump);
+	bezierSurface_tessellate(&dome, 16, 16, &bump);
+	module_mesh(caster[5], &bump);
+	lod = meshLOD_create(&bump, 3);
+	module_meshLOD(caster[6], lod);
+	module_bezierSurface(caster[7], &dome, 4, 1);
+
+	light = lighting_create();
+	vector_set(&sunward, -1, 1.5, -0.5);
+	lighting_add(light, LightDirect, &sun, &sunward, NULL, 0, 0);
+	lighting_add(light, LightAmbient, &ambient, NULL, NULL, 0, 0);
+
+	ds = drawstate_create();
+	point_copy(&ds->viewer, &view.vrp);
+	ds->shade = ShadeGouraud;
+	off = image_create(view.screeny, view.screenx);
+	on = image_create(view.screeny, view.screenx);
+
+	// each caster alone over the floor, with and without the directional light's shadow map
+	printf("pixels shadowed by each caster over a %d x %d floor\n", 16, 16);
+	for (i = 0; i < CASTERS; i++) {
+		scene = module_create();
+		module_module(scene, floor);
+		module_scale(scene, 2, 2, 2);
+		module_translate(scene, 0, 2, 0);
+		module_module(scene, caster[i]);
+		lighting_setShadow(light, 0, 0);
+		draw(scene, &VTM, ds, light, off);
+		lighting_setShadow(light, 0, size);
+		draw(scene, &VTM, ds, light, on);
+		printf("%-12s %6d\n", name[i], pixelsDiffer(off, on));
+		module_delete(scene);
+	}
+
+	// all of them in a row, with a shadowed point light too
+	all = module_create();
+	module_module(all, floor);
+	for (i = 0; i < CASTERS; i++) {
+		module_identity(all);
+		module_scale(all, 1.5, 1.5, 1.5);
+		module_translate(all, 1.8 * (i - (CASTERS - 1) / 2.0), 1.5, 0);
+		module_module(all, caster[i]);
+	}
+	point_set3D(&pos, -2, 6, -3);
+	lighting_add(light, LightPoint, &lamp, NULL, &pos, 0, 0);
+
+	lighting_setShadow(light, 0, 0);
+	lighting_setShadow(light, 2, 0);
+	start = clock();
+	for (k = 0; k < frames; k++) draw(all, &VTM, ds, light, off);
+	tOff = seconds(start);
+
+	lighting_setShadow(light, 0, size);
+	lighting_setShadow(light, 2, size / 2);
+	start = clock();
+	draw(all, &VTM, ds, light, on);
+	tRender = seconds(start);
+	start = clock();
+	for (k = 0; k < frames; k++) draw(all, &VTM, ds, light, on);
+	tOn = seconds(start);
+
+	printf("%d frames of 640x360, %d casters\n", frames, CASTERS);
+	printf("no shadows       %8.3f ms/frame\n", 1000 * tOff / frames);
+	printf("shadows          %8.3f ms/frame  %d pixels shadowed\n", 1000 * tOn / frames, pixelsDiffer(off, on));
+	printf("first frame      %8.3f ms, rendering the %dx%d and %d x %dx%d maps\n", 1000 * tRender, size, size, 6, size / 2, size / 2);
+	image_write(on, "benchShadow.ppm");
+
+	// the maps are only rendered again when a light or the geometry changes
+	matrix_identity(&GTM);
+	update = lighting_updateShadows(light, all, &GTM);
+	printf("unchanged        %d maps rendered\n", update);
+	light->light[2].position.val[0] += 1;
+	update = lighting_updateShadows(light, all, &GTM);
+	printf("point light moved %d maps rendered\n", update);
+	module_invalidate(caster[1]);
+	update = lighting_updateShadows(light, all, &GTM);
+	n = lighting_updateShadows(light, all, &GTM);
+	printf("cube invalidated %d maps rendered, then %d\n", update, n);
+
+	module_delete(all);
+	module_delete(floor);
+	for (i = 0; i < CASTERS; i++) module_delete(caster[i]);
+	meshLOD_release(lod);
+	mesh_clear(&bump);
+	module_freePrimitives();
+	lighting_delete(light);
+	free(ds);
+	image_free(off);
+	image_free(on);
+
+	return(0);
+}
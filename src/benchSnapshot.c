@@ -0,0 +1,165 @@
+/*
+	Jiafeng
+	Summer 2024
+
+	Benchmark of scene snapshots: reads a PLY model as lit polygons and
+	puts n x n copies of it in a field, compiles the field and writes it
+	to a snapshot with its lights, then maps the snapshot back. Reports
+	milliseconds to build the scene from the PLY file, to compile and
+	write it, to map it and to draw the first frame from the mapping,
+	whether the lights come back and whether the mapped draw matches
+	module_draw of the field.
+
+	usage: benchSnapshot file.ply [n] [snapshot]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include "graphics.h"
+#include "benchUtil.h"
+
+/*
+	Wall clock seconds since start, since mapping a file is mostly time not spent in this process.
+ */
+static double elapsed(struct timeval *start) {
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) + (now.tv_usec - start->tv_usec) / 1e6;
+}
+
+/*
+	1 if the two lightings hold the same lights, shadows aside.
+ */
+static int sameLights(Lighting *a, Lighting *b) {
+	int i;
+
+	if (a->nLights != b->nLights) return 0;
+	for (i = 0; i < a->nLights; i++) {
+		Light *p = &a->light[i], *q = &b->light[i];
+		if (p->type != q->type || p->cutoff != q->cutoff || p->sharpness != q->sharpness) return 0;
+		if (memcmp(&p->color, &q->color, sizeof(Color)) || memcmp(&p->position, &q->position, sizeof(Point))) return 0;
+		if (memcmp(p->direction.val, q->direction.val, 3 * sizeof(p->direction.val[0]))) return 0;
+	}
+	return 1;
+}
+
+int main(int argc, char *argv[]) {
+	int n = argc > 2 ? atoi(argv[2]) : 8;
+	char *filename = argc > 3 ? argv[3] : "benchSnapshot.snap";
+	Module *model, *field;
+	Polygon *plist;
+	Color *clist;
+	Color surface = {{0.2, 0.2, 0.2}}, ambient = {{0.1, 0.1, 0.1}}, sun = {{0.7, 0.6, 0.45}};
+	Lighting *light, *loaded;
+	CommandBuffer *cb, *mapped;
+	View3D view;
+	Matrix VTM, GTM;
+	DrawState *ds;
+	Image *ref, *src;
+	Point pos;
+	struct timeval start;
+	double tBuild, tWrite, tRead, tDraw;
+	int nPolygons, i, j;
+
+	if (argc < 2) {
+		printf("usage: benchSnapshot file.ply [n] [snapshot]\n");
+		return(-1);
+	}
+
+	gettimeofday(&start, NULL);
+	if (readPLY(argv[1], &nPolygons, &plist, &clist, 1)) {
+		printf("unable to read %s\n", argv[1]);
+		return(-1);
+	}
+	model = module_create();
+	module_surfaceColor(model, &surface);
+	for (i = 0; i < nPolygons; i++) {
+		module_bodyColor(model, &clist[i]);
+		module_polygon(model, &plist[i]);
+		polygon_clear(&plist[i]);
+	}
+	free(plist);
+	free(clist);
+
+	field = module_create();
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < n; j++) {
+			double a = 0.4 * (i + 2 * j);
+			module_identity(field);
+			module_rotateY(field, cos(a), sin(a));
+			module_translate(field, 3.0 * (i - (n - 1) / 2.0), 0, 3.0 * j);
+			module_module(field, model);
+		}
+	}
+	tBuild = elapsed(&start);
+
+	light = lighting_create();
+	point_set3D(&pos, 0, 20, -50);
+	lighting_add(light, LightPoint, &sun, NULL, &pos, 0, 0);
+	lighting_add(light, LightAmbient, &ambient, NULL, NULL, 0, 0);
+
+	gettimeofday(&start, NULL);
+	cb = commandBuffer_create();
+	if (!module_compile(field, cb) || snapshot_write(filename, cb, light)) {
+		printf("unable to write %s\n", filename);
+		return(-1);
+	}
+	tWrite = elapsed(&start);
+
+	point_set3D(&view.vrp, 0, 3.0 * n, -3.0 * n);
+	vector_set(&view.vpn, 0, -0.6, 1);
+	vector_set(&view.vup, 0, 1, 0);
+	view.d = 2;
+	view.du = 1.6;
+	view.dv = 0.9;
+	view.f = 0;
+	view.b = 20.0 * n;
+	view.screenx = 640;
+	view.screeny = 360;
+	matrix_setView3D(&VTM, &view);
+	matrix_identity(&GTM);
+
+	ds = drawstate_create();
+	point_copy(&ds->viewer, &view.vrp);
+	ds->shade = ShadeGouraud;
+	ref = image_create(view.screeny, view.screenx);
+	src = image_create(view.screeny, view.screenx);
+	module_draw(field, &VTM, &GTM, ds, light, ref);
+
+	// the mapped draw touches the pages of the snapshot for the first time
+	loaded = lighting_create();
+	gettimeofday(&start, NULL);
+	mapped = snapshot_read(filename, loaded);
+	tRead = elapsed(&start);
+	if (!mapped) {
+		printf("unable to read %s\n", filename);
+		return(-1);
+	}
+	gettimeofday(&start, NULL);
+	commandBuffer_draw(mapped, &VTM, &GTM, ds, loaded, src);
+	tDraw = elapsed(&start);
+
+	printf("%d x %d copies of %d polygons, snapshot of %.1f MB\n", n, n, nPolygons, mapped->mappingBytes / 1048576.0);
+	printf("build from ply     %8.3f ms\n", 1000 * tBuild);
+	printf("compile and write  %8.3f ms\n", 1000 * tWrite);
+	printf("map snapshot       %8.3f ms\n", 1000 * tRead);
+	printf("first mapped draw  %8.3f ms\n", 1000 * tDraw);
+	printf("lights %s, image %s\n", sameLights(light, loaded) ? "same" : "differ", sameImage(ref, src) ? "same" : "differs");
+	image_write(src, "benchSnapshot.ppm");
+
+	commandBuffer_free(mapped);
+	commandBuffer_free(cb);
+	module_delete(field);
+	module_delete(model);
+	module_freePrimitives();
+	lighting_delete(light);
+	lighting_delete(loaded);
+	free(ds);
+	image_free(ref);
+	image_free(src);
+
+	return(0);
+}
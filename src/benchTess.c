@@ -0,0 +1,109 @@
+/*
+	Jiafeng
+	Summer 2024
+
+	Benchmark of the tessellation cache: draws the spinning teapot of
+	test9teapot for a number of frames, tessellating every patch in every
+	frame and then through a TessCache, unbounded and with a small memory
+	budget. Reports milliseconds per frame, patches tessellated per frame,
+	the cache hit rate and the entries evicted.
+
+	usage: benchTess [frames] [divisions] [budget KB]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "graphics.h"
+#include "benchUtil.h"
+
+/*
+	Draw frames of the teapot turning about its axis with the given cache and
+	report the time per frame.
+ */
+static void bench(char *name, Module *teapot, Matrix *VTM, DrawState *ds, Lighting *light, Image *src, int frames, TessCache *tc) {
+	Matrix GTM;
+	DrawStats *stats;
+	clock_t start;
+	double t;
+	int i;
+
+	ds->tessCache = tc;
+	matrix_identity(&GTM);
+	matrix_rotateX(&GTM, cos(M_PI / 2.0), -sin(M_PI / 2.0));
+	drawstats_reset();
+	start = clock();
+	for (i = 0; i < frames; i++) {
+		image_reset(src);
+		module_draw(teapot, VTM, &GTM, ds, light, src);
+		matrix_rotateY(&GTM, cos(M_PI / 30.0), sin(M_PI / 30.0));
+	}
+	t = seconds(start);
+	stats = drawstats_get();
+	printf("%-10s %8.2f ms/frame  %6.1f patches tessellated/frame", name, 1000 * t / frames,
+		   (double)stats->patchTessellations / frames);
+	if (tc) printf("  %5.1f%% hits  %6ld evictions  %8.0f KB held", 100 * tessCache_hitRate(tc), tc->evictions, tc->bytes / 1024.0);
+	printf("\n");
+}
+
+int main(int argc, char *argv[]) {
+	int frames = argc > 1 ? atoi(argv[1]) : 60;
+	int divisions = argc > 2 ? atoi(argv[2]) : 6;
+	size_t budget = argc > 3 ? (size_t)atoi(argv[3]) * 1024 : 1024 * 1024;
+	int rows = 400, cols = 600;
+	Image *src = image_create(rows, cols);
+	Color purple, white, bkg;
+	DrawState ds;
+	Module *teapot;
+	View3D view;
+	Matrix VTM;
+	Lighting *light;
+	TessCache *tc;
+
+	color_set(&purple, 0.6, 0.1, 0.7);
+	color_set(&white, 1.0, 1.0, 1.0);
+	color_set(&bkg, 0.05, 0.04, 0.03);
+
+	teapot = module_create();
+	module_color(teapot, &purple);
+	module_bodyColor(teapot, &purple);
+	module_teapot(teapot, divisions, 1);
+
+	point_set3D(&view.vrp, 0.0, 2.4, -7.0);
+	vector_set(&view.vpn, 0.0, -0.6, 4.0);
+	vector_set(&view.vup, 0.0, 1.0, 0.0);
+	view.d = 1.0;
+	view.du = 1.0;
+	view.dv = 1.0 * rows / cols;
+	view.screeny = rows;
+	view.screenx = cols;
+	view.f = 0.0;
+	view.b = 10.0;
+	matrix_setView3D(&VTM, &view);
+
+	light = lighting_create();
+	lighting_add(light, LightAmbient, &bkg, NULL, NULL, 0, 0);
+	lighting_add(light, LightPoint, &white, NULL, &view.vrp, 0, 0);
+	drawstate_init(&ds);
+	drawstate_setViewer(&ds, &view.vrp);
+	drawstate_setShading(&ds, ShadeGouraud);
+
+	printf("%d frames of %dx%d, at most %d cells per patch side\n", frames, cols, rows, 1 << divisions);
+	bench("no cache", teapot, &VTM, &ds, light, src, frames, NULL);
+	image_write(src, "benchTess-none.ppm");
+
+	tc = tessCache_create((size_t)-1);
+	bench("unbounded", teapot, &VTM, &ds, light, src, frames, tc);
+	image_write(src, "benchTess-cache.ppm");
+	tessCache_free(tc);
+
+	tc = tessCache_create(budget);
+	bench("budget", teapot, &VTM, &ds, light, src, frames, tc);
+	tessCache_free(tc);
+
+	lighting_delete(light);
+	module_delete(teapot);
+	image_free(src);
+
+	return(0);
+}
@@ -0,0 +1,117 @@
+/*
+	Jiafeng
+	Summer 2024
+
+	Helpers shared by the benchmarks: timing, comparing images and building
+	the creature formations of portfolio and fields of them.
+ */
+
+#include <string.h>
+#include <math.h>
+#include "benchUtil.h"
+
+/*
+	seconds of processor time since start.
+ */
+double seconds(clock_t start) {
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+/*
+	1 if the two images hold the same colors and depths.
+ */
+int sameImage(Image *a, Image *b) {
+	int i;
+
+	for (i = 0; i < a->rows; i++) {
+		if (memcmp(a->data[i], b->data[i], sizeof(FPixel) * a->cols)) return 0;
+		if (memcmp(a->depth[i], b->depth[i], sizeof(float) * a->cols)) return 0;
+	}
+	return 1;
+}
+
+/*
+	Build the portfolio creature and its formation into f. The legs take legColor
+	as their body color if it is not NULL, and the head is a cylinder if roundHead
+	is set and a cube otherwise.
+ */
+void buildFormation(Formation *f, Color *legColor, int roundHead) {
+	double leg_length = 7.0, body_height = 5.0;
+
+	f->legs = module_create();
+	if (legColor) module_bodyColor(f->legs, legColor);
+	module_scale(f->legs, 3, 3, leg_length);
+	module_translate(f->legs, 20, 20, 20);
+	module_cube(f->legs, 1);
+	module_translate(f->legs, 4, 0, 0);
+	module_cube(f->legs, 1);
+
+	f->body = module_create();
+	module_scale(f->body, 8, 5, body_height);
+	module_translate(f->body, 23, 21, 20 + leg_length);
+	module_cube(f->body, 1);
+	module_identity(f->body);
+	module_scale(f->body, 2, 2, 6);
+	module_translate(f->body, 18, 20, 20 + leg_length - 1);
+	module_cube(f->body, 1);
+	module_translate(f->body, 9, 0, 0);
+	module_cube(f->body, 1);
+
+	f->head = module_create();
+	module_scale(f->head, 4, 4, 4);
+	module_translate(f->head, 23, 22.5, 20 + leg_length + body_height + 1);
+	if (roundHead) module_cylinder(f->head, 24);
+	else module_cube(f->head, 1);
+
+	f->creature = module_create();
+	module_module(f->creature, f->legs);
+	module_module(f->creature, f->body);
+	module_module(f->creature, f->head);
+
+	f->formation = module_create();
+	module_module(f->formation, f->creature);
+	module_translate(f->formation, 15, 0, 0);
+	module_module(f->formation, f->creature);
+	module_translate(f->formation, -15, 0, 0);
+	module_rotateZ(f->formation, 0, 1);
+	module_translate(f->formation, 25, -7.5, 0);
+	module_module(f->formation, f->creature);
+}
+
+/*
+	Delete the modules of a formation made by buildFormation.
+ */
+void deleteFormation(Formation *f) {
+	module_delete(f->formation);
+	module_delete(f->creature);
+	module_delete(f->head);
+	module_delete(f->body);
+	module_delete(f->legs);
+}
+
+/*
+	Fill field with n x n formations 60 units apart, each turned by turn plus a little
+	more, and model, if not NULL, scaled up in the middle and turned by turn.
+ */
+void buildField(Module *field, Module *formation, Module *model, int n, double turn) {
+	int i, j;
+
+	module_clear(field);
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < n; j++) {
+			double a = turn + 0.3 * (i + 2 * j);
+			module_identity(field);
+			module_translate(field, -40, -30, -30);
+			module_rotateZ(field, cos(a), sin(a));
+			module_translate(field, 60.0 * (i - (n - 1) / 2.0), 60.0 * (j - (n - 1) / 2.0), 0);
+			module_module(field, formation);
+		}
+	}
+	if (model) {
+		module_identity(field);
+		module_scale(field, 20, 20, 20);
+		module_rotateZ(field, cos(turn), sin(turn));
+		module_translate(field, 0, 0, 40);
+		module_module(field, model);
+	}
+}
@@ -0,0 +1,23 @@
+#ifndef BENCHUTIL_H
+#define BENCHUTIL_H
+
+#include <time.h>
+#include "graphics.h"
+
+// Formation Structure, the creature of portfolio and the formation of three it stands in
+typedef struct {
+	Module *legs; // two legs
+	Module *body; // torso and arms
+	Module *head; // a cube, or a cylinder of 24 sides
+	Module *creature; // legs, body and head
+	Module *formation; // three creatures, the third turned to face the other two
+} Formation;
+
+/* Benchmark Functions */
+double seconds(clock_t start);
+int sameImage(Image *a, Image *b);
+void buildFormation(Formation *f, Color *legColor, int roundHead);
+void deleteFormation(Formation *f);
+void buildField(Module *field, Module *formation, Module *model, int n, double turn);
+
+#endif
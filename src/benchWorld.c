@@ -0,0 +1,158 @@
+/*
+	Jiafeng
+	Summer 2024
+
+	Benchmark of the world cache across animation frames: puts n starfuries,
+	read as lit polygons, in a row with a ring of lit cubes around them, and
+	each frame turns only the first ship by editing its rotation matrix in
+	place and calling module_invalidate on the module holding it. Draws every
+	frame with and without a world cache. Reports milliseconds and vertex
+	transforms per frame, the cache hit rate and whether every frame's
+	images match.
+
+	usage: benchWorld starfury.ply [frames] [n]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include "graphics.h"
+#include "benchUtil.h"
+
+/*
+	Draw the scene into src and add the CPU time it took to *t and the vertices it
+	transformed to *vertices.
+ */
+static void drawTimed(Module *scene, Matrix *VTM, DrawState *ds, Lighting *light, Image *src, double *t, long *vertices) {
+	Matrix GTM;
+	clock_t start;
+
+	matrix_identity(&GTM);
+	image_reset(src);
+	drawstats_reset();
+	start = clock();
+	module_draw(scene, VTM, &GTM, ds, light, src);
+	*t += (double)(clock() - start) / CLOCKS_PER_SEC;
+	*vertices += drawstats_get()->vertexTransforms;
+}
+
+int main(int argc, char *argv[]) {
+	int frames = argc > 2 ? atoi(argv[2]) : 30;
+	int n = argc > 3 ? atoi(argv[3]) : 6;
+	Module *starfury, *spinner, *ring, *scene;
+	Element *spin;
+	Polygon *plist;
+	Color *clist;
+	Color surface = {{0.2, 0.2, 0.2}}, ambient = {{0.1, 0.1, 0.1}}, sun = {{0.7, 0.6, 0.45}};
+	Lighting *light;
+	WorldCache *wc;
+	View3D view;
+	Matrix VTM;
+	DrawState *plain, *cached;
+	Image *a, *b;
+	Point pos;
+	double tPlain = 0, tCached = 0;
+	long vPlain = 0, vCached = 0;
+	int nPolygons, i, k, differ = 0;
+
+	if (argc < 2) {
+		printf("usage: benchWorld starfury.ply [frames] [n]\n");
+		return(-1);
+	}
+	if (readPLY(argv[1], &nPolygons, &plist, &clist, 1)) {
+		printf("unable to read %s\n", argv[1]);
+		return(-1);
+	}
+	starfury = module_create();
+	module_surfaceColor(starfury, &surface);
+	for (i = 0; i < nPolygons; i++) {
+		module_bodyColor(starfury, &clist[i]);
+		module_polygon(starfury, &plist[i]);
+		polygon_clear(&plist[i]);
+	}
+	free(plist);
+	free(clist);
+
+	// the ship that turns, its rotation edited in place every frame
+	spinner = module_create();
+	module_rotateY(spinner, 1, 0);
+	spin = spinner->tail;
+	module_module(spinner, starfury);
+
+	ring = module_create();
+	for (i = 0; i < 24; i++) {
+		double a = 2 * M_PI * i / 24;
+		module_identity(ring);
+		module_scale(ring, 0.6, 0.6, 0.6);
+		module_rotateY(ring, cos(a), sin(a));
+		module_translate(ring, 9 * cos(a), -3, 9 * sin(a));
+		module_cube(ring, 1);
+	}
+
+	scene = module_create();
+	module_module(scene, ring);
+	for (i = 0; i < n; i++) {
+		module_identity(scene);
+		module_translate(scene, 3.0 * (i - (n - 1) / 2.0), 0, 2.0 * (i % 2));
+		module_module(scene, i == 0 ? spinner : starfury);
+	}
+
+	point_set3D(&view.vrp, 0, 4, -20);
+	vector_set(&view.vpn, 0, -0.2, 1);
+	vector_set(&view.vup, 0, 1, 0);
+	view.d = 2;
+	view.du = 1.6;
+	view.dv = 0.9;
+	view.f = 0;
+	view.b = 100;
+	view.screenx = 640;
+	view.screeny = 360;
+	matrix_setView3D(&VTM, &view);
+
+	light = lighting_create();
+	point_set3D(&pos, 0, 0, -50);
+	lighting_add(light, LightPoint, &sun, NULL, &pos, 0, 0);
+	lighting_add(light, LightAmbient, &ambient, NULL, NULL, 0, 0);
+
+	wc = worldCache_create(64 << 20);
+	plain = drawstate_create();
+	point_copy(&plain->viewer, &view.vrp);
+	plain->shade = ShadeGouraud;
+	cached = drawstate_create();
+	drawstate_copy(cached, plain);
+	cached->worldCache = wc;
+	a = image_create(360, 640);
+	b = image_create(360, 640);
+
+	printf("%d frames of 640x360, %d ships of %d polygons, 24 cubes\n", frames, n, nPolygons);
+	for (k = 0; k < frames; k++) {
+		double angle = 2 * M_PI * k / frames;
+		matrix_identity(&spin->obj->matrix);
+		matrix_rotateY(&spin->obj->matrix, cos(angle), sin(angle));
+		module_invalidate(spinner);
+
+		drawTimed(scene, &VTM, plain, light, a, &tPlain, &vPlain);
+		drawTimed(scene, &VTM, cached, light, b, &tCached, &vCached);
+		differ += !sameImage(a, b);
+	}
+	printf("no cache    %8.3f ms/frame  %7ld vertex transforms per frame\n", 1000 * tPlain / frames, vPlain / frames);
+	printf("world cache %8.3f ms/frame  %7ld vertex transforms per frame  hit rate %.3f  %d entries  %.1f MB\n",
+		   1000 * tCached / frames, vCached / frames, worldCache_hitRate(wc), wc->nEntry, wc->bytes / 1048576.0);
+	printf("%d of %d frames differ\n", differ, frames);
+	image_write(b, "benchWorld.ppm");
+
+	module_delete(scene);
+	module_delete(ring);
+	module_delete(spinner);
+	module_delete(starfury);
+	module_freePrimitives();
+	worldCache_free(wc);
+	lighting_delete(light);
+	free(plain);
+	free(cached);
+	image_free(a);
+	image_free(b);
+
+	return(0);
+}
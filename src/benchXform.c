@@ -0,0 +1,98 @@
+/*
+	Jiafeng
+	Summer 2024
+
+	Microbenchmark of the vertex transforms: three matrix_xformPoint passes
+	per vertex (LTM, GTM, VTM) as in module_draw, against one pass of the
+	composed matrix through a VertexStream, both with the perspective divide.
+	Reports vertices per second and the largest difference between the two.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "graphics.h"
+#include "benchUtil.h"
+
+int main(int argc, char *argv[]) {
+	int n = argc > 1 ? atoi(argv[1]) : 100000;
+	int reps = argc > 2 ? atoi(argv[2]) : 50;
+	Matrix LTM, GTM, VTM, all;
+	Matrix4f all4f;
+	View3D view;
+	Point *pts, *ref, *out, tmp;
+	VertexStream *vs, *screen;
+	double t, err = 0;
+	clock_t start;
+	int i, r;
+
+	// a typical camera and model placement
+	point_set3D(&view.vrp, 3, 2, -8);
+	vector_set(&view.vpn, -3, -2, 8);
+	vector_set(&view.vup, 0, 1, 0);
+	view.d = 2;
+	view.du = 1.6;
+	view.dv = 0.9;
+	view.f = 0;
+	view.b = 30;
+	view.screenx = 640;
+	view.screeny = 360;
+	matrix_setView3D(&VTM, &view);
+	matrix_identity(&LTM);
+	matrix_scale(&LTM, 1.5, 0.5, 2.0);
+	matrix_rotateY(&LTM, cos(0.3), sin(0.3));
+	matrix_identity(&GTM);
+	matrix_translate(&GTM, 0.5, -0.2, 1.0);
+
+	pts = malloc(sizeof(Point) * n);
+	ref = malloc(sizeof(Point) * n);
+	out = malloc(sizeof(Point) * n);
+	srand(42);
+	for (i = 0; i < n; i++) {
+		point_set3D(&pts[i], (float)rand() / RAND_MAX * 2 - 1, (float)rand() / RAND_MAX * 2 - 1, (float)rand() / RAND_MAX * 2 - 1);
+	}
+
+	// per-point transforms
+	start = clock();
+	for (r = 0; r < reps; r++) {
+		for (i = 0; i < n; i++) {
+			matrix_xformPoint(&LTM, &pts[i], &tmp);
+			matrix_xformPoint(&GTM, &tmp, &ref[i]);
+			matrix_xformPoint(&VTM, &ref[i], &tmp);
+			point_normalize(&tmp);
+			ref[i] = tmp;
+		}
+	}
+	t = seconds(start);
+	printf("matrix_xformPoint x3:  %8.2f Mvertices/s\n", (double)n * reps / t / 1e6);
+
+	// one composed matrix over a structure of arrays
+	matrix_multiply(&GTM, &LTM, &all);
+	matrix_multiply(&VTM, &all, &all);
+	matrix4f_set(&all4f, &all);
+	vs = vertexStream_create(n);
+	screen = vertexStream_create(n);
+	vertexStream_setPoints(vs, pts, n);
+	start = clock();
+	for (r = 0; r < reps; r++) {
+		vertexStream_xform(&all4f, vs, screen, 1);
+	}
+	t = seconds(start);
+	printf("vertexStream_xform:    %8.2f Mvertices/s\n", (double)n * reps / t / 1e6);
+
+	vertexStream_getPoints(screen, out);
+	for (i = 0; i < n; i++) {
+		double dx = fabs(out[i].val[0] - ref[i].val[0]);
+		double dy = fabs(out[i].val[1] - ref[i].val[1]);
+		if (dx > err) err = dx;
+		if (dy > err) err = dy;
+	}
+	printf("largest screen difference: %g pixels\n", err);
+
+	vertexStream_free(vs);
+	vertexStream_free(screen);
+	free(pts);
+	free(ref);
+	free(out);
+	return 0;
+}